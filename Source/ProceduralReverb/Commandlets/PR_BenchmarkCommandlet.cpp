@@ -0,0 +1,403 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PR_BenchmarkCommandlet.h"
+
+#include "Components/StaticMeshComponent.h"
+#include "Dom/JsonObject.h"
+#include "Engine/Engine.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/StaticMeshActor.h"
+#include "Misc/FileHelper.h"
+#include "NNEModelData.h"
+#include "ProceduralReverb/LogPrPartition.h"
+#include "ProceduralReverb/Model/PR_ReverbNet.h"
+#include "ProceduralReverb/Partition/PR_PartitionTree.h"
+#include "ProceduralReverb/Partition/PR_PartitionWorldSubsystem.h"
+#include "ProceduralReverb/Partition/Settings/ProceduralReverbSettings.h"
+#include "Serialization/JsonSerializer.h"
+
+
+namespace
+{
+constexpr float QueryRadius = 1000.0f;
+constexpr float WallThickness = 20.0f;
+
+struct FPR_BenchmarkResult
+{
+	FString Scene;
+	int32 Size = 0;
+	int32 MaxDepth = 0;
+	int32 NumActors = 0;
+	int32 NumNodes = 0;
+	int32 NumLeaves = 0;
+	SIZE_T TreeBytes = 0;
+
+	double BoundsMs = 0.0;
+	double BuildMs = 0.0;
+	double CollectMs = 0.0;
+	/** Negative when no model is configured */
+	double InferenceMs = -1.0;
+	/** Merging the evaluated leaves, negative when no model is configured */
+	double CompactMs = -1.0;
+	double QueryUs = 0.0;
+
+	/** Negative when allocation counting is compiled out */
+	int64 BuildAllocations = -1;
+	int64 CollectAllocations = -1;
+	int64 InferenceAllocations = -1;
+	int64 CompactAllocations = -1;
+	int64 QueryAllocations = -1;
+};
+
+int64 GetAllocationCount()
+{
+#if STATS
+	return static_cast<int64>(FMalloc::TotalMallocCalls + FMalloc::TotalReallocCalls);
+#else
+	return -1;
+#endif // STATS
+}
+
+/** Wall clock and heap allocations of one stage */
+struct FPR_StageTimer
+{
+	FPR_StageTimer()
+		: StartTime(FPlatformTime::Seconds())
+		, StartAllocations(GetAllocationCount())
+	{
+	}
+
+	double GetMilliseconds() const { return (FPlatformTime::Seconds() - StartTime) * 1000.0; }
+	int64 GetAllocations() const { return StartAllocations < 0 ? -1 : GetAllocationCount() - StartAllocations; }
+
+	double StartTime;
+	int64 StartAllocations;
+};
+
+/** Static 100cm engine cube scaled to the given box */
+void SpawnBlock(UWorld* World, UStaticMesh* Cube, const FVector& Center, const FVector& Extent)
+{
+	const FTransform Transform(FQuat::Identity, Center, Extent / 50.0);
+
+	// Deferred so the mesh is set before the static component is registered
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.bDeferConstruction = true;
+
+	AStaticMeshActor* Actor = World->SpawnActor<AStaticMeshActor>(AStaticMeshActor::StaticClass(), Transform, SpawnParams);
+	Actor->GetStaticMeshComponent()->SetMobility(EComponentMobility::Static);
+	Actor->GetStaticMeshComponent()->SetStaticMesh(Cube);
+	Actor->FinishSpawning(Transform);
+}
+
+/** Closed shell around the inner half extent */
+void SpawnShell(UWorld* World, UStaticMesh* Cube, const FVector& Center, const FVector& HalfExtent)
+{
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		for (const double Sign : {-1.0, 1.0})
+		{
+			FVector WallCenter = Center;
+			WallCenter[Axis] += Sign * (HalfExtent[Axis] + WallThickness * 0.5);
+
+			FVector WallExtent = HalfExtent + FVector(WallThickness);
+			WallExtent[Axis] = WallThickness * 0.5;
+
+			SpawnBlock(World, Cube, WallCenter, WallExtent);
+		}
+	}
+}
+
+int32 BuildScene(UWorld* World, UStaticMesh* Cube, const FString& Scene, int32 Size)
+{
+	const int32 NumActorsBefore = World->GetActorCount();
+
+	if (Scene == TEXT("Room"))
+	{
+		SpawnShell(World, Cube, FVector::ZeroVector, FVector(1000.0, 800.0, 300.0) * Size);
+	}
+	else if (Scene == TEXT("Corridor"))
+	{
+		// Long shell split by walls with a door in each of them
+		const FVector HalfExtent(2000.0 * Size, 150.0, 150.0);
+		SpawnShell(World, Cube, FVector::ZeroVector, HalfExtent);
+
+		const int32 NumDividers = 3 * Size;
+		for (int32 Divider = 1; Divider <= NumDividers; ++Divider)
+		{
+			const double X = -HalfExtent.X + 2.0 * HalfExtent.X * Divider / (NumDividers + 1);
+			const double Door = 50.0;
+			const double PieceHalfWidth = (HalfExtent.Y - Door) * 0.5;
+			SpawnBlock(World, Cube, FVector(X, -HalfExtent.Y + PieceHalfWidth, 0.0), FVector(WallThickness * 0.5, PieceHalfWidth, HalfExtent.Z));
+			SpawnBlock(World, Cube, FVector(X, HalfExtent.Y - PieceHalfWidth, 0.0), FVector(WallThickness * 0.5, PieceHalfWidth, HalfExtent.Z));
+		}
+	}
+	else if (Scene == TEXT("Open"))
+	{
+		// Floor with a grid of pillars every 10 m
+		const double HalfSize = 5000.0 * Size;
+		SpawnBlock(World, Cube, FVector(0.0, 0.0, -WallThickness * 0.5), FVector(HalfSize, HalfSize, WallThickness * 0.5));
+
+		for (double X = -HalfSize + 500.0; X < HalfSize; X += 1000.0)
+		{
+			for (double Y = -HalfSize + 500.0; Y < HalfSize; Y += 1000.0)
+			{
+				SpawnBlock(World, Cube, FVector(X, Y, 250.0), FVector(50.0, 50.0, 250.0));
+			}
+		}
+	}
+	else
+	{
+		UE_LOG(LogPrPartition, Warning, TEXT("Unknown benchmark scene %s"), *Scene);
+	}
+
+	return World->GetActorCount() - NumActorsBefore;
+}
+
+TArray<int32> ParseIntList(const FString& Value)
+{
+	TArray<FString> Items;
+	Value.ParseIntoArray(Items, TEXT(","));
+
+	TArray<int32> Result;
+	for (const FString& Item : Items)
+	{
+		Result.Add(FCString::Atoi(*Item));
+	}
+	return Result;
+}
+
+FString ToJson(const TArray<FPR_BenchmarkResult>& Results)
+{
+	TArray<TSharedPtr<FJsonValue>> Runs;
+	for (const FPR_BenchmarkResult& Result : Results)
+	{
+		TSharedRef<FJsonObject> Run = MakeShared<FJsonObject>();
+		Run->SetStringField(TEXT("scene"), Result.Scene);
+		Run->SetNumberField(TEXT("size"), Result.Size);
+		Run->SetNumberField(TEXT("max_depth"), Result.MaxDepth);
+		Run->SetNumberField(TEXT("actors"), Result.NumActors);
+		Run->SetNumberField(TEXT("nodes"), Result.NumNodes);
+		Run->SetNumberField(TEXT("leaves"), Result.NumLeaves);
+		Run->SetNumberField(TEXT("tree_bytes"), static_cast<double>(Result.TreeBytes));
+		Run->SetNumberField(TEXT("bounds_ms"), Result.BoundsMs);
+		Run->SetNumberField(TEXT("build_ms"), Result.BuildMs);
+		Run->SetNumberField(TEXT("collect_ms"), Result.CollectMs);
+		Run->SetNumberField(TEXT("inference_ms"), Result.InferenceMs);
+		Run->SetNumberField(TEXT("compact_ms"), Result.CompactMs);
+		Run->SetNumberField(TEXT("query_us"), Result.QueryUs);
+		Run->SetNumberField(TEXT("build_allocs"), Result.BuildAllocations);
+		Run->SetNumberField(TEXT("collect_allocs"), Result.CollectAllocations);
+		Run->SetNumberField(TEXT("inference_allocs"), Result.InferenceAllocations);
+		Run->SetNumberField(TEXT("compact_allocs"), Result.CompactAllocations);
+		Run->SetNumberField(TEXT("query_allocs"), Result.QueryAllocations);
+		Runs.Add(MakeShared<FJsonValueObject>(Run));
+	}
+
+	TSharedRef<FJsonObject> Root = MakeShared<FJsonObject>();
+	Root->SetStringField(TEXT("platform"), FPlatformProperties::PlatformName());
+	Root->SetStringField(TEXT("date"), FDateTime::UtcNow().ToIso8601());
+	Root->SetArrayField(TEXT("runs"), Runs);
+
+	FString Output;
+	TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&Output);
+	FJsonSerializer::Serialize(Root, Writer);
+	return Output;
+}
+
+FString ToCsv(const TArray<FPR_BenchmarkResult>& Results)
+{
+	FString Output = TEXT("scene,size,max_depth,actors,nodes,leaves,tree_bytes,bounds_ms,build_ms,collect_ms,inference_ms,compact_ms,query_us,"
+		"build_allocs,collect_allocs,inference_allocs,compact_allocs,query_allocs\n");
+
+	for (const FPR_BenchmarkResult& Result : Results)
+	{
+		Output += FString::Printf(TEXT("%s,%d,%d,%d,%d,%d,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%lld,%lld,%lld,%lld,%lld\n"),
+			*Result.Scene,
+			Result.Size,
+			Result.MaxDepth,
+			Result.NumActors,
+			Result.NumNodes,
+			Result.NumLeaves,
+			static_cast<uint64>(Result.TreeBytes),
+			Result.BoundsMs,
+			Result.BuildMs,
+			Result.CollectMs,
+			Result.InferenceMs,
+			Result.CompactMs,
+			Result.QueryUs,
+			Result.BuildAllocations,
+			Result.CollectAllocations,
+			Result.InferenceAllocations,
+			Result.CompactAllocations,
+			Result.QueryAllocations);
+	}
+
+	return Output;
+}
+}
+
+
+UPR_BenchmarkCommandlet::UPR_BenchmarkCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 UPR_BenchmarkCommandlet::Main(const FString& Params)
+{
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+
+	FString ScenesParam = TEXT("Room,Corridor,Open");
+	FString SizesParam = TEXT("1,4");
+	FString DepthsParam = FString::FromInt(Settings->MaxPartitionDepth);
+	int32 NumQueries = 10000;
+	FString OutputPath = FPaths::ProjectSavedDir() / TEXT("Benchmarks") / TEXT("PartitionBenchmark.json");
+
+	FParse::Value(*Params, TEXT("Scenes="), ScenesParam);
+	FParse::Value(*Params, TEXT("Sizes="), SizesParam);
+	FParse::Value(*Params, TEXT("Depths="), DepthsParam);
+	FParse::Value(*Params, TEXT("Queries="), NumQueries);
+	FParse::Value(*Params, TEXT("Output="), OutputPath);
+
+	TArray<FString> Scenes;
+	ScenesParam.ParseIntoArray(Scenes, TEXT(","));
+	const TArray<int32> Sizes = ParseIntList(SizesParam);
+	const TArray<int32> Depths = ParseIntList(DepthsParam);
+
+	UStaticMesh* Cube = LoadObject<UStaticMesh>(nullptr, TEXT("/Engine/BasicShapes/Cube.Cube"));
+	if (!Cube)
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Benchmark needs /Engine/BasicShapes/Cube"));
+		return 1;
+	}
+
+	FPR_ReverbNet ReverbNet;
+	UNNEModelData* ModelData = Settings->PreLoadedModelData.LoadSynchronous();
+	const bool bHasModel = ModelData && ReverbNet.Init(ModelData, Settings->InferenceBatchSize, Settings->InferenceBackend);
+	if (!bHasModel)
+	{
+		UE_LOG(LogPrPartition, Warning, TEXT("No reverb model available, inference is not benchmarked"));
+	}
+
+	TArray<FPR_BenchmarkResult> Results;
+	for (const FString& Scene : Scenes)
+	{
+		for (const int32 Size : Sizes)
+		{
+			// Initialized for queries and physics but never begun, so the subsystem doesn't generate on its own
+			UWorld* World = UWorld::CreateWorld(EWorldType::Game, false, FName(*FString::Printf(TEXT("PR_Benchmark_%s_%d"), *Scene, Size)));
+			FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+			WorldContext.SetCurrentWorld(World);
+
+			const int32 NumActors = BuildScene(World, Cube, Scene, FMath::Max(1, Size));
+			World->Tick(LEVELTICK_All, 0.0f);
+
+			auto* Subsystem = World->GetSubsystem<UPR_PartitionWorldSubsystem>();
+			check(Subsystem);
+
+			const FPR_StageTimer BoundsTimer;
+			const FBox Bounds = Subsystem->GetInitialBoundingBox();
+			const double BoundsMs = BoundsTimer.GetMilliseconds();
+
+			// Same query points for every depth
+			FRandomStream Random(1234);
+			TArray<FVector> QueryPositions;
+			for (int32 Query = 0; Query < NumQueries; ++Query)
+			{
+				QueryPositions.Add(Random.RandPointInBox(Bounds));
+			}
+
+			for (const int32 Depth : Depths)
+			{
+				FPR_BenchmarkResult& Result = Results.AddDefaulted_GetRef();
+				Result.Scene = Scene;
+				Result.Size = Size;
+				Result.MaxDepth = Depth;
+				Result.NumActors = NumActors;
+				Result.BoundsMs = BoundsMs;
+
+				FPR_PartitionBuildParams BuildParams = FPR_PartitionBuildParams::FromSettings(World);
+				BuildParams.MaxDepth = Depth;
+
+				FPR_PartitionTree Tree;
+				{
+					const FPR_StageTimer Timer;
+					Tree.Build(Bounds, BuildParams, World);
+					Result.BuildMs = Timer.GetMilliseconds();
+					Result.BuildAllocations = Timer.GetAllocations();
+				}
+
+				{
+					const FPR_StageTimer Timer;
+					Tree.CollectAcousticData(World);
+					Result.CollectMs = Timer.GetMilliseconds();
+					Result.CollectAllocations = Timer.GetAllocations();
+				}
+
+				// Evaluation only, the leaves are merged after the queries so every run queries the tree as built
+				if (bHasModel)
+				{
+					TArray<int32> PlayableLeaves;
+					Tree.GetPlayableLeaves(PlayableLeaves);
+
+					const FPR_StageTimer Timer;
+					Tree.RunModel(ReverbNet, PlayableLeaves);
+					Result.InferenceMs = Timer.GetMilliseconds();
+					Result.InferenceAllocations = Timer.GetAllocations();
+				}
+
+				{
+					TArray<FPR_LeafQueryResult> Leaves;
+					const FPR_StageTimer Timer;
+					for (const FVector& Position : QueryPositions)
+					{
+						Leaves.Reset();
+						Tree.FindNearbyLeaves(Position, QueryRadius, Leaves);
+					}
+					Result.QueryUs = NumQueries > 0 ? Timer.GetMilliseconds() * 1000.0 / NumQueries : 0.0;
+					Result.QueryAllocations = Timer.GetAllocations();
+				}
+
+				Result.NumNodes = Tree.GetNumNodes();
+				Result.NumLeaves = Tree.GetNumLeaves();
+				Result.TreeBytes = Tree.GetAllocatedSize();
+
+				if (bHasModel)
+				{
+					const FPR_StageTimer Timer;
+					Tree.CompactLeaves();
+					Result.CompactMs = Timer.GetMilliseconds();
+					Result.CompactAllocations = Timer.GetAllocations();
+				}
+
+				UE_LOG(LogPrPartition, Display, TEXT("%s x%d depth %d: %d leaves, build %.2f ms, collect %.2f ms, inference %.2f ms, compact %.2f ms, query %.3f us"),
+					*Scene,
+					Size,
+					Depth,
+					Result.NumLeaves,
+					Result.BuildMs,
+					Result.CollectMs,
+					Result.InferenceMs,
+					Result.CompactMs,
+					Result.QueryUs);
+			}
+
+			GEngine->DestroyWorldContext(World);
+			World->DestroyWorld(false);
+			CollectGarbage(RF_NoFlags);
+		}
+	}
+
+	const FString Output = FPaths::GetExtension(OutputPath) == TEXT("csv") ? ToCsv(Results) : ToJson(Results);
+	if (!FFileHelper::SaveStringToFile(Output, *OutputPath))
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Failed to write benchmark results to %s"), *OutputPath);
+		return 1;
+	}
+
+	UE_LOG(LogPrPartition, Display, TEXT("Wrote %d benchmark runs to %s"), Results.Num(), *OutputPath);
+	return 0;
+}
@@ -0,0 +1,29 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "PR_BenchmarkCommandlet.generated.h"
+
+
+/**
+ * Times the partition pipeline on synthetic levels, meant to run headless:
+ * UnrealEditor-Cmd <Project> -run=PR_Benchmark -nullrhi -unattended [options]
+ *
+ * -Scenes=Room,Corridor,Open   Synthetic levels to build
+ * -Sizes=1,4                   Scale of every scene
+ * -Depths=6,8,10               MaxPartitionDepth sweep, defaults to the project setting
+ * -Queries=10000               Listener queries per run
+ * -Output=<path>               Results file, .json or .csv by extension
+ */
+UCLASS()
+class PROCEDURALREVERB_API UPR_BenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UPR_BenchmarkCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
@@ -0,0 +1,134 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PR_CsvReader.h"
+
+#include "HAL/PlatformFileManager.h"
+#include "ProceduralReverb/LogPrPartition.h"
+
+
+FPR_CsvReader::FPR_CsvReader(int32 InBufferSize)
+	: BufferSize(FMath::Max(InBufferSize, 1024))
+{
+}
+
+FPR_CsvReader::~FPR_CsvReader() = default;
+
+bool FPR_CsvReader::Open(const FString& Path)
+{
+	File.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*Path));
+
+	// One extra byte, so the last line can be terminated even without a trailing newline
+	Buffer.SetNumUninitialized(BufferSize + 1);
+	Begin = 0;
+	End = 0;
+	LineNumber = 0;
+	bEndOfFile = false;
+	bError = !File.IsValid();
+	return !bError;
+}
+
+bool FPR_CsvReader::Refill()
+{
+	// Moves the partial line to the front and appends as much of the file as fits
+	const int32 Remaining = End - Begin;
+	if (Remaining > 0 && Begin > 0)
+	{
+		FMemory::Memmove(Buffer.GetData(), Buffer.GetData() + Begin, Remaining);
+	}
+	Begin = 0;
+	End = Remaining;
+
+	const int64 BytesToRead = FMath::Min<int64>(BufferSize - End, File->Size() - File->Tell());
+	if (BytesToRead <= 0)
+	{
+		bEndOfFile = true;
+		return false;
+	}
+
+	if (!File->Read(reinterpret_cast<uint8*>(Buffer.GetData() + End), BytesToRead))
+	{
+		bError = true;
+		return false;
+	}
+
+	End += static_cast<int32>(BytesToRead);
+	return true;
+}
+
+bool FPR_CsvReader::ReadRow(FRow& OutFields)
+{
+	OutFields.Reset();
+	if (!File.IsValid() || bError)
+	{
+		return false;
+	}
+
+	while (true)
+	{
+		ANSICHAR* Data = Buffer.GetData();
+		int32 LineEnd = Begin;
+		while (LineEnd < End && Data[LineEnd] != '\n')
+		{
+			++LineEnd;
+		}
+
+		if (LineEnd == End && !bEndOfFile)
+		{
+			if (Begin == 0 && End == BufferSize)
+			{
+				UE_LOG(LogPrPartition, Error, TEXT("CSV line %lld is longer than %d bytes"), LineNumber + 1, BufferSize);
+				bError = true;
+				return false;
+			}
+
+			Refill();
+			if (bError)
+			{
+				return false;
+			}
+			continue;
+		}
+
+		if (Begin == End)
+		{
+			return false;
+		}
+
+		const int32 LineStart = Begin;
+		Begin = FMath::Min(LineEnd + 1, End);
+		++LineNumber;
+
+		int32 ContentEnd = LineEnd;
+		if (ContentEnd > LineStart && Data[ContentEnd - 1] == '\r')
+		{
+			--ContentEnd;
+		}
+
+		if (ContentEnd == LineStart)
+		{
+			continue;
+		}
+
+		// Separators become terminators, so fields can be handed to C string parsers
+		Data[ContentEnd] = '\0';
+		int32 FieldStart = LineStart;
+		for (int32 Index = LineStart; Index <= ContentEnd; ++Index)
+		{
+			if (Index == ContentEnd || Data[Index] == ',')
+			{
+				Data[Index] = '\0';
+				OutFields.Add(FAnsiStringView(Data + FieldStart, Index - FieldStart));
+				FieldStart = Index + 1;
+			}
+		}
+
+		return true;
+	}
+}
+
+float FPR_CsvReader::ParseFloat(FAnsiStringView Field)
+{
+	// Fields are null terminated by ReadRow
+	return FCStringAnsi::Atof(Field.GetData());
+}
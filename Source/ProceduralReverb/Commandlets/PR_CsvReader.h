@@ -0,0 +1,44 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IFileHandle;
+
+
+/**
+ * Streams a comma separated file through one fixed buffer. Fields are views into that buffer,
+ * null terminated in place and valid until the next ReadRow, so parsing a row never allocates.
+ * Quoting is not supported, a row has to fit into the buffer.
+ */
+class FPR_CsvReader
+{
+public:
+	using FRow = TArray<FAnsiStringView, TInlineAllocator<32>>;
+
+	explicit FPR_CsvReader(int32 InBufferSize = 64 * 1024);
+	~FPR_CsvReader();
+
+	bool Open(const FString& Path);
+
+	/** Returns false at the end of the file or on error, blank lines are skipped */
+	bool ReadRow(FRow& OutFields);
+
+	bool HasError() const { return bError; }
+	int64 GetLineNumber() const { return LineNumber; }
+
+	static float ParseFloat(FAnsiStringView Field);
+
+private:
+	bool Refill();
+
+	TUniquePtr<IFileHandle> File;
+	TArray<ANSICHAR> Buffer;
+	int32 BufferSize;
+	int32 Begin = 0;
+	int32 End = 0;
+	int64 LineNumber = 0;
+	bool bEndOfFile = false;
+	bool bError = false;
+};
@@ -0,0 +1,395 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PR_EvaluateDatasetCommandlet.h"
+
+#include "Async/ParallelFor.h"
+#include "Dom/JsonObject.h"
+#include "Misc/FileHelper.h"
+#include "NNEModelData.h"
+#include "PhysicsEngine/PhysicsSettings.h"
+#include "PR_CsvReader.h"
+#include "ProceduralReverb/Core/PRCore_Acoustics.h"
+#include "ProceduralReverb/Core/PRCore_Reverb.h"
+#include "ProceduralReverb/LogPrPartition.h"
+#include "ProceduralReverb/Model/PR_ReverbNet.h"
+#include "ProceduralReverb/Partition/Settings/ProceduralReverbSettings.h"
+#include "Serialization/JsonSerializer.h"
+
+
+namespace
+{
+// Model inputs in the column order of the training data
+const ANSICHAR* const DatasetInputColumns[PRCore::NumModelInputs] = {
+	"RoomLength", "RoomWidth", "RoomHeight",
+	"DistanceFront", "DistanceBack", "DistanceLeft", "DistanceRight", "DistanceUp", "DistanceDown",
+	"MaterialFront", "MaterialBack", "MaterialLeft", "MaterialRight", "MaterialUp", "MaterialDown"
+};
+
+// Ordered as PRCore::EDirection
+const ANSICHAR* const DirectionNames[PRCore::NumDirections] = {"Front", "Back", "Right", "Left", "Up", "Down"};
+
+// Ordered as the model outputs, see PRCore::MapModelOutput
+const ANSICHAR* const TargetColumns[PRCore::NumModelOutputs] = {"DecayTime", "EarlyReflections", "ReverbDensity", "ReverbMix"};
+
+constexpr int32 FirstMaterialInput = 3 + PRCore::NumDirections;
+
+struct FPR_TargetError
+{
+	double SumAbsolute = 0.0;
+	double SumSquared = 0.0;
+	double MaxAbsolute = 0.0;
+};
+
+/** Resolves material names through the project's physical surfaces, like traces resolve physical materials */
+class FPR_SurfaceTypeMap
+{
+public:
+	FPR_SurfaceTypeMap()
+	{
+		for (const FPhysicalSurfaceName& Surface : UPhysicsSettings::Get()->PhysicalSurfaces)
+		{
+			SurfaceTypes.Add(Surface.Name, Surface.Type);
+		}
+	}
+
+	uint8 Find(FAnsiStringView Name)
+	{
+		// FNAME_Find doesn't add names, unknown materials don't grow the name table
+		const FName SurfaceName(Name.Len(), Name.GetData(), FNAME_Find);
+		if (const EPhysicalSurface* SurfaceType = SurfaceTypes.Find(SurfaceName))
+		{
+			return static_cast<uint8>(*SurfaceType);
+		}
+
+		// Same as a hit without physical material at runtime
+		++NumUnmapped;
+		if (UnmappedNames.Num() < 16)
+		{
+			bool bAlreadyInSet = false;
+			UnmappedNames.Add(FString(Name), &bAlreadyInSet);
+			if (!bAlreadyInSet)
+			{
+				UE_LOG(LogPrPartition, Warning, TEXT("Material %s is not a physical surface of the project, evaluated as SurfaceType_Default"), *FString(Name));
+			}
+		}
+		return static_cast<uint8>(SurfaceType_Default);
+	}
+
+	int64 NumUnmapped = 0;
+
+private:
+	TMap<FName, EPhysicalSurface> SurfaceTypes;
+	TSet<FString> UnmappedNames;
+};
+
+bool FindColumn(const FPR_CsvReader::FRow& Header, const ANSICHAR* Name, int32& OutColumn)
+{
+	OutColumn = Header.IndexOfByPredicate([Name](FAnsiStringView Field) { return Field.Equals(Name, ESearchCase::IgnoreCase); });
+	if (OutColumn == INDEX_NONE)
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Dataset has no %hs column"), Name);
+		return false;
+	}
+	return true;
+}
+}
+
+
+UPR_EvaluateDatasetCommandlet::UPR_EvaluateDatasetCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 UPR_EvaluateDatasetCommandlet::Main(const FString& Params)
+{
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+
+	FString InputPath = FPaths::ProjectDir() / TEXT("SyntheticAcousticDataWithMaterials.csv");
+	int32 BatchSize = Settings->InferenceBatchSize;
+	int32 NumThreads = 1;
+	FString BackendParam;
+	FString PackingParam = TEXT("Runtime");
+	FString OutputPath;
+
+	FParse::Value(*Params, TEXT("Input="), InputPath);
+	FParse::Value(*Params, TEXT("BatchSize="), BatchSize);
+	FParse::Value(*Params, TEXT("Threads="), NumThreads);
+	FParse::Value(*Params, TEXT("Backend="), BackendParam);
+	FParse::Value(*Params, TEXT("Packing="), PackingParam);
+	FParse::Value(*Params, TEXT("Output="), OutputPath);
+
+	BatchSize = FMath::Max(BatchSize, 1);
+	NumThreads = FMath::Clamp(NumThreads, 1, 64);
+	const bool bRuntimePacking = PackingParam != TEXT("Dataset");
+
+	EPR_InferenceBackend Backend = Settings->InferenceBackend;
+	if (!BackendParam.IsEmpty())
+	{
+		const int64 BackendValue = StaticEnum<EPR_InferenceBackend>()->GetValueByNameString(BackendParam);
+		if (BackendValue == INDEX_NONE)
+		{
+			UE_LOG(LogPrPartition, Error, TEXT("Unknown inference backend %s"), *BackendParam);
+			return 1;
+		}
+		Backend = static_cast<EPR_InferenceBackend>(BackendValue);
+	}
+
+	UNNEModelData* ModelData = Settings->PreLoadedModelData.LoadSynchronous();
+	if (!ModelData)
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("No reverb model configured"));
+		return 1;
+	}
+
+	// Model instances are not thread safe, every thread owns one
+	TArray<FPR_ReverbNet> ReverbNets;
+	ReverbNets.SetNum(NumThreads);
+	for (FPR_ReverbNet& ReverbNet : ReverbNets)
+	{
+		if (!ReverbNet.Init(ModelData, BatchSize, Backend))
+		{
+			UE_LOG(LogPrPartition, Error, TEXT("Failed to create the reverb model"));
+			return 1;
+		}
+	}
+
+	const int32 NumInputs = ReverbNets[0].GetNumInputs();
+	const int32 NumOutputs = ReverbNets[0].GetNumOutputs();
+	if (NumInputs != PRCore::NumModelInputs || NumOutputs < PRCore::NumModelOutputs)
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Model takes %d inputs and returns %d outputs, expected %d and %d"),
+			NumInputs, NumOutputs, PRCore::NumModelInputs, PRCore::NumModelOutputs);
+		return 1;
+	}
+
+	FPR_CsvReader Reader;
+	FPR_CsvReader::FRow Row;
+	if (!Reader.Open(InputPath) || !Reader.ReadRow(Row))
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Failed to read %s"), *InputPath);
+		return 1;
+	}
+
+	int32 InputColumns[PRCore::NumModelInputs];
+	int32 DistanceColumns[PRCore::NumDirections];
+	int32 MaterialColumns[PRCore::NumDirections];
+	int32 TargetColumnIndices[PRCore::NumModelOutputs];
+	bool bHasColumns = true;
+	for (int32 Input = 0; Input < PRCore::NumModelInputs; ++Input)
+	{
+		bHasColumns &= FindColumn(Row, DatasetInputColumns[Input], InputColumns[Input]);
+	}
+	for (int32 Direction = 0; Direction < PRCore::NumDirections; ++Direction)
+	{
+		bHasColumns &= FindColumn(Row, TCHAR_TO_ANSI(*FString::Printf(TEXT("Distance%hs"), DirectionNames[Direction])), DistanceColumns[Direction]);
+		bHasColumns &= FindColumn(Row, TCHAR_TO_ANSI(*FString::Printf(TEXT("Material%hs"), DirectionNames[Direction])), MaterialColumns[Direction]);
+	}
+	for (int32 Target = 0; Target < PRCore::NumModelOutputs; ++Target)
+	{
+		bHasColumns &= FindColumn(Row, TargetColumns[Target], TargetColumnIndices[Target]);
+	}
+
+	if (!bHasColumns)
+	{
+		return 1;
+	}
+
+	int32 NumRequiredFields = 0;
+	for (const int32 Column : InputColumns)
+	{
+		NumRequiredFields = FMath::Max(NumRequiredFields, Column + 1);
+	}
+	for (const int32 Column : TargetColumnIndices)
+	{
+		NumRequiredFields = FMath::Max(NumRequiredFields, Column + 1);
+	}
+
+	// Material columns are resolved once per row, dataset order refers to them by direction
+	int32 InputMaterialDirections[PRCore::NumDirections];
+	for (int32 Material = 0; Material < PRCore::NumDirections; ++Material)
+	{
+		InputMaterialDirections[Material] = 0;
+		for (int32 Direction = 0; Direction < PRCore::NumDirections; ++Direction)
+		{
+			if (MaterialColumns[Direction] == InputColumns[FirstMaterialInput + Material])
+			{
+				InputMaterialDirections[Material] = Direction;
+			}
+		}
+	}
+
+	FPR_SurfaceTypeMap SurfaceTypeMap;
+	FPR_TargetError Errors[PRCore::NumModelOutputs];
+	float MaxPackingDifference[PRCore::NumModelInputs] = {};
+
+	// One block feeds every thread one batch, buffers are reused for the whole file
+	const int32 BlockRows = BatchSize * NumThreads;
+	TArray<float> BlockInputs;
+	TArray<float> BlockOutputs;
+	TArray<float> BlockTargets;
+	BlockInputs.SetNumUninitialized(BlockRows * NumInputs);
+	BlockOutputs.SetNumUninitialized(BlockRows * NumOutputs);
+	BlockTargets.SetNumUninitialized(BlockRows * PRCore::NumModelOutputs);
+
+	int64 NumRows = 0;
+	int64 NumSkipped = 0;
+	double InferenceSeconds = 0.0;
+	bool bInferenceFailed = false;
+
+	auto EvaluateBlock = [&](int32 NumBlockRows)
+	{
+		const double InferenceStart = FPlatformTime::Seconds();
+		TArray<bool, TInlineAllocator<64>> Succeeded;
+		Succeeded.Init(true, NumThreads);
+		ParallelFor(FMath::DivideAndRoundUp(NumBlockRows, BatchSize), [&](int32 Shard)
+		{
+			const int32 FirstRow = Shard * BatchSize;
+			const int32 NumShardRows = FMath::Min(BatchSize, NumBlockRows - FirstRow);
+			Succeeded[Shard] = ReverbNets[Shard].Run(
+				MakeArrayView(BlockInputs.GetData() + FirstRow * NumInputs, NumShardRows * NumInputs),
+				MakeArrayView(BlockOutputs.GetData() + FirstRow * NumOutputs, NumShardRows * NumOutputs));
+		});
+		InferenceSeconds += FPlatformTime::Seconds() - InferenceStart;
+
+		if (Succeeded.Contains(false))
+		{
+			bInferenceFailed = true;
+			return;
+		}
+
+		for (int32 BlockRow = 0; BlockRow < NumBlockRows; ++BlockRow)
+		{
+			// Compared after the same clamping the partition applies
+			const PRCore::FReverbParams Params = PRCore::MapModelOutput(BlockOutputs.GetData() + BlockRow * NumOutputs);
+			const float Predictions[PRCore::NumModelOutputs] = {Params.DecayTime, Params.Gain, Params.Density, Params.WetLevel};
+			for (int32 Target = 0; Target < PRCore::NumModelOutputs; ++Target)
+			{
+				const double Error = FMath::Abs(Predictions[Target] - BlockTargets[BlockRow * PRCore::NumModelOutputs + Target]);
+				Errors[Target].SumAbsolute += Error;
+				Errors[Target].SumSquared += Error * Error;
+				Errors[Target].MaxAbsolute = FMath::Max(Errors[Target].MaxAbsolute, Error);
+			}
+		}
+	};
+
+	const double StartTime = FPlatformTime::Seconds();
+	int32 NumBlockRows = 0;
+	while (!bInferenceFailed && Reader.ReadRow(Row))
+	{
+		if (Row.Num() < NumRequiredFields)
+		{
+			++NumSkipped;
+			continue;
+		}
+
+		// Same packing the partition uses for probed leaves
+		PRCore::FLeafFeatures Features;
+		for (int32 Direction = 0; Direction < PRCore::NumDirections; ++Direction)
+		{
+			Features.Distances[Direction] = FPR_CsvReader::ParseFloat(Row[DistanceColumns[Direction]]);
+			Features.Materials[Direction] = SurfaceTypeMap.Find(Row[MaterialColumns[Direction]]);
+		}
+
+		float DatasetInputs[PRCore::NumModelInputs];
+		for (int32 Input = 0; Input < PRCore::NumModelInputs; ++Input)
+		{
+			DatasetInputs[Input] = Input >= FirstMaterialInput
+				? Features.Materials[InputMaterialDirections[Input - FirstMaterialInput]]
+				: FPR_CsvReader::ParseFloat(Row[InputColumns[Input]]);
+		}
+
+		float RuntimeInputs[PRCore::NumModelInputs];
+		PRCore::PackFeatures(Features, RuntimeInputs);
+		for (int32 Input = 0; Input < PRCore::NumModelInputs; ++Input)
+		{
+			MaxPackingDifference[Input] = FMath::Max(MaxPackingDifference[Input], FMath::Abs(RuntimeInputs[Input] - DatasetInputs[Input]));
+		}
+
+		FMemory::Memcpy(BlockInputs.GetData() + NumBlockRows * NumInputs, bRuntimePacking ? RuntimeInputs : DatasetInputs, sizeof(DatasetInputs));
+		for (int32 Target = 0; Target < PRCore::NumModelOutputs; ++Target)
+		{
+			BlockTargets[NumBlockRows * PRCore::NumModelOutputs + Target] = FPR_CsvReader::ParseFloat(Row[TargetColumnIndices[Target]]);
+		}
+
+		++NumRows;
+		if (++NumBlockRows == BlockRows)
+		{
+			EvaluateBlock(NumBlockRows);
+			NumBlockRows = 0;
+		}
+	}
+
+	if (NumBlockRows > 0 && !bInferenceFailed)
+	{
+		EvaluateBlock(NumBlockRows);
+	}
+
+	const double TotalSeconds = FPlatformTime::Seconds() - StartTime;
+	if (Reader.HasError() || bInferenceFailed || NumRows == 0)
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Evaluation failed after %lld rows (line %lld)"), NumRows, Reader.GetLineNumber());
+		return 1;
+	}
+
+	UE_LOG(LogPrPartition, Display, TEXT("Evaluated %lld rows (%lld skipped, %lld unmapped materials) with %s packing, batch %d on %d threads"),
+		NumRows, NumSkipped, SurfaceTypeMap.NumUnmapped, bRuntimePacking ? TEXT("runtime") : TEXT("dataset"), BatchSize, NumThreads);
+	UE_LOG(LogPrPartition, Display, TEXT("Inference %.0f rows/s, end to end %.0f rows/s (%s)"),
+		NumRows / FMath::Max(InferenceSeconds, UE_DOUBLE_SMALL_NUMBER),
+		NumRows / FMath::Max(TotalSeconds, UE_DOUBLE_SMALL_NUMBER),
+		ReverbNets[0].IsNative() ? TEXT("native") : TEXT("ORT"));
+
+	TSharedRef<FJsonObject> Report = MakeShared<FJsonObject>();
+	Report->SetStringField(TEXT("input"), InputPath);
+	Report->SetStringField(TEXT("backend"), ReverbNets[0].IsNative() ? TEXT("native") : TEXT("ort"));
+	Report->SetStringField(TEXT("packing"), bRuntimePacking ? TEXT("runtime") : TEXT("dataset"));
+	Report->SetNumberField(TEXT("batch_size"), BatchSize);
+	Report->SetNumberField(TEXT("threads"), NumThreads);
+	Report->SetNumberField(TEXT("rows"), static_cast<double>(NumRows));
+	Report->SetNumberField(TEXT("inference_rows_per_second"), NumRows / FMath::Max(InferenceSeconds, UE_DOUBLE_SMALL_NUMBER));
+	Report->SetNumberField(TEXT("total_rows_per_second"), NumRows / FMath::Max(TotalSeconds, UE_DOUBLE_SMALL_NUMBER));
+
+	TSharedRef<FJsonObject> TargetReport = MakeShared<FJsonObject>();
+	for (int32 Target = 0; Target < PRCore::NumModelOutputs; ++Target)
+	{
+		const double MeanAbsolute = Errors[Target].SumAbsolute / NumRows;
+		const double RootMeanSquared = FMath::Sqrt(Errors[Target].SumSquared / NumRows);
+		UE_LOG(LogPrPartition, Display, TEXT("  %-16hs MAE %.4f  RMSE %.4f  Max %.4f"), TargetColumns[Target], MeanAbsolute, RootMeanSquared, Errors[Target].MaxAbsolute);
+
+		TSharedRef<FJsonObject> Entry = MakeShared<FJsonObject>();
+		Entry->SetNumberField(TEXT("mae"), MeanAbsolute);
+		Entry->SetNumberField(TEXT("rmse"), RootMeanSquared);
+		Entry->SetNumberField(TEXT("max"), Errors[Target].MaxAbsolute);
+		TargetReport->SetObjectField(ANSI_TO_TCHAR(TargetColumns[Target]), Entry);
+	}
+	Report->SetObjectField(TEXT("targets"), TargetReport);
+
+	// Columns the runtime derives differently than the dataset stores them, e.g. reordered or recomputed features
+	TArray<TSharedPtr<FJsonValue>> Mismatches;
+	for (int32 Input = 0; Input < PRCore::NumModelInputs; ++Input)
+	{
+		if (MaxPackingDifference[Input] > UE_KINDA_SMALL_NUMBER)
+		{
+			UE_LOG(LogPrPartition, Warning, TEXT("Runtime packing differs from dataset column %hs by up to %.4f"), DatasetInputColumns[Input], MaxPackingDifference[Input]);
+			Mismatches.Add(MakeShared<FJsonValueString>(ANSI_TO_TCHAR(DatasetInputColumns[Input])));
+		}
+	}
+	Report->SetArrayField(TEXT("packing_mismatches"), Mismatches);
+
+	if (!OutputPath.IsEmpty())
+	{
+		FString Output;
+		TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&Output);
+		FJsonSerializer::Serialize(Report, Writer);
+		if (!FFileHelper::SaveStringToFile(Output, *OutputPath))
+		{
+			UE_LOG(LogPrPartition, Error, TEXT("Failed to write the evaluation report to %s"), *OutputPath);
+			return 1;
+		}
+	}
+
+	return 0;
+}
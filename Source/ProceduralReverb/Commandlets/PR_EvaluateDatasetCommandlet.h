@@ -0,0 +1,30 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "PR_EvaluateDatasetCommandlet.generated.h"
+
+
+/**
+ * Runs the configured reverb model over a training dataset and reports throughput and per target error:
+ * UnrealEditor-Cmd <Project> -run=PR_EvaluateDataset -nullrhi -unattended [options]
+ *
+ * -Input=<path>          Dataset, defaults to SyntheticAcousticDataWithMaterials.csv in the project directory
+ * -BatchSize=256         Rows per model run, defaults to the project setting
+ * -Threads=1             Model instances evaluating batches in parallel
+ * -Backend=ORT|Native    Defaults to the project setting
+ * -Packing=Runtime       Runtime packs features like the partition does, Dataset feeds the columns as stored
+ * -Output=<path>         Optional .json report
+ */
+UCLASS()
+class PROCEDURALREVERB_API UPR_EvaluateDatasetCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UPR_EvaluateDatasetCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
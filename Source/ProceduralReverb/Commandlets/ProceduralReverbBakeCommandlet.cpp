@@ -0,0 +1,306 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ProceduralReverbBakeCommandlet.h"
+
+#include "Engine/Engine.h"
+#include "HAL/PlatformProcess.h"
+#include "Misc/PackageName.h"
+#include "NNEModelData.h"
+#include "ProceduralReverb/Core/PRCore_InferenceCache.h"
+#include "ProceduralReverb/LogPrPartition.h"
+#include "ProceduralReverb/Model/PR_ReverbNet.h"
+#include "ProceduralReverb/Partition/PR_PartitionBake.h"
+#include "ProceduralReverb/Partition/PR_PartitionTree.h"
+#include "ProceduralReverb/Partition/PR_PartitionWorldSubsystem.h"
+#include "ProceduralReverb/Partition/Settings/ProceduralReverbSettings.h"
+
+
+namespace
+{
+enum class EPR_BakeResult : uint8
+{
+	Baked,
+	Skipped,
+	Failed
+};
+
+TArray<FString> FindMaps(const FString& MapsParam, const FString& MapFilter)
+{
+	TArray<FString> Maps;
+	MapsParam.ParseIntoArray(Maps, TEXT(","));
+
+	if (!MapFilter.IsEmpty())
+	{
+		TArray<FString> PackageFiles;
+		FPackageName::FindPackagesInDirectory(PackageFiles, FPaths::ProjectContentDir());
+		for (const FString& PackageFile : PackageFiles)
+		{
+			FString PackageName;
+			if (FPaths::GetExtension(PackageFile, true) == FPackageName::GetMapPackageExtension()
+				&& FPackageName::TryConvertFilenameToLongPackageName(PackageFile, PackageName)
+				&& PackageName.MatchesWildcard(MapFilter))
+			{
+				Maps.Add(PackageName);
+			}
+		}
+	}
+
+	// Every worker derives its shard from the same sorted list
+	Maps = TSet<FString>(Maps).Array();
+	Maps.Sort();
+	return Maps;
+}
+
+/** Loaded for queries and collision but never begun, so the subsystem doesn't generate on its own */
+UWorld* LoadMap(const FString& MapName)
+{
+	UPackage* Package = LoadPackage(nullptr, *MapName, LOAD_None);
+	UWorld* World = Package ? UWorld::FindWorldInPackage(Package) : nullptr;
+	if (!World)
+	{
+		return nullptr;
+	}
+
+	World->WorldType = EWorldType::Editor;
+	World->AddToRoot();
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Editor);
+	WorldContext.SetCurrentWorld(World);
+
+	World->InitWorld(UWorld::InitializationValues()
+		.InitializeScenes(false)
+		.AllowAudioPlayback(false)
+		.RequiresHitProxies(false)
+		.CreatePhysicsScene(true)
+		.CreateNavigation(false)
+		.CreateAISystem(false)
+		.ShouldSimulatePhysics(false)
+		.EnableTraceCollision(true)
+		.SetTransactional(false)
+		.CreateFXSystem(false));
+	World->UpdateWorldComponents(true, false);
+
+#if WITH_EDITOR
+	// Sublevels contribute geometry like they do in game
+	World->LoadSecondaryLevels();
+#endif // WITH_EDITOR
+	World->FlushLevelStreaming(EFlushLevelStreamingType::Full);
+	return World;
+}
+
+void UnloadMap(UWorld* World)
+{
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+	World->RemoveFromRoot();
+	CollectGarbage(RF_NoFlags);
+}
+
+EPR_BakeResult BakeMap(const FString& MapName, FPR_ReverbNet& ReverbNet, PRCore::FInferenceCache* Cache, bool bForce)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	UWorld* World = LoadMap(MapName);
+	if (!World)
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Failed to load map %s"), *MapName);
+		return EPR_BakeResult::Failed;
+	}
+
+	const FString FilePath = FPR_PartitionBake::GetFilePath(World);
+	const FPR_PartitionBakeKey Key = FPR_PartitionBakeKey::Compute(World);
+	FPR_PartitionBakeKey BakedKey;
+	if (!bForce && FPR_PartitionBake::LoadKey(FilePath, BakedKey) && BakedKey.Matches(Key))
+	{
+		UE_LOG(LogPrPartition, Display, TEXT("%s is up to date"), *MapName);
+		UnloadMap(World);
+		return EPR_BakeResult::Skipped;
+	}
+
+	// Same stages as a blocking generation, without the lazy and time sliced modes of the subsystem
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+	auto* Subsystem = World->GetSubsystem<UPR_PartitionWorldSubsystem>();
+	check(Subsystem);
+
+	FPR_PartitionTree Tree;
+	Tree.Build(Subsystem->GetInitialBoundingBox(), FPR_PartitionBuildParams::FromSettings(World), World);
+	if (Tree.IsEmpty())
+	{
+		UE_LOG(LogPrPartition, Warning, TEXT("%s has no static geometry to bake"), *MapName);
+		UnloadMap(World);
+		return EPR_BakeResult::Skipped;
+	}
+
+	Tree.CollectAcousticData(World);
+	if (Settings->bBuildLeafVisibility)
+	{
+		Tree.CollectLeafVisibility(World, Settings->LeafVisibilityRadius);
+	}
+
+	const FPR_ReverbCompaction Compaction = Tree.RunModel(ReverbNet, Cache);
+	const bool bSaved = Compaction.NumLeavesAfter > 0 && FPR_PartitionBake::Save(FilePath, Key, Tree);
+	UnloadMap(World);
+
+	if (!bSaved)
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Failed to bake %s"), *MapName);
+		return EPR_BakeResult::Failed;
+	}
+
+	UE_LOG(LogPrPartition, Display, TEXT("Baked %s: %d leaves in %.2f s"), *MapName, Tree.GetNumLeaves(), FPlatformTime::Seconds() - StartTime);
+	return EPR_BakeResult::Baked;
+}
+
+/** Runs the commandlet once per shard in child processes and waits for all of them */
+int32 RunWorkers(int32 NumWorkers, const FString& WorkerParams)
+{
+	const FString ProjectPath = FPaths::ConvertRelativePathToFull(FPaths::GetProjectFilePath());
+
+	TArray<FProcHandle> Workers;
+	for (int32 Worker = 0; Worker < NumWorkers; ++Worker)
+	{
+		const FString LogPath = FPaths::ConvertRelativePathToFull(FPaths::ProjectLogDir() / FString::Printf(TEXT("ProceduralReverbBake_Worker%d.log"), Worker));
+		const FString Args = FString::Printf(TEXT("\"%s\" -run=ProceduralReverbBake %s -Shard=%d/%d -nullrhi -unattended -nopause -nosplash -abslog=\"%s\""),
+			*ProjectPath,
+			*WorkerParams,
+			Worker,
+			NumWorkers,
+			*LogPath);
+
+		FProcHandle Handle = FPlatformProcess::CreateProc(FPlatformProcess::ExecutablePath(), *Args, false, true, true, nullptr, 0, nullptr, nullptr);
+		if (!Handle.IsValid())
+		{
+			UE_LOG(LogPrPartition, Error, TEXT("Failed to start bake worker %d"), Worker);
+			continue;
+		}
+
+		UE_LOG(LogPrPartition, Display, TEXT("Started bake worker %d, logging to %s"), Worker, *LogPath);
+		Workers.Add(Handle);
+	}
+
+	int32 NumFailedWorkers = NumWorkers - Workers.Num();
+	for (int32 Worker = 0; Worker < Workers.Num(); ++Worker)
+	{
+		FPlatformProcess::WaitForProc(Workers[Worker]);
+
+		int32 ReturnCode = 1;
+		FPlatformProcess::GetProcReturnCode(Workers[Worker], &ReturnCode);
+		FPlatformProcess::CloseProc(Workers[Worker]);
+		NumFailedWorkers += ReturnCode != 0;
+	}
+
+	if (NumFailedWorkers > 0)
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("%d of %d bake workers failed, see their logs"), NumFailedWorkers, NumWorkers);
+		return 1;
+	}
+
+	return 0;
+}
+}
+
+
+UProceduralReverbBakeCommandlet::UProceduralReverbBakeCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 UProceduralReverbBakeCommandlet::Main(const FString& Params)
+{
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+
+	FString MapsParam;
+	FString MapFilter;
+	FString ShardParam;
+	int32 NumWorkers = 1;
+
+	FParse::Value(*Params, TEXT("Maps="), MapsParam);
+	FParse::Value(*Params, TEXT("MapFilter="), MapFilter);
+	FParse::Value(*Params, TEXT("Shard="), ShardParam);
+	FParse::Value(*Params, TEXT("Workers="), NumWorkers);
+	const bool bForce = FParse::Param(*Params, TEXT("Force"));
+
+	int32 ShardIndex = 0;
+	int32 NumShards = 1;
+	FString ShardIndexString;
+	FString NumShardsString;
+	if (!ShardParam.IsEmpty())
+	{
+		if (!ShardParam.Split(TEXT("/"), &ShardIndexString, &NumShardsString))
+		{
+			UE_LOG(LogPrPartition, Error, TEXT("Shard has to be given as Index/Count"));
+			return 1;
+		}
+
+		ShardIndex = FCString::Atoi(*ShardIndexString);
+		NumShards = FCString::Atoi(*NumShardsString);
+		if (NumShards < 1 || ShardIndex < 0 || ShardIndex >= NumShards)
+		{
+			UE_LOG(LogPrPartition, Error, TEXT("Invalid shard %s"), *ShardParam);
+			return 1;
+		}
+	}
+
+	const TArray<FString> Maps = FindMaps(MapsParam, MapFilter);
+	if (Maps.IsEmpty())
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("No maps to bake, pass -Maps= or -MapFilter="));
+		return 1;
+	}
+
+	// Workers are only spawned by the top level process, shards never fan out again
+	NumWorkers = FMath::Clamp(NumWorkers, 1, Maps.Num());
+	if (NumWorkers > 1 && ShardParam.IsEmpty())
+	{
+#if WITH_EDITOR
+		// Every worker initializes the model, with the sidecar current they only read it
+		FPR_ReverbNet::UpdateNativeModel(Settings->PreLoadedModelData.LoadSynchronous());
+#endif // WITH_EDITOR
+
+		const FString WorkerParams = FString::Printf(TEXT("-Maps=\"%s\" -MapFilter=\"%s\"%s"),
+			*MapsParam,
+			*MapFilter,
+			bForce ? TEXT(" -Force") : TEXT(""));
+		return RunWorkers(NumWorkers, WorkerParams);
+	}
+
+	UNNEModelData* ModelData = Settings->PreLoadedModelData.LoadSynchronous();
+	FPR_ReverbNet ReverbNet;
+	if (!ModelData || !ReverbNet.Init(ModelData, Settings->InferenceBatchSize, Settings->InferenceBackend))
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Baking needs the reverb model, check PreLoadedModelData"));
+		return 1;
+	}
+
+	// Shared by every map of this process, maps built from the same rooms mostly reuse each other's results
+	TOptional<PRCore::FInferenceCache> InferenceCache;
+	if (Settings->bInferenceCache)
+	{
+		InferenceCache.Emplace(Settings->InferenceCacheResolution);
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	int32 NumResults[3] = {};
+	for (int32 MapIndex = ShardIndex; MapIndex < Maps.Num(); MapIndex += NumShards)
+	{
+		++NumResults[static_cast<uint8>(BakeMap(Maps[MapIndex], ReverbNet, InferenceCache.GetPtrOrNull(), bForce))];
+	}
+
+	if (InferenceCache.IsSet())
+	{
+		UE_LOG(LogPrPartition, Display, TEXT("Inference cache holds %d results, %.1f%% of %llu lookups hit"),
+			static_cast<int32>(InferenceCache->Num()),
+			InferenceCache->GetHitRate() * 100.0,
+			InferenceCache->GetNumLookups());
+	}
+
+	UE_LOG(LogPrPartition, Display, TEXT("Baked %d, skipped %d, failed %d maps in %.1f s"),
+		NumResults[static_cast<uint8>(EPR_BakeResult::Baked)],
+		NumResults[static_cast<uint8>(EPR_BakeResult::Skipped)],
+		NumResults[static_cast<uint8>(EPR_BakeResult::Failed)],
+		FPlatformTime::Seconds() - StartTime);
+
+	return NumResults[static_cast<uint8>(EPR_BakeResult::Failed)] > 0 ? 1 : 0;
+}
@@ -0,0 +1,32 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "ProceduralReverbBakeCommandlet.generated.h"
+
+
+/**
+ * Bakes the partition of every selected map without running the game, meant for build machines:
+ * UnrealEditor-Cmd <Project> -run=ProceduralReverbBake -nullrhi -unattended [options]
+ *
+ * -Maps=/Game/Maps/A,/Game/Maps/B    Long package names of the maps to bake
+ * -MapFilter=/Game/Maps/*            Adds every map under Content whose package name matches the wildcard
+ * -Workers=4                         Fans the maps out over that many child processes, each logs to its own file
+ * -Shard=0/4                         Bakes only every 4th map starting at the first, set by the parent for its workers
+ * -Force                             Bakes maps whose bake is up to date as well
+ *
+ * Maps whose baked geometry, settings and model hashes still match are skipped.
+ * Returns non-zero when any map failed to bake.
+ */
+UCLASS()
+class PROCEDURALREVERB_API UProceduralReverbBakeCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UProceduralReverbBakeCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
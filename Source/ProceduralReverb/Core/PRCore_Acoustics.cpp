@@ -0,0 +1,278 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PRCore_Acoustics.h"
+
+
+namespace PRCore
+{
+const FVec3 FeatureDirections[NumDirections] = {
+	FVec3(1, 0, 0), FVec3(-1, 0, 0),  // X directions
+	FVec3(0, 1, 0), FVec3(0, -1, 0),  // Y directions
+	FVec3(0, 0, 1), FVec3(0, 0, -1)   // Z directions
+};
+
+
+namespace
+{
+double Dot(const FVec3& A, const FVec3& B)
+{
+	return A.X * B.X + A.Y * B.Y + A.Z * B.Z;
+}
+
+FVec3 Normalize(const FVec3& Vector)
+{
+	return Vector * (1.0 / std::sqrt(Dot(Vector, Vector)));
+}
+}
+
+
+FProbeRaySet::FProbeRaySet(EProbeRaySet Type, int32_t NumFibonacciRays)
+	: bPassthrough(Type == EProbeRaySet::Axes6)
+{
+	// Axis rays come first in every fixed set
+	if (Type != EProbeRaySet::Fibonacci)
+	{
+		for (const FVec3& Direction : FeatureDirections)
+		{
+			Directions.push_back(Direction);
+		}
+	}
+
+	if (Type == EProbeRaySet::Axes14 || Type == EProbeRaySet::Axes26)
+	{
+		for (int32_t Z = -1; Z <= 1; ++Z)
+		{
+			for (int32_t Y = -1; Y <= 1; ++Y)
+			{
+				for (int32_t X = -1; X <= 1; ++X)
+				{
+					const int32_t NumNonZero = (X != 0) + (Y != 0) + (Z != 0);
+					if (NumNonZero == 3 || (NumNonZero == 2 && Type == EProbeRaySet::Axes26))
+					{
+						Directions.push_back(Normalize(FVec3(X, Y, Z)));
+					}
+				}
+			}
+		}
+	}
+	else if (Type == EProbeRaySet::Fibonacci)
+	{
+		const int32_t NumRays = std::clamp(NumFibonacciRays, MinFibonacciRays, MaxRays);
+		const double GoldenAngle = 3.14159265358979323846 * (3.0 - std::sqrt(5.0));
+		for (int32_t Ray = 0; Ray < NumRays; ++Ray)
+		{
+			const double Z = 1.0 - (2.0 * Ray + 1.0) / NumRays;
+			const double Radius = std::sqrt(std::max(0.0, 1.0 - Z * Z));
+			const double Angle = GoldenAngle * Ray;
+			Directions.push_back(FVec3(Radius * std::cos(Angle), Radius * std::sin(Angle), Z));
+		}
+	}
+}
+
+void FProbeRaySet::Reduce(const FProbeHits& Hits, size_t FirstHit, int32_t NumLeaves, float RayDistance, FLeafFeatures* OutFeatures) const
+{
+	const int32_t NumRays = Num();
+	if (bPassthrough)
+	{
+		// Misses are already stored at the ray distance with material 0
+		for (int32_t Leaf = 0; Leaf < NumLeaves; ++Leaf)
+		{
+			const size_t Begin = FirstHit + static_cast<size_t>(Leaf) * NumRays;
+			for (int32_t Feature = 0; Feature < NumDirections; ++Feature)
+			{
+				OutFeatures[Leaf].Distances[Feature] = Hits.Distances[Begin + Feature];
+				OutFeatures[Leaf].Materials[Feature] = Hits.Materials[Begin + Feature];
+			}
+		}
+		return;
+	}
+
+	for (int32_t Leaf = 0; Leaf < NumLeaves; ++Leaf)
+	{
+		const size_t Begin = FirstHit + static_cast<size_t>(Leaf) * NumRays;
+		const float* Distances = Hits.Distances.data() + Begin;
+		const float* NormalX = Hits.NormalX.data() + Begin;
+		const float* NormalY = Hits.NormalY.data() + Begin;
+		const float* NormalZ = Hits.NormalZ.data() + Begin;
+
+		// Weighted perpendicular distances and the most aligned hit per direction
+		float WeightedDistances[NumDirections] = {};
+		float WeightSums[NumDirections] = {};
+		float BestWeights[NumDirections] = {};
+		int32_t BestRays[NumDirections];
+		std::fill(std::begin(BestRays), std::end(BestRays), -1);
+
+		for (int32_t Ray = 0; Ray < NumRays; ++Ray)
+		{
+			const FVec3& Direction = Directions[Ray];
+
+			// Walls face the probe, the direction a wall lies in is the opposite of its normal
+			const float WallX = -NormalX[Ray];
+			const float WallY = -NormalY[Ray];
+			const float WallZ = -NormalZ[Ray];
+			const float Perpendicular = Distances[Ray] * std::max(0.0f,
+				static_cast<float>(Direction.X) * WallX + static_cast<float>(Direction.Y) * WallY + static_cast<float>(Direction.Z) * WallZ);
+
+			// Ordered as EDirection, cos^2 towards every axis
+			const float Weights[NumDirections] = {
+				std::max(WallX, 0.0f) * WallX, std::min(WallX, 0.0f) * WallX,
+				std::max(WallY, 0.0f) * WallY, std::min(WallY, 0.0f) * WallY,
+				std::max(WallZ, 0.0f) * WallZ, std::min(WallZ, 0.0f) * WallZ
+			};
+
+			for (int32_t Feature = 0; Feature < NumDirections; ++Feature)
+			{
+				WeightedDistances[Feature] += Weights[Feature] * Perpendicular;
+				WeightSums[Feature] += Weights[Feature];
+			}
+
+			for (int32_t Feature = 0; Feature < NumDirections; ++Feature)
+			{
+				if (Weights[Feature] > BestWeights[Feature])
+				{
+					BestWeights[Feature] = Weights[Feature];
+					BestRays[Feature] = Ray;
+				}
+			}
+		}
+
+		FLeafFeatures& Features = OutFeatures[Leaf];
+		for (int32_t Feature = 0; Feature < NumDirections; ++Feature)
+		{
+			const bool bFaced = WeightSums[Feature] > 0.0f;
+			Features.Distances[Feature] = bFaced ? WeightedDistances[Feature] / WeightSums[Feature] : RayDistance;
+			Features.Materials[Feature] = BestRays[Feature] >= 0 ? Hits.Materials[Begin + BestRays[Feature]] : 0;
+		}
+	}
+}
+
+
+void FProbeHits::Resize(size_t Num)
+{
+	Distances.resize(Num);
+	NormalX.resize(Num);
+	NormalY.resize(Num);
+	NormalZ.resize(Num);
+	Materials.resize(Num);
+}
+
+void FProbeHits::Set(size_t Index, const FTraceHit& Hit, const FVec3& RayDirection, float RayDistance)
+{
+	const FVec3 Normal = Hit.bHit ? Hit.Normal : RayDirection * -1.0;
+	Distances[Index] = Hit.bHit ? Hit.Distance : RayDistance;
+	NormalX[Index] = static_cast<float>(Normal.X);
+	NormalY[Index] = static_cast<float>(Normal.Y);
+	NormalZ[Index] = static_cast<float>(Normal.Z);
+	Materials[Index] = Hit.bHit ? Hit.Material : 0;
+}
+
+
+void ProbeLeaf(const IWorldQueries& World, const FProbeRaySet& RaySet, const FVec3& Center, float RayDistance, FLeafFeatures& OutFeatures)
+{
+	// Reused per thread, probing a leaf doesn't allocate after the first call
+	thread_local FProbeHits Hits;
+	Hits.Resize(RaySet.Num());
+	for (int32_t Ray = 0; Ray < RaySet.Num(); ++Ray)
+	{
+		const FVec3& Direction = RaySet.GetDirections()[Ray];
+		Hits.Set(Ray, World.Trace(Center, Center + Direction * RayDistance), Direction, RayDistance);
+	}
+
+	RaySet.Reduce(Hits, 0, 1, RayDistance, &OutFeatures);
+}
+
+ELeafSpace ClassifyLeaf(const IWorldQueries& World, const FBox3& Bounds, const FLeafSpaceParams& Params)
+{
+	if (!Params.PlayableBounds.empty())
+	{
+		const FVec3 Margin(Params.PlayableMargin, Params.PlayableMargin, Params.PlayableMargin);
+		const FBox3 Reach(Bounds.Min - Margin, Bounds.Max + Margin);
+		const bool bNearPlayable = std::any_of(Params.PlayableBounds.begin(), Params.PlayableBounds.end(), [&Reach](const FBox3& Playable)
+		{
+			return Playable.Intersects(Reach);
+		});
+
+		if (!bNearPlayable)
+		{
+			return ELeafSpace::Exterior;
+		}
+	}
+
+	if (!Params.bDetectSolid)
+	{
+		return ELeafSpace::Playable;
+	}
+
+	// Center first, most leaves are decided by one overlap
+	constexpr double PointExtent = 0.5;
+	const FVec3 PointSize(PointExtent, PointExtent, PointExtent);
+	const FVec3 Center = Bounds.GetCenter();
+	const FVec3 Quarter = Bounds.GetExtent() * 0.5;
+	for (int32_t Sample = -1; Sample < 8; ++Sample)
+	{
+		FVec3 Point = Center;
+		if (Sample >= 0)
+		{
+			Point.X += (Sample & 1) ? Quarter.X : -Quarter.X;
+			Point.Y += (Sample & 2) ? Quarter.Y : -Quarter.Y;
+			Point.Z += (Sample & 4) ? Quarter.Z : -Quarter.Z;
+		}
+
+		if (!World.Overlaps(FBox3(Point - PointSize, Point + PointSize)))
+		{
+			return ELeafSpace::Playable;
+		}
+	}
+
+	return ELeafSpace::Solid;
+}
+
+bool IsRegionUniform(const IWorldQueries& World, const FBox3& BoundingBox, float ProbeDistance)
+{
+	if (World.Overlaps(BoundingBox))
+	{
+		return false;
+	}
+
+	const FVec3 Center = BoundingBox.GetCenter();
+	const FVec3 Extents = BoundingBox.GetExtent();
+	const uint8_t Axis = BoundingBox.GetLongestAxis();
+	FVec3 LeftCenter = Center;
+	FVec3 RightCenter = Center;
+	LeftCenter[Axis] -= 0.5 * Extents[Axis];
+	RightCenter[Axis] += 0.5 * Extents[Axis];
+
+	for (const FVec3& Direction : FeatureDirections)
+	{
+		const FTraceHit LeftHit = World.Trace(LeftCenter, LeftCenter + Direction * ProbeDistance);
+		const FTraceHit RightHit = World.Trace(RightCenter, RightCenter + Direction * ProbeDistance);
+
+		if (LeftHit.bHit != RightHit.bHit)
+		{
+			return false;
+		}
+
+		if (LeftHit.bHit && (LeftHit.Surface != RightHit.Surface || LeftHit.SurfaceMaterial != RightHit.SurfaceMaterial))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void PackFeatures(const FLeafFeatures& Features, float* OutInputs)
+{
+	const float* Distances = Features.Distances;
+	OutInputs[0] = Distances[Front] + Distances[Back];
+	OutInputs[1] = Distances[Left] + Distances[Right];
+	OutInputs[2] = Distances[Up] + Distances[Down];
+
+	for (int32_t Direction = 0; Direction < NumDirections; ++Direction)
+	{
+		OutInputs[3 + Direction] = Distances[Direction];
+		OutInputs[3 + NumDirections + Direction] = static_cast<float>(Features.Materials[Direction]);
+	}
+}
+}
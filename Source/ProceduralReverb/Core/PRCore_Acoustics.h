@@ -0,0 +1,169 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "PRCore_Types.h"
+
+#include <vector>
+
+
+namespace PRCore
+{
+/** Probe directions of a leaf, the model expects its inputs in this order */
+enum EDirection : int32_t
+{
+	Front = 0,
+	Back,
+	Right,
+	Left,
+	Up,
+	Down,
+	NumDirections
+};
+
+extern const FVec3 FeatureDirections[NumDirections];
+
+// Room size, distance and material per direction
+constexpr int32_t NumModelInputs = 3 + 2 * NumDirections;
+
+
+struct FTraceHit
+{
+	bool bHit = false;
+	float Distance = 0.0f;
+	/** Unit surface normal at the hit, facing back towards the trace start */
+	FVec3 Normal;
+	/** Surface type the model is trained on */
+	uint8_t Material = 0;
+	/** Opaque identity of what was hit, only compared against other hits */
+	const void* Surface = nullptr;
+	const void* SurfaceMaterial = nullptr;
+};
+
+
+/**
+ * Scene queries the featurization needs, implemented by the engine or by a synthetic scene.
+ * Called from several threads at once.
+ */
+class IWorldQueries
+{
+public:
+	virtual ~IWorldQueries() = default;
+
+	virtual FTraceHit Trace(const FVec3& Start, const FVec3& End) const = 0;
+	/** True when blocking geometry intersects the box */
+	virtual bool Overlaps(const FBox3& Box) const = 0;
+};
+
+
+struct FLeafFeatures
+{
+	float Distances[NumDirections] = {};
+	uint8_t Materials[NumDirections] = {};
+};
+
+
+enum class EProbeRaySet : uint8_t
+{
+	/** One ray per feature direction */
+	Axes6,
+	/** Axes and the 8 cube corners */
+	Axes14,
+	/** Axes, the 12 cube edges and the 8 corners */
+	Axes26,
+	/** Evenly spread rays on a Fibonacci sphere */
+	Fibonacci
+};
+
+
+/**
+ * Hits of many probe rays stored as structure of arrays. Misses are stored as a wall facing the ray at
+ * the ray distance, so the reduction doesn't need to tell them apart.
+ */
+struct FProbeHits
+{
+	void Resize(size_t Num);
+	void Set(size_t Index, const FTraceHit& Hit, const FVec3& RayDirection, float RayDistance);
+
+	std::vector<float> Distances;
+	std::vector<float> NormalX;
+	std::vector<float> NormalY;
+	std::vector<float> NormalZ;
+	std::vector<uint8_t> Materials;
+};
+
+
+/**
+ * Probe directions of a leaf and their reduction to the feature directions.
+ * Axes6 passes every ray straight through to its feature, the distance along the ray and the material hit, which is
+ * the per axis probe the model was trained on. Larger sets credit every hit to the feature directions its wall faces
+ * with weight cos^2, which sums to 1 over the six directions, and report the perpendicular distance to the wall's
+ * plane. Walls of box shaped rooms land in one direction each, walls of rotated rooms are shared between the two
+ * directions they face. Materials come from the hit facing each direction most directly.
+ */
+class FProbeRaySet
+{
+public:
+	static constexpr int32_t MinFibonacciRays = NumDirections;
+	static constexpr int32_t MaxRays = 256;
+
+	explicit FProbeRaySet(EProbeRaySet Type = EProbeRaySet::Axes6, int32_t NumFibonacciRays = 32);
+
+	int32_t Num() const { return static_cast<int32_t>(Directions.size()); }
+	const std::vector<FVec3>& GetDirections() const { return Directions; }
+
+	/**
+	 * Reduces NumLeaves leaves whose Num() hits each are stored from FirstHit on. Directions no wall faces
+	 * report RayDistance and material 0. The weighted distance sums don't branch per hit, picking the material does.
+	 */
+	void Reduce(const FProbeHits& Hits, size_t FirstHit, int32_t NumLeaves, float RayDistance, FLeafFeatures* OutFeatures) const;
+
+private:
+	std::vector<FVec3> Directions;
+	/** Set for Axes6, ray i is feature i */
+	bool bPassthrough = false;
+};
+
+
+/** Traces every ray of the set from Center and reduces the hits to features */
+void ProbeLeaf(const IWorldQueries& World, const FProbeRaySet& RaySet, const FVec3& Center, float RayDistance, FLeafFeatures& OutFeatures);
+
+/** What fills a leaf, only playable leaves are probed, evaluated and returned by queries */
+enum class ELeafSpace : uint8_t
+{
+	Playable = 0,
+	/** Inside blocking geometry, e.g. wall interiors */
+	Solid,
+	/** Far from every playable box, e.g. above the sky */
+	Exterior
+};
+
+constexpr int32_t NumLeafSpaces = 3;
+
+
+struct FLeafSpaceParams
+{
+	/** Boxes listeners can reach, e.g. navigation bounds. Without any box no leaf is exterior */
+	std::vector<FBox3> PlayableBounds;
+	/** Leaves further than this from every playable box are exterior */
+	double PlayableMargin = 1000.0;
+	bool bDetectSolid = true;
+};
+
+
+/**
+ * Classifies a leaf with cheap tests only. It is exterior when it doesn't come within the margin of any playable box,
+ * solid when its center and the centers of its eight octants all overlap blocking geometry. Overlaps only report
+ * closed shapes, leaves inside hollow triangle meshes stay playable.
+ */
+ELeafSpace ClassifyLeaf(const IWorldQueries& World, const FBox3& Bounds, const FLeafSpaceParams& Params);
+
+/**
+ * A region is uniform when no geometry crosses it and both halves see the same surfaces in every probe direction,
+ * splitting it would produce leaves with the same acoustic surroundings.
+ */
+bool IsRegionUniform(const IWorldQueries& World, const FBox3& BoundingBox, float ProbeDistance);
+
+/** Writes NumModelInputs floats: room length, width and height, then distances and materials per direction */
+void PackFeatures(const FLeafFeatures& Features, float* OutInputs);
+}
@@ -0,0 +1,91 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PRCore_Inference.h"
+
+#include "PRCore_InferenceCache.h"
+
+#include <vector>
+
+
+namespace PRCore
+{
+bool EvaluateFeatures(
+	IReverbModel& Model,
+	const FLeafFeatures* Features,
+	int32_t NumLeaves,
+	FReverbParams* OutParams,
+	FInferenceCache* Cache,
+	int32_t* OutNumEvaluated)
+{
+	if (OutNumEvaluated)
+	{
+		*OutNumEvaluated = 0;
+	}
+
+	const int32_t NumInputs = Model.GetNumInputs();
+	const int32_t NumOutputs = Model.GetNumOutputs();
+	if (NumLeaves <= 0 || NumInputs != NumModelInputs || NumOutputs < NumModelOutputs)
+	{
+		return false;
+	}
+
+	// Without a cache every row is evaluated, with one only the first row of every missing key
+	std::vector<int32_t> MissRows;
+	std::vector<int32_t> RowMisses;
+	if (Cache)
+	{
+		Cache->Lookup(Features, NumLeaves, OutParams, MissRows, RowMisses);
+	}
+
+	const int32_t NumRows = Cache ? static_cast<int32_t>(MissRows.size()) : NumLeaves;
+	if (NumRows == 0)
+	{
+		return true;
+	}
+
+	// [N, NumInputs] features and [N, NumOutputs] results, the model reads and writes them in place
+	std::vector<float> InputData(static_cast<size_t>(NumRows) * NumInputs);
+	std::vector<float> OutputData(static_cast<size_t>(NumRows) * NumOutputs);
+	for (int32_t Row = 0; Row < NumRows; ++Row)
+	{
+		float* Inputs = InputData.data() + static_cast<size_t>(Row) * NumInputs;
+		PackFeatures(Cache ? Cache->Quantize(Features[MissRows[Row]]) : Features[Row], Inputs);
+	}
+
+	if (!Model.Run(InputData.data(), OutputData.data(), NumRows))
+	{
+		return false;
+	}
+
+	for (int32_t Row = 0; Row < NumRows; ++Row)
+	{
+		const FReverbParams Params = MapModelOutput(OutputData.data() + static_cast<size_t>(Row) * NumOutputs);
+		if (Cache)
+		{
+			OutParams[MissRows[Row]] = Params;
+			Cache->Add(Features[MissRows[Row]], Params);
+		}
+		else
+		{
+			OutParams[Row] = Params;
+		}
+	}
+
+	// Duplicates of a missing key share the result of its first row
+	for (int32_t Row = 0; Row < static_cast<int32_t>(RowMisses.size()); ++Row)
+	{
+		if (RowMisses[Row] >= 0)
+		{
+			OutParams[Row] = OutParams[MissRows[RowMisses[Row]]];
+		}
+	}
+
+	if (OutNumEvaluated)
+	{
+		*OutNumEvaluated = NumRows;
+	}
+
+	return true;
+}
+}
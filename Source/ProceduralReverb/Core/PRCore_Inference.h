@@ -0,0 +1,43 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "PRCore_Acoustics.h"
+#include "PRCore_Reverb.h"
+
+
+namespace PRCore
+{
+class FInferenceCache;
+
+
+/**
+ * Reverb model features are evaluated with. The module implements it with its inference backends,
+ * Tools/ProceduralReverbCore with stand-ins.
+ */
+class IReverbModel
+{
+public:
+	virtual ~IReverbModel() = default;
+
+	virtual int32_t GetNumInputs() const = 0;
+	virtual int32_t GetNumOutputs() const = 0;
+
+	/** Evaluates NumRows rows stored contiguously, GetNumInputs() floats in and GetNumOutputs() floats out each */
+	virtual bool Run(const float* Inputs, float* Outputs, int32_t NumRows) = 0;
+};
+
+
+/**
+ * Packs the features of NumLeaves leaves, runs the model on them and maps its outputs to reverb parameters.
+ * With a cache only features missing from it are evaluated, once per distinct key and on the quantized features,
+ * and their results are added. OutNumEvaluated receives the number of rows the model ran on.
+ */
+bool EvaluateFeatures(
+	IReverbModel& Model,
+	const FLeafFeatures* Features,
+	int32_t NumLeaves,
+	FReverbParams* OutParams,
+	FInferenceCache* Cache = nullptr,
+	int32_t* OutNumEvaluated = nullptr);
+}
@@ -0,0 +1,112 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PRCore_InferenceCache.h"
+
+
+namespace PRCore
+{
+void FInferenceCache::Reset(float InResolution, size_t InMaxEntries)
+{
+	Resolution = std::max(InResolution, 0.01f);
+	InvResolution = 1.0f / Resolution;
+	MaxEntries = std::max<size_t>(InMaxEntries, 1);
+	Entries.clear();
+	PendingMisses.clear();
+	NumLookups = 0;
+	NumHits = 0;
+}
+
+FLeafFeatures FInferenceCache::Quantize(const FLeafFeatures& Features) const
+{
+	const FKey Key = MakeKey(Features);
+
+	FLeafFeatures Quantized = Features;
+	for (int32_t Direction = 0; Direction < NumDirections; ++Direction)
+	{
+		Quantized.Distances[Direction] = Key.Distances[Direction] * Resolution;
+	}
+	return Quantized;
+}
+
+void FInferenceCache::Lookup(
+	const FLeafFeatures* Features,
+	int32_t NumRows,
+	FReverbParams* OutParams,
+	std::vector<int32_t>& OutMissRows,
+	std::vector<int32_t>& OutRowMisses)
+{
+	OutMissRows.clear();
+	OutRowMisses.assign(NumRows, -1);
+	PendingMisses.clear();
+
+	for (int32_t Row = 0; Row < NumRows; ++Row)
+	{
+		const FKey Key = MakeKey(Features[Row]);
+		const auto Found = Entries.find(Key);
+		if (Found != Entries.end())
+		{
+			OutParams[Row] = Found->second;
+			continue;
+		}
+
+		// Rows sharing a missing key are evaluated once
+		const auto Pending = PendingMisses.emplace(Key, static_cast<int32_t>(OutMissRows.size()));
+		if (Pending.second)
+		{
+			OutMissRows.push_back(Row);
+		}
+		OutRowMisses[Row] = Pending.first->second;
+	}
+
+	NumLookups += NumRows;
+	NumHits += NumRows - OutMissRows.size();
+}
+
+void FInferenceCache::Add(const FLeafFeatures& Features, const FReverbParams& Params)
+{
+	if (Entries.size() >= MaxEntries)
+	{
+		Entries.clear();
+	}
+
+	Entries.emplace(MakeKey(Features), Params);
+}
+
+size_t FInferenceCache::GetAllocatedSize() const
+{
+	// Approximation, the node layout of the standard containers is not portable
+	const size_t NodeSize = sizeof(FKey) + sizeof(FReverbParams) + 2 * sizeof(void*);
+	return Entries.size() * NodeSize + Entries.bucket_count() * sizeof(void*)
+		+ PendingMisses.size() * NodeSize + PendingMisses.bucket_count() * sizeof(void*);
+}
+
+bool FInferenceCache::FKey::operator==(const FKey& Other) const
+{
+	return std::equal(std::begin(Distances), std::end(Distances), std::begin(Other.Distances))
+		&& std::equal(std::begin(Materials), std::end(Materials), std::begin(Other.Materials));
+}
+
+size_t FInferenceCache::FKeyHash::operator()(const FKey& Key) const
+{
+	// FNV-1a over the fields, the padding of the key is never read
+	uint64_t Hash = 0xcbf29ce484222325ull;
+	for (int32_t Direction = 0; Direction < NumDirections; ++Direction)
+	{
+		Hash = (Hash ^ static_cast<uint32_t>(Key.Distances[Direction])) * 0x100000001b3ull;
+		Hash = (Hash ^ Key.Materials[Direction]) * 0x100000001b3ull;
+	}
+	return static_cast<size_t>(Hash);
+}
+
+FInferenceCache::FKey FInferenceCache::MakeKey(const FLeafFeatures& Features) const
+{
+	FKey Key;
+	for (int32_t Direction = 0; Direction < NumDirections; ++Direction)
+	{
+		Key.Distances[Direction] = static_cast<int32_t>(std::lround(Features.Distances[Direction] * InvResolution));
+		Key.Materials[Direction] = Features.Materials[Direction];
+	}
+	return Key;
+}
+}
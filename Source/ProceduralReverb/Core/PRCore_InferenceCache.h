@@ -0,0 +1,81 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "PRCore_Acoustics.h"
+#include "PRCore_Reverb.h"
+
+#include <unordered_map>
+#include <vector>
+
+
+namespace PRCore
+{
+/**
+ * Memoizes model results by leaf features. Distances are snapped to multiples of the resolution, materials are compared
+ * exactly. The model is evaluated on the snapped features, so a result doesn't depend on which leaf reached the cache first.
+ * Not thread safe, meant to be kept across evaluations of a partition and across the maps of a bake.
+ */
+class FInferenceCache
+{
+public:
+	static constexpr size_t DefaultMaxEntries = 1 << 20;
+
+	explicit FInferenceCache(float InResolution = 1.0f, size_t InMaxEntries = DefaultMaxEntries) { Reset(InResolution, InMaxEntries); }
+
+	/** Drops every entry and the statistics */
+	void Reset(float InResolution, size_t InMaxEntries = DefaultMaxEntries);
+
+	/** Features with every distance snapped to the resolution, the model input for every leaf sharing the key */
+	FLeafFeatures Quantize(const FLeafFeatures& Features) const;
+
+	/**
+	 * Writes the cached result of every row to OutParams. Rows without one are grouped by key, OutMissRows receives
+	 * the first row of every distinct missing key and OutRowMisses the index into OutMissRows of every row, -1 for hits.
+	 */
+	void Lookup(
+		const FLeafFeatures* Features,
+		int32_t NumRows,
+		FReverbParams* OutParams,
+		std::vector<int32_t>& OutMissRows,
+		std::vector<int32_t>& OutRowMisses);
+
+	/** Stores the result evaluated for the key of Features, starts over once the cache holds MaxEntries */
+	void Add(const FLeafFeatures& Features, const FReverbParams& Params);
+
+	float GetResolution() const { return Resolution; }
+	size_t Num() const { return Entries.size(); }
+	/** Rows looked up and rows that needed no model run, duplicates within one lookup count as hits */
+	uint64_t GetNumLookups() const { return NumLookups; }
+	uint64_t GetNumHits() const { return NumHits; }
+	double GetHitRate() const { return NumLookups > 0 ? static_cast<double>(NumHits) / NumLookups : 0.0; }
+
+	size_t GetAllocatedSize() const;
+
+private:
+	struct FKey
+	{
+		bool operator==(const FKey& Other) const;
+
+		int32_t Distances[NumDirections];
+		uint8_t Materials[NumDirections];
+	};
+
+	struct FKeyHash
+	{
+		size_t operator()(const FKey& Key) const;
+	};
+
+	FKey MakeKey(const FLeafFeatures& Features) const;
+
+	float Resolution = 1.0f;
+	float InvResolution = 1.0f;
+	size_t MaxEntries = DefaultMaxEntries;
+	std::unordered_map<FKey, FReverbParams, FKeyHash> Entries;
+	/** Scratch of Lookup, kept to reuse its buckets */
+	std::unordered_map<FKey, int32_t, FKeyHash> PendingMisses;
+
+	uint64_t NumLookups = 0;
+	uint64_t NumHits = 0;
+};
+}
@@ -0,0 +1,476 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PRCore_Partition.h"
+
+#include <limits>
+
+
+namespace PRCore
+{
+void FLeafBounds::Reset(size_t ExpectedNum)
+{
+	for (std::vector<float>* Column : {&MinX, &MinY, &MinZ, &MaxX, &MaxY, &MaxZ})
+	{
+		Column->clear();
+		Column->reserve(ExpectedNum);
+	}
+}
+
+int32_t FLeafBounds::Add(const FBox3& Box)
+{
+	MinX.push_back(static_cast<float>(Box.Min.X));
+	MinY.push_back(static_cast<float>(Box.Min.Y));
+	MinZ.push_back(static_cast<float>(Box.Min.Z));
+	MaxX.push_back(static_cast<float>(Box.Max.X));
+	MaxY.push_back(static_cast<float>(Box.Max.Y));
+	MaxZ.push_back(static_cast<float>(Box.Max.Z));
+	return Num() - 1;
+}
+
+FBox3 FLeafBounds::GetBox(int32_t LeafIndex) const
+{
+	return FBox3(
+		FVec3(MinX[LeafIndex], MinY[LeafIndex], MinZ[LeafIndex]),
+		FVec3(MaxX[LeafIndex], MaxY[LeafIndex], MaxZ[LeafIndex]));
+}
+
+FVec3 FLeafBounds::GetCenter(int32_t LeafIndex) const
+{
+	return FVec3(
+		0.5f * (MinX[LeafIndex] + MaxX[LeafIndex]),
+		0.5f * (MinY[LeafIndex] + MaxY[LeafIndex]),
+		0.5f * (MinZ[LeafIndex] + MaxZ[LeafIndex]));
+}
+
+float FLeafBounds::DistanceTo(int32_t LeafIndex, const FVec3& Point) const
+{
+	const float PX = static_cast<float>(Point.X);
+	const float PY = static_cast<float>(Point.Y);
+	const float PZ = static_cast<float>(Point.Z);
+	const float DX = std::max({MinX[LeafIndex] - PX, 0.0f, PX - MaxX[LeafIndex]});
+	const float DY = std::max({MinY[LeafIndex] - PY, 0.0f, PY - MaxY[LeafIndex]});
+	const float DZ = std::max({MinZ[LeafIndex] - PZ, 0.0f, PZ - MaxZ[LeafIndex]});
+	return std::sqrt(DX * DX + DY * DY + DZ * DZ);
+}
+
+size_t FLeafBounds::GetAllocatedSize() const
+{
+	return (MinX.capacity() + MinY.capacity() + MinZ.capacity() + MaxX.capacity() + MaxY.capacity() + MaxZ.capacity()) * sizeof(float);
+}
+
+
+void FPartition::Build(const FBox3& RootBox, const FBuildParams& Params)
+{
+	BeginBuild(RootBox, Params);
+	while (!StepBuild(std::numeric_limits<int32_t>::max()))
+	{
+	}
+}
+
+void FPartition::BeginBuild(const FBox3& RootBox, const FBuildParams& Params)
+{
+	Reset();
+
+	if (!RootBox.bValid)
+	{
+		return;
+	}
+
+	FBuildState& State = BuildState;
+	State.Params = Params;
+	State.RootBounds = RootBox;
+	State.MaxDepth = std::min(Params.MaxDepth, MaxDepthLimit);
+
+	// A uniform tree has 2^(depth + 1) - 1 nodes, don't reserve more than a sane amount upfront
+	const int32_t ReserveDepth = std::clamp(State.MaxDepth, 0, 20);
+	const int32_t ReserveLeaves = Params.MaxLeafCount > 0 ? std::min(Params.MaxLeafCount, 1 << ReserveDepth) : 1 << ReserveDepth;
+	State.Nodes.reserve(2 * ReserveLeaves - 1);
+	State.Nodes.emplace_back();
+	State.Level.push_back({0, RootBox});
+	State.NumLeaves = 1;
+	bBuilding = true;
+}
+
+bool FPartition::StepBuild(int32_t MaxNodes)
+{
+	if (!bBuilding)
+	{
+		return true;
+	}
+
+	// Built level by level, so the leaf budget is spread evenly over the whole world
+	FBuildState& State = BuildState;
+	const FBuildParams& Params = State.Params;
+	if (State.Depth < State.MaxDepth && !State.Level.empty())
+	{
+		// Nodes are split in level order whatever the step size, so every step size gives the same tree
+		const size_t First = State.NextNode;
+		const size_t Num = std::min(State.Level.size() - First, static_cast<size_t>(std::max(MaxNodes, 1)));
+		State.ShouldSplit.resize(Num);
+		const FParallelFor ParallelForFunction = Params.CanSplit ? Params.ParallelFor : FParallelFor();
+		RunParallel(ParallelForFunction, static_cast<int32_t>(Num), [&](int32_t Index)
+		{
+			const FBox3& BoundingBox = State.Level[First + Index].Bounds;
+			State.ShouldSplit[Index] = 0.5 * BoundingBox.GetVolume() >= Params.MinLeafVolume
+				&& (!Params.CanSplit || Params.CanSplit(BoundingBox));
+		});
+
+		for (size_t Index = 0; Index < Num; ++Index)
+		{
+			if (!State.ShouldSplit[Index] || (Params.MaxLeafCount > 0 && State.NumLeaves >= Params.MaxLeafCount))
+			{
+				continue;
+			}
+
+			PartitionSpace(State.Level[First + Index], State.Nodes, State.NextLevel);
+			++State.NumLeaves;
+		}
+
+		State.NextNode += Num;
+		if (State.NextNode == State.Level.size())
+		{
+			std::swap(State.Level, State.NextLevel);
+			State.NextLevel.clear();
+			State.NextNode = 0;
+			++State.Depth;
+		}
+		return false;
+	}
+
+	RootBounds = State.RootBounds;
+	Nodes = std::move(State.Nodes);
+	LeafBounds.Reset(State.NumLeaves);
+	BuildState = FBuildState();
+	bBuilding = false;
+
+	AssignLeaves();
+	return true;
+}
+
+void FPartition::Reset()
+{
+	RootBounds = FBox3();
+	Nodes.clear();
+	LeafBounds.Reset();
+	BuildState = FBuildState();
+	bBuilding = false;
+}
+
+bool FPartition::Assign(const FBox3& RootBox, std::vector<FNode>&& InNodes, FLeafBounds&& InLeafBounds)
+{
+	Reset();
+
+	const size_t NumLeaves = InLeafBounds.MinX.size();
+	for (const std::vector<float>* Column : {&InLeafBounds.MinY, &InLeafBounds.MinZ, &InLeafBounds.MaxX, &InLeafBounds.MaxY, &InLeafBounds.MaxZ})
+	{
+		if (Column->size() != NumLeaves)
+		{
+			return false;
+		}
+	}
+
+	// Queries trust the indices and a bounded depth, children always come after their parent.
+	// Every node but the root has exactly one parent, so no node is orphaned and depths can't be reset
+	std::vector<uint8_t> Depths(InNodes.size(), 0);
+	std::vector<uint8_t> Reached(InNodes.size(), 0);
+	for (size_t NodeIndex = 0; NodeIndex < InNodes.size(); ++NodeIndex)
+	{
+		if (NodeIndex > 0 && !Reached[NodeIndex])
+		{
+			return false;
+		}
+
+		const FNode& Node = InNodes[NodeIndex];
+		if (Node.IsLeaf())
+		{
+			if (Node.LeafIndex >= NumLeaves)
+			{
+				return false;
+			}
+			continue;
+		}
+
+		if (Node.SplitAxis >= 3 || Node.FirstChild <= NodeIndex || static_cast<size_t>(Node.FirstChild) + 1 >= InNodes.size()
+			|| Depths[NodeIndex] >= MaxDepthLimit || Reached[Node.GetLeftChild()] || Reached[Node.GetRightChild()])
+		{
+			return false;
+		}
+
+		Reached[Node.GetLeftChild()] = Reached[Node.GetRightChild()] = 1;
+		Depths[Node.GetLeftChild()] = Depths[Node.GetRightChild()] = Depths[NodeIndex] + 1;
+	}
+
+	if (InNodes.empty() != (NumLeaves == 0) || (!InNodes.empty() && !RootBox.bValid))
+	{
+		return false;
+	}
+
+	RootBounds = RootBox;
+	Nodes = std::move(InNodes);
+	LeafBounds = std::move(InLeafBounds);
+	return true;
+}
+
+void FPartition::MergeLeaves(const std::vector<uint32_t>& LeafKeys, std::vector<int32_t>& OutLeafRemap)
+{
+	OutLeafRemap.clear();
+	if (Nodes.empty() || LeafKeys.size() != static_cast<size_t>(LeafBounds.Num()))
+	{
+		return;
+	}
+
+	// Children come after their parent, walking backwards settles both children first
+	constexpr uint64_t MixedKeys = ~0ull;
+	std::vector<uint64_t> NodeKeys(Nodes.size(), MixedKeys);
+	for (size_t NodeIndex = Nodes.size(); NodeIndex-- > 0;)
+	{
+		const FNode& Node = Nodes[NodeIndex];
+		if (Node.IsLeaf())
+		{
+			NodeKeys[NodeIndex] = LeafKeys[Node.LeafIndex];
+		}
+		else if (NodeKeys[Node.GetLeftChild()] == NodeKeys[Node.GetRightChild()])
+		{
+			NodeKeys[NodeIndex] = NodeKeys[Node.GetLeftChild()];
+		}
+	}
+
+	// Rebuilt breadth first from the root, nodes with a single key below them stay leaves
+	std::vector<FNode> MergedNodes(1);
+	std::vector<uint32_t> SourceNodes = {0};
+	MergedNodes.reserve(Nodes.size());
+	SourceNodes.reserve(Nodes.size());
+	for (size_t NodeIndex = 0; NodeIndex < MergedNodes.size(); ++NodeIndex)
+	{
+		const FNode& Source = Nodes[SourceNodes[NodeIndex]];
+		if (NodeKeys[SourceNodes[NodeIndex]] != MixedKeys)
+		{
+			continue;
+		}
+
+		MergedNodes[NodeIndex].SplitAxis = Source.SplitAxis;
+		MergedNodes[NodeIndex].SplitPosition = Source.SplitPosition;
+		MergedNodes[NodeIndex].FirstChild = static_cast<uint32_t>(MergedNodes.size());
+		MergedNodes.resize(MergedNodes.size() + 2);
+		SourceNodes.push_back(Source.GetLeftChild());
+		SourceNodes.push_back(Source.GetRightChild());
+	}
+
+	const FLeafBounds PreviousLeafBounds = std::move(LeafBounds);
+	Nodes = std::move(MergedNodes);
+	Nodes.shrink_to_fit();
+	LeafBounds.Reset();
+	AssignLeaves();
+
+	// Every previous leaf lies inside exactly one merged leaf, its center is never on a split plane
+	OutLeafRemap.resize(PreviousLeafBounds.Num());
+	for (int32_t LeafIndex = 0; LeafIndex < PreviousLeafBounds.Num(); ++LeafIndex)
+	{
+		OutLeafRemap[LeafIndex] = FindLeaf(PreviousLeafBounds.GetCenter(LeafIndex));
+	}
+}
+
+void FPartition::CutAtDepth(int32_t Depth, std::vector<FBox3>& OutRegionBounds, std::vector<int32_t>& OutLeafRegions) const
+{
+	OutRegionBounds.clear();
+	OutLeafRegions.assign(LeafBounds.Num(), -1);
+	if (Nodes.empty())
+	{
+		return;
+	}
+
+	struct FCutEntry
+	{
+		uint32_t NodeIndex;
+		int32_t Depth;
+		int32_t Region;
+		FBox3 Bounds;
+	};
+
+	// The region is opened at the cut and handed down to every leaf below it
+	std::vector<FCutEntry> Stack = {{0, 0, -1, RootBounds}};
+	while (!Stack.empty())
+	{
+		FCutEntry Entry = Stack.back();
+		Stack.pop_back();
+
+		const FNode& Node = Nodes[Entry.NodeIndex];
+		if (Entry.Region < 0 && (Entry.Depth >= Depth || Node.IsLeaf()))
+		{
+			Entry.Region = static_cast<int32_t>(OutRegionBounds.size());
+			OutRegionBounds.push_back(Entry.Bounds);
+		}
+
+		if (Node.IsLeaf())
+		{
+			OutLeafRegions[Node.LeafIndex] = Entry.Region;
+			continue;
+		}
+
+		FCutEntry Left = {Node.GetLeftChild(), Entry.Depth + 1, Entry.Region, Entry.Bounds};
+		FCutEntry Right = {Node.GetRightChild(), Entry.Depth + 1, Entry.Region, Entry.Bounds};
+		Left.Bounds.Max[Node.SplitAxis] = Node.SplitPosition;
+		Right.Bounds.Min[Node.SplitAxis] = Node.SplitPosition;
+		Stack.push_back(Right);
+		Stack.push_back(Left);
+	}
+}
+
+void FPartition::PartitionSpace(const FPendingNode& Node, std::vector<FNode>& InOutNodes, std::vector<FPendingNode>& OutChildren)
+{
+	const FBox3& BoundingBox = Node.Bounds;
+	const FVec3 Center = BoundingBox.GetCenter();
+	const uint8_t Axis = BoundingBox.GetLongestAxis();
+
+	// Split based on the Axis
+	FVec3 LeftMax = BoundingBox.Max;
+	FVec3 RightMin = BoundingBox.Min;
+	LeftMax[Axis] = Center[Axis];
+	RightMin[Axis] = Center[Axis];
+
+	// Children are added as a pair, the nodes may reallocate so only indices are kept
+	const uint32_t FirstChild = static_cast<uint32_t>(InOutNodes.size());
+	InOutNodes.resize(InOutNodes.size() + 2);
+	InOutNodes[Node.NodeIndex].SplitAxis = Axis;
+	InOutNodes[Node.NodeIndex].SplitPosition = static_cast<float>(Center[Axis]);
+	InOutNodes[Node.NodeIndex].FirstChild = FirstChild;
+
+	OutChildren.push_back({FirstChild, FBox3(BoundingBox.Min, LeftMax)});
+	OutChildren.push_back({FirstChild + 1, FBox3(RightMin, BoundingBox.Max)});
+}
+
+void FPartition::AssignLeaves()
+{
+	// Depth first, so leaves that are close in space are close in the leaf tables
+	std::vector<FPendingNode> Stack = {{0, RootBounds}};
+	while (!Stack.empty())
+	{
+		const FPendingNode Entry = Stack.back();
+		Stack.pop_back();
+
+		FNode& Node = Nodes[Entry.NodeIndex];
+		if (Node.IsLeaf())
+		{
+			Node.LeafIndex = static_cast<uint32_t>(LeafBounds.Add(Entry.Bounds));
+			continue;
+		}
+
+		FBox3 LeftBounds = Entry.Bounds;
+		FBox3 RightBounds = Entry.Bounds;
+		LeftBounds.Max[Node.SplitAxis] = Node.SplitPosition;
+		RightBounds.Min[Node.SplitAxis] = Node.SplitPosition;
+		Stack.push_back({Node.GetRightChild(), RightBounds});
+		Stack.push_back({Node.GetLeftChild(), LeftBounds});
+	}
+}
+
+int32_t FPartition::FindLeaf(const FVec3& Position) const
+{
+	if (Nodes.empty() || !RootBounds.IsInsideOrOn(Position))
+	{
+		return -1;
+	}
+
+	const FNode* Node = &Nodes[0];
+	while (!Node->IsLeaf())
+	{
+		Node = &Nodes[Position[Node->SplitAxis] < Node->SplitPosition ? Node->GetLeftChild() : Node->GetRightChild()];
+	}
+
+	return static_cast<int32_t>(Node->LeafIndex);
+}
+
+int32_t FPartition::FindNearestLeaves(const FVec3& Position, int32_t Count, FLeafHit* OutHits, int32_t& OutNumHits, const uint8_t* SkipLeaves) const
+{
+	OutNumHits = 0;
+	if (Nodes.empty() || Count <= 0)
+	{
+		return 0;
+	}
+
+	int32_t NodesVisited = 0;
+
+	FStackEntry Stack[StackSize];
+	int32_t StackNum = 0;
+	Stack[StackNum++] = {0, 1, RootBounds};
+	while (StackNum > 0)
+	{
+		const FStackEntry Entry = Stack[--StackNum];
+		++NodesVisited;
+
+		const float Distance = static_cast<float>(std::sqrt(Entry.Bounds.ComputeSquaredDistanceToPoint(Position)));
+		if (OutNumHits == Count && Distance >= OutHits[OutNumHits - 1].Distance)
+		{
+			continue;
+		}
+
+		const FNode& Node = Nodes[Entry.NodeIndex];
+		if (!Node.IsLeaf())
+		{
+			PushChildren(Stack, StackNum, Entry, &Position);
+			continue;
+		}
+
+		if (SkipLeaves && SkipLeaves[Node.LeafIndex])
+		{
+			continue;
+		}
+
+		// Count is expected to be small, keep the results sorted with an insertion
+		if (OutNumHits < Count)
+		{
+			++OutNumHits;
+		}
+
+		int32_t InsertIndex = OutNumHits - 1;
+		while (InsertIndex > 0 && OutHits[InsertIndex - 1].Distance > Distance)
+		{
+			OutHits[InsertIndex] = OutHits[InsertIndex - 1];
+			--InsertIndex;
+		}
+		OutHits[InsertIndex] = {static_cast<int32_t>(Node.LeafIndex), Distance};
+	}
+
+	return NodesVisited;
+}
+
+void FPartition::SortQueriesByPosition(const FSphereQuery* Queries, int32_t NumQueries, std::vector<int32_t>& OutOrder) const
+{
+	// 10 bits per axis, interleaved
+	const auto SpreadBits = [](uint32_t Value)
+	{
+		Value = (Value | (Value << 16)) & 0x030000FFu;
+		Value = (Value | (Value << 8)) & 0x0300F00Fu;
+		Value = (Value | (Value << 4)) & 0x030C30C3u;
+		Value = (Value | (Value << 2)) & 0x09249249u;
+		return Value;
+	};
+
+	const FVec3 Size = RootBounds.Max - RootBounds.Min;
+	std::vector<std::pair<uint32_t, int32_t>> Codes(NumQueries);
+	for (int32_t QueryIndex = 0; QueryIndex < NumQueries; ++QueryIndex)
+	{
+		uint32_t Code = 0;
+		for (int32_t Axis = 0; Axis < 3; ++Axis)
+		{
+			const double Normalized = Size[Axis] > 0.0 ? (Queries[QueryIndex].Center[Axis] - RootBounds.Min[Axis]) / Size[Axis] : 0.0;
+			Code |= SpreadBits(static_cast<uint32_t>(std::clamp(Normalized, 0.0, 1.0) * 1023.0)) << Axis;
+		}
+		Codes[QueryIndex] = {Code, QueryIndex};
+	}
+
+	std::sort(Codes.begin(), Codes.end());
+
+	OutOrder.resize(NumQueries);
+	for (int32_t Index = 0; Index < NumQueries; ++Index)
+	{
+		OutOrder[Index] = Codes[Index].second;
+	}
+}
+
+size_t FPartition::GetAllocatedSize() const
+{
+	return Nodes.capacity() * sizeof(FNode) + LeafBounds.GetAllocatedSize();
+}
+}
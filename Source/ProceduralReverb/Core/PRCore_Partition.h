@@ -0,0 +1,496 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "PRCore_Types.h"
+
+#include <limits>
+#include <vector>
+
+
+namespace PRCore
+{
+/**
+ * Node of the flat partition tree, see FPartition.
+ * Children of an interior node are stored next to each other, so only the first one is referenced.
+ */
+struct FNode
+{
+	static constexpr uint32_t InvalidIndex = 0xFFFFFFFFu;
+	static constexpr uint8_t LeafAxis = 3;
+
+	bool IsLeaf() const { return SplitAxis == LeafAxis; }
+	uint32_t GetLeftChild() const { return FirstChild; }
+	uint32_t GetRightChild() const { return FirstChild + 1; }
+
+	float SplitPosition = 0.0f;
+	uint32_t FirstChild = InvalidIndex;
+	uint32_t LeafIndex = InvalidIndex;
+	uint8_t SplitAxis = LeafAxis;
+};
+
+
+/**
+ * Leaf bounds kept as structure of arrays, so distance tests over many leaves stay in cache.
+ */
+struct FLeafBounds
+{
+	void Reset(size_t ExpectedNum = 0);
+	int32_t Add(const FBox3& Box);
+	int32_t Num() const { return static_cast<int32_t>(MinX.size()); }
+
+	FBox3 GetBox(int32_t LeafIndex) const;
+	FVec3 GetCenter(int32_t LeafIndex) const;
+	float DistanceTo(int32_t LeafIndex, const FVec3& Point) const;
+
+	size_t GetAllocatedSize() const;
+
+	std::vector<float> MinX;
+	std::vector<float> MinY;
+	std::vector<float> MinZ;
+	std::vector<float> MaxX;
+	std::vector<float> MaxY;
+	std::vector<float> MaxZ;
+};
+
+
+struct FBuildParams
+{
+	int32_t MaxDepth = 10;
+	/** Leaves are never split below this volume */
+	double MinLeafVolume = 0.0;
+	/** 0 means no budget */
+	int32_t MaxLeafCount = 0;
+	/** Optional, regions it rejects are kept as leaves. Runs through ParallelFor when that is set */
+	std::function<bool(const FBox3& Region)> CanSplit;
+	FParallelFor ParallelFor;
+};
+
+
+struct FLeafHit
+{
+	int32_t LeafIndex = -1;
+	float Distance = 0.0f;
+};
+
+
+struct FSphereQuery
+{
+	FVec3 Center;
+	float Radius = 0.0f;
+};
+
+
+/**
+ * Binary space partition stored in one contiguous node array, split at the middle of the longest axis.
+ * Built level by level so a leaf budget is spread evenly, leaves are numbered depth first so leaves
+ * that are close in space are close in the leaf tables. Queries return the number of nodes they visited.
+ */
+class FPartition
+{
+public:
+	static constexpr int32_t MaxDepthLimit = 100;
+	static constexpr int32_t MaxBatchedQueries = 32;
+
+	void Build(const FBox3& RootBox, const FBuildParams& Params);
+	/**
+	 * Same build spread over several calls, every StepBuild decides up to MaxNodes pending nodes of the current level.
+	 * The partition stays empty until StepBuild returned true, which it also does when no build is in progress.
+	 */
+	void BeginBuild(const FBox3& RootBox, const FBuildParams& Params);
+	bool StepBuild(int32_t MaxNodes);
+	bool IsBuilding() const { return bBuilding; }
+	void Reset();
+
+	/** Takes over previously built nodes and leaf bounds, e.g. loaded from disk. Rejects inconsistent data and stays empty */
+	bool Assign(const FBox3& RootBox, std::vector<FNode>&& InNodes, FLeafBounds&& InLeafBounds);
+
+	/**
+	 * Collapses every subtree whose leaves all have the same key into one leaf, LeafKeys holds one key per leaf.
+	 * Leaves are renumbered, OutLeafRemap receives the new index of every previous leaf.
+	 */
+	void MergeLeaves(const std::vector<uint32_t>& LeafKeys, std::vector<int32_t>& OutLeafRemap);
+
+	/**
+	 * Cuts the tree at Depth into coarse regions, the nodes at that depth and the shallower leaves.
+	 * OutRegionBounds receives their bounds, OutLeafRegions the region every leaf lies in.
+	 */
+	void CutAtDepth(int32_t Depth, std::vector<FBox3>& OutRegionBounds, std::vector<int32_t>& OutLeafRegions) const;
+
+	bool IsEmpty() const { return Nodes.empty(); }
+	int32_t GetNumNodes() const { return static_cast<int32_t>(Nodes.size()); }
+	int32_t GetNumLeaves() const { return LeafBounds.Num(); }
+	const FBox3& GetRootBounds() const { return RootBounds; }
+	const std::vector<FNode>& GetNodes() const { return Nodes; }
+	const FLeafBounds& GetLeafBounds() const { return LeafBounds; }
+
+	/** Descends along the split planes, returns -1 when the position is outside of the partition */
+	int32_t FindLeaf(const FVec3& Position) const;
+
+	/** Calls Visitor(LeafIndex, Distance) for every leaf closer than SearchRadius */
+	template <typename VisitorType>
+	int32_t FindNearbyLeaves(const FVec3& Position, float SearchRadius, VisitorType&& Visitor) const;
+
+	/**
+	 * Answers many nearby queries with one traversal, every node carries the mask of queries that still reach it.
+	 * Close queries descend as one sphere around their center until a box only reaches some of them.
+	 * Calls Visitor(QueryIndex, LeafIndex, Distance), queries are processed MaxBatchedQueries at a time,
+	 * grouped by position when there are more of them.
+	 */
+	template <typename VisitorType>
+	int32_t FindNearbyLeaves(const FSphereQuery* Queries, int32_t NumQueries, VisitorType&& Visitor) const;
+
+	/** Calls Visitor(LeafIndex) for every leaf intersecting Box */
+	template <typename VisitorType>
+	int32_t FindLeavesInBox(const FBox3& Box, VisitorType&& Visitor) const;
+
+	/** Writes up to Count closest leaves to OutHits sorted by distance, leaves with a non-zero SkipLeaves entry are passed over */
+	int32_t FindNearestLeaves(const FVec3& Position, int32_t Count, FLeafHit* OutHits, int32_t& OutNumHits, const uint8_t* SkipLeaves = nullptr) const;
+
+	float DistanceToLeaf(int32_t LeafIndex, const FVec3& Point) const { return LeafBounds.DistanceTo(LeafIndex, Point); }
+
+	size_t GetAllocatedSize() const;
+
+private:
+	struct FPendingNode
+	{
+		uint32_t NodeIndex;
+		FBox3 Bounds;
+	};
+
+	/** Level by level state of a build in progress, nodes only move to the partition once it is complete */
+	struct FBuildState
+	{
+		FBuildParams Params;
+		FBox3 RootBounds;
+		std::vector<FNode> Nodes;
+		int32_t MaxDepth = 0;
+		int32_t Depth = 0;
+		int32_t NumLeaves = 0;
+		/** Nodes of the current level before it are decided */
+		size_t NextNode = 0;
+		std::vector<FPendingNode> Level;
+		std::vector<FPendingNode> NextLevel;
+		std::vector<uint8_t> ShouldSplit;
+	};
+
+	struct FStackEntry
+	{
+		uint32_t NodeIndex;
+		uint32_t QueryMask;
+		FBox3 Bounds;
+	};
+
+	// Depth first traversal never holds more than two entries per level
+	static constexpr int32_t StackSize = 2 * MaxDepthLimit + 2;
+	// Pushing only after popping the parent holds at most one pending sibling per level
+	static constexpr int32_t BatchedStackSize = MaxDepthLimit + 2;
+
+	static void PartitionSpace(const FPendingNode& Node, std::vector<FNode>& InOutNodes, std::vector<FPendingNode>& OutChildren);
+	void AssignLeaves();
+	void PushChildren(FStackEntry* Stack, int32_t& StackNum, const FStackEntry& Entry, const FVec3* NearPosition) const;
+	/** Orders queries along a Morton curve over the root bounds */
+	void SortQueriesByPosition(const FSphereQuery* Queries, int32_t NumQueries, std::vector<int32_t>& OutOrder) const;
+
+	FBox3 RootBounds;
+	std::vector<FNode> Nodes;
+	FLeafBounds LeafBounds;
+	FBuildState BuildState;
+	bool bBuilding = false;
+};
+
+
+inline void FPartition::PushChildren(FStackEntry* Stack, int32_t& StackNum, const FStackEntry& Entry, const FVec3* NearPosition) const
+{
+	const FNode& Node = Nodes[Entry.NodeIndex];
+	FStackEntry Left = {Node.GetLeftChild(), Entry.QueryMask, Entry.Bounds};
+	FStackEntry Right = {Node.GetRightChild(), Entry.QueryMask, Entry.Bounds};
+	Left.Bounds.Max[Node.SplitAxis] = Node.SplitPosition;
+	Right.Bounds.Min[Node.SplitAxis] = Node.SplitPosition;
+
+	// Far child goes first, so the one containing the position is popped next
+	const bool bRightIsNear = NearPosition && (*NearPosition)[Node.SplitAxis] >= Node.SplitPosition;
+	Stack[StackNum++] = bRightIsNear ? Left : Right;
+	Stack[StackNum++] = bRightIsNear ? Right : Left;
+}
+
+template <typename VisitorType>
+int32_t FPartition::FindNearbyLeaves(const FVec3& Position, float SearchRadius, VisitorType&& Visitor) const
+{
+	if (Nodes.empty())
+	{
+		return 0;
+	}
+
+	const double SearchRadiusSquared = static_cast<double>(SearchRadius) * SearchRadius;
+	int32_t NodesVisited = 0;
+
+	FStackEntry Stack[StackSize];
+	int32_t StackNum = 0;
+	Stack[StackNum++] = {0, 1, RootBounds};
+	while (StackNum > 0)
+	{
+		const FStackEntry Entry = Stack[--StackNum];
+		++NodesVisited;
+
+		const double DistanceSquared = Entry.Bounds.ComputeSquaredDistanceToPoint(Position);
+		if (DistanceSquared > SearchRadiusSquared)
+		{
+			continue;
+		}
+
+		const FNode& Node = Nodes[Entry.NodeIndex];
+		if (Node.IsLeaf())
+		{
+			Visitor(static_cast<int32_t>(Node.LeafIndex), static_cast<float>(std::sqrt(DistanceSquared)));
+			continue;
+		}
+
+		PushChildren(Stack, StackNum, Entry, &Position);
+	}
+
+	return NodesVisited;
+}
+
+template <typename VisitorType>
+int32_t FPartition::FindLeavesInBox(const FBox3& Box, VisitorType&& Visitor) const
+{
+	if (Nodes.empty())
+	{
+		return 0;
+	}
+
+	int32_t NodesVisited = 0;
+	FStackEntry Stack[StackSize];
+	int32_t StackNum = 0;
+	Stack[StackNum++] = {0, 1, RootBounds};
+	while (StackNum > 0)
+	{
+		const FStackEntry Entry = Stack[--StackNum];
+		++NodesVisited;
+
+		if (!Entry.Bounds.Intersects(Box))
+		{
+			continue;
+		}
+
+		const FNode& Node = Nodes[Entry.NodeIndex];
+		if (Node.IsLeaf())
+		{
+			Visitor(static_cast<int32_t>(Node.LeafIndex));
+			continue;
+		}
+
+		PushChildren(Stack, StackNum, Entry, nullptr);
+	}
+
+	return NodesVisited;
+}
+
+template <typename VisitorType>
+int32_t FPartition::FindNearbyLeaves(const FSphereQuery* Queries, int32_t NumQueries, VisitorType&& Visitor) const
+{
+	if (Nodes.empty() || NumQueries <= 0)
+	{
+		return 0;
+	}
+
+	// Batches of nearby queries share most of their traversal, more than one batch is regrouped by position
+	std::vector<int32_t> QueryOrder;
+	if (NumQueries > MaxBatchedQueries)
+	{
+		SortQueriesByPosition(Queries, NumQueries, QueryOrder);
+	}
+
+	int32_t NodesVisited = 0;
+	FStackEntry Stack[BatchedStackSize];
+	// Squared distance of every query of the batch to the box of the stack entry in the same row
+	double StackDistancesSquared[BatchedStackSize][MaxBatchedQueries];
+	// Squared distance of the batch center to the box, rows of shared entries only carry this one
+	double StackCenterDistancesSquared[BatchedStackSize];
+	bool StackShared[BatchedStackSize];
+	for (int32_t FirstQuery = 0; FirstQuery < NumQueries; FirstQuery += MaxBatchedQueries)
+	{
+		const int32_t BatchNum = std::min(MaxBatchedQueries, NumQueries - FirstQuery);
+
+		// Structure of arrays, so every split is applied to the whole batch in one pass
+		int32_t QueryIndices[MaxBatchedQueries];
+		double Centers[3][MaxBatchedQueries];
+		double SearchRadiiSquared[MaxBatchedQueries];
+		FVec3 BatchCenter;
+		for (int32_t BatchIndex = 0; BatchIndex < BatchNum; ++BatchIndex)
+		{
+			QueryIndices[BatchIndex] = QueryOrder.empty() ? FirstQuery + BatchIndex : QueryOrder[FirstQuery + BatchIndex];
+			const FSphereQuery& Query = Queries[QueryIndices[BatchIndex]];
+			for (int32_t Axis = 0; Axis < 3; ++Axis)
+			{
+				Centers[Axis][BatchIndex] = Query.Center[Axis];
+			}
+			SearchRadiiSquared[BatchIndex] = static_cast<double>(Query.Radius) * Query.Radius;
+			BatchCenter = BatchCenter + Query.Center * (1.0 / BatchNum);
+		}
+
+		// Every box reaching the inner sphere around the batch center reaches all queries, none reaches past the outer one
+		double InnerRadius = std::numeric_limits<double>::max();
+		double OuterRadius = 0.0;
+		for (int32_t BatchIndex = 0; BatchIndex < BatchNum; ++BatchIndex)
+		{
+			const FVec3 Offset = Queries[QueryIndices[BatchIndex]].Center - BatchCenter;
+			const double OffsetLength = std::sqrt(Offset.X * Offset.X + Offset.Y * Offset.Y + Offset.Z * Offset.Z);
+			InnerRadius = std::min(InnerRadius, Queries[QueryIndices[BatchIndex]].Radius - OffsetLength);
+			OuterRadius = std::max(OuterRadius, Queries[QueryIndices[BatchIndex]].Radius + OffsetLength);
+		}
+		const double InnerRadiusSquared = InnerRadius > 0.0 ? InnerRadius * InnerRadius : -1.0;
+		const double OuterRadiusSquared = OuterRadius * OuterRadius;
+		const uint32_t BatchMask = BatchNum == 32 ? ~0u : (1u << BatchNum) - 1;
+
+		// Fills the row with every query's distance to Bounds, returns the mask of queries in range
+		const auto ComputeDistances = [&](const FBox3& Bounds, double* OutDistancesSquared)
+		{
+			uint32_t Mask = 0;
+			for (int32_t BatchIndex = 0; BatchIndex < BatchNum; ++BatchIndex)
+			{
+				OutDistancesSquared[BatchIndex] = Bounds.ComputeSquaredDistanceToPoint(Queries[QueryIndices[BatchIndex]].Center);
+				Mask |= static_cast<uint32_t>(OutDistancesSquared[BatchIndex] <= SearchRadiiSquared[BatchIndex]) << BatchIndex;
+			}
+			return Mask;
+		};
+
+		++NodesVisited;
+		const double RootCenterDistanceSquared = RootBounds.ComputeSquaredDistanceToPoint(BatchCenter);
+		if (RootCenterDistanceSquared > OuterRadiusSquared)
+		{
+			continue;
+		}
+
+		int32_t StackNum = 0;
+		if (RootCenterDistanceSquared <= InnerRadiusSquared)
+		{
+			Stack[StackNum] = {0, BatchMask, RootBounds};
+			StackCenterDistancesSquared[StackNum] = RootCenterDistanceSquared;
+			StackShared[StackNum++] = true;
+		}
+		else if (const uint32_t RootMask = ComputeDistances(RootBounds, StackDistancesSquared[0]))
+		{
+			Stack[StackNum] = {0, RootMask, RootBounds};
+			StackShared[StackNum++] = false;
+		}
+
+		while (StackNum > 0)
+		{
+			const FStackEntry Entry = Stack[--StackNum];
+			const double* DistancesSquared = StackDistancesSquared[StackNum];
+			const bool bShared = StackShared[StackNum];
+
+			const FNode& Node = Nodes[Entry.NodeIndex];
+			if (Node.IsLeaf())
+			{
+				// Shared entries are checked once more per query, so rounding never reports a leaf out of range
+				double LeafDistancesSquared[MaxBatchedQueries];
+				uint32_t LeafMask = Entry.QueryMask;
+				if (bShared)
+				{
+					LeafMask &= ComputeDistances(Entry.Bounds, LeafDistancesSquared);
+					DistancesSquared = LeafDistancesSquared;
+				}
+				for (uint32_t Bits = LeafMask; Bits; Bits &= Bits - 1)
+				{
+					const int32_t BatchIndex = CountTrailingZeros(Bits);
+					Visitor(QueryIndices[BatchIndex], static_cast<int32_t>(Node.LeafIndex), static_cast<float>(std::sqrt(DistancesSquared[BatchIndex])));
+				}
+				continue;
+			}
+
+			// Children only differ from their parent along the split axis, so only that axis' term of every distance is replaced
+			const int32_t Axis = Node.SplitAxis;
+			const double Min = Entry.Bounds.Min[Axis];
+			const double Max = Entry.Bounds.Max[Axis];
+			const double Split = Node.SplitPosition;
+			const auto SplitDistances = [Min, Max, Split](double Center, double ParentDistanceSquared, double& OutLeft, double& OutRight)
+			{
+				const double ParentDelta = std::max(std::max(Min - Center, Center - Max), 0.0);
+				const double LeftDelta = std::max(std::max(Min - Center, Center - Split), 0.0);
+				const double RightDelta = std::max(std::max(Split - Center, Center - Max), 0.0);
+				const double OtherAxes = ParentDistanceSquared - ParentDelta * ParentDelta;
+				OutLeft = OtherAxes + LeftDelta * LeftDelta;
+				OutRight = OtherAxes + RightDelta * RightDelta;
+			};
+
+			NodesVisited += 2;
+			FBox3 ChildBounds[2] = {Entry.Bounds, Entry.Bounds};
+			ChildBounds[0].Min[Axis] = Split;
+			ChildBounds[1].Max[Axis] = Split;
+			const uint32_t ChildNodes[2] = {Node.GetRightChild(), Node.GetLeftChild()};
+
+			// The whole batch descends as one query while the children reach all of it or none of it
+			if (bShared)
+			{
+				double CenterDistancesSquared[2];
+				SplitDistances(BatchCenter[Axis], StackCenterDistancesSquared[StackNum], CenterDistancesSquared[1], CenterDistancesSquared[0]);
+				for (int32_t Child = 0; Child < 2; ++Child)
+				{
+					if (CenterDistancesSquared[Child] > OuterRadiusSquared)
+					{
+						continue;
+					}
+					if (CenterDistancesSquared[Child] <= InnerRadiusSquared)
+					{
+						Stack[StackNum] = {ChildNodes[Child], Entry.QueryMask, ChildBounds[Child]};
+						StackCenterDistancesSquared[StackNum] = CenterDistancesSquared[Child];
+						StackShared[StackNum++] = true;
+					}
+					else if (const uint32_t ChildMask = ComputeDistances(ChildBounds[Child], StackDistancesSquared[StackNum]))
+					{
+						Stack[StackNum] = {ChildNodes[Child], ChildMask, ChildBounds[Child]};
+						StackShared[StackNum++] = false;
+					}
+				}
+				continue;
+			}
+
+			// Both children are written straight into the next two rows, the left one is popped first
+			double* RightDistancesSquared = StackDistancesSquared[StackNum];
+			double* LeftDistancesSquared = StackDistancesSquared[StackNum + 1];
+			uint32_t LeftMask = 0;
+			uint32_t RightMask = 0;
+			for (int32_t BatchIndex = 0; BatchIndex < BatchNum; ++BatchIndex)
+			{
+				SplitDistances(Centers[Axis][BatchIndex], DistancesSquared[BatchIndex], LeftDistancesSquared[BatchIndex], RightDistancesSquared[BatchIndex]);
+				LeftMask |= static_cast<uint32_t>(LeftDistancesSquared[BatchIndex] <= SearchRadiiSquared[BatchIndex]) << BatchIndex;
+				RightMask |= static_cast<uint32_t>(RightDistancesSquared[BatchIndex] <= SearchRadiiSquared[BatchIndex]) << BatchIndex;
+			}
+			RightMask &= Entry.QueryMask;
+			LeftMask &= Entry.QueryMask;
+
+			const uint32_t ChildMasks[2] = {RightMask, LeftMask};
+			const double* ChildDistancesSquared[2] = {RightDistancesSquared, LeftDistancesSquared};
+			const int32_t RightRow = StackNum;
+			for (int32_t Child = 0; Child < 2; ++Child)
+			{
+				if (!ChildMasks[Child])
+				{
+					continue;
+				}
+				const FNode& ChildNode = Nodes[ChildNodes[Child]];
+				if (ChildNode.IsLeaf())
+				{
+					for (uint32_t Bits = ChildMasks[Child]; Bits; Bits &= Bits - 1)
+					{
+						const int32_t BatchIndex = CountTrailingZeros(Bits);
+						Visitor(QueryIndices[BatchIndex], static_cast<int32_t>(ChildNode.LeafIndex), static_cast<float>(std::sqrt(ChildDistancesSquared[Child][BatchIndex])));
+					}
+					continue;
+				}
+				if (StackNum != RightRow + Child)
+				{
+					std::copy(ChildDistancesSquared[Child], ChildDistancesSquared[Child] + BatchNum, StackDistancesSquared[StackNum]);
+				}
+				Stack[StackNum] = {ChildNodes[Child], ChildMasks[Child], ChildBounds[Child]};
+				StackShared[StackNum++] = false;
+			}
+		}
+	}
+
+	return NodesVisited;
+}
+}
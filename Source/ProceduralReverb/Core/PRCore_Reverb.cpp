@@ -0,0 +1,144 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PRCore_Reverb.h"
+
+
+namespace PRCore
+{
+FReverbParams MapModelOutput(const float* Outputs)
+{
+	FReverbParams Params;
+	Params.DecayTime = std::clamp(Outputs[0], 0.0f, MaxDecayTime);
+	Params.Gain = std::clamp(Outputs[1], 0.0f, 1.0f);
+	Params.Density = std::clamp(Outputs[2], 0.0f, 1.0f);
+	Params.WetLevel = std::clamp(Outputs[3], 0.0f, 1.0f);
+	return Params;
+}
+
+
+void FReverbPalette::Reset(float InTolerance)
+{
+	// Codes of 16 bits per parameter
+	Tolerance = std::clamp(InTolerance, 1.0f / 65535.0f, 1.0f);
+	Entries.clear();
+	EntryLookup.clear();
+}
+
+int32_t FReverbPalette::Add(const FReverbParams& Params)
+{
+	FReverbParams StepParams;
+	const uint64_t Key = Quantize(Params, StepParams);
+	const auto Found = EntryLookup.find(Key);
+	if (Found != EntryLookup.end())
+	{
+		return Found->second;
+	}
+
+	if (Num() >= MaxEntries)
+	{
+		return -1;
+	}
+
+	Entries.push_back(StepParams);
+	EntryLookup.emplace(Key, Num() - 1);
+	return Num() - 1;
+}
+
+void FReverbPalette::Coarsen(std::vector<int32_t>& OutEntryRemap)
+{
+	std::vector<FReverbParams> PreviousEntries = std::move(Entries);
+	Reset(2.0f * Tolerance);
+
+	// Fewer entries than before, adding can't fail
+	OutEntryRemap.resize(PreviousEntries.size());
+	for (size_t Index = 0; Index < PreviousEntries.size(); ++Index)
+	{
+		OutEntryRemap[Index] = Add(PreviousEntries[Index]);
+	}
+}
+
+bool FReverbPalette::Assign(float InTolerance, std::vector<FReverbParams>&& InEntries)
+{
+	Reset(InTolerance);
+	if (InEntries.size() > static_cast<size_t>(MaxEntries))
+	{
+		return false;
+	}
+
+	for (const FReverbParams& Entry : InEntries)
+	{
+		// Entries are step values, quantizing them again must neither move them nor merge two of them
+		FReverbParams StepParams;
+		Quantize(Entry, StepParams);
+		const bool bOnStep = StepParams.DecayTime == Entry.DecayTime && StepParams.Gain == Entry.Gain
+			&& StepParams.Density == Entry.Density && StepParams.WetLevel == Entry.WetLevel;
+		if (!bOnStep || Add(Entry) != Num() - 1)
+		{
+			Reset(InTolerance);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+size_t FReverbPalette::GetAllocatedSize() const
+{
+	// Buckets and one node per entry, an estimate of the map's allocations
+	return Entries.capacity() * sizeof(FReverbParams)
+		+ EntryLookup.bucket_count() * sizeof(void*)
+		+ EntryLookup.size() * (sizeof(std::pair<const uint64_t, int32_t>) + sizeof(void*));
+}
+
+uint64_t FReverbPalette::Quantize(const FReverbParams& Params, FReverbParams& OutStepParams) const
+{
+	const float Ranges[NumModelOutputs] = {MaxDecayTime, 1.0f, 1.0f, 1.0f};
+	const float Values[NumModelOutputs] = {Params.DecayTime, Params.Gain, Params.Density, Params.WetLevel};
+	float* StepValues[NumModelOutputs] = {&OutStepParams.DecayTime, &OutStepParams.Gain, &OutStepParams.Density, &OutStepParams.WetLevel};
+
+	uint64_t Key = 0;
+	for (int32_t Parameter = 0; Parameter < NumModelOutputs; ++Parameter)
+	{
+		const float Normalized = std::clamp(Values[Parameter] / Ranges[Parameter], 0.0f, 1.0f);
+		const uint64_t Code = static_cast<uint64_t>(std::lround(Normalized / Tolerance));
+		*StepValues[Parameter] = std::min(Code * Tolerance, 1.0f) * Ranges[Parameter];
+		Key |= Code << (16 * Parameter);
+	}
+
+	return Key;
+}
+
+
+bool FNeighbourBlend::Add(int32_t LeafIndex, float Distance, float DecayTime)
+{
+	if (SearchRadius <= 0.0f || Distance > SearchRadius)
+	{
+		return false;
+	}
+
+	const float Weight = 1.0f - Distance / SearchRadius;
+	Sum += Weight;
+	WeightedDecayTime += DecayTime * Weight;
+
+	if (Weight > MaxWeight)
+	{
+		MaxWeight = Weight;
+		MaxWeightLeaf = LeafIndex;
+	}
+
+	return true;
+}
+
+bool FNeighbourBlend::Resolve(float& OutDecayTime, int32_t& OutDominantLeaf) const
+{
+	if (Sum <= 0.0f || MaxWeightLeaf < 0)
+	{
+		return false;
+	}
+
+	OutDecayTime = WeightedDecayTime / Sum;
+	OutDominantLeaf = MaxWeightLeaf;
+	return true;
+}
+}
@@ -0,0 +1,91 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "PRCore_Types.h"
+
+#include <unordered_map>
+#include <vector>
+
+
+namespace PRCore
+{
+constexpr int32_t NumModelOutputs = 4;
+
+// Decay is clamped to [0, MaxDecayTime] seconds, the other parameters to [0, 1]
+constexpr float MaxDecayTime = 5.0f;
+
+struct FReverbParams
+{
+	float DecayTime = 0.0f;
+	float Gain = 0.0f;
+	float Density = 0.0f;
+	float WetLevel = 0.0f;
+};
+
+
+/** Clamps raw model outputs to the ranges the reverb effect accepts, Outputs holds NumModelOutputs floats */
+FReverbParams MapModelOutput(const float* Outputs);
+
+
+/**
+ * Shared table of reverb parameters, leaves store an index into it instead of their own copy.
+ * Every parameter is quantized to steps of Tolerance times its range, parameters quantizing to the same steps
+ * share an entry holding the step values. Indices fit in 16 bits, InvalidIndex is never used by an entry.
+ */
+class FReverbPalette
+{
+public:
+	static constexpr int32_t MaxEntries = 65535;
+	static constexpr uint16_t InvalidIndex = 0xFFFF;
+
+	explicit FReverbPalette(float InTolerance = 0.01f) { Reset(InTolerance); }
+
+	void Reset(float InTolerance);
+	/** Returns the entry Params quantize to, adding it when it is new. -1 when the palette is full */
+	int32_t Add(const FReverbParams& Params);
+	/** Doubles the tolerance and requantizes the entries, OutEntryRemap receives the new index of every previous entry */
+	void Coarsen(std::vector<int32_t>& OutEntryRemap);
+	/** Takes over entries, e.g. loaded from disk. Rejects entries that don't sit on the quantization steps and stays empty */
+	bool Assign(float InTolerance, std::vector<FReverbParams>&& InEntries);
+
+	float GetTolerance() const { return Tolerance; }
+	int32_t Num() const { return static_cast<int32_t>(Entries.size()); }
+	bool IsValidIndex(int32_t Index) const { return Index >= 0 && Index < Num(); }
+	const FReverbParams& Get(int32_t Index) const { return Entries[Index]; }
+	const std::vector<FReverbParams>& GetEntries() const { return Entries; }
+
+	size_t GetAllocatedSize() const;
+
+private:
+	uint64_t Quantize(const FReverbParams& Params, FReverbParams& OutStepParams) const;
+
+	float Tolerance = 0.01f;
+	std::vector<FReverbParams> Entries;
+	std::unordered_map<uint64_t, int32_t> EntryLookup;
+};
+
+
+/**
+ * Blends leaves around a listener, decay is weighted by 1 - distance / radius,
+ * the other parameters come from the leaf with the largest weight.
+ */
+class FNeighbourBlend
+{
+public:
+	explicit FNeighbourBlend(float InSearchRadius) : SearchRadius(InSearchRadius) {}
+
+	/** Returns false when the leaf is out of range and was ignored */
+	bool Add(int32_t LeafIndex, float Distance, float DecayTime);
+
+	/** Returns false when no leaf was in range */
+	bool Resolve(float& OutDecayTime, int32_t& OutDominantLeaf) const;
+
+private:
+	float SearchRadius;
+	float Sum = 0.0f;
+	float WeightedDecayTime = 0.0f;
+	float MaxWeight = 0.0f;
+	int32_t MaxWeightLeaf = -1;
+};
+}
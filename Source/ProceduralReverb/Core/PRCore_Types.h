@@ -0,0 +1,115 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+// Engine independent part of the procedural reverb, built by the module and by Tools/ProceduralReverbCore.
+// Only the standard library may be included from here.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+
+namespace PRCore
+{
+struct FVec3
+{
+	FVec3() = default;
+	FVec3(double InX, double InY, double InZ) : X(InX), Y(InY), Z(InZ) {}
+
+	double operator[](int32_t Axis) const { return (&X)[Axis]; }
+	double& operator[](int32_t Axis) { return (&X)[Axis]; }
+
+	FVec3 operator+(const FVec3& Other) const { return FVec3(X + Other.X, Y + Other.Y, Z + Other.Z); }
+	FVec3 operator-(const FVec3& Other) const { return FVec3(X - Other.X, Y - Other.Y, Z - Other.Z); }
+	FVec3 operator*(double Scale) const { return FVec3(X * Scale, Y * Scale, Z * Scale); }
+
+	double X = 0.0;
+	double Y = 0.0;
+	double Z = 0.0;
+};
+
+
+struct FBox3
+{
+	FBox3() = default;
+	FBox3(const FVec3& InMin, const FVec3& InMax) : Min(InMin), Max(InMax), bValid(true) {}
+
+	FVec3 GetCenter() const { return (Min + Max) * 0.5; }
+	FVec3 GetExtent() const { return (Max - Min) * 0.5; }
+	double GetVolume() const { return (Max.X - Min.X) * (Max.Y - Min.Y) * (Max.Z - Min.Z); }
+
+	bool IsInsideOrOn(const FVec3& Point) const
+	{
+		return Point.X >= Min.X && Point.X <= Max.X
+			&& Point.Y >= Min.Y && Point.Y <= Max.Y
+			&& Point.Z >= Min.Z && Point.Z <= Max.Z;
+	}
+
+	/** Touching boxes intersect */
+	bool Intersects(const FBox3& Other) const
+	{
+		return Min.X <= Other.Max.X && Max.X >= Other.Min.X
+			&& Min.Y <= Other.Max.Y && Max.Y >= Other.Min.Y
+			&& Min.Z <= Other.Max.Z && Max.Z >= Other.Min.Z;
+	}
+
+	double ComputeSquaredDistanceToPoint(const FVec3& Point) const
+	{
+		double DistanceSquared = 0.0;
+		for (int32_t Axis = 0; Axis < 3; ++Axis)
+		{
+			const double Delta = std::max({Min[Axis] - Point[Axis], 0.0, Point[Axis] - Max[Axis]});
+			DistanceSquared += Delta * Delta;
+		}
+		return DistanceSquared;
+	}
+
+	/** Longest axis, ties prefer X over Y over Z */
+	uint8_t GetLongestAxis() const
+	{
+		const FVec3 Extent = GetExtent();
+		return (Extent.X >= Extent.Y && Extent.X >= Extent.Z) ? 0 : (Extent.Y >= Extent.Z ? 1 : 2);
+	}
+
+	FVec3 Min;
+	FVec3 Max;
+	bool bValid = false;
+};
+
+
+/** Index of the lowest set bit, Value must not be 0 */
+inline int32_t CountTrailingZeros(uint32_t Value)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long Index;
+	_BitScanForward(&Index, Value);
+	return static_cast<int32_t>(Index);
+#else
+	return __builtin_ctz(Value);
+#endif
+}
+
+
+/** Calls Body for every index in [0, Num), possibly from several threads. Work runs serially when it is not set */
+using FParallelFor = std::function<void(int32_t Num, const std::function<void(int32_t Index)>& Body)>;
+
+inline void RunParallel(const FParallelFor& ParallelForFunction, int32_t Num, const std::function<void(int32_t Index)>& Body)
+{
+	if (ParallelForFunction)
+	{
+		ParallelForFunction(Num, Body);
+		return;
+	}
+
+	for (int32_t Index = 0; Index < Num; ++Index)
+	{
+		Body(Index);
+	}
+}
+}
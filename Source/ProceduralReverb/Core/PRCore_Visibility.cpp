@@ -0,0 +1,222 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PRCore_Visibility.h"
+
+
+namespace PRCore
+{
+namespace
+{
+FVec3 ClosestPoint(const FBox3& Box, const FVec3& Point)
+{
+	return FVec3(
+		std::clamp(Point.X, Box.Min.X, Box.Max.X),
+		std::clamp(Point.Y, Box.Min.Y, Box.Max.Y),
+		std::clamp(Point.Z, Box.Min.Z, Box.Max.Z));
+}
+
+bool CanSee(const IWorldQueries& World, const FBox3& From, const FBox3& To)
+{
+	const FVec3 FromCenter = From.GetCenter();
+	const FVec3 ToCenter = To.GetCenter();
+	return !World.Trace(FromCenter, ToCenter).bHit
+		|| !World.Trace(FromCenter, ClosestPoint(To, FromCenter)).bHit
+		|| !World.Trace(ClosestPoint(From, ToCenter), ToCenter).bHit;
+}
+}
+
+
+void FLeafVisibility::Build(const FPartition& Partition, const IWorldQueries& World, const FVisibilityParams& Params)
+{
+	BeginBuild(Partition, Params);
+	StepBuild(Partition, World, Partition.GetNumLeaves());
+}
+
+void FLeafVisibility::BeginBuild(const FPartition& Partition, const FVisibilityParams& Params)
+{
+	Reset();
+
+	PendingRows.resize(Partition.GetNumLeaves());
+	PendingParams = Params;
+}
+
+bool FLeafVisibility::StepBuild(const FPartition& Partition, const IWorldQueries& World, int32_t MaxLeaves)
+{
+	const int32_t NumLeaves = static_cast<int32_t>(PendingRows.size());
+	if (NumLeaves == 0)
+	{
+		return true;
+	}
+
+	// Every pair is traced once, from the lower leaf index. Rows only hold higher leaves until they are mirrored
+	const FVisibilityParams& Params = PendingParams;
+	const FLeafBounds& LeafBounds = Partition.GetLeafBounds();
+	const int32_t FirstLeaf = NumPendingLeavesTraced;
+	const int32_t NumStepLeaves = std::min(NumLeaves - FirstLeaf, std::max(MaxLeaves, 1));
+	RunParallel(Params.ParallelFor, NumStepLeaves, [&](int32_t Index)
+	{
+		const int32_t Leaf = FirstLeaf + Index;
+		if (Params.SkipLeaves && Params.SkipLeaves[Leaf])
+		{
+			return;
+		}
+
+		const FBox3 Box = LeafBounds.GetBox(Leaf);
+		const FVec3 Extent = Box.GetExtent();
+		const float Reach = Params.Radius + static_cast<float>(std::sqrt(Extent.X * Extent.X + Extent.Y * Extent.Y + Extent.Z * Extent.Z));
+
+		std::vector<int32_t>& Row = PendingRows[Leaf];
+		Partition.FindNearbyLeaves(Box.GetCenter(), Reach, [&](int32_t OtherLeaf, float)
+		{
+			if (OtherLeaf > Leaf && !(Params.SkipLeaves && Params.SkipLeaves[OtherLeaf]) && CanSee(World, Box, LeafBounds.GetBox(OtherLeaf)))
+			{
+				Row.push_back(OtherLeaf);
+			}
+		});
+		std::sort(Row.begin(), Row.end());
+	});
+
+	NumPendingLeavesTraced += NumStepLeaves;
+	if (NumPendingLeavesTraced < NumLeaves)
+	{
+		return false;
+	}
+
+	const std::vector<std::vector<int32_t>> HigherVisibleLeaves = std::move(PendingRows);
+	PendingRows.clear();
+	NumPendingLeavesTraced = 0;
+	PendingParams = FVisibilityParams();
+	StoreRows(HigherVisibleLeaves);
+	return true;
+}
+
+void FLeafVisibility::StoreRows(const std::vector<std::vector<int32_t>>& HigherVisibleLeaves)
+{
+	const int32_t NumLeaves = static_cast<int32_t>(HigherVisibleLeaves.size());
+	Offsets.assign(NumLeaves + 1, 0);
+	for (int32_t Leaf = 0; Leaf < NumLeaves; ++Leaf)
+	{
+		Offsets[Leaf + 1] += static_cast<uint32_t>(HigherVisibleLeaves[Leaf].size());
+		for (const int32_t OtherLeaf : HigherVisibleLeaves[Leaf])
+		{
+			++Offsets[OtherLeaf + 1];
+		}
+	}
+
+	for (int32_t Leaf = 0; Leaf < NumLeaves; ++Leaf)
+	{
+		Offsets[Leaf + 1] += Offsets[Leaf];
+	}
+
+	// Lower leaves are written in ascending order before the higher ones, rows come out sorted
+	VisibleLeaves.resize(Offsets[NumLeaves]);
+	std::vector<uint32_t> Cursors(Offsets.begin(), Offsets.end() - 1);
+	for (int32_t Leaf = 0; Leaf < NumLeaves; ++Leaf)
+	{
+		for (const int32_t OtherLeaf : HigherVisibleLeaves[Leaf])
+		{
+			VisibleLeaves[Cursors[Leaf]++] = OtherLeaf;
+			VisibleLeaves[Cursors[OtherLeaf]++] = Leaf;
+		}
+	}
+}
+
+void FLeafVisibility::Reset()
+{
+	Offsets.clear();
+	VisibleLeaves.clear();
+	PendingRows.clear();
+	NumPendingLeavesTraced = 0;
+	PendingParams = FVisibilityParams();
+}
+
+bool FLeafVisibility::Assign(int32_t NumLeaves, std::vector<uint32_t>&& InOffsets, std::vector<int32_t>&& InVisibleLeaves)
+{
+	Reset();
+
+	if (NumLeaves <= 0 || InOffsets.size() != static_cast<size_t>(NumLeaves) + 1 || InOffsets.front() != 0
+		|| InOffsets.back() != InVisibleLeaves.size())
+	{
+		return false;
+	}
+
+	for (int32_t Leaf = 0; Leaf < NumLeaves; ++Leaf)
+	{
+		if (InOffsets[Leaf] > InOffsets[Leaf + 1])
+		{
+			return false;
+		}
+
+		for (uint32_t Index = InOffsets[Leaf]; Index < InOffsets[Leaf + 1]; ++Index)
+		{
+			const int32_t OtherLeaf = InVisibleLeaves[Index];
+			if (OtherLeaf < 0 || OtherLeaf >= NumLeaves || (Index > InOffsets[Leaf] && InVisibleLeaves[Index - 1] >= OtherLeaf))
+			{
+				return false;
+			}
+		}
+	}
+
+	Offsets = std::move(InOffsets);
+	VisibleLeaves = std::move(InVisibleLeaves);
+	return true;
+}
+
+void FLeafVisibility::Remap(const std::vector<int32_t>& LeafRemap, int32_t NumLeaves)
+{
+	if (IsEmpty() || LeafRemap.size() != static_cast<size_t>(GetNumLeaves()))
+	{
+		Reset();
+		return;
+	}
+
+	std::vector<std::vector<int32_t>> Rows(NumLeaves);
+	for (int32_t Leaf = 0; Leaf < GetNumLeaves(); ++Leaf)
+	{
+		for (uint32_t Index = Offsets[Leaf]; Index < Offsets[Leaf + 1]; ++Index)
+		{
+			const int32_t MergedLeaf = LeafRemap[Leaf];
+			const int32_t MergedOtherLeaf = LeafRemap[VisibleLeaves[Index]];
+			if (MergedLeaf != MergedOtherLeaf)
+			{
+				Rows[MergedLeaf].push_back(MergedOtherLeaf);
+			}
+		}
+	}
+
+	Offsets.assign(NumLeaves + 1, 0);
+	VisibleLeaves.clear();
+	for (int32_t Leaf = 0; Leaf < NumLeaves; ++Leaf)
+	{
+		std::vector<int32_t>& Row = Rows[Leaf];
+		std::sort(Row.begin(), Row.end());
+		Row.erase(std::unique(Row.begin(), Row.end()), Row.end());
+		VisibleLeaves.insert(VisibleLeaves.end(), Row.begin(), Row.end());
+		Offsets[Leaf + 1] = static_cast<uint32_t>(VisibleLeaves.size());
+	}
+	VisibleLeaves.shrink_to_fit();
+}
+
+bool FLeafVisibility::IsVisible(int32_t FromLeaf, int32_t ToLeaf) const
+{
+	if (FromLeaf == ToLeaf)
+	{
+		return true;
+	}
+
+	if (FromLeaf < 0 || FromLeaf >= GetNumLeaves())
+	{
+		return false;
+	}
+
+	const int32_t* RowBegin = VisibleLeaves.data() + Offsets[FromLeaf];
+	const int32_t* RowEnd = VisibleLeaves.data() + Offsets[FromLeaf + 1];
+	return std::binary_search(RowBegin, RowEnd, ToLeaf);
+}
+
+size_t FLeafVisibility::GetAllocatedSize() const
+{
+	return Offsets.capacity() * sizeof(uint32_t) + VisibleLeaves.capacity() * sizeof(int32_t);
+}
+}
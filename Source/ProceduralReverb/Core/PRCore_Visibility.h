@@ -0,0 +1,70 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "PRCore_Acoustics.h"
+#include "PRCore_Partition.h"
+
+#include <vector>
+
+
+namespace PRCore
+{
+struct FVisibilityParams
+{
+	/** Leaves further than this from any point of a leaf are never stored as visible from it */
+	float Radius = 2000.0f;
+	/** Optional, one entry per leaf. Leaves with a non-zero entry are neither traced from nor to and see nothing */
+	const uint8_t* SkipLeaves = nullptr;
+	FParallelFor ParallelFor;
+};
+
+
+/**
+ * Leaf to leaf visibility baked from line traces, so listeners can drop leaves behind walls without tracing at runtime.
+ * Stored as compressed sparse rows: the leaves visible from leaf L are VisibleLeaves[Offsets[L], Offsets[L + 1]),
+ * sorted by index. Visibility is symmetric and a leaf always sees itself, which is not stored.
+ */
+class FLeafVisibility
+{
+public:
+	/** Two leaves see each other when a trace between their centers, or from one center to the other leaf, is unblocked */
+	void Build(const FPartition& Partition, const IWorldQueries& World, const FVisibilityParams& Params);
+	/**
+	 * Same build spread over several calls, every StepBuild traces from up to MaxLeaves further leaves of Partition,
+	 * which must not change in between. Rows are only stored once StepBuild returned true, which it also does when
+	 * no build is in progress.
+	 */
+	void BeginBuild(const FPartition& Partition, const FVisibilityParams& Params);
+	bool StepBuild(const FPartition& Partition, const IWorldQueries& World, int32_t MaxLeaves);
+	bool IsBuilding() const { return !PendingRows.empty(); }
+	void Reset();
+
+	/** Takes over previously built rows, e.g. loaded from disk. Rejects inconsistent data and stays empty */
+	bool Assign(int32_t NumLeaves, std::vector<uint32_t>&& InOffsets, std::vector<int32_t>&& InVisibleLeaves);
+
+	/** Follows FPartition::MergeLeaves, a merged leaf sees everything any of its previous leaves saw */
+	void Remap(const std::vector<int32_t>& LeafRemap, int32_t NumLeaves);
+
+	bool IsEmpty() const { return Offsets.empty(); }
+	int32_t GetNumLeaves() const { return IsEmpty() ? 0 : static_cast<int32_t>(Offsets.size()) - 1; }
+	const std::vector<uint32_t>& GetOffsets() const { return Offsets; }
+	const std::vector<int32_t>& GetVisibleLeaves() const { return VisibleLeaves; }
+
+	/** Binary search in the row of FromLeaf */
+	bool IsVisible(int32_t FromLeaf, int32_t ToLeaf) const;
+
+	size_t GetAllocatedSize() const;
+
+private:
+	/** Turns the rows of higher visible leaves into the mirrored compressed rows */
+	void StoreRows(const std::vector<std::vector<int32_t>>& HigherVisibleLeaves);
+
+	std::vector<uint32_t> Offsets;
+	std::vector<int32_t> VisibleLeaves;
+	/** Higher visible leaves of every leaf while a build is in progress */
+	std::vector<std::vector<int32_t>> PendingRows;
+	int32_t NumPendingLeavesTraced = 0;
+	FVisibilityParams PendingParams;
+};
+}
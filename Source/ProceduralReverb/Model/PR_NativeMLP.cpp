@@ -0,0 +1,733 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PR_NativeMLP.h"
+
+#include "Async/ParallelFor.h"
+#include "Math/VectorRegister.h"
+#include "ProceduralReverb/LogPrPartition.h"
+
+
+namespace
+{
+constexpr int32 VectorWidth = 4;
+constexpr int32 RowsPerTask = 64;
+
+/** Protobuf wire format reader, just enough to walk an ONNX model */
+struct FPR_ProtoReader
+{
+	explicit FPR_ProtoReader(TConstArrayView<uint8> Bytes)
+		: Data(Bytes.GetData())
+		, End(Bytes.GetData() + Bytes.Num())
+	{
+	}
+
+	bool IsDone() const { return bError || Data >= End; }
+
+	uint64 ReadVarint()
+	{
+		uint64 Result = 0;
+		for (int32 Shift = 0; Shift < 64 && Data < End; Shift += 7)
+		{
+			const uint8 Byte = *Data++;
+			Result |= static_cast<uint64>(Byte & 0x7F) << Shift;
+			if (!(Byte & 0x80))
+			{
+				return Result;
+			}
+		}
+
+		bError = true;
+		return 0;
+	}
+
+	float ReadFloat()
+	{
+		float Result = 0.0f;
+		if (End - Data < 4)
+		{
+			bError = true;
+			return Result;
+		}
+
+		FMemory::Memcpy(&Result, Data, sizeof(float));
+		Data += sizeof(float);
+		return Result;
+	}
+
+	TConstArrayView<uint8> ReadBytes()
+	{
+		const uint64 Length = ReadVarint();
+		if (bError || Length > static_cast<uint64>(End - Data))
+		{
+			bError = true;
+			return {};
+		}
+
+		TConstArrayView<uint8> Result(Data, static_cast<int32>(Length));
+		Data += Length;
+		return Result;
+	}
+
+	FString ReadString()
+	{
+		TConstArrayView<uint8> Bytes = ReadBytes();
+		return FString(Bytes.Num(), reinterpret_cast<const ANSICHAR*>(Bytes.GetData()));
+	}
+
+	bool ReadTag(uint32& OutField, uint32& OutWireType)
+	{
+		const uint64 Tag = ReadVarint();
+		OutField = static_cast<uint32>(Tag >> 3);
+		OutWireType = static_cast<uint32>(Tag & 7);
+		return !bError;
+	}
+
+	void Skip(uint32 WireType)
+	{
+		switch (WireType)
+		{
+			case 0: ReadVarint(); break;
+			case 1: Data += 8; break;
+			case 2: ReadBytes(); break;
+			case 5: Data += 4; break;
+			default: bError = true; break;
+		}
+
+		bError |= Data > End;
+	}
+
+	const uint8* Data;
+	const uint8* End;
+	bool bError = false;
+};
+
+namespace ONNX
+{
+// Field numbers from onnx.proto
+constexpr uint32 ModelGraph = 7;
+constexpr uint32 GraphNode = 1;
+constexpr uint32 GraphInitializer = 5;
+constexpr uint32 GraphInput = 11;
+constexpr uint32 GraphOutput = 12;
+constexpr uint32 NodeInput = 1;
+constexpr uint32 NodeOutput = 2;
+constexpr uint32 NodeOpType = 4;
+constexpr uint32 NodeAttribute = 5;
+constexpr uint32 AttributeName = 1;
+constexpr uint32 AttributeFloat = 2;
+constexpr uint32 AttributeInt = 3;
+constexpr uint32 AttributeTensor = 5;
+constexpr uint32 TensorDims = 1;
+constexpr uint32 TensorDataType = 2;
+constexpr uint32 TensorFloatData = 4;
+constexpr uint32 TensorName = 8;
+constexpr uint32 TensorRawData = 9;
+constexpr uint32 TensorDataLocation = 14;
+constexpr uint32 ValueInfoName = 1;
+
+constexpr uint64 DataTypeFloat = 1;
+}
+
+struct FPR_ONNXTensor
+{
+	TArray<int64, TInlineAllocator<2>> Dims;
+	TArray<float> Data;
+};
+
+struct FPR_ONNXNode
+{
+	FString OpType;
+	TArray<FString, TInlineAllocator<3>> Inputs;
+	TArray<FString, TInlineAllocator<1>> Outputs;
+	TMap<FString, float> FloatAttributes;
+	TMap<FString, int64> IntAttributes;
+	TOptional<FPR_ONNXTensor> TensorAttribute;
+};
+
+struct FPR_ONNXGraph
+{
+	TArray<FPR_ONNXNode> Nodes;
+	TMap<FString, FPR_ONNXTensor> Initializers;
+	TArray<FString> Inputs;
+	TArray<FString> Outputs;
+};
+
+bool ParseTensor(TConstArrayView<uint8> Bytes, FString& OutName, FPR_ONNXTensor& OutTensor)
+{
+	FPR_ProtoReader Reader(Bytes);
+	uint64 DataType = 0;
+	while (!Reader.IsDone())
+	{
+		uint32 Field, WireType;
+		if (!Reader.ReadTag(Field, WireType))
+		{
+			break;
+		}
+
+		if (Field == ONNX::TensorDims && WireType == 0)
+		{
+			OutTensor.Dims.Add(static_cast<int64>(Reader.ReadVarint()));
+		}
+		else if (Field == ONNX::TensorDims && WireType == 2)
+		{
+			FPR_ProtoReader Packed(Reader.ReadBytes());
+			while (!Packed.IsDone())
+			{
+				OutTensor.Dims.Add(static_cast<int64>(Packed.ReadVarint()));
+			}
+		}
+		else if (Field == ONNX::TensorDataType && WireType == 0)
+		{
+			DataType = Reader.ReadVarint();
+		}
+		else if (Field == ONNX::TensorFloatData && WireType == 2)
+		{
+			TConstArrayView<uint8> Packed = Reader.ReadBytes();
+			const int32 NumFloats = Packed.Num() / sizeof(float);
+			const int32 Offset = OutTensor.Data.AddUninitialized(NumFloats);
+			FMemory::Memcpy(OutTensor.Data.GetData() + Offset, Packed.GetData(), NumFloats * sizeof(float));
+		}
+		else if (Field == ONNX::TensorFloatData && WireType == 5)
+		{
+			OutTensor.Data.Add(Reader.ReadFloat());
+		}
+		else if (Field == ONNX::TensorName && WireType == 2)
+		{
+			OutName = Reader.ReadString();
+		}
+		else if (Field == ONNX::TensorRawData && WireType == 2)
+		{
+			TConstArrayView<uint8> Raw = Reader.ReadBytes();
+			OutTensor.Data.SetNumUninitialized(Raw.Num() / sizeof(float));
+			FMemory::Memcpy(OutTensor.Data.GetData(), Raw.GetData(), OutTensor.Data.Num() * sizeof(float));
+		}
+		else if (Field == ONNX::TensorDataLocation && WireType == 0)
+		{
+			// External data is not embedded in the asset
+			if (Reader.ReadVarint() != 0)
+			{
+				return false;
+			}
+		}
+		else
+		{
+			Reader.Skip(WireType);
+		}
+	}
+
+	int64 Volume = 1;
+	for (const int64 Dim : OutTensor.Dims)
+	{
+		Volume *= Dim;
+	}
+
+	return !Reader.bError && DataType == ONNX::DataTypeFloat && Volume == OutTensor.Data.Num();
+}
+
+bool ParseNode(TConstArrayView<uint8> Bytes, FPR_ONNXNode& OutNode)
+{
+	FPR_ProtoReader Reader(Bytes);
+	while (!Reader.IsDone())
+	{
+		uint32 Field, WireType;
+		if (!Reader.ReadTag(Field, WireType))
+		{
+			break;
+		}
+
+		if (Field == ONNX::NodeInput && WireType == 2)
+		{
+			OutNode.Inputs.Add(Reader.ReadString());
+		}
+		else if (Field == ONNX::NodeOutput && WireType == 2)
+		{
+			OutNode.Outputs.Add(Reader.ReadString());
+		}
+		else if (Field == ONNX::NodeOpType && WireType == 2)
+		{
+			OutNode.OpType = Reader.ReadString();
+		}
+		else if (Field == ONNX::NodeAttribute && WireType == 2)
+		{
+			FPR_ProtoReader AttributeReader(Reader.ReadBytes());
+			FString Name;
+			TOptional<float> FloatValue;
+			TOptional<int64> IntValue;
+			while (!AttributeReader.IsDone())
+			{
+				uint32 AttributeField, AttributeWireType;
+				if (!AttributeReader.ReadTag(AttributeField, AttributeWireType))
+				{
+					break;
+				}
+
+				if (AttributeField == ONNX::AttributeName && AttributeWireType == 2)
+				{
+					Name = AttributeReader.ReadString();
+				}
+				else if (AttributeField == ONNX::AttributeFloat && AttributeWireType == 5)
+				{
+					FloatValue = AttributeReader.ReadFloat();
+				}
+				else if (AttributeField == ONNX::AttributeInt && AttributeWireType == 0)
+				{
+					IntValue = static_cast<int64>(AttributeReader.ReadVarint());
+				}
+				else if (AttributeField == ONNX::AttributeTensor && AttributeWireType == 2)
+				{
+					FString TensorName;
+					FPR_ONNXTensor Tensor;
+					if (!ParseTensor(AttributeReader.ReadBytes(), TensorName, Tensor))
+					{
+						return false;
+					}
+					OutNode.TensorAttribute = MoveTemp(Tensor);
+				}
+				else
+				{
+					AttributeReader.Skip(AttributeWireType);
+				}
+			}
+
+			if (AttributeReader.bError)
+			{
+				return false;
+			}
+
+			if (FloatValue.IsSet())
+			{
+				OutNode.FloatAttributes.Add(Name, FloatValue.GetValue());
+			}
+
+			if (IntValue.IsSet())
+			{
+				OutNode.IntAttributes.Add(Name, IntValue.GetValue());
+			}
+		}
+		else
+		{
+			Reader.Skip(WireType);
+		}
+	}
+
+	return !Reader.bError;
+}
+
+FString ParseValueInfoName(TConstArrayView<uint8> Bytes)
+{
+	FPR_ProtoReader Reader(Bytes);
+	while (!Reader.IsDone())
+	{
+		uint32 Field, WireType;
+		if (!Reader.ReadTag(Field, WireType))
+		{
+			break;
+		}
+
+		if (Field == ONNX::ValueInfoName && WireType == 2)
+		{
+			return Reader.ReadString();
+		}
+
+		Reader.Skip(WireType);
+	}
+
+	return FString();
+}
+
+bool ParseGraph(TConstArrayView<uint8> Bytes, FPR_ONNXGraph& OutGraph)
+{
+	FPR_ProtoReader Reader(Bytes);
+	while (!Reader.IsDone())
+	{
+		uint32 Field, WireType;
+		if (!Reader.ReadTag(Field, WireType))
+		{
+			break;
+		}
+
+		if (Field == ONNX::GraphNode && WireType == 2)
+		{
+			if (!ParseNode(Reader.ReadBytes(), OutGraph.Nodes.AddDefaulted_GetRef()))
+			{
+				return false;
+			}
+		}
+		else if (Field == ONNX::GraphInitializer && WireType == 2)
+		{
+			FString Name;
+			FPR_ONNXTensor Tensor;
+			if (!ParseTensor(Reader.ReadBytes(), Name, Tensor))
+			{
+				return false;
+			}
+			OutGraph.Initializers.Add(Name, MoveTemp(Tensor));
+		}
+		else if (Field == ONNX::GraphInput && WireType == 2)
+		{
+			OutGraph.Inputs.Add(ParseValueInfoName(Reader.ReadBytes()));
+		}
+		else if (Field == ONNX::GraphOutput && WireType == 2)
+		{
+			OutGraph.Outputs.Add(ParseValueInfoName(Reader.ReadBytes()));
+		}
+		else
+		{
+			Reader.Skip(WireType);
+		}
+	}
+
+	return !Reader.bError;
+}
+
+bool ParseModel(TConstArrayView<uint8> Bytes, FPR_ONNXGraph& OutGraph)
+{
+	FPR_ProtoReader Reader(Bytes);
+	while (!Reader.IsDone())
+	{
+		uint32 Field, WireType;
+		if (!Reader.ReadTag(Field, WireType))
+		{
+			break;
+		}
+
+		if (Field == ONNX::ModelGraph && WireType == 2)
+		{
+			return ParseGraph(Reader.ReadBytes(), OutGraph);
+		}
+
+		Reader.Skip(WireType);
+	}
+
+	return false;
+}
+
+template <typename ValueType>
+ValueType FindAttribute(const TMap<FString, ValueType>& Attributes, const TCHAR* Name, ValueType Default)
+{
+	const ValueType* Value = Attributes.Find(Name);
+	return Value ? *Value : Default;
+}
+
+int32 RoundUpToVector(int32 Value)
+{
+	return Align(Value, VectorWidth);
+}
+}
+
+
+bool FPR_NativeMLP::LoadFromONNX(TConstArrayView<uint8> ONNXData)
+{
+	Layers.Reset();
+	MaxStride = 0;
+
+	FPR_ONNXGraph Graph;
+	if (!ParseModel(ONNXData, Graph))
+	{
+		UE_LOG(LogPrPartition, Log, TEXT("Native inference: failed to parse the ONNX graph"));
+		return false;
+	}
+
+	// Constants are initializers in disguise
+	for (FPR_ONNXNode& Node : Graph.Nodes)
+	{
+		if (Node.OpType == TEXT("Constant") && Node.TensorAttribute.IsSet() && Node.Outputs.Num() == 1)
+		{
+			Graph.Initializers.Add(Node.Outputs[0], Node.TensorAttribute.GetValue());
+		}
+	}
+
+	// Older exporters list the initializers among the graph inputs
+	const FString* GraphInput = Graph.Inputs.FindByPredicate([&Graph](const FString& Name)
+	{
+		return !Graph.Initializers.Contains(Name);
+	});
+
+	if (!GraphInput || Graph.Outputs.Num() != 1)
+	{
+		UE_LOG(LogPrPartition, Log, TEXT("Native inference: only graphs with a single input and output are supported"));
+		return false;
+	}
+
+	auto Fail = [this](const FString& Reason)
+	{
+		UE_LOG(LogPrPartition, Log, TEXT("Native inference: unsupported graph, %s"), *Reason);
+		Layers.Reset();
+		return false;
+	};
+
+	FString Current = *GraphInput;
+	for (const FPR_ONNXNode& Node : Graph.Nodes)
+	{
+		if (Node.OpType == TEXT("Constant"))
+		{
+			continue;
+		}
+
+		if (Node.Outputs.Num() != 1 || Node.Inputs.IsEmpty())
+		{
+			return Fail(FString::Printf(TEXT("%s has unexpected inputs or outputs"), *Node.OpType));
+		}
+
+		// Every supported op takes the running activation plus optional initializers
+		const FPR_ONNXTensor* Parameters[2] = {nullptr, nullptr};
+		bool bConsumesCurrent = false;
+		int32 NumParameters = 0;
+		for (const FString& Input : Node.Inputs)
+		{
+			if (Input == Current && !bConsumesCurrent)
+			{
+				bConsumesCurrent = true;
+			}
+			else if (const FPR_ONNXTensor* Initializer = Graph.Initializers.Find(Input); Initializer && NumParameters < 2)
+			{
+				Parameters[NumParameters++] = Initializer;
+			}
+			else if (!Input.IsEmpty())
+			{
+				return Fail(FString::Printf(TEXT("%s is not a chain of dense layers"), *Node.OpType));
+			}
+		}
+
+		if (!bConsumesCurrent)
+		{
+			return Fail(FString::Printf(TEXT("%s doesn't consume the previous layer"), *Node.OpType));
+		}
+
+		if (Node.OpType == TEXT("Gemm") || Node.OpType == TEXT("MatMul"))
+		{
+			const bool bGemm = Node.OpType == TEXT("Gemm");
+			const FPR_ONNXTensor* Weights = Parameters[0];
+			if (!Weights || Weights->Dims.Num() != 2 || Node.Inputs[0] != Current
+				|| (bGemm && FindAttribute<int64>(Node.IntAttributes, TEXT("transA"), 0) != 0))
+			{
+				return Fail(TEXT("dense layer weights must be a 2D initializer"));
+			}
+
+			const bool bTransposed = bGemm && FindAttribute<int64>(Node.IntAttributes, TEXT("transB"), 0) != 0;
+			const float Alpha = bGemm ? FindAttribute(Node.FloatAttributes, TEXT("alpha"), 1.0f) : 1.0f;
+			const float Beta = bGemm ? FindAttribute(Node.FloatAttributes, TEXT("beta"), 1.0f) : 1.0f;
+
+			FLayer& Layer = Layers.AddDefaulted_GetRef();
+			Layer.NumInputs = static_cast<int32>(bTransposed ? Weights->Dims[1] : Weights->Dims[0]);
+			Layer.NumOutputs = static_cast<int32>(bTransposed ? Weights->Dims[0] : Weights->Dims[1]);
+			Layer.Stride = RoundUpToVector(Layer.NumOutputs);
+			Layer.Weights.SetNumZeroed(Layer.NumInputs * Layer.Stride);
+			Layer.Bias.SetNumZeroed(Layer.Stride);
+
+			for (int32 In = 0; In < Layer.NumInputs; ++In)
+			{
+				for (int32 Out = 0; Out < Layer.NumOutputs; ++Out)
+				{
+					const int32 SourceIndex = bTransposed ? Out * Layer.NumInputs + In : In * Layer.NumOutputs + Out;
+					Layer.Weights[In * Layer.Stride + Out] = Alpha * Weights->Data[SourceIndex];
+				}
+			}
+
+			if (const FPR_ONNXTensor* Bias = Parameters[1])
+			{
+				if (Bias->Data.Num() != Layer.NumOutputs)
+				{
+					return Fail(TEXT("only per-output bias is supported"));
+				}
+
+				for (int32 Out = 0; Out < Layer.NumOutputs; ++Out)
+				{
+					Layer.Bias[Out] = Beta * Bias->Data[Out];
+				}
+			}
+
+			if (Layers.Num() > 1 && Layers.Last(1).NumOutputs != Layer.NumInputs)
+			{
+				return Fail(TEXT("layer sizes don't match"));
+			}
+		}
+		else if (Node.OpType == TEXT("Add"))
+		{
+			const FPR_ONNXTensor* Bias = Parameters[0];
+			if (Layers.IsEmpty() || Layers.Last().Activation != EPR_MLPActivation::None
+				|| !Bias || Bias->Data.Num() != Layers.Last().NumOutputs)
+			{
+				return Fail(TEXT("Add is only supported as a dense layer bias"));
+			}
+
+			for (int32 Out = 0; Out < Bias->Data.Num(); ++Out)
+			{
+				Layers.Last().Bias[Out] += Bias->Data[Out];
+			}
+		}
+		else if (Node.OpType == TEXT("Relu") || Node.OpType == TEXT("LeakyRelu")
+			|| Node.OpType == TEXT("Sigmoid") || Node.OpType == TEXT("Tanh"))
+		{
+			if (Layers.IsEmpty() || Layers.Last().Activation != EPR_MLPActivation::None)
+			{
+				return Fail(TEXT("activations must follow a dense layer"));
+			}
+
+			FLayer& Layer = Layers.Last();
+			if (Node.OpType == TEXT("Relu"))
+			{
+				Layer.Activation = EPR_MLPActivation::Relu;
+			}
+			else if (Node.OpType == TEXT("LeakyRelu"))
+			{
+				Layer.Activation = EPR_MLPActivation::LeakyRelu;
+				Layer.ActivationAlpha = FindAttribute(Node.FloatAttributes, TEXT("alpha"), 0.01f);
+			}
+			else if (Node.OpType == TEXT("Sigmoid"))
+			{
+				Layer.Activation = EPR_MLPActivation::Sigmoid;
+			}
+			else
+			{
+				Layer.Activation = EPR_MLPActivation::Tanh;
+			}
+		}
+		else if (Node.OpType != TEXT("Identity") && Node.OpType != TEXT("Dropout"))
+		{
+			return Fail(FString::Printf(TEXT("%s is not supported"), *Node.OpType));
+		}
+
+		Current = Node.Outputs[0];
+	}
+
+	if (Layers.IsEmpty() || Current != Graph.Outputs[0])
+	{
+		return Fail(TEXT("the graph output is not produced by the layer chain"));
+	}
+
+	for (const FLayer& Layer : Layers)
+	{
+		MaxStride = FMath::Max3(MaxStride, Layer.Stride, RoundUpToVector(Layer.NumInputs));
+	}
+
+	UE_LOG(LogPrPartition, Log, TEXT("Native inference: loaded %d dense layers, %d inputs, %d outputs"),
+		Layers.Num(),
+		GetNumInputs(),
+		GetNumOutputs());
+
+	return true;
+}
+
+bool FPR_NativeMLP::Serialize(FArchive& Ar)
+{
+	Ar << Layers;
+	if (!Ar.IsLoading())
+	{
+		return !Ar.IsError();
+	}
+
+	MaxStride = 0;
+	bool bValid = !Ar.IsError() && !Layers.IsEmpty();
+	for (int32 Index = 0; bValid && Index < Layers.Num(); ++Index)
+	{
+		const FLayer& Layer = Layers[Index];
+		bValid = Layer.NumInputs > 0
+			&& Layer.NumOutputs > 0
+			&& Layer.Stride == RoundUpToVector(Layer.NumOutputs)
+			&& Layer.Weights.Num() == Layer.NumInputs * Layer.Stride
+			&& Layer.Bias.Num() == Layer.Stride
+			&& Layer.Activation <= EPR_MLPActivation::Tanh
+			&& (Index == 0 || Layers[Index - 1].NumOutputs == Layer.NumInputs);
+		MaxStride = FMath::Max3(MaxStride, Layer.Stride, RoundUpToVector(Layer.NumInputs));
+	}
+
+	if (!bValid)
+	{
+		Layers.Reset();
+		MaxStride = 0;
+	}
+
+	return bValid;
+}
+
+void FPR_NativeMLP::Run(TConstArrayView<float> Inputs, TArrayView<float> Outputs) const
+{
+	check(IsValid());
+
+	const int32 NumInputs = GetNumInputs();
+	const int32 NumOutputs = GetNumOutputs();
+	check(Inputs.Num() % NumInputs == 0);
+	const int32 NumRows = Inputs.Num() / NumInputs;
+	check(Outputs.Num() == NumRows * NumOutputs);
+
+	const int32 NumTasks = FMath::DivideAndRoundUp(NumRows, RowsPerTask);
+	ParallelFor(NumTasks, [this, &Inputs, &Outputs, NumRows, NumInputs, NumOutputs](int32 TaskIndex)
+	{
+		const int32 FirstRow = TaskIndex * RowsPerTask;
+		const int32 TaskRows = FMath::Min(RowsPerTask, NumRows - FirstRow);
+		RunRows(
+			Inputs.GetData() + static_cast<SIZE_T>(FirstRow) * NumInputs,
+			Outputs.GetData() + static_cast<SIZE_T>(FirstRow) * NumOutputs,
+			TaskRows);
+	}, NumTasks > 1 ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+}
+
+void FPR_NativeMLP::RunRows(const float* Inputs, float* Outputs, int32 NumRows) const
+{
+	// Ping-pong activations, padded to the vector width so every store is a full register
+	TArray<float, TInlineAllocator<256>> Front;
+	TArray<float, TInlineAllocator<256>> Back;
+	Front.SetNumZeroed(MaxStride);
+	Back.SetNumZeroed(MaxStride);
+
+	const int32 NumInputs = GetNumInputs();
+	const int32 NumOutputs = GetNumOutputs();
+	const VectorRegister4Float Zero = VectorZeroFloat();
+
+	for (int32 Row = 0; Row < NumRows; ++Row)
+	{
+		FMemory::Memcpy(Front.GetData(), Inputs + static_cast<SIZE_T>(Row) * NumInputs, NumInputs * sizeof(float));
+
+		float* In = Front.GetData();
+		float* Out = Back.GetData();
+		for (const FLayer& Layer : Layers)
+		{
+			const VectorRegister4Float Alpha = VectorSetFloat1(Layer.ActivationAlpha);
+			for (int32 Column = 0; Column < Layer.Stride; Column += VectorWidth)
+			{
+				VectorRegister4Float Accumulator = VectorLoad(Layer.Bias.GetData() + Column);
+				const float* Weights = Layer.Weights.GetData() + Column;
+				for (int32 Input = 0; Input < Layer.NumInputs; ++Input)
+				{
+					Accumulator = VectorMultiplyAdd(VectorSetFloat1(In[Input]), VectorLoad(Weights), Accumulator);
+					Weights += Layer.Stride;
+				}
+
+				switch (Layer.Activation)
+				{
+					case EPR_MLPActivation::Relu:
+						Accumulator = VectorMax(Accumulator, Zero);
+						break;
+					case EPR_MLPActivation::LeakyRelu:
+						Accumulator = VectorSelect(VectorCompareGT(Accumulator, Zero), Accumulator, VectorMultiply(Accumulator, Alpha));
+						break;
+					default:
+						break;
+				}
+
+				VectorStore(Accumulator, Out + Column);
+			}
+
+			if (Layer.Activation == EPR_MLPActivation::Sigmoid)
+			{
+				for (int32 Column = 0; Column < Layer.NumOutputs; ++Column)
+				{
+					Out[Column] = 1.0f / (1.0f + FMath::Exp(-Out[Column]));
+				}
+			}
+			else if (Layer.Activation == EPR_MLPActivation::Tanh)
+			{
+				for (int32 Column = 0; Column < Layer.NumOutputs; ++Column)
+				{
+					Out[Column] = 2.0f / (1.0f + FMath::Exp(-2.0f * Out[Column])) - 1.0f;
+				}
+			}
+
+			Swap(In, Out);
+		}
+
+		FMemory::Memcpy(Outputs + static_cast<SIZE_T>(Row) * NumOutputs, In, NumOutputs * sizeof(float));
+	}
+}
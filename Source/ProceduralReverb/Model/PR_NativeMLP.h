@@ -0,0 +1,69 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+
+enum class EPR_MLPActivation : uint8
+{
+	None,
+	Relu,
+	LeakyRelu,
+	Sigmoid,
+	Tanh
+};
+
+
+/**
+ * Small dense network evaluated with vector registers, loaded from an ONNX graph.
+ * Supports chains of Gemm/MatMul, bias Add and element-wise activations, which covers the reverb model.
+ * Evaluation doesn't mutate the network, so it can run on any number of threads at once.
+ */
+class PROCEDURALREVERB_API FPR_NativeMLP
+{
+public:
+	/** Returns false when the graph uses anything outside of the supported subset */
+	bool LoadFromONNX(TConstArrayView<uint8> ONNXData);
+	/** Reads or writes the parsed layers. Returns false when loaded layers don't form a valid chain */
+	bool Serialize(FArchive& Ar);
+	bool IsValid() const { return !Layers.IsEmpty(); }
+
+	int32 GetNumInputs() const { return IsValid() ? Layers[0].NumInputs : 0; }
+	int32 GetNumOutputs() const { return IsValid() ? Layers.Last().NumOutputs : 0; }
+
+	/**
+	 * Evaluates rows stored contiguously in Inputs, GetNumInputs() floats each.
+	 * Outputs are written in place, GetNumOutputs() floats per row.
+	 */
+	void Run(TConstArrayView<float> Inputs, TArrayView<float> Outputs) const;
+
+private:
+	struct FLayer
+	{
+		int32 NumInputs = 0;
+		int32 NumOutputs = 0;
+		/** NumOutputs rounded up to the vector width */
+		int32 Stride = 0;
+		/** [NumInputs, Stride], zero padded */
+		TArray<float> Weights;
+		/** [Stride], zero padded */
+		TArray<float> Bias;
+		EPR_MLPActivation Activation = EPR_MLPActivation::None;
+		float ActivationAlpha = 0.01f;
+
+		friend FArchive& operator<<(FArchive& Ar, FLayer& Layer)
+		{
+			uint8 ActivationValue = static_cast<uint8>(Layer.Activation);
+			Ar << Layer.NumInputs << Layer.NumOutputs << Layer.Stride << Layer.Weights << Layer.Bias;
+			Ar << ActivationValue << Layer.ActivationAlpha;
+			Layer.Activation = static_cast<EPR_MLPActivation>(ActivationValue);
+			return Ar;
+		}
+	};
+
+	void RunRows(const float* Inputs, float* Outputs, int32 NumRows) const;
+
+	TArray<FLayer> Layers;
+	int32 MaxStride = 0;
+};
@@ -5,25 +5,429 @@
 
 #include "NNE.h"
 #include "NNEModelData.h"
-#include "NNERuntimeORT/Private/NNERuntimeORT.h"
+#include "NNERuntimeCPU.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "ProceduralReverb/LogPrPartition.h"
+#include "ProceduralReverb/PR_Stats.h"
+#include "ProceduralReverb/Partition/Settings/ProceduralReverbSettings.h"
 
 
-PR_ReverbNet::PR_ReverbNet()
+#if !UE_BUILD_SHIPPING
+static TAutoConsoleVariable<bool> CVarInferenceCrossCheck(
+	TEXT("PR.Inference.CrossCheck"),
+	UE_BUILD_DEBUG != 0,
+	TEXT("Runs ORT next to the native backend and logs the largest difference between their outputs. On by default in debug builds"),
+	ECVF_Default
+);
+#endif // !UE_BUILD_SHIPPING
+
+
+namespace
+{
+constexpr uint32 NativeModelMagic = 0x50524D4C; // PRML
+
+// Bump whenever the header or FPR_NativeMLP's serialized layout changes
+constexpr uint32 NativeModelVersion = 2;
+}
+
+
+bool FPR_ReverbNet::Init(UNNEModelData* ModelData, int32 InMaxBatchSize, EPR_InferenceBackend Backend)
+{
+	NativeModel = FPR_NativeMLP();
+	ModelInstance.Reset();
+	Model.Reset();
+
+#if WITH_EDITOR
+	// Cooked builds may pick another backend than this session, keep their weights current either way
+	if (Backend != EPR_InferenceBackend::Native)
+	{
+		UpdateNativeModel(ModelData);
+	}
+#endif // WITH_EDITOR
+
+	const bool bNative = Backend == EPR_InferenceBackend::Native && InitNative(ModelData);
+
+	bool bNeedsORT = !bNative;
+#if !UE_BUILD_SHIPPING
+	bNeedsORT |= CVarInferenceCrossCheck.GetValueOnAnyThread();
+#endif // !UE_BUILD_SHIPPING
+
+	if (bNeedsORT && !InitORT(ModelData, InMaxBatchSize) && !bNative)
+	{
+		return false;
+	}
+
+	if (bNative && ModelInstance.IsValid()
+		&& (NativeModel.GetNumInputs() != NumInputs || NativeModel.GetNumOutputs() != NumOutputs))
+	{
+		UE_LOG(LogPrPartition, Warning, TEXT("Native model shape doesn't match the ORT model, using ORT"));
+		NativeModel = FPR_NativeMLP();
+	}
+
+	if (NativeModel.IsValid())
+	{
+		NumInputs = NativeModel.GetNumInputs();
+		NumOutputs = NativeModel.GetNumOutputs();
+		UE_LOG(LogPrPartition, Log, TEXT("Reverb model ready: %d inputs, %d outputs, native backend"), NumInputs, NumOutputs);
+	}
+
+	return true;
+}
+
+FString FPR_ReverbNet::GetNativeModelPath(const UNNEModelData* ModelData)
+{
+	// /Game/Models/ReverbNet -> Content/ProceduralReverb/Game/Models/ReverbNet.prmodel
+	FString PackageName = ModelData->GetOutermost()->GetName();
+	PackageName.RemoveFromStart(TEXT("/"));
+	return FPaths::ProjectContentDir() / TEXT("ProceduralReverb") / PackageName + TEXT(".prmodel");
+}
+
+bool FPR_ReverbNet::InitNative(UNNEModelData* ModelData)
+{
+	const FString NativeModelPath = GetNativeModelPath(ModelData);
+
+	// The source file is only kept in editor data, cooked assets carry the runtime specific format instead
+	if (ModelData->GetFileType() != TEXT("onnx") || ModelData->GetFileData().IsEmpty())
+	{
+		if (LoadNativeModel(NativeModelPath, ModelData->GetFileId()))
+		{
+			return true;
+		}
+
+		UE_LOG(LogPrPartition, Log, TEXT("%s has no ONNX data or saved weights for the native backend, using ORT"), *GetNameSafe(ModelData));
+		return false;
+	}
+
+	if (!NativeModel.LoadFromONNX(ModelData->GetFileData()))
+	{
+		UE_LOG(LogPrPartition, Log, TEXT("%s can't run on the native backend, using ORT"), *GetNameSafe(ModelData));
+		return false;
+	}
+
+#if WITH_EDITOR
+	SaveNativeModel(NativeModel, ModelData->GetFileId(), NativeModelPath);
+#endif // WITH_EDITOR
+
+	return true;
+}
+
+bool FPR_ReverbNet::LoadNativeModel(const FString& FilePath, const FGuid& SourceId)
+{
+	TArray<uint8> Bytes;
+	if (!FFileHelper::LoadFileToArray(Bytes, *FilePath, FILEREAD_Silent))
+	{
+		return false;
+	}
+
+	FMemoryReader Reader(Bytes);
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	FGuid FileSourceId;
+	Reader << Magic << Version;
+	if (!Reader.IsError() && Magic == NativeModelMagic && Version == NativeModelVersion)
+	{
+		Reader << FileSourceId;
+		if (!Reader.IsError() && FileSourceId != SourceId)
+		{
+			UE_LOG(LogPrPartition, Warning, TEXT("Native model weights %s were saved from another version of the model, using ORT"), *FilePath);
+			return false;
+		}
+	}
+
+	if (Reader.IsError() || Magic != NativeModelMagic || Version != NativeModelVersion || !NativeModel.Serialize(Reader))
+	{
+		UE_LOG(LogPrPartition, Warning, TEXT("Native model weights %s are unsupported or corrupt"), *FilePath);
+		NativeModel = FPR_NativeMLP();
+		return false;
+	}
+
+	UE_LOG(LogPrPartition, Log, TEXT("Loaded native model weights from %s"), *FilePath);
+	return true;
+}
+
+#if WITH_EDITOR
+bool FPR_ReverbNet::UpdateNativeModel(UNNEModelData* ModelData)
+{
+	FPR_NativeMLP ParsedModel;
+	if (!ModelData || ModelData->GetFileType() != TEXT("onnx") || !ParsedModel.LoadFromONNX(ModelData->GetFileData()))
+	{
+		return false;
+	}
+
+	SaveNativeModel(ParsedModel, ModelData->GetFileId(), GetNativeModelPath(ModelData));
+	return true;
+}
+
+void FPR_ReverbNet::SaveNativeModel(FPR_NativeMLP& InNativeModel, const FGuid& SourceId, const FString& FilePath)
+{
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+
+	uint32 Magic = NativeModelMagic;
+	uint32 Version = NativeModelVersion;
+	FGuid FileSourceId = SourceId;
+	Writer << Magic << Version << FileSourceId;
+	InNativeModel.Serialize(Writer);
+
+	// Every editor session parses the model again, only touch the file when the weights changed
+	TArray<uint8> ExistingBytes;
+	if (FFileHelper::LoadFileToArray(ExistingBytes, *FilePath, FILEREAD_Silent) && ExistingBytes == Bytes)
+	{
+		return;
+	}
+
+	// Written next to the target and moved into place, so readers never see a partial file
+	const FString TempFilePath = FString::Printf(TEXT("%s.%u.tmp"), *FilePath, FPlatformProcess::GetCurrentProcessId());
+	if (Writer.IsError() || !FFileHelper::SaveArrayToFile(Bytes, *TempFilePath)
+		|| !IFileManager::Get().Move(*FilePath, *TempFilePath, true, true))
+	{
+		IFileManager::Get().Delete(*TempFilePath, false, false, true);
+		UE_LOG(LogPrPartition, Warning, TEXT("Failed to write native model weights to %s, cooked builds will use ORT"), *FilePath);
+		return;
+	}
+
+	UE_LOG(LogPrPartition, Log, TEXT("Saved native model weights to %s (%d bytes)"), *FilePath, Bytes.Num());
+}
+#endif // WITH_EDITOR
+
+bool FPR_ReverbNet::InitORT(UNNEModelData* ModelData, int32 InMaxBatchSize)
 {
-	// Create the model from a neural network model data asset
-	TObjectPtr<UNNEModelData> ModelData = LoadObject<UNNEModelData>(GetTransientPackage(), TEXT("C:/Users/anton/OneDrive/Programming/KPI-FICT-M/diploma/reverb_model.onnx"));
 	TWeakInterfacePtr<INNERuntimeCPU> Runtime = UE::NNE::GetRuntime<INNERuntimeCPU>(FString("NNERuntimeORTCpu"));
-	TSharedPtr<UE::NNE::IModelCPU> Model = Runtime->CreateModelCPU(ModelData);
-	TSharedPtr<UE::NNE::IModelInstanceCPU> ModelInstance = Model->CreateModelInstanceCPU();
- 
-	// Prepare the model given a certain input size
-	// ModelInstance->SetInputTensorShapes(InputShapes);
- 
-	// Run the model passing caller owned CPU memory
-	// ModelInstance->RunSync(Inputs, Outputs);
+	if (!Runtime.IsValid())
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("NNERuntimeORTCpu runtime is not available"));
+		return false;
+	}
+
+	Model = Runtime->CreateModelCPU(ModelData);
+	if (!Model.IsValid())
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Failed to create the model from %s"), *GetNameSafe(ModelData));
+		return false;
+	}
+
+	TSharedPtr<UE::NNE::IModelInstanceCPU> NewModelInstance = Model->CreateModelInstanceCPU();
+	if (!NewModelInstance.IsValid())
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Failed to create the model instance from %s"), *GetNameSafe(ModelData));
+		return false;
+	}
+
+	TConstArrayView<UE::NNE::FTensorDesc> InputTensorDescs = NewModelInstance->GetInputTensorDescs();
+	TConstArrayView<UE::NNE::FTensorDesc> OutputTensorDescs = NewModelInstance->GetOutputTensorDescs();
+	if (InputTensorDescs.Num() != 1 || OutputTensorDescs.Num() != 1)
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Only models with a single input and a single output tensor are supported"));
+		return false;
+	}
+
+	const UE::NNE::FSymbolicTensorShape SymbolicInputTensorShape = InputTensorDescs[0].GetShape();
+	const UE::NNE::FSymbolicTensorShape SymbolicOutputTensorShape = OutputTensorDescs[0].GetShape();
+	TConstArrayView<int32> InputShape = SymbolicInputTensorShape.GetData();
+	TConstArrayView<int32> OutputShape = SymbolicOutputTensorShape.GetData();
+	if (InputShape.IsEmpty() || OutputShape.IsEmpty())
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Model tensors must have at least one dimension"));
+		return false;
+	}
+
+	// Only the leading batch dimension is allowed to be variable
+	for (int32 Index = 1; Index < InputShape.Num(); ++Index)
+	{
+		if (InputShape[Index] < 0)
+		{
+			UE_LOG(LogPrPartition, Error, TEXT("Only the leading input dimension can be variable"));
+			return false;
+		}
+	}
+
+	for (int32 Index = 1; Index < OutputShape.Num(); ++Index)
+	{
+		if (OutputShape[Index] < 0)
+		{
+			UE_LOG(LogPrPartition, Error, TEXT("Only the leading output dimension can be variable"));
+			return false;
+		}
+	}
+
+	InputDimensions.Reset();
+	InputDimensions.Append(InputShape.GetData(), InputShape.Num());
+	NumInputs = InputShape.Last();
+	NumOutputs = OutputShape.Last();
+	bDynamicBatch = InputShape.Num() > 1 && InputShape[0] < 0;
+
+	if (NumInputs <= 0 || NumOutputs <= 0)
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Model feature dimensions must be concrete"));
+		return false;
+	}
+
+	ModelInstance = NewModelInstance;
+	BoundBatchSize = 0;
+
+	if (bDynamicBatch)
+	{
+		BatchSize = FMath::Max(1, InMaxBatchSize);
+	}
+	else
+	{
+		// Concrete shape, the whole tensor is split into rows of features
+		const UE::NNE::FTensorShape InputTensorShape = UE::NNE::FTensorShape::MakeFromSymbolic(SymbolicInputTensorShape);
+		BatchSize = FMath::Max<int32>(1, InputTensorShape.Volume() / NumInputs);
+		if (!SetBoundBatchSize(BatchSize))
+		{
+			ModelInstance.Reset();
+			return false;
+		}
+	}
+
+	UE_LOG(LogPrPartition, Log, TEXT("Reverb model ready: %d inputs, %d outputs, %s batch of %d"),
+		NumInputs,
+		NumOutputs,
+		bDynamicBatch ? TEXT("dynamic") : TEXT("fixed"),
+		BatchSize);
+
+	return true;
 }
 
-PR_ReverbNet::~PR_ReverbNet()
+bool FPR_ReverbNet::SetBoundBatchSize(int32 InBatchSize)
 {
+	if (BoundBatchSize == InBatchSize)
+	{
+		return true;
+	}
+
+	TArray<uint32, TInlineAllocator<4>> Dimensions;
+	for (const int32 Dimension : InputDimensions)
+	{
+		Dimensions.Add(static_cast<uint32>(Dimension));
+	}
+
+	if (bDynamicBatch)
+	{
+		Dimensions[0] = InBatchSize;
+	}
+
+	const TArray<UE::NNE::FTensorShape> InputTensorShapes = {UE::NNE::FTensorShape::Make(Dimensions)};
+	if (ModelInstance->SetInputTensorShapes(InputTensorShapes) != UE::NNE::EResultStatus::Ok)
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Failed to set the model input shape for a batch of %d"), InBatchSize);
+		BoundBatchSize = 0;
+		return false;
+	}
+
+	BoundBatchSize = InBatchSize;
+	return true;
+}
+
+bool FPR_ReverbNet::Run(TConstArrayView<float> Inputs, TArrayView<float> Outputs)
+{
+	if (!NativeModel.IsValid())
+	{
+		return RunORT(Inputs, Outputs);
+	}
+
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE(FPR_NativeMLP::Run);
+		NativeModel.Run(Inputs, Outputs);
+	}
+
+	INC_DWORD_STAT(STAT_PR_InferenceCalls);
+	SET_DWORD_STAT(STAT_PR_InferenceBatchSize, Inputs.Num() / NumInputs);
+
+#if !UE_BUILD_SHIPPING
+	if (ModelInstance.IsValid() && CVarInferenceCrossCheck.GetValueOnAnyThread())
+	{
+		TArray<float> ReferenceOutputs;
+		ReferenceOutputs.SetNumUninitialized(Outputs.Num());
+		if (RunORT(Inputs, ReferenceOutputs))
+		{
+			float MaxDifference = 0.0f;
+			for (int32 Index = 0; Index < Outputs.Num(); ++Index)
+			{
+				MaxDifference = FMath::Max(MaxDifference, FMath::Abs(Outputs[Index] - ReferenceOutputs[Index]));
+			}
+
+			UE_LOG(LogPrPartition, Log, TEXT("Inference cross check: %d rows, max difference to ORT %g"),
+				Inputs.Num() / NumInputs,
+				MaxDifference);
+		}
+	}
+#endif // !UE_BUILD_SHIPPING
+
+	return true;
+}
+
+bool FPR_ReverbNet::RunORT(TConstArrayView<float> Inputs, TArrayView<float> Outputs)
+{
+	if (!ModelInstance.IsValid())
+	{
+		return false;
+	}
+
+	check(Inputs.Num() % NumInputs == 0);
+	const int32 NumRows = Inputs.Num() / NumInputs;
+	check(Outputs.Num() == NumRows * NumOutputs);
+
+	for (int32 FirstRow = 0; FirstRow < NumRows; FirstRow += BatchSize)
+	{
+		const int32 ChunkRows = FMath::Min(BatchSize, NumRows - FirstRow);
+		const float* ChunkInputs = Inputs.GetData() + static_cast<SIZE_T>(FirstRow) * NumInputs;
+		float* ChunkOutputs = Outputs.GetData() + static_cast<SIZE_T>(FirstRow) * NumOutputs;
+
+		if (bDynamicBatch || ChunkRows == BatchSize)
+		{
+			if (!RunChunk(ChunkInputs, ChunkOutputs, ChunkRows))
+			{
+				return false;
+			}
+			continue;
+		}
+
+		// Trailing chunk of a fixed batch model, pad it up to the model's batch
+		PaddedInputs.SetNumZeroed(BatchSize * NumInputs);
+		PaddedOutputs.SetNumUninitialized(BatchSize * NumOutputs);
+		FMemory::Memcpy(PaddedInputs.GetData(), ChunkInputs, ChunkRows * NumInputs * sizeof(float));
+
+		if (!RunChunk(PaddedInputs.GetData(), PaddedOutputs.GetData(), BatchSize))
+		{
+			return false;
+		}
+
+		FMemory::Memcpy(ChunkOutputs, PaddedOutputs.GetData(), ChunkRows * NumOutputs * sizeof(float));
+	}
+
+	return true;
+}
+
+bool FPR_ReverbNet::RunChunk(const float* Inputs, float* Outputs, int32 NumRows)
+{
+	if (!SetBoundBatchSize(NumRows))
+	{
+		return false;
+	}
+
+	UE::NNE::FTensorBindingCPU InputBinding;
+	InputBinding.Data = const_cast<float*>(Inputs);
+	InputBinding.SizeInBytes = NumRows * NumInputs * sizeof(float);
+
+	UE::NNE::FTensorBindingCPU OutputBinding;
+	OutputBinding.Data = Outputs;
+	OutputBinding.SizeInBytes = NumRows * NumOutputs * sizeof(float);
+
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_ReverbNet::RunChunk);
+	INC_DWORD_STAT(STAT_PR_InferenceCalls);
+	SET_DWORD_STAT(STAT_PR_InferenceBatchSize, NumRows);
+
+	UE::NNE::EResultStatus Result = ModelInstance->RunSync(MakeArrayView(&InputBinding, 1), MakeArrayView(&OutputBinding, 1));
+	if (Result == UE::NNE::EResultStatus::Fail)
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Failed to run the model on a batch of %d"), NumRows);
+		return false;
+	}
 
+	return true;
 }
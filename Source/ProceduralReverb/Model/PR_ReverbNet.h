@@ -3,13 +3,81 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "PR_NativeMLP.h"
+#include "ProceduralReverb/Core/PRCore_Inference.h"
+
+class UNNEModelData;
+enum class EPR_InferenceBackend : uint8;
+
+namespace UE::NNE
+{
+class IModelCPU;
+class IModelInstanceCPU;
+}
 
 /**
- * 
+ * Reverb model instance that evaluates many rows of features per RunSync call.
+ * Models with a variable leading dimension run in chunks of the requested batch size,
+ * models with concrete shapes run in chunks of their own batch size.
+ * The native backend evaluates the whole input at once and keeps ORT around only as a fallback
+ * or, with PR.Inference.CrossCheck, to validate its results.
+ * Cooked assets drop the ONNX source, so the editor saves the parsed weights to a sidecar file next to the bakes
+ * and cooked builds load the native backend from there. The sidecar carries the file id of the model it was parsed
+ * from, cooked builds fall back to ORT when the model changed since.
  */
-class PROCEDURALREVERB_API PR_ReverbNet
+class PROCEDURALREVERB_API FPR_ReverbNet : public PRCore::IReverbModel
 {
 public:
-	PR_ReverbNet();
-	~PR_ReverbNet();
+	bool Init(UNNEModelData* ModelData, int32 InMaxBatchSize, EPR_InferenceBackend Backend);
+	bool IsValid() const { return NativeModel.IsValid() || ModelInstance.IsValid(); }
+	bool IsNative() const { return NativeModel.IsValid(); }
+
+	virtual int32 GetNumInputs() const override { return NumInputs; }
+	virtual int32 GetNumOutputs() const override { return NumOutputs; }
+	int32 GetBatchSize() const { return BatchSize; }
+	bool HasDynamicBatch() const { return bDynamicBatch; }
+
+	/**
+	 * Evaluates rows stored contiguously in Inputs, GetNumInputs() floats each.
+	 * Outputs are written in place, GetNumOutputs() floats per row.
+	 */
+	bool Run(TConstArrayView<float> Inputs, TArrayView<float> Outputs);
+	virtual bool Run(const float* Inputs, float* Outputs, int32 NumRows) override
+	{
+		return Run(MakeArrayView(Inputs, NumRows * NumInputs), MakeArrayView(Outputs, NumRows * NumOutputs));
+	}
+
+	/** Content/ProceduralReverb/<package>.prmodel, staged with the game like the baked partitions */
+	static FString GetNativeModelPath(const UNNEModelData* ModelData);
+#if WITH_EDITOR
+	/** Parses the ONNX data and rewrites the sidecar when it is out of date, whatever backend runs. False without usable weights */
+	static bool UpdateNativeModel(UNNEModelData* ModelData);
+#endif // WITH_EDITOR
+
+private:
+	bool InitNative(UNNEModelData* ModelData);
+	bool LoadNativeModel(const FString& FilePath, const FGuid& SourceId);
+#if WITH_EDITOR
+	static void SaveNativeModel(FPR_NativeMLP& InNativeModel, const FGuid& SourceId, const FString& FilePath);
+#endif // WITH_EDITOR
+	bool InitORT(UNNEModelData* ModelData, int32 InMaxBatchSize);
+	bool RunORT(TConstArrayView<float> Inputs, TArrayView<float> Outputs);
+	bool SetBoundBatchSize(int32 InBatchSize);
+	bool RunChunk(const float* Inputs, float* Outputs, int32 NumRows);
+
+	FPR_NativeMLP NativeModel;
+
+	TSharedPtr<UE::NNE::IModelCPU> Model;
+	TSharedPtr<UE::NNE::IModelInstanceCPU> ModelInstance;
+
+	TArray<int32, TInlineAllocator<4>> InputDimensions;
+	int32 NumInputs = 0;
+	int32 NumOutputs = 0;
+	int32 BatchSize = 1;
+	int32 BoundBatchSize = 0;
+	bool bDynamicBatch = false;
+
+	// Only used to pad the trailing chunk of models with a fixed batch size
+	TArray<float> PaddedInputs;
+	TArray<float> PaddedOutputs;
 };
@@ -0,0 +1,23 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PR_Stats.h"
+
+DEFINE_STAT(STAT_PR_ListenerUpdate);
+DEFINE_STAT(STAT_PR_PartitionBuild);
+DEFINE_STAT(STAT_PR_AcousticProbes);
+DEFINE_STAT(STAT_PR_Inference);
+
+DEFINE_STAT(STAT_PR_ListenerQueries);
+DEFINE_STAT(STAT_PR_NodesVisited);
+
+DEFINE_STAT(STAT_PR_NumLeaves);
+DEFINE_STAT(STAT_PR_TracesIssued);
+DEFINE_STAT(STAT_PR_InferenceCalls);
+DEFINE_STAT(STAT_PR_InferenceBatchSize);
+DEFINE_STAT(STAT_PR_InferenceCacheLookups);
+DEFINE_STAT(STAT_PR_InferenceCacheHits);
+
+DEFINE_STAT(STAT_PR_PartitionMemory);
+DEFINE_STAT(STAT_PR_AcousticDataMemory);
+DEFINE_STAT(STAT_PR_ReverbGridMemory);
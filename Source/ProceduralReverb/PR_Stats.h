@@ -0,0 +1,30 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "Stats/Stats.h"
+
+// stat ProceduralReverb
+DECLARE_STATS_GROUP(TEXT("ProceduralReverb"), STATGROUP_ProceduralReverb, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Listener Update"), STAT_PR_ListenerUpdate, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Partition Build"), STAT_PR_PartitionBuild, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Acoustic Probes"), STAT_PR_AcousticProbes, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Inference"), STAT_PR_Inference, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Listener Queries"), STAT_PR_ListenerQueries, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Nodes Visited"), STAT_PR_NodesVisited, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+
+// Totals since the partition was generated, they don't reset every frame
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Leaves"), STAT_PR_NumLeaves, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Traces Issued"), STAT_PR_TracesIssued, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Inference Calls"), STAT_PR_InferenceCalls, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Inference Batch Size"), STAT_PR_InferenceBatchSize, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Inference Cache Lookups"), STAT_PR_InferenceCacheLookups, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Inference Cache Hits"), STAT_PR_InferenceCacheHits, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Partition Memory"), STAT_PR_PartitionMemory, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Acoustic Data Memory"), STAT_PR_AcousticDataMemory, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Reverb Grid Memory"), STAT_PR_ReverbGridMemory, STATGROUP_ProceduralReverb, PROCEDURALREVERB_API);
@@ -0,0 +1,60 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PR_LeafPriorityQueue.h"
+
+
+void FPR_LeafPriorityQueue::Reset()
+{
+	Heap.Reset();
+	Positions.Reset();
+}
+
+void FPR_LeafPriorityQueue::Add(const FPR_PartitionTree& Tree, int32 LeafIndex)
+{
+	Heap.HeapPush({GetDistance(Tree, LeafIndex), LeafIndex});
+}
+
+void FPR_LeafPriorityQueue::UpdatePositions(const FPR_PartitionTree& Tree, const FPositions& InPositions, float RefreshDistance)
+{
+	bool bMoved = InPositions.Num() != Positions.Num();
+	for (int32 Index = 0; Index < InPositions.Num() && !bMoved; ++Index)
+	{
+		bMoved = FVector::DistSquared(InPositions[Index], Positions[Index]) > FMath::Square(RefreshDistance);
+	}
+
+	if (!bMoved)
+	{
+		return;
+	}
+
+	Positions = InPositions;
+	for (FEntry& Entry : Heap)
+	{
+		Entry.Distance = GetDistance(Tree, Entry.LeafIndex);
+	}
+	Heap.Heapify();
+}
+
+void FPR_LeafPriorityQueue::Pop(int32 Count, TArray<int32>& OutLeaves)
+{
+	const int32 NumLeaves = FMath::Min(Count, Heap.Num());
+	OutLeaves.Reserve(OutLeaves.Num() + NumLeaves);
+	for (int32 Index = 0; Index < NumLeaves; ++Index)
+	{
+		FEntry Entry;
+		Heap.HeapPop(Entry, EAllowShrinking::No);
+		OutLeaves.Add(Entry.LeafIndex);
+	}
+}
+
+float FPR_LeafPriorityQueue::GetDistance(const FPR_PartitionTree& Tree, int32 LeafIndex) const
+{
+	// Without positions every leaf is equally close and leaves go in depth first order, which keeps regions compact
+	float Distance = Positions.IsEmpty() ? 0.0f : TNumericLimits<float>::Max();
+	for (const FVector& Position : Positions)
+	{
+		Distance = FMath::Min(Distance, Tree.DistanceToLeaf(LeafIndex, Position));
+	}
+	return Distance;
+}
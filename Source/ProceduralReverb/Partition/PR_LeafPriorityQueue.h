@@ -0,0 +1,44 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PR_PartitionTree.h"
+
+
+/**
+ * Leaves ordered by their distance to a few priority positions, closest first and by leaf index on ties.
+ * Kept as a heap, distances are only recomputed once the positions moved further than the refresh distance.
+ */
+struct FPR_LeafPriorityQueue
+{
+	using FPositions = TArray<FVector, TInlineAllocator<8>>;
+
+	void Reset();
+	void Add(const FPR_PartitionTree& Tree, int32 LeafIndex);
+	/** Rekeys every leaf when a position was added, removed or moved further than RefreshDistance */
+	void UpdatePositions(const FPR_PartitionTree& Tree, const FPositions& InPositions, float RefreshDistance);
+	/** Removes up to Count closest leaves and appends them to OutLeaves */
+	void Pop(int32 Count, TArray<int32>& OutLeaves);
+
+	int32 Num() const { return Heap.Num(); }
+	bool IsEmpty() const { return Heap.IsEmpty(); }
+
+private:
+	struct FEntry
+	{
+		float Distance = 0.0f;
+		int32 LeafIndex = INDEX_NONE;
+
+		bool operator<(const FEntry& Other) const
+		{
+			return Distance < Other.Distance || (Distance == Other.Distance && LeafIndex < Other.LeafIndex);
+		}
+	};
+
+	float GetDistance(const FPR_PartitionTree& Tree, int32 LeafIndex) const;
+
+	TArray<FEntry> Heap;
+	/** Positions the distances were computed for */
+	FPositions Positions;
+};
@@ -0,0 +1,272 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PR_PartitionBake.h"
+
+#include "EngineUtils.h"
+#include "PR_PartitionTree.h"
+#include "Misc/FileHelper.h"
+#include "Misc/PackageName.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "ProceduralReverb/LogPrPartition.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "Settings/ProceduralReverbSettings.h"
+
+
+namespace
+{
+constexpr uint32 BakeMagic = 0x50524246; // PRBF
+
+// Bump whenever the file layout or the generation algorithm changes
+constexpr uint32 BakeVersion = 6;
+
+FSHAHash HashBytes(const TArray<uint8>& Bytes)
+{
+	FSHAHash Hash;
+	FSHA1::HashBuffer(Bytes.GetData(), Bytes.Num(), Hash.Hash);
+	return Hash;
+}
+
+/**
+ * Content of a mesh as far as traces see it. The body setup GUID is renewed whenever the mesh is rebuilt or its collision
+ * edited, the bounds follow changes of the render geometry. Both are cooked, so editor and cooked builds agree on the key.
+ */
+FString DescribeMeshContent(const UStaticMesh* Mesh)
+{
+	const UBodySetup* BodySetup = Mesh->GetBodySetup();
+	return FString::Printf(TEXT("%s|%s"),
+		BodySetup ? *BodySetup->BodySetupGuid.ToString() : TEXT("NoBodySetup"),
+		*Mesh->GetBounds().ToString());
+}
+
+FSHAHash ComputeGeometryHash(const UWorld* World)
+{
+	// Same set of components the partition bounds are taken from
+	TArray<FString> Entries;
+	TMap<const UStaticMesh*, FString> MeshContents;
+	for (TActorIterator<AActor> It(World); It; ++It)
+	{
+		TArray<UStaticMeshComponent*> Components;
+		It->GetComponents<UStaticMeshComponent>(Components);
+
+		for (const UStaticMeshComponent* Component : Components)
+		{
+			if (Component->Mobility != EComponentMobility::Static || !IsValid(Component->GetStaticMesh()))
+			{
+				continue;
+			}
+
+			// Meshes placed many times are described once
+			const UStaticMesh* Mesh = Component->GetStaticMesh();
+			const FString* MeshContent = MeshContents.Find(Mesh);
+			if (!MeshContent)
+			{
+				MeshContent = &MeshContents.Add(Mesh, DescribeMeshContent(Mesh));
+			}
+
+			Entries.Add(FString::Printf(TEXT("%s|%s|%s|%s"),
+				*UWorld::RemovePIEPrefix(Component->GetPathName()),
+				*Mesh->GetPathName(),
+				**MeshContent,
+				*Component->GetComponentTransform().ToString()));
+		}
+	}
+
+	// Actor iteration order is not guaranteed to be stable between loads
+	Entries.Sort();
+
+	FSHA1 Sha;
+	for (const FString& Entry : Entries)
+	{
+		Sha.UpdateWithString(*Entry, Entry.Len());
+	}
+	Sha.Final();
+
+	FSHAHash Hash;
+	Sha.GetHash(Hash.Hash);
+	return Hash;
+}
+
+FSHAHash ComputeSettingsHash()
+{
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+
+	uint32 Version = BakeVersion;
+	int32 MaxPartitionDepth = Settings->MaxPartitionDepth;
+	float RayDistance = Settings->RayDistance;
+	bool bAdaptivePartition = Settings->bAdaptivePartition;
+	float MinLeafVolume = Settings->MinLeafVolume;
+	int32 MaxLeafCount = Settings->MaxLeafCount;
+	Writer << Version << MaxPartitionDepth << RayDistance << bAdaptivePartition << MinLeafVolume << MaxLeafCount;
+
+	uint8 BoundsMode = static_cast<uint8>(Settings->BoundsMode);
+	TArray<FName> BoundsExcludedActorTags = Settings->BoundsExcludedActorTags;
+	TArray<FName> BoundsExcludedCollisionProfiles = Settings->BoundsExcludedCollisionProfiles;
+	Writer << BoundsMode << BoundsExcludedActorTags << BoundsExcludedCollisionProfiles;
+
+	uint8 ProbeRaySet = static_cast<uint8>(Settings->ProbeRaySet);
+	int32 ProbeRayCount = Settings->ProbeRayCount;
+	Writer << ProbeRaySet << ProbeRayCount;
+
+	bool bClassifyLeaves = Settings->bClassifyLeaves;
+	bool bNavigationBoundsArePlayable = Settings->bNavigationBoundsArePlayable;
+	TArray<FName> PlayableActorTags = Settings->PlayableActorTags;
+	float PlayableMargin = Settings->PlayableMargin;
+	Writer << bClassifyLeaves << bNavigationBoundsArePlayable << PlayableActorTags << PlayableMargin;
+
+	bool bBuildLeafVisibility = Settings->bBuildLeafVisibility;
+	float LeafVisibilityRadius = Settings->LeafVisibilityRadius;
+	Writer << bBuildLeafVisibility << LeafVisibilityRadius;
+
+	float ReverbPaletteTolerance = Settings->ReverbPaletteTolerance;
+	bool bMergeLeaves = Settings->bMergeLeaves;
+	Writer << ReverbPaletteTolerance << bMergeLeaves;
+
+	// The model runs on snapped distances when the cache is on
+	bool bInferenceCache = Settings->bInferenceCache;
+	float InferenceCacheResolution = bInferenceCache ? Settings->InferenceCacheResolution : 0.0f;
+	Writer << bInferenceCache << InferenceCacheResolution;
+
+	return HashBytes(Bytes);
+}
+
+FSHAHash ComputeModelHash()
+{
+	const FSoftObjectPath ModelPath = GetDefault<UProceduralReverbSettings>()->PreLoadedModelData.ToSoftObjectPath();
+
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+
+	FString ModelPathString = ModelPath.ToString();
+	Writer << ModelPathString;
+
+#if WITH_EDITOR
+	// Source asset content, cooked builds only ever see the cooked package
+	FString PackageFilename;
+	TArray<uint8> PackageBytes;
+	if (FPackageName::TryConvertLongPackageNameToFilename(
+			ModelPath.GetLongPackageName(),
+			PackageFilename,
+			FPackageName::GetAssetPackageExtension())
+		&& FFileHelper::LoadFileToArray(PackageBytes, *PackageFilename, FILEREAD_Silent))
+	{
+		FSHAHash PackageHash = HashBytes(PackageBytes);
+		Writer << PackageHash;
+	}
+#endif // WITH_EDITOR
+
+	return HashBytes(Bytes);
+}
+
+bool ReadHeader(FArchive& Ar, FPR_PartitionBakeKey& OutKey)
+{
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	Ar << Magic << Version;
+	if (Ar.IsError() || Magic != BakeMagic || Version != BakeVersion)
+	{
+		return false;
+	}
+
+	Ar << OutKey;
+	return !Ar.IsError();
+}
+}
+
+
+FPR_PartitionBakeKey FPR_PartitionBakeKey::Compute(const UWorld* World)
+{
+	FPR_PartitionBakeKey Key;
+	Key.GeometryHash = ComputeGeometryHash(World);
+	Key.SettingsHash = ComputeSettingsHash();
+	Key.ModelHash = ComputeModelHash();
+	return Key;
+}
+
+bool FPR_PartitionBakeKey::Matches(const FPR_PartitionBakeKey& Other) const
+{
+	bool bMatches = GeometryHash == Other.GeometryHash && SettingsHash == Other.SettingsHash;
+#if WITH_EDITOR
+	bMatches = bMatches && ModelHash == Other.ModelHash;
+#endif // WITH_EDITOR
+	return bMatches;
+}
+
+FArchive& operator<<(FArchive& Ar, FPR_PartitionBakeKey& Key)
+{
+	return Ar << Key.GeometryHash << Key.SettingsHash << Key.ModelHash;
+}
+
+
+FString FPR_PartitionBake::GetFilePath(const UWorld* World)
+{
+	// /Game/Maps/Level -> Content/ProceduralReverb/Game/Maps/Level.prbake
+	FString PackageName = UWorld::RemovePIEPrefix(World->GetOutermost()->GetName());
+	PackageName.RemoveFromStart(TEXT("/"));
+	return FPaths::ProjectContentDir() / TEXT("ProceduralReverb") / PackageName + TEXT(".prbake");
+}
+
+bool FPR_PartitionBake::Save(const FString& FilePath, const FPR_PartitionBakeKey& Key, FPR_PartitionTree& Tree)
+{
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+
+	uint32 Magic = BakeMagic;
+	uint32 Version = BakeVersion;
+	FPR_PartitionBakeKey KeyCopy = Key;
+	Writer << Magic << Version << KeyCopy;
+	Tree.Serialize(Writer);
+
+	if (Writer.IsError() || !FFileHelper::SaveArrayToFile(Bytes, *FilePath))
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Failed to write baked partition to %s"), *FilePath);
+		return false;
+	}
+
+	UE_LOG(LogPrPartition, Log, TEXT("Baked partition with %d leaves to %s (%d bytes)"), Tree.GetNumLeaves(), *FilePath, Bytes.Num());
+	return true;
+}
+
+bool FPR_PartitionBake::Load(const FString& FilePath, const FPR_PartitionBakeKey& Key, FPR_PartitionTree& OutTree)
+{
+	TArray<uint8> Bytes;
+	if (!FFileHelper::LoadFileToArray(Bytes, *FilePath, FILEREAD_Silent))
+	{
+		return false;
+	}
+
+	FMemoryReader Reader(Bytes);
+	FPR_PartitionBakeKey BakedKey;
+	if (!ReadHeader(Reader, BakedKey))
+	{
+		UE_LOG(LogPrPartition, Warning, TEXT("Baked partition %s has an unsupported format"), *FilePath);
+		return false;
+	}
+
+	if (!BakedKey.Matches(Key))
+	{
+		UE_LOG(LogPrPartition, Log, TEXT("Baked partition %s is stale"), *FilePath);
+		return false;
+	}
+
+	OutTree.Serialize(Reader);
+	if (Reader.IsError())
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Failed to read baked partition %s"), *FilePath);
+		OutTree.Reset();
+		return false;
+	}
+
+	UE_LOG(LogPrPartition, Log, TEXT("Loaded baked partition with %d leaves from %s"), OutTree.GetNumLeaves(), *FilePath);
+	return true;
+}
+
+bool FPR_PartitionBake::LoadKey(const FString& FilePath, FPR_PartitionBakeKey& OutKey)
+{
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*FilePath, FILEREAD_Silent));
+	return Reader && ReadHeader(*Reader, OutKey);
+}
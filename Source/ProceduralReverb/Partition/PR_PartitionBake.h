@@ -0,0 +1,41 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/SecureHash.h"
+
+struct FPR_PartitionTree;
+
+
+/**
+ * Identifies the inputs baked data was generated from.
+ */
+struct FPR_PartitionBakeKey
+{
+	static FPR_PartitionBakeKey Compute(const UWorld* World);
+
+	/** The model hash is only checked in editor builds, cooked builds can't hash the source asset */
+	bool Matches(const FPR_PartitionBakeKey& Other) const;
+
+	friend FArchive& operator<<(FArchive& Ar, FPR_PartitionBakeKey& Key);
+
+	/** Placement of every static mesh and the content its collision and render geometry were built from */
+	FSHAHash GeometryHash;
+	FSHAHash SettingsHash;
+	FSHAHash ModelHash;
+};
+
+
+/**
+ * Sidecar file with the partition, the acoustic features and the reverb settings of every leaf,
+ * stored under Content/ProceduralReverb so it is staged with the game.
+ */
+struct FPR_PartitionBake
+{
+	static FString GetFilePath(const UWorld* World);
+
+	static bool Save(const FString& FilePath, const FPR_PartitionBakeKey& Key, FPR_PartitionTree& Tree);
+	static bool Load(const FString& FilePath, const FPR_PartitionBakeKey& Key, FPR_PartitionTree& OutTree);
+	static bool LoadKey(const FString& FilePath, FPR_PartitionBakeKey& OutKey);
+};
@@ -0,0 +1,1089 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PR_PartitionTree.h"
+
+#include "Async/ParallelFor.h"
+#include "EngineUtils.h"
+#include "NavMesh/NavMeshBoundsVolume.h"
+#include "PR_WorldQueries.h"
+#include "ProceduralReverb/Core/PRCore_Inference.h"
+#include "ProceduralReverb/Core/PRCore_InferenceCache.h"
+#include "ProceduralReverb/Core/PRCore_Reverb.h"
+#include "ProceduralReverb/LogPrPartition.h"
+#include "ProceduralReverb/Model/PR_ReverbNet.h"
+#include "ProceduralReverb/PR_Stats.h"
+#include "Settings/ProceduralReverbSettings.h"
+
+
+#if UE_ENABLE_DEBUG_DRAWING
+static TAutoConsoleVariable<int32> CVarDebugPartition(
+	TEXT("PR.Debug.Partition"),
+	0,
+	TEXT("Shows world partition debug"),
+	ECVF_Default
+);
+#endif // UE_ENABLE_DEBUG_DRAWING
+
+static_assert(static_cast<uint8>(EPR_ProbeRaySet::Fibonacci) == static_cast<uint8>(PRCore::EProbeRaySet::Fibonacci),
+	"EPR_ProbeRaySet has to mirror PRCore::EProbeRaySet");
+static_assert(sizeof(PRCore::ELeafSpace) == 1 && static_cast<uint8>(PRCore::ELeafSpace::Playable) == 0,
+	"Leaf spaces double as the skip mask of the core queries");
+
+
+namespace
+{
+/** Counts read from a file are rejected when negative or when the rest of the file can't hold that many elements */
+bool SerializeCount(FArchive& Ar, int32& Num, SIZE_T MinElementSize)
+{
+	Ar << Num;
+	if (!Ar.IsLoading())
+	{
+		return true;
+	}
+
+	const int64 RemainingSize = Ar.TotalSize() - Ar.Tell();
+	if (Ar.IsError() || Num < 0 || (Ar.TotalSize() >= 0 && static_cast<int64>(Num) * static_cast<int64>(MinElementSize) > RemainingSize))
+	{
+		Ar.SetError();
+		Num = 0;
+		return false;
+	}
+	return true;
+}
+
+template <typename ElementType>
+void SerializeColumn(FArchive& Ar, std::vector<ElementType>& Column)
+{
+	int32 Num = static_cast<int32>(Column.size());
+	if (!SerializeCount(Ar, Num, sizeof(ElementType)))
+	{
+		return;
+	}
+
+	if (Ar.IsLoading())
+	{
+		Column.resize(Num);
+	}
+
+	Ar.Serialize(Column.data(), Column.size() * sizeof(ElementType));
+}
+
+void SerializeLeafBounds(FArchive& Ar, PRCore::FLeafBounds& LeafBounds)
+{
+	SerializeColumn(Ar, LeafBounds.MinX);
+	SerializeColumn(Ar, LeafBounds.MinY);
+	SerializeColumn(Ar, LeafBounds.MinZ);
+	SerializeColumn(Ar, LeafBounds.MaxX);
+	SerializeColumn(Ar, LeafBounds.MaxY);
+	SerializeColumn(Ar, LeafBounds.MaxZ);
+}
+
+void SerializeNodes(FArchive& Ar, std::vector<PRCore::FNode>& Nodes)
+{
+	// Split position, first child, leaf index and split axis
+	constexpr SIZE_T SerializedNodeSize = sizeof(float) + 2 * sizeof(uint32) + sizeof(uint8);
+	int32 Num = static_cast<int32>(Nodes.size());
+	if (!SerializeCount(Ar, Num, SerializedNodeSize))
+	{
+		return;
+	}
+
+	if (Ar.IsLoading())
+	{
+		Nodes.resize(Num);
+	}
+
+	for (PRCore::FNode& Node : Nodes)
+	{
+		Ar << Node.SplitPosition << Node.FirstChild << Node.LeafIndex << Node.SplitAxis;
+	}
+}
+}
+
+
+void FPR_AcousticData::Serialize(FArchive& Ar)
+{
+	int32 NumDirections = PRCore::NumDirections;
+	Ar << NumDirections;
+	if (NumDirections != PRCore::NumDirections)
+	{
+		Ar.SetError();
+		return;
+	}
+
+	for (float& Distance : Features.Distances)
+	{
+		Ar << Distance;
+	}
+
+	for (uint8& Material : Features.Materials)
+	{
+		Ar << Material;
+	}
+
+	Ar << ReverbIndex;
+}
+
+
+FPR_PartitionBuildParams FPR_PartitionBuildParams::FromSettings(const UWorld* World)
+{
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+
+	FPR_PartitionBuildParams Params;
+	Params.MaxDepth = Settings->MaxPartitionDepth;
+	Params.MinLeafVolume = Settings->MinLeafVolume * 1.0e6;
+	Params.MaxLeafCount = Settings->MaxLeafCount;
+	Params.bAdaptive = Settings->bAdaptivePartition;
+	Params.ProbeDistance = Settings->RayDistance;
+	Params.bClassifyLeaves = Settings->bClassifyLeaves;
+	Params.PlayableMargin = Settings->PlayableMargin;
+	if (!World || !Settings->bClassifyLeaves)
+	{
+		return Params;
+	}
+
+	for (TActorIterator<AActor> It(World); It; ++It)
+	{
+		const bool bNavigationBounds = Settings->bNavigationBoundsArePlayable && It->IsA<ANavMeshBoundsVolume>();
+		if (bNavigationBounds || Settings->PlayableActorTags.ContainsByPredicate([&It](const FName& Tag) { return It->ActorHasTag(Tag); }))
+		{
+			const FBox Bounds = It->GetComponentsBoundingBox(true);
+			if (Bounds.IsValid)
+			{
+				Params.PlayableBounds.Add(Bounds);
+			}
+		}
+	}
+
+	return Params;
+}
+
+
+void FPR_PartitionTree::Build(const FBox& RootBox, const FPR_PartitionBuildParams& Params, const UWorld* World)
+{
+	BeginBuild(RootBox, Params, World);
+	StepBuild(TNumericLimits<int32>::Max());
+	BeginClassifyLeaves();
+	StepClassifyLeaves(TNumericLimits<int32>::Max());
+}
+
+void FPR_PartitionTree::BeginBuild(const FBox& RootBox, const FPR_PartitionBuildParams& Params, const UWorld* World)
+{
+	Reset();
+
+	if (!RootBox.IsValid)
+	{
+		return;
+	}
+
+	PendingWorld = World;
+	PendingBuildParams = Params;
+
+	PRCore::FBuildParams CoreParams;
+	CoreParams.MaxDepth = Params.MaxDepth;
+	CoreParams.MinLeafVolume = Params.MinLeafVolume;
+	CoreParams.MaxLeafCount = Params.MaxLeafCount;
+	CoreParams.ParallelFor = [](int32 Num, const std::function<void(int32)>& Body)
+	{
+		ParallelFor(Num, [&Body](int32 Index) { Body(Index); });
+	};
+	if (Params.bAdaptive && World)
+	{
+		const float ProbeDistance = Params.ProbeDistance;
+		CoreParams.CanSplit = [WorldQueries = FPR_WorldQueries(World), ProbeDistance](const PRCore::FBox3& Region)
+		{
+			return !PRCore::IsRegionUniform(WorldQueries, Region, ProbeDistance);
+		};
+	}
+
+	Partition.BeginBuild(ToCore(RootBox), CoreParams);
+}
+
+bool FPR_PartitionTree::StepBuild(int32 MaxNodes)
+{
+	if (!Partition.IsBuilding())
+	{
+		return true;
+	}
+
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_PartitionTree::StepBuild);
+	SCOPE_CYCLE_COUNTER(STAT_PR_PartitionBuild);
+
+	const double StartTime = FPlatformTime::Seconds();
+	const bool bBuilt = Partition.StepBuild(MaxNodes);
+	PendingSeconds += FPlatformTime::Seconds() - StartTime;
+	if (!bBuilt)
+	{
+		return false;
+	}
+
+	UE_LOG(LogPrPartition, Log, TEXT("Partition built: %d nodes, %d leaves in %.2f ms"),
+		GetNumNodes(),
+		GetNumLeaves(),
+		PendingSeconds * 1000.0);
+
+	// World and params stay for the classification
+	PendingSeconds = 0.0;
+	return true;
+}
+
+void FPR_PartitionTree::BeginClassifyLeaves()
+{
+	if (!PendingBuildParams.bClassifyLeaves || !PendingWorld || IsEmpty())
+	{
+		PendingWorld = nullptr;
+		PendingBuildParams = FPR_PartitionBuildParams();
+		return;
+	}
+
+	// Leaves not classified yet stay playable, queries during the classification still find them
+	LeafSpaces.SetNumZeroed(GetNumLeaves());
+	NumClassifiedLeaves = 0;
+	PendingSeconds = 0.0;
+}
+
+bool FPR_PartitionTree::StepClassifyLeaves(int32 MaxLeaves)
+{
+	if (NumClassifiedLeaves == INDEX_NONE)
+	{
+		return true;
+	}
+
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_PartitionTree::StepClassifyLeaves);
+
+	const double StartTime = FPlatformTime::Seconds();
+	PRCore::FLeafSpaceParams SpaceParams;
+	SpaceParams.PlayableMargin = PendingBuildParams.PlayableMargin;
+	for (const FBox& Bounds : PendingBuildParams.PlayableBounds)
+	{
+		SpaceParams.PlayableBounds.push_back(ToCore(Bounds));
+	}
+
+	const FPR_WorldQueries WorldQueries(PendingWorld);
+	const PRCore::FLeafBounds& LeafBounds = Partition.GetLeafBounds();
+	const int32 FirstLeaf = NumClassifiedLeaves;
+	const int32 NumStepLeaves = FMath::Min(MaxLeaves, GetNumLeaves() - FirstLeaf);
+	ParallelFor(NumStepLeaves, [this, &WorldQueries, &SpaceParams, &LeafBounds, FirstLeaf](int32 Row)
+	{
+		LeafSpaces[FirstLeaf + Row] = PRCore::ClassifyLeaf(WorldQueries, LeafBounds.GetBox(FirstLeaf + Row), SpaceParams);
+	});
+
+	NumClassifiedLeaves += NumStepLeaves;
+	PendingSeconds += FPlatformTime::Seconds() - StartTime;
+	if (NumClassifiedLeaves < GetNumLeaves())
+	{
+		return false;
+	}
+
+	MergeClassifiedLeaves();
+	NumClassifiedLeaves = INDEX_NONE;
+	PendingWorld = nullptr;
+	PendingBuildParams = FPR_PartitionBuildParams();
+	PendingSeconds = 0.0;
+	return true;
+}
+
+void FPR_PartitionTree::MergeClassifiedLeaves()
+{
+	const int32 NumLeaves = GetNumLeaves();
+
+	// Playable leaves keep their own keys, nothing is stored per leaf yet so collapsing only renumbers the spaces
+	int32 NumSpaceLeaves[PRCore::NumLeafSpaces] = {};
+	std::vector<uint32_t> LeafKeys(NumLeaves);
+	for (int32 LeafIndex = 0; LeafIndex < NumLeaves; ++LeafIndex)
+	{
+		const uint8 Space = static_cast<uint8>(LeafSpaces[LeafIndex]);
+		++NumSpaceLeaves[Space];
+		LeafKeys[LeafIndex] = LeafSpaces[LeafIndex] == PRCore::ELeafSpace::Playable ? PRCore::NumLeafSpaces + LeafIndex : Space;
+	}
+
+	if (NumSpaceLeaves[static_cast<uint8>(PRCore::ELeafSpace::Playable)] == NumLeaves)
+	{
+		LeafSpaces.Empty();
+		return;
+	}
+
+	std::vector<int32_t> LeafRemap;
+	Partition.MergeLeaves(LeafKeys, LeafRemap);
+	RemapLeafSpaces(LeafRemap);
+	// Queries may have run between the steps of the classification
+	++Revision;
+
+	UE_LOG(LogPrPartition, Log, TEXT("Classified %d leaves: %d playable, %d solid, %d exterior, collapsed into %d leaves in %.2f ms"),
+		NumLeaves,
+		NumSpaceLeaves[static_cast<uint8>(PRCore::ELeafSpace::Playable)],
+		NumSpaceLeaves[static_cast<uint8>(PRCore::ELeafSpace::Solid)],
+		NumSpaceLeaves[static_cast<uint8>(PRCore::ELeafSpace::Exterior)],
+		GetNumLeaves(),
+		PendingSeconds * 1000.0);
+}
+
+void FPR_PartitionTree::RemapLeafSpaces(const std::vector<int32_t>& LeafRemap)
+{
+	if (LeafRemap.empty() || LeafSpaces.IsEmpty())
+	{
+		return;
+	}
+
+	// Only leaves of the same space merge
+	TArray<PRCore::ELeafSpace> MergedSpaces;
+	MergedSpaces.SetNumUninitialized(GetNumLeaves());
+	for (int32 LeafIndex = 0; LeafIndex < static_cast<int32>(LeafRemap.size()); ++LeafIndex)
+	{
+		MergedSpaces[LeafRemap[LeafIndex]] = LeafSpaces[LeafIndex];
+	}
+
+	LeafSpaces = MoveTemp(MergedSpaces);
+}
+
+void FPR_PartitionTree::GetPlayableLeaves(TArray<int32>& OutLeaves) const
+{
+	OutLeaves.Reset(GetNumLeaves());
+	for (int32 LeafIndex = 0; LeafIndex < GetNumLeaves(); ++LeafIndex)
+	{
+		if (IsLeafPlayable(LeafIndex))
+		{
+			OutLeaves.Add(LeafIndex);
+		}
+	}
+}
+
+void FPR_PartitionTree::Reset()
+{
+	++Revision;
+	Partition.Reset();
+	AcousticData.Reset();
+	ReverbPalette.Reset(ReverbPalette.GetTolerance());
+	Visibility.Reset();
+	LeafSpaces.Empty();
+	UnevaluatedLeaves.Empty();
+	NumUnevaluatedLeaves = 0;
+	PendingWorld = nullptr;
+	PendingBuildParams = FPR_PartitionBuildParams();
+	PendingSeconds = 0.0;
+	NumClassifiedLeaves = INDEX_NONE;
+	PendingEstimates = FPR_PendingEstimates();
+	bEstimating = false;
+}
+
+FBox FPR_PartitionTree::GetRootBounds() const
+{
+	return ToUE(Partition.GetRootBounds());
+}
+
+FBox FPR_PartitionTree::GetLeafBounds(int32 LeafIndex) const
+{
+	return ToUE(Partition.GetLeafBounds().GetBox(LeafIndex));
+}
+
+float FPR_PartitionTree::DistanceToLeaf(int32 LeafIndex, const FVector& Point) const
+{
+	return Partition.DistanceToLeaf(LeafIndex, ToCore(Point));
+}
+
+void FPR_PartitionTree::CollectAcousticData(const UWorld* World)
+{
+	TArray<int32> LeafIndices;
+	GetPlayableLeaves(LeafIndices);
+	CollectAcousticData(World, LeafIndices);
+}
+
+void FPR_PartitionTree::CollectAcousticData(const UWorld* World, TConstArrayView<int32> LeafIndices)
+{
+	const PRCore::FLeafBounds& LeafBounds = Partition.GetLeafBounds();
+	TArray<PRCore::FVec3> Centers;
+	Centers.Reserve(LeafIndices.Num());
+	for (const int32 LeafIndex : LeafIndices)
+	{
+		Centers.Add(LeafBounds.GetCenter(LeafIndex));
+	}
+
+	TArray<PRCore::FLeafFeatures> Features;
+	Features.SetNum(LeafIndices.Num());
+	ProbeLeaves(World, Centers, Features);
+
+	AcousticData.SetNum(GetNumLeaves());
+	for (int32 Row = 0; Row < LeafIndices.Num(); ++Row)
+	{
+		AcousticData[LeafIndices[Row]].Features = Features[Row];
+	}
+}
+
+void FPR_PartitionTree::ProbeLeaves(const UWorld* World, TConstArrayView<PRCore::FVec3> Centers, TArrayView<PRCore::FLeafFeatures> OutFeatures)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_PartitionTree::ProbeLeaves);
+	SCOPE_CYCLE_COUNTER(STAT_PR_AcousticProbes);
+
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+	const float RayDistance = Settings->RayDistance;
+	const PRCore::FProbeRaySet RaySet(static_cast<PRCore::EProbeRaySet>(Settings->ProbeRaySet), Settings->ProbeRayCount);
+	const double StartTime = FPlatformTime::Seconds();
+	const FPR_WorldQueries WorldQueries(World);
+	const int32 NumLeaves = Centers.Num();
+	const int32 NumRays = RaySet.Num();
+
+	// Leaves are probed in chunks to bound the hit buffers, inside a chunk every task traces a fixed
+	// number of rays regardless of which leaves they belong to, so large ray sets spread over all workers
+	constexpr int32 LeavesPerChunk = 4096;
+	constexpr int32 TracesPerTask = 64;
+	constexpr int32 LeavesPerReduceTask = 256;
+
+	PRCore::FProbeHits Hits;
+	Hits.Resize(FMath::Min(NumLeaves, LeavesPerChunk) * NumRays);
+
+	// Every leaf owns its slot, workers never touch the same data
+	for (int32 FirstLeaf = 0; FirstLeaf < NumLeaves; FirstLeaf += LeavesPerChunk)
+	{
+		const int32 NumChunkLeaves = FMath::Min(LeavesPerChunk, NumLeaves - FirstLeaf);
+		const int32 NumTraces = NumChunkLeaves * NumRays;
+		ParallelFor(FMath::DivideAndRoundUp(NumTraces, TracesPerTask), [&](int32 Task)
+		{
+			const int32 EndTrace = FMath::Min((Task + 1) * TracesPerTask, NumTraces);
+			for (int32 TraceIndex = Task * TracesPerTask; TraceIndex < EndTrace; ++TraceIndex)
+			{
+				const PRCore::FVec3& Center = Centers[FirstLeaf + TraceIndex / NumRays];
+				const PRCore::FVec3& Direction = RaySet.GetDirections()[TraceIndex % NumRays];
+				Hits.Set(TraceIndex, WorldQueries.Trace(Center, Center + Direction * RayDistance), Direction, RayDistance);
+			}
+		});
+
+		ParallelFor(FMath::DivideAndRoundUp(NumChunkLeaves, LeavesPerReduceTask), [&](int32 Task)
+		{
+			const int32 ChunkLeaf = Task * LeavesPerReduceTask;
+			const int32 NumTaskLeaves = FMath::Min(LeavesPerReduceTask, NumChunkLeaves - ChunkLeaf);
+			RaySet.Reduce(Hits, ChunkLeaf * NumRays, NumTaskLeaves, RayDistance, OutFeatures.GetData() + FirstLeaf + ChunkLeaf);
+		});
+	}
+
+	UE_LOG(LogPrPartition, Verbose, TEXT("Collected acoustic data for %d leaves (%d traces) in %.2f ms"),
+		NumLeaves,
+		NumLeaves * NumRays,
+		(FPlatformTime::Seconds() - StartTime) * 1000.0);
+}
+
+void FPR_PartitionTree::CollectLeafVisibility(const UWorld* World, float Radius)
+{
+	BeginLeafVisibility(World, Radius);
+	StepLeafVisibility(TNumericLimits<int32>::Max());
+}
+
+void FPR_PartitionTree::BeginLeafVisibility(const UWorld* World, float Radius)
+{
+	PendingWorld = World;
+	PendingSeconds = 0.0;
+
+	PRCore::FVisibilityParams Params;
+	Params.Radius = Radius;
+	Params.SkipLeaves = GetSkippedLeaves();
+	Params.ParallelFor = [](int32 Num, const std::function<void(int32)>& Body)
+	{
+		ParallelFor(Num, [&Body](int32 Index) { Body(Index); });
+	};
+	Visibility.BeginBuild(Partition, Params);
+}
+
+bool FPR_PartitionTree::StepLeafVisibility(int32 MaxLeaves)
+{
+	if (!Visibility.IsBuilding())
+	{
+		return true;
+	}
+
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_PartitionTree::StepLeafVisibility);
+	SCOPE_CYCLE_COUNTER(STAT_PR_AcousticProbes);
+
+	const double StartTime = FPlatformTime::Seconds();
+	const bool bBuilt = Visibility.StepBuild(Partition, FPR_WorldQueries(PendingWorld), MaxLeaves);
+	PendingSeconds += FPlatformTime::Seconds() - StartTime;
+	if (!bBuilt)
+	{
+		return false;
+	}
+
+	UE_LOG(LogPrPartition, Log, TEXT("Collected visibility for %d leaves (%d visible pairs) in %.2f ms"),
+		Visibility.GetNumLeaves(),
+		static_cast<int32>(Visibility.GetVisibleLeaves().size() / 2),
+		PendingSeconds * 1000.0);
+
+	PendingWorld = nullptr;
+	PendingSeconds = 0.0;
+	return true;
+}
+
+void FPR_PartitionTree::FindLeavesInBox(const FBox& Box, TArray<int32>& OutLeaves) const
+{
+	const int32 NodesVisited = Partition.FindLeavesInBox(ToCore(Box), [this, &OutLeaves](int32 LeafIndex)
+	{
+		if (IsLeafPlayable(LeafIndex))
+		{
+			OutLeaves.Add(LeafIndex);
+		}
+	});
+
+	INC_DWORD_STAT_BY(STAT_PR_NodesVisited, NodesVisited);
+}
+
+int32 FPR_PartitionTree::FindLeaf(const FVector& Position) const
+{
+	const int32 LeafIndex = Partition.FindLeaf(ToCore(Position));
+	return LeafIndex >= 0 && IsLeafPlayable(LeafIndex) ? LeafIndex : INDEX_NONE;
+}
+
+void FPR_PartitionTree::FindNearbyLeaves(
+	const FVector& Position,
+	const float SearchRadius,
+	TArray<FPR_LeafQueryResult>& OutNearbyLeaves) const
+{
+	const int32 NodesVisited = Partition.FindNearbyLeaves(ToCore(Position), SearchRadius, [this, &OutNearbyLeaves](int32 LeafIndex, float Distance)
+	{
+		if (IsLeafPlayable(LeafIndex))
+		{
+			OutNearbyLeaves.Add({LeafIndex, Distance});
+		}
+	});
+
+	INC_DWORD_STAT(STAT_PR_ListenerQueries);
+	INC_DWORD_STAT_BY(STAT_PR_NodesVisited, NodesVisited);
+}
+
+void FPR_PartitionTree::FindNearbyLeaves(TConstArrayView<FPR_NearbyLeavesQuery> Queries) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_PartitionTree::FindNearbyLeavesBatched);
+
+	TArray<PRCore::FSphereQuery, TInlineAllocator<MaxBatchedQueries>> Spheres;
+	Spheres.Reserve(Queries.Num());
+	for (const FPR_NearbyLeavesQuery& Query : Queries)
+	{
+		Spheres.Add({ToCore(Query.Position), Query.SearchRadius});
+	}
+
+	const int32 NodesVisited = Partition.FindNearbyLeaves(Spheres.GetData(), Spheres.Num(), [this, Queries](int32 QueryIndex, int32 LeafIndex, float Distance)
+	{
+		if (IsLeafPlayable(LeafIndex))
+		{
+			Queries[QueryIndex].OutLeaves->Add({LeafIndex, Distance});
+		}
+	});
+
+	INC_DWORD_STAT_BY(STAT_PR_ListenerQueries, Queries.Num());
+	INC_DWORD_STAT_BY(STAT_PR_NodesVisited, NodesVisited);
+}
+
+void FPR_PartitionTree::FindNearestLeaves(
+	const FVector& Position,
+	const int32 Count,
+	TArray<FPR_LeafQueryResult>& OutNearestLeaves) const
+{
+	OutNearestLeaves.Reset();
+	if (Count <= 0)
+	{
+		return;
+	}
+
+	TArray<PRCore::FLeafHit, TInlineAllocator<16>> Hits;
+	Hits.SetNumUninitialized(Count);
+
+	int32 NumHits = 0;
+	const int32 NodesVisited = Partition.FindNearestLeaves(ToCore(Position), Count, Hits.GetData(), NumHits, GetSkippedLeaves());
+	for (int32 HitIndex = 0; HitIndex < NumHits; ++HitIndex)
+	{
+		OutNearestLeaves.Add({Hits[HitIndex].LeafIndex, Hits[HitIndex].Distance});
+	}
+
+	INC_DWORD_STAT(STAT_PR_ListenerQueries);
+	INC_DWORD_STAT_BY(STAT_PR_NodesVisited, NodesVisited);
+}
+
+FPR_ReverbCompaction FPR_PartitionTree::RunModel(FPR_ReverbNet& ReverbNet, PRCore::FInferenceCache* Cache)
+{
+	TArray<int32> LeafIndices;
+	GetPlayableLeaves(LeafIndices);
+	LeafIndices.RemoveAll([this](int32 LeafIndex) { return !HasAcousticData(LeafIndex); });
+
+	if (!RunModel(ReverbNet, LeafIndices, Cache))
+	{
+		return FPR_ReverbCompaction();
+	}
+
+	return CompactLeaves();
+}
+
+bool FPR_PartitionTree::RunModel(FPR_ReverbNet& ReverbNet, TConstArrayView<int32> LeafIndices, PRCore::FInferenceCache* Cache)
+{
+	TArray<PRCore::FLeafFeatures> Features;
+	Features.Reserve(LeafIndices.Num());
+	for (const int32 LeafIndex : LeafIndices)
+	{
+		Features.Add(AcousticData[LeafIndex].Features);
+	}
+
+	TArray<PRCore::FReverbParams> ReverbParams;
+	if (!EvaluateFeatures(ReverbNet, Features, ReverbParams, Cache))
+	{
+		return false;
+	}
+
+	for (int32 Row = 0; Row < LeafIndices.Num(); ++Row)
+	{
+		const PRCore::FReverbParams& Params = ReverbParams[Row];
+		StoreReverbParams(LeafIndices[Row], Params);
+		UE_LOG(
+			LogPrPartition,
+			VeryVerbose,
+			TEXT("Model output for leaf [%d]: Decay [%.2f] Gain [%.2f] Density [%.2f] Wet Level [%.2f]"),
+			LeafIndices[Row],
+			Params.DecayTime,
+			Params.Gain,
+			Params.Density,
+			Params.WetLevel
+		);
+	}
+
+	return true;
+}
+
+bool FPR_PartitionTree::EvaluateFeatures(
+	FPR_ReverbNet& ReverbNet,
+	TConstArrayView<PRCore::FLeafFeatures> Features,
+	TArray<PRCore::FReverbParams>& OutParams,
+	PRCore::FInferenceCache* Cache)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_PartitionTree::EvaluateFeatures);
+	SCOPE_CYCLE_COUNTER(STAT_PR_Inference);
+
+	const int32 NumLeaves = Features.Num();
+	const int32 NumInputs = ReverbNet.GetNumInputs();
+	const int32 NumOutputs = ReverbNet.GetNumOutputs();
+	if (NumLeaves == 0 || !ensure(NumInputs == PRCore::NumModelInputs) || !ensure(NumOutputs >= PRCore::NumModelOutputs))
+	{
+		return false;
+	}
+
+	OutParams.SetNumUninitialized(NumLeaves);
+
+	const double StartTime = FPlatformTime::Seconds();
+	int32 NumRows = 0;
+	if (!PRCore::EvaluateFeatures(ReverbNet, Features.GetData(), NumLeaves, OutParams.GetData(), Cache, &NumRows))
+	{
+		UE_LOG(LogPrPartition, Error, TEXT("Failed to run the model"));
+		return false;
+	}
+
+	if (Cache)
+	{
+		INC_DWORD_STAT_BY(STAT_PR_InferenceCacheLookups, NumLeaves);
+		INC_DWORD_STAT_BY(STAT_PR_InferenceCacheHits, NumLeaves - NumRows);
+	}
+
+	UE_LOG(LogPrPartition, Verbose, TEXT("Evaluated %d leaves (%d cached) %s in %.2f ms"),
+		NumRows,
+		NumLeaves - NumRows,
+		ReverbNet.IsNative() ? TEXT("natively") : *FString::Printf(TEXT("in batches of %d"), ReverbNet.GetBatchSize()),
+		(FPlatformTime::Seconds() - StartTime) * 1000.0);
+
+	return true;
+}
+
+void FPR_PartitionTree::UpdateLeaves(
+	TConstArrayView<int32> LeafIndices,
+	TConstArrayView<PRCore::FLeafFeatures> Features,
+	TConstArrayView<PRCore::FReverbParams> ReverbParams)
+{
+	check(Features.Num() == LeafIndices.Num() && (ReverbParams.IsEmpty() || ReverbParams.Num() == LeafIndices.Num()));
+
+	AcousticData.SetNum(GetNumLeaves());
+	for (int32 Row = 0; Row < LeafIndices.Num(); ++Row)
+	{
+		AcousticData[LeafIndices[Row]].Features = Features[Row];
+		if (!ReverbParams.IsEmpty())
+		{
+			StoreReverbParams(LeafIndices[Row], ReverbParams[Row]);
+		}
+
+		if (!IsLeafEvaluated(LeafIndices[Row]))
+		{
+			UnevaluatedLeaves[LeafIndices[Row]] = false;
+			--NumUnevaluatedLeaves;
+		}
+	}
+}
+
+void FPR_PartitionTree::EstimateLeaves(const UWorld* World, FPR_ReverbNet* ReverbNet, int32 Depth, PRCore::FInferenceCache* Cache)
+{
+	BeginEstimateLeaves(World, Depth);
+	StepEstimateLeaves(ReverbNet, TNumericLimits<int32>::Max(), Cache);
+}
+
+void FPR_PartitionTree::BeginEstimateLeaves(const UWorld* World, int32 Depth)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_PartitionTree::BeginEstimateLeaves);
+
+	AcousticData.Reset();
+	AcousticData.SetNum(GetNumLeaves());
+	UnevaluatedLeaves.Init(false, GetNumLeaves());
+	NumUnevaluatedLeaves = 0;
+	for (int32 LeafIndex = 0; LeafIndex < GetNumLeaves(); ++LeafIndex)
+	{
+		if (IsLeafPlayable(LeafIndex))
+		{
+			UnevaluatedLeaves[LeafIndex] = true;
+			++NumUnevaluatedLeaves;
+		}
+	}
+
+	PendingEstimates = FPR_PendingEstimates();
+	bEstimating = !IsEmpty();
+	if (!bEstimating)
+	{
+		return;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	PendingWorld = World;
+	PendingEstimates.Depth = Depth;
+	std::vector<int32_t> LeafRegions;
+	Partition.CutAtDepth(Depth, PendingEstimates.RegionBounds, LeafRegions);
+
+	// Playable leaves grouped by region, so every step only touches the leaves of its own regions
+	const int32 NumRegions = static_cast<int32>(PendingEstimates.RegionBounds.size());
+	TArray<int32>& Offsets = PendingEstimates.RegionLeafOffsets;
+	Offsets.Init(0, NumRegions + 1);
+	for (int32 LeafIndex = 0; LeafIndex < GetNumLeaves(); ++LeafIndex)
+	{
+		if (IsLeafPlayable(LeafIndex))
+		{
+			++Offsets[LeafRegions[LeafIndex] + 1];
+		}
+	}
+
+	for (int32 Region = 0; Region < NumRegions; ++Region)
+	{
+		Offsets[Region + 1] += Offsets[Region];
+	}
+
+	TArray<int32> NextSlots(Offsets.GetData(), NumRegions);
+	PendingEstimates.RegionLeaves.SetNumUninitialized(Offsets[NumRegions]);
+	for (int32 LeafIndex = 0; LeafIndex < GetNumLeaves(); ++LeafIndex)
+	{
+		if (IsLeafPlayable(LeafIndex))
+		{
+			PendingEstimates.RegionLeaves[NextSlots[LeafRegions[LeafIndex]]++] = LeafIndex;
+		}
+	}
+
+	PendingSeconds = FPlatformTime::Seconds() - StartTime;
+}
+
+bool FPR_PartitionTree::StepEstimateLeaves(FPR_ReverbNet* ReverbNet, int32 MaxRegions, PRCore::FInferenceCache* Cache)
+{
+	if (!bEstimating)
+	{
+		return true;
+	}
+
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_PartitionTree::StepEstimateLeaves);
+
+	// Without a model the leaves keep no reverb, they are still marked for lazy evaluation
+	const int32 NumRegions = static_cast<int32>(PendingEstimates.RegionBounds.size());
+	const int32 FirstRegion = PendingEstimates.NextRegion;
+	const int32 NumStepRegions = FMath::Min(MaxRegions, NumRegions - FirstRegion);
+	if (ReverbNet && NumStepRegions > 0)
+	{
+		const double StartTime = FPlatformTime::Seconds();
+		TArray<PRCore::FVec3> Centers;
+		Centers.Reserve(NumStepRegions);
+		for (int32 Region = FirstRegion; Region < FirstRegion + NumStepRegions; ++Region)
+		{
+			Centers.Add(PendingEstimates.RegionBounds[Region].GetCenter());
+		}
+
+		TArray<PRCore::FLeafFeatures> Features;
+		TArray<PRCore::FReverbParams> RegionParams;
+		Features.SetNum(Centers.Num());
+		ProbeLeaves(PendingWorld, Centers, Features);
+		if (EvaluateFeatures(*ReverbNet, Features, RegionParams, Cache))
+		{
+			// Features stay empty, they are only meaningful once the leaf itself was probed
+			const TArray<int32>& Offsets = PendingEstimates.RegionLeafOffsets;
+			for (int32 Row = 0; Row < NumStepRegions; ++Row)
+			{
+				for (int32 Slot = Offsets[FirstRegion + Row]; Slot < Offsets[FirstRegion + Row + 1]; ++Slot)
+				{
+					StoreReverbParams(PendingEstimates.RegionLeaves[Slot], RegionParams[Row]);
+				}
+			}
+
+			PendingEstimates.NextRegion += NumStepRegions;
+			PendingSeconds += FPlatformTime::Seconds() - StartTime;
+			if (PendingEstimates.NextRegion < NumRegions)
+			{
+				return false;
+			}
+
+			UE_LOG(LogPrPartition, Log, TEXT("Estimated %d leaves from %d regions at depth %d in %.2f ms"),
+				GetNumLeaves(),
+				NumRegions,
+				PendingEstimates.Depth,
+				PendingSeconds * 1000.0);
+		}
+	}
+
+	PendingEstimates = FPR_PendingEstimates();
+	bEstimating = false;
+	PendingWorld = nullptr;
+	PendingSeconds = 0.0;
+	return true;
+}
+
+void FPR_PartitionTree::StoreReverbParams(int32 LeafIndex, const PRCore::FReverbParams& Params)
+{
+	if (ReverbPalette.Num() == 0)
+	{
+		ReverbPalette.Reset(GetDefault<UProceduralReverbSettings>()->ReverbPaletteTolerance);
+	}
+
+	// Indices are 16 bits, the step is coarsened until every distinct result fits
+	int32 ReverbIndex = ReverbPalette.Add(Params);
+	while (ReverbIndex < 0)
+	{
+		std::vector<int32_t> EntryRemap;
+		ReverbPalette.Coarsen(EntryRemap);
+		for (FPR_AcousticData& LeafData : AcousticData)
+		{
+			if (LeafData.ReverbIndex != PRCore::FReverbPalette::InvalidIndex)
+			{
+				LeafData.ReverbIndex = static_cast<uint16>(EntryRemap[LeafData.ReverbIndex]);
+			}
+		}
+
+		UE_LOG(LogPrPartition, Log, TEXT("Reverb palette tolerance raised to %.4f to fit %d entries"),
+			ReverbPalette.GetTolerance(),
+			PRCore::FReverbPalette::MaxEntries);
+		ReverbIndex = ReverbPalette.Add(Params);
+	}
+
+	AcousticData[LeafIndex].ReverbIndex = static_cast<uint16>(ReverbIndex);
+}
+
+FPR_ReverbCompaction FPR_PartitionTree::CompactLeaves()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_PartitionTree::CompactLeaves);
+
+	// Compared against every leaf storing its own parameters instead of a palette index
+	FPR_ReverbCompaction Result;
+	Result.NumLeavesBefore = GetNumLeaves();
+	Result.BytesBefore = GetAllocatedSize() - ReverbPalette.GetAllocatedSize()
+		+ AcousticData.Num() * (sizeof(PRCore::FReverbParams) - sizeof(uint16));
+
+	// Leaves sharing a coarse estimate would merge before they were evaluated
+	if (GetDefault<UProceduralReverbSettings>()->bMergeLeaves && !HasUnevaluatedLeaves())
+	{
+		MergeLeaves();
+	}
+
+	AcousticData.Shrink();
+
+	Result.NumLeavesAfter = GetNumLeaves();
+	Result.NumPaletteEntries = ReverbPalette.Num();
+	Result.Tolerance = ReverbPalette.GetTolerance();
+	Result.BytesAfter = GetAllocatedSize();
+
+	UE_LOG(LogPrPartition, Log, TEXT("Compacted reverb of %d leaves into %d palette entries and %d leaves, %.1f KiB -> %.1f KiB"),
+		Result.NumLeavesBefore,
+		Result.NumPaletteEntries,
+		Result.NumLeavesAfter,
+		Result.BytesBefore / 1024.0,
+		Result.BytesAfter / 1024.0);
+
+	return Result;
+}
+
+void FPR_PartitionTree::MergeLeaves()
+{
+	// Playable leaves without results never merge with each other, the others merge with leaves of their space
+	std::vector<uint32_t> LeafKeys;
+	LeafKeys.reserve(AcousticData.Num());
+	for (int32 LeafIndex = 0; LeafIndex < AcousticData.Num(); ++LeafIndex)
+	{
+		const uint16 ReverbIndex = AcousticData[LeafIndex].ReverbIndex;
+		const uint32 NoResultKey = IsLeafPlayable(LeafIndex)
+			? PRCore::FReverbPalette::MaxEntries + PRCore::NumLeafSpaces + LeafIndex
+			: PRCore::FReverbPalette::MaxEntries + static_cast<uint32>(GetLeafSpace(LeafIndex));
+		LeafKeys.push_back(ReverbIndex != PRCore::FReverbPalette::InvalidIndex ? ReverbIndex : NoResultKey);
+	}
+
+	std::vector<int32_t> LeafRemap;
+	Partition.MergeLeaves(LeafKeys, LeafRemap);
+	if (LeafRemap.empty())
+	{
+		return;
+	}
+
+	// Merged leaves share their palette entry, the features of the first previous leaf are kept
+	TArray<FPR_AcousticData> MergedData;
+	MergedData.SetNum(GetNumLeaves());
+	TBitArray<> bAssigned(false, GetNumLeaves());
+	for (int32 LeafIndex = 0; LeafIndex < static_cast<int32>(LeafRemap.size()); ++LeafIndex)
+	{
+		const int32 MergedLeaf = LeafRemap[LeafIndex];
+		if (!bAssigned[MergedLeaf])
+		{
+			bAssigned[MergedLeaf] = true;
+			MergedData[MergedLeaf] = AcousticData[LeafIndex];
+		}
+	}
+
+	AcousticData = MoveTemp(MergedData);
+	RemapLeafSpaces(LeafRemap);
+	Visibility.Remap(LeafRemap, GetNumLeaves());
+	++Revision;
+}
+
+void FPR_PartitionTree::DrawDebug(const UWorld* World) const
+{
+#if UE_ENABLE_DEBUG_DRAWING
+	if (!CVarDebugPartition.GetValueOnGameThread())
+	{
+		return;
+	}
+
+	for (int32 LeafIndex = 0; LeafIndex < GetNumLeaves(); ++LeafIndex)
+	{
+		if (IsLeafPlayable(LeafIndex))
+		{
+			DrawLeafDebug(World, LeafIndex);
+		}
+	}
+#endif // UE_ENABLE_DEBUG_DRAWING
+}
+
+void FPR_PartitionTree::DrawLeafDebug(const UWorld* World, int32 LeafIndex) const
+{
+#if UE_ENABLE_DEBUG_DRAWING
+	if (!CVarDebugPartition.GetValueOnGameThread())
+	{
+		return;
+	}
+
+	const FBox Box = GetLeafBounds(LeafIndex);
+	DrawDebugBox(World, Box.GetCenter(), Box.GetExtent(), FColor::MakeRandomSeededColor(LeafIndex), false, -1, 0, 5);
+#endif // UE_ENABLE_DEBUG_DRAWING
+}
+
+SIZE_T FPR_PartitionTree::GetAllocatedSize() const
+{
+	return Partition.GetAllocatedSize() + GetAcousticDataAllocatedSize() + Visibility.GetAllocatedSize() + LeafSpaces.GetAllocatedSize()
+		+ UnevaluatedLeaves.GetAllocatedSize();
+}
+
+void FPR_PartitionTree::Serialize(FArchive& Ar)
+{
+	if (Ar.IsLoading())
+	{
+		Reset();
+	}
+
+	FBox RootBounds = GetRootBounds();
+	Ar << RootBounds;
+	if (Ar.IsLoading())
+	{
+		std::vector<PRCore::FNode> Nodes;
+		PRCore::FLeafBounds LeafBounds;
+		SerializeNodes(Ar, Nodes);
+		SerializeLeafBounds(Ar, LeafBounds);
+		if (Ar.IsError() || !Partition.Assign(ToCore(RootBounds), MoveTemp(Nodes), MoveTemp(LeafBounds)))
+		{
+			Ar.SetError();
+			return;
+		}
+	}
+	else
+	{
+		// Saving only reads, the helpers are shared with loading
+		SerializeNodes(Ar, const_cast<std::vector<PRCore::FNode>&>(Partition.GetNodes()));
+		SerializeLeafBounds(Ar, const_cast<PRCore::FLeafBounds&>(Partition.GetLeafBounds()));
+	}
+
+	// Empty when the leaves weren't classified
+	int32 NumLeafSpaces = LeafSpaces.Num();
+	Ar << NumLeafSpaces;
+	if (Ar.IsLoading())
+	{
+		if (NumLeafSpaces != 0 && NumLeafSpaces != GetNumLeaves())
+		{
+			Ar.SetError();
+			return;
+		}
+		LeafSpaces.SetNumUninitialized(NumLeafSpaces);
+	}
+
+	Ar.Serialize(LeafSpaces.GetData(), LeafSpaces.Num() * sizeof(PRCore::ELeafSpace));
+	if (Ar.IsLoading() && LeafSpaces.ContainsByPredicate([](PRCore::ELeafSpace Space) { return static_cast<uint8>(Space) >= PRCore::NumLeafSpaces; }))
+	{
+		Ar.SetError();
+		return;
+	}
+
+	float PaletteTolerance = ReverbPalette.GetTolerance();
+	Ar << PaletteTolerance;
+	if (Ar.IsLoading())
+	{
+		std::vector<PRCore::FReverbParams> Entries;
+		SerializeColumn(Ar, Entries);
+		if (Ar.IsError() || !ReverbPalette.Assign(PaletteTolerance, MoveTemp(Entries)))
+		{
+			Ar.SetError();
+			return;
+		}
+	}
+	else
+	{
+		SerializeColumn(Ar, const_cast<std::vector<PRCore::FReverbParams>&>(ReverbPalette.GetEntries()));
+	}
+
+	int32 NumAcousticData = AcousticData.Num();
+	Ar << NumAcousticData;
+	if (Ar.IsLoading())
+	{
+		if (Ar.IsError() || NumAcousticData != GetNumLeaves())
+		{
+			Ar.SetError();
+			return;
+		}
+		AcousticData.SetNum(NumAcousticData);
+	}
+
+	for (FPR_AcousticData& LeafData : AcousticData)
+	{
+		LeafData.Serialize(Ar);
+	}
+
+	// A palette that doesn't match the leaves would be read out of bounds at runtime
+	if (Ar.IsLoading() && AcousticData.ContainsByPredicate([this](const FPR_AcousticData& LeafData)
+		{
+			return LeafData.ReverbIndex != PRCore::FReverbPalette::InvalidIndex && !ReverbPalette.IsValidIndex(LeafData.ReverbIndex);
+		}))
+	{
+		Ar.SetError();
+		return;
+	}
+
+	// Empty offsets when no visibility was collected
+	if (Ar.IsLoading())
+	{
+		std::vector<uint32_t> Offsets;
+		std::vector<int32_t> VisibleLeaves;
+		SerializeColumn(Ar, Offsets);
+		SerializeColumn(Ar, VisibleLeaves);
+		if (Ar.IsError() || (!Offsets.empty() && !Visibility.Assign(GetNumLeaves(), MoveTemp(Offsets), MoveTemp(VisibleLeaves))))
+		{
+			Ar.SetError();
+		}
+	}
+	else
+	{
+		SerializeColumn(Ar, const_cast<std::vector<uint32_t>&>(Visibility.GetOffsets()));
+		SerializeColumn(Ar, const_cast<std::vector<int32_t>&>(Visibility.GetVisibleLeaves()));
+	}
+}
@@ -0,0 +1,233 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PR_BSPNode.h"
+#include "ProceduralReverb/Core/PRCore_Partition.h"
+#include "ProceduralReverb/Core/PRCore_Reverb.h"
+#include "ProceduralReverb/Core/PRCore_Visibility.h"
+
+class FPR_ReverbNet;
+
+namespace PRCore
+{
+class FInferenceCache;
+}
+
+
+struct FPR_PartitionBuildParams
+{
+	/** Playable bounds are only gathered when a world is given */
+	static FPR_PartitionBuildParams FromSettings(const UWorld* World = nullptr);
+
+	int32 MaxDepth = 10;
+	/** Leaves are never split below this volume, in cm^3 */
+	double MinLeafVolume = 0.0;
+	/** 0 means no budget */
+	int32 MaxLeafCount = 0;
+	/** Stops splitting regions whose acoustic surroundings are uniform, requires a world to probe */
+	bool bAdaptive = false;
+	float ProbeDistance = 5000.0f;
+	/** Marks solid and exterior leaves and collapses them, requires a world to test against */
+	bool bClassifyLeaves = false;
+	/** Boxes listeners can reach, leaves further than PlayableMargin from all of them are exterior. Empty disables the test */
+	TArray<FBox> PlayableBounds;
+	float PlayableMargin = 1000.0f;
+};
+
+
+struct FPR_LeafQueryResult
+{
+	int32 LeafIndex = INDEX_NONE;
+	float Distance = 0.0f;
+};
+
+
+/** Outcome of the compaction that follows the model run */
+struct FPR_ReverbCompaction
+{
+	int32 NumLeavesBefore = 0;
+	int32 NumLeavesAfter = 0;
+	int32 NumPaletteEntries = 0;
+	float Tolerance = 0.0f;
+	/** Tree with the per leaf model results, and the tree after compaction */
+	SIZE_T BytesBefore = 0;
+	SIZE_T BytesAfter = 0;
+};
+
+
+/** One sphere of a batched FindNearbyLeaves, results are appended to OutLeaves */
+struct FPR_NearbyLeavesQuery
+{
+	FVector Position = FVector::ZeroVector;
+	float SearchRadius = 0.0f;
+	TArray<FPR_LeafQueryResult>* OutLeaves = nullptr;
+};
+
+
+/**
+ * Binary space partition of the world, the engine independent PRCore::FPartition holds nodes and leaf bounds.
+ * Adds world probing, model evaluation, stats and serialization, acoustic data is stored in a table parallel to the leaves.
+ */
+struct FPR_PartitionTree
+{
+	static constexpr int32 MaxBatchedQueries = PRCore::FPartition::MaxBatchedQueries;
+
+	void Build(const FBox& RootBox, const FPR_PartitionBuildParams& Params, const UWorld* World = nullptr);
+	/**
+	 * Same build spread over several frames, every StepBuild decides up to MaxNodes pending nodes.
+	 * The tree stays empty until StepBuild returned true, the world has to outlive the build and the classification.
+	 */
+	void BeginBuild(const FBox& RootBox, const FPR_PartitionBuildParams& Params, const UWorld* World = nullptr);
+	bool StepBuild(int32 MaxNodes);
+	/**
+	 * Classifies the leaves of the finished build when its params ask for it, every StepClassifyLeaves tests up to
+	 * MaxLeaves further leaves and the last one merges them. Leaves count as playable until they are classified.
+	 */
+	void BeginClassifyLeaves();
+	bool StepClassifyLeaves(int32 MaxLeaves);
+	void Reset();
+
+	bool IsEmpty() const { return Partition.IsEmpty(); }
+	int32 GetNumNodes() const { return Partition.GetNumNodes(); }
+	int32 GetNumLeaves() const { return Partition.GetNumLeaves(); }
+	FBox GetRootBounds() const;
+	/** Changes whenever leaves are rebuilt or reloaded, lets users drop cached leaf indices */
+	uint32 GetRevision() const { return Revision; }
+
+	/** Traces every playable leaf in parallel on task graph workers, blocks until all leaves are done */
+	void CollectAcousticData(const UWorld* World);
+	/** Same for a subset of the leaves, e.g. one region of a time sliced generation */
+	void CollectAcousticData(const UWorld* World, TConstArrayView<int32> LeafIndices);
+
+	/**
+	 * Traces from the given leaf centers in parallel and reduces the hits, OutFeatures holds one entry per center.
+	 * Touches no tree state, so it can run on a worker thread while the tree is in use, as long as it finishes within the world tick.
+	 */
+	static void ProbeLeaves(const UWorld* World, TConstArrayView<PRCore::FVec3> Centers, TArrayView<PRCore::FLeafFeatures> OutFeatures);
+
+	/** Traces between leaves up to Radius apart in parallel and stores which of them see each other */
+	void CollectLeafVisibility(const UWorld* World, float Radius);
+	/** Same collection spread over several frames, every StepLeafVisibility traces from up to MaxLeaves further leaves */
+	void BeginLeafVisibility(const UWorld* World, float Radius);
+	bool StepLeafVisibility(int32 MaxLeaves);
+
+	/** Evaluates every playable leaf with one batched model run, then compacts the leaves */
+	FPR_ReverbCompaction RunModel(FPR_ReverbNet& ReverbNet, PRCore::FInferenceCache* Cache = nullptr);
+	/** Evaluates a subset of the leaves with one batched model run, results are stored as indices into the reverb palette */
+	bool RunModel(FPR_ReverbNet& ReverbNet, TConstArrayView<int32> LeafIndices, PRCore::FInferenceCache* Cache = nullptr);
+	/**
+	 * Runs the model on features of any leaves, touches no tree state either. With a cache only features missing
+	 * from it are evaluated, once per distinct key and on the quantized features, and their results are added.
+	 */
+	static bool EvaluateFeatures(
+		FPR_ReverbNet& ReverbNet,
+		TConstArrayView<PRCore::FLeafFeatures> Features,
+		TArray<PRCore::FReverbParams>& OutParams,
+		PRCore::FInferenceCache* Cache = nullptr);
+	/** Replaces the results of a subset of the leaves and marks them evaluated. ReverbParams may be empty to keep the reverb */
+	void UpdateLeaves(
+		TConstArrayView<int32> LeafIndices,
+		TConstArrayView<PRCore::FLeafFeatures> Features,
+		TConstArrayView<PRCore::FReverbParams> ReverbParams);
+	/**
+	 * Starts lazy evaluation, every leaf is marked unevaluated and takes the estimate of the coarse region
+	 * it lies in at Depth. Only the region centers are probed and evaluated, leaves keep no reverb without a model.
+	 */
+	void EstimateLeaves(const UWorld* World, FPR_ReverbNet* ReverbNet, int32 Depth, PRCore::FInferenceCache* Cache = nullptr);
+	/**
+	 * Same estimate spread over several frames. BeginEstimateLeaves marks the leaves and cuts the regions, the model
+	 * is only needed once StepEstimateLeaves probes and evaluates up to MaxRegions further regions.
+	 */
+	void BeginEstimateLeaves(const UWorld* World, int32 Depth);
+	bool StepEstimateLeaves(FPR_ReverbNet* ReverbNet, int32 MaxRegions, PRCore::FInferenceCache* Cache = nullptr);
+	bool HasUnevaluatedLeaves() const { return NumUnevaluatedLeaves > 0; }
+	/** Leaves are evaluated unless EstimateLeaves was called and no update reached them yet */
+	bool IsLeafEvaluated(int32 LeafIndex) const { return !UnevaluatedLeaves.IsValidIndex(LeafIndex) || !UnevaluatedLeaves[LeafIndex]; }
+	/** Merges sibling leaves sharing a palette entry when bMergeLeaves is set and every leaf is evaluated. Renumbers the leaves */
+	FPR_ReverbCompaction CompactLeaves();
+
+	/** Leaves are playable unless Build classified them, only playable leaves are probed, evaluated and returned by queries */
+	PRCore::ELeafSpace GetLeafSpace(int32 LeafIndex) const { return LeafSpaces.IsValidIndex(LeafIndex) ? LeafSpaces[LeafIndex] : PRCore::ELeafSpace::Playable; }
+	bool IsLeafPlayable(int32 LeafIndex) const { return GetLeafSpace(LeafIndex) == PRCore::ELeafSpace::Playable; }
+	/** Replaces OutLeaves with the indices of all playable leaves */
+	void GetPlayableLeaves(TArray<int32>& OutLeaves) const;
+
+	/** Descends along the split planes, returns INDEX_NONE when the position is outside of the partition or in a leaf that isn't playable */
+	int32 FindLeaf(const FVector& Position) const;
+	/** Appends all leaves closer than SearchRadius, subtrees out of range are skipped by their bounds */
+	void FindNearbyLeaves(const FVector& Position, float SearchRadius, TArray<FPR_LeafQueryResult>& OutNearbyLeaves) const;
+	/**
+	 * Answers many nearby queries with one traversal, every node carries the mask of queries that still reach it.
+	 * Queries are processed MaxBatchedQueries at a time.
+	 */
+	void FindNearbyLeaves(TConstArrayView<FPR_NearbyLeavesQuery> Queries) const;
+	/** Appends all leaves intersecting Box */
+	void FindLeavesInBox(const FBox& Box, TArray<int32>& OutLeaves) const;
+	/** Replaces OutNearestLeaves with up to Count closest leaves sorted by distance */
+	void FindNearestLeaves(const FVector& Position, int32 Count, TArray<FPR_LeafQueryResult>& OutNearestLeaves) const;
+
+	float DistanceToLeaf(int32 LeafIndex, const FVector& Point) const;
+	FBox GetLeafBounds(int32 LeafIndex) const;
+	bool HasAcousticData(int32 LeafIndex) const { return AcousticData.IsValidIndex(LeafIndex); }
+	const FPR_AcousticData& GetAcousticData(int32 LeafIndex) const { return AcousticData[LeafIndex]; }
+	/** False until the model has evaluated the leaf */
+	bool HasReverbParams(int32 LeafIndex) const { return HasAcousticData(LeafIndex) && ReverbPalette.IsValidIndex(AcousticData[LeafIndex].ReverbIndex); }
+	const PRCore::FReverbParams& GetReverbParams(int32 LeafIndex) const { return ReverbPalette.Get(AcousticData[LeafIndex].ReverbIndex); }
+	const PRCore::FReverbPalette& GetReverbPalette() const { return ReverbPalette; }
+	/** Everything is visible while no visibility was collected or when FromLeaf is INDEX_NONE */
+	bool IsLeafVisible(int32 FromLeaf, int32 ToLeaf) const
+	{
+		return Visibility.IsEmpty() || FromLeaf == INDEX_NONE || Visibility.IsVisible(FromLeaf, ToLeaf);
+	}
+
+	void DrawDebug(const UWorld* World) const;
+	void DrawLeafDebug(const UWorld* World, int32 LeafIndex) const;
+
+	SIZE_T GetAllocatedSize() const;
+	SIZE_T GetAcousticDataAllocatedSize() const { return AcousticData.GetAllocatedSize() + ReverbPalette.GetAllocatedSize(); }
+
+	/** Nodes, leaf bounds, leaf spaces, reverb palette, acoustic data and visibility, used by baked partitions */
+	void Serialize(FArchive& Ar);
+
+private:
+	/** Merges sibling leaves of the same space unless they are playable */
+	void MergeClassifiedLeaves();
+	void RemapLeafSpaces(const std::vector<int32_t>& LeafRemap);
+	const uint8* GetSkippedLeaves() const { return LeafSpaces.IsEmpty() ? nullptr : reinterpret_cast<const uint8*>(LeafSpaces.GetData()); }
+
+	/** Coarsens the palette when it is full */
+	void StoreReverbParams(int32 LeafIndex, const PRCore::FReverbParams& Params);
+	void MergeLeaves();
+
+	PRCore::FPartition Partition;
+	uint32 Revision = 0;
+	TArray<FPR_AcousticData> AcousticData;
+	PRCore::FReverbPalette ReverbPalette;
+	PRCore::FLeafVisibility Visibility;
+	/** Empty when the leaves weren't classified, non-zero entries double as the skip mask of the core queries */
+	TArray<PRCore::ELeafSpace> LeafSpaces;
+	/** Set for leaves still using their coarse estimate, empty outside of lazy evaluation */
+	TBitArray<> UnevaluatedLeaves;
+	int32 NumUnevaluatedLeaves = 0;
+
+	/** Coarse regions of an estimate in progress, their leaves are grouped by region */
+	struct FPR_PendingEstimates
+	{
+		int32 Depth = 0;
+		std::vector<PRCore::FBox3> RegionBounds;
+		TArray<int32> RegionLeafOffsets;
+		TArray<int32> RegionLeaves;
+		int32 NextRegion = 0;
+	};
+
+	/** World and settings of the build, classification, estimate or visibility collection in progress, with the time its steps took so far */
+	const UWorld* PendingWorld = nullptr;
+	FPR_PartitionBuildParams PendingBuildParams;
+	double PendingSeconds = 0.0;
+	/** Leaves classified so far, INDEX_NONE while no classification is in progress */
+	int32 NumClassifiedLeaves = INDEX_NONE;
+	FPR_PendingEstimates PendingEstimates;
+	bool bEstimating = false;
+};
@@ -3,97 +3,827 @@
 
 #include "PR_PartitionWorldSubsystem.h"
 
+#include "Async/ParallelFor.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/World.h"
 #include "EngineUtils.h"
-#include "PR_BSPNode.h"
+#include "GameFramework/Pawn.h"
+#include "GameFramework/PlayerController.h"
 #include "PhysicsEngine/BodySetup.h"
-#include "NNE.h"
 #include "NNEModelData.h"
-#include "NNERuntimeORT/Private/NNERuntimeORT.h"
+#include "PR_PartitionBake.h"
+#include "PR_WorldQueries.h"
+#include "ProceduralReverb/Core/PRCore_InferenceCache.h"
+#include "ProceduralReverb/LogPrPartition.h"
+#include "ProceduralReverb/Model/PR_ReverbNet.h"
+#include "ProceduralReverb/PR_Stats.h"
 #include "Settings/ProceduralReverbSettings.h"
 
+#include <algorithm>
+
 void UPR_PartitionWorldSubsystem::OnWorldBeginPlay(UWorld& InWorld)
 {
 	Super::OnWorldBeginPlay(InWorld);
 
-	Generate();
+	FWorldDelegates::OnWorldTickEnd.AddUObject(this, &UPR_PartitionWorldSubsystem::HandleWorldTickEnd);
+
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+	if (Settings->bUseBakedData && LoadBakedData())
+	{
+		// Baked leaves already carry their reverb settings, the model is not needed at all
+		BuildReverbGrid();
+		UpdatePartitionStats();
+		OnAcousticDataCollected.Broadcast();
+		GenerationStage = EPR_GenerationStage::Ready;
+		OnWorldReady.Broadcast();
+		return;
+	}
+
+	if (Settings->bTimeSlicedGeneration)
+	{
+		StartGeneration();
+	}
+	else
+	{
+		Generate();
+	}
+}
+
+void UPR_PartitionWorldSubsystem::Deinitialize()
+{
+	FWorldDelegates::OnWorldTickEnd.RemoveAll(this);
+	WaitForLeafUpdate();
+
+	Super::Deinitialize();
+}
+
+void UPR_PartitionWorldSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (GenerationStage != EPR_GenerationStage::Idle && GenerationStage != EPR_GenerationStage::Ready)
+	{
+		AdvanceGeneration(GetDefault<UProceduralReverbSettings>()->GenerationFrameBudget / 1000.0);
+	}
+	else if (IsReady())
+	{
+		UpdateQueuedLeaves();
+	}
+
+	UpdateListeners();
+	AdvanceListeners(DeltaTime);
+	PartitionTree.DrawDebug(GetWorld());
+}
+
+int32 UPR_PartitionWorldSubsystem::RegisterListener(
+	const AActor* Owner,
+	const FPR_ListenerParams& Params,
+	FOnPRListenerReverbUpdated OnUpdated,
+	FOnPRListenerAdvance OnAdvance)
+{
+	return Listeners.Add({Owner, Params, MoveTemp(OnUpdated), MoveTemp(OnAdvance)});
+}
+
+void UPR_PartitionWorldSubsystem::UnregisterListener(int32 ListenerHandle)
+{
+	if (Listeners.IsValidIndex(ListenerHandle))
+	{
+		Listeners.RemoveAt(ListenerHandle);
+	}
+}
+
+void UPR_PartitionWorldSubsystem::SetListenerParams(int32 ListenerHandle, const FPR_ListenerParams& Params)
+{
+	if (Listeners.IsValidIndex(ListenerHandle))
+	{
+		FPR_Listener& Listener = Listeners[ListenerHandle];
+		Listener.Params = Params;
+		Listener.Neighbourhood.Reset();
+	}
+}
+
+void UPR_PartitionWorldSubsystem::UpdateListeners()
+{
+	SCOPE_CYCLE_COUNTER(STAT_PR_ListenerUpdate);
+
+	if (Listeners.Num() == 0 || PartitionTree.IsEmpty())
+	{
+		return;
+	}
+
+	// Gather the listeners that left their cached neighbourhood and query them all at once
+	PendingQueries.Reset();
+	for (FPR_Listener& Listener : Listeners)
+	{
+		const AActor* Owner = Listener.Owner.Get();
+		// Grid listeners still gather leaves while some wait for lazy evaluation, so the leaves around them get evaluated
+		const bool bSamplesGrid = Listener.Params.bUseReverbGrid && ReverbGrid.IsValid() && !PartitionTree.HasUnevaluatedLeaves();
+		if (!Owner || Listener.Params.SearchRadius <= 0.0f || bSamplesGrid)
+		{
+			continue;
+		}
+
+		const FVector Position = Owner->GetActorLocation();
+		if (Listener.Neighbourhood.NeedsRequery(PartitionTree, Position, Listener.Params.SearchRadius))
+		{
+			const float QueryRadius = Listener.Neighbourhood.BeginRequery(
+				PartitionTree,
+				Position,
+				Listener.Params.SearchRadius,
+				Listener.Params.RequeryDistance);
+			PendingQueries.Add({Position, QueryRadius, &Listener.Neighbourhood.CachedLeaves});
+		}
+	}
+
+	PartitionTree.FindNearbyLeaves(PendingQueries);
+
+	if (PartitionTree.HasUnevaluatedLeaves())
+	{
+		for (const FPR_NearbyLeavesQuery& Query : PendingQueries)
+		{
+			for (const FPR_LeafQueryResult& Leaf : *Query.OutLeaves)
+			{
+				if (!PartitionTree.IsLeafEvaluated(Leaf.LeafIndex))
+				{
+					QueueLeaf(Leaf.LeafIndex, false);
+				}
+			}
+		}
+	}
+
+	for (FPR_Listener& Listener : Listeners)
+	{
+		const AActor* Owner = Listener.Owner.Get();
+		if (!Owner)
+		{
+			continue;
+		}
+
+		const FVector Position = Owner->GetActorLocation();
+		FSubmixEffectReverbSettings Settings;
+		if (Listener.Params.bUseReverbGrid && ReverbGrid.IsValid())
+		{
+			ReverbGrid.Sample(Position, Settings);
+		}
+		else if (Listener.Params.SearchRadius <= 0.0f
+			|| !Listener.Neighbourhood.Evaluate(PartitionTree, Position, Listener.Params.SearchRadius, Settings, GetWorld()))
+		{
+			continue;
+		}
+
+		Listener.OnUpdated.ExecuteIfBound(Settings);
+	}
+}
+
+void UPR_PartitionWorldSubsystem::AdvanceListeners(float DeltaTime)
+{
+	for (FPR_Listener& Listener : Listeners)
+	{
+		Listener.OnAdvance.ExecuteIfBound(DeltaTime);
+	}
+}
+
+TStatId UPR_PartitionWorldSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UPR_PartitionWorldSubsystem, STATGROUP_ProceduralReverb);
+}
+
+void UPR_PartitionWorldSubsystem::Generate()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UPR_PartitionWorldSubsystem::Generate);
+
+	StartGeneration();
+
+	bBlockingGeneration = true;
+	AdvanceGeneration(TNumericLimits<double>::Max());
+	bBlockingGeneration = false;
+}
+
+void UPR_PartitionWorldSubsystem::StartGeneration()
+{
+	// Regions marked dirty from now on are still re-evaluated once the world is ready
+	WaitForLeafUpdate();
+	DirtyLeaves.Reset();
+	LazyLeaves.Reset();
+	QueuedLeafMask.Reset();
+
+	PartitionTree.Reset();
+	ReverbGrid.Reset();
+	PendingLeaves.Reset();
+	ProbingRegion = FPR_GenerationRegion();
+	ProbedRegions.Reset();
+	ReverbNet.Reset();
+	InferenceCache.Reset();
+	bModelResolved = false;
+	ModelLoadHandle.Reset();
+	GenerationStartTime = FPlatformTime::Seconds();
+	GenerationFrames = 0;
+
+	// Loads while the partition is built and probed, only evaluation waits for it
+	RequestModel();
+
+	GenerationStage = EPR_GenerationStage::Bounds;
+}
+
+void UPR_PartitionWorldSubsystem::AdvanceGeneration(double BudgetSeconds)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UPR_PartitionWorldSubsystem::AdvanceGeneration);
+
+	const double StartTime = FPlatformTime::Seconds();
+	++GenerationFrames;
+	do
+	{
+		if (!StepGeneration())
+		{
+			return;
+		}
+	}
+	while (GenerationStage != EPR_GenerationStage::Ready && FPlatformTime::Seconds() - StartTime < BudgetSeconds);
+}
+
+bool UPR_PartitionWorldSubsystem::StepGeneration()
+{
+	switch (GenerationStage)
+	{
+	case EPR_GenerationStage::Bounds:
+		PartitionTree.BeginBuild(GetInitialBoundingBox(), FPR_PartitionBuildParams::FromSettings(GetWorld()), GetWorld());
+		GenerationStage = EPR_GenerationStage::Partition;
+		return true;
+
+	case EPR_GenerationStage::Partition:
+	{
+		// Adaptive builds probe every node they decide, slices keep a step well below the frame budget
+		constexpr int32 NodesPerStep = 256;
+		if (!PartitionTree.StepBuild(NodesPerStep))
+		{
+			return true;
+		}
+
+		PartitionTree.BeginClassifyLeaves();
+		GenerationStage = EPR_GenerationStage::Classification;
+		return true;
+	}
+
+	case EPR_GenerationStage::Classification:
+	{
+		// Every leaf runs a few overlap tests, all workers share a slice
+		constexpr int32 LeavesPerStep = 512;
+		if (PartitionTree.StepClassifyLeaves(LeavesPerStep))
+		{
+			UpdatePartitionStats();
+			BeginEvaluation();
+		}
+		return true;
+	}
+
+	case EPR_GenerationStage::Regions:
+		return StepRegions();
+
+	case EPR_GenerationStage::Estimates:
+	{
+		if (!ResolveModel())
+		{
+			if (!bBlockingGeneration)
+			{
+				return false;
+			}
+
+			ModelLoadHandle->WaitUntilComplete();
+			return true;
+		}
+
+		// Every region center is probed and evaluated, visibility would trace between all leaves and is skipped
+		constexpr int32 RegionsPerStep = 32;
+		if (PartitionTree.StepEstimateLeaves(ReverbNet.Get(), RegionsPerStep, InferenceCache.Get()))
+		{
+			GenerationStage = EPR_GenerationStage::Compaction;
+		}
+		return true;
+	}
+
+	case EPR_GenerationStage::Visibility:
+	{
+		// Every leaf traces to all leaves within the visibility radius
+		constexpr int32 LeavesPerStep = 32;
+		if (PartitionTree.StepLeafVisibility(LeavesPerStep))
+		{
+			GenerationStage = EPR_GenerationStage::Compaction;
+		}
+		return true;
+	}
+
+	case EPR_GenerationStage::Compaction:
+		if (ReverbNet.IsValid())
+		{
+			PartitionTree.CompactLeaves();
+		}
+
+		UpdatePartitionStats();
+		BeginReverbGrid();
+		GenerationStage = EPR_GenerationStage::Grid;
+		return true;
+
+	case EPR_GenerationStage::Grid:
+	{
+		// Every sample descends the partition, slices are sized by their samples
+		constexpr int32 SamplesPerStep = 16 * 1024;
+		const FIntVector& Dimensions = ReverbGrid.GetDimensions();
+		const int32 SlicesPerStep = FMath::Max(1, SamplesPerStep / FMath::Max(1, Dimensions.X * Dimensions.Y));
+		if (ReverbGrid.StepBuild(PartitionTree, SlicesPerStep))
+		{
+			GenerationStage = EPR_GenerationStage::Save;
+		}
+		return true;
+	}
+
+	case EPR_GenerationStage::Save:
+		FinishGeneration();
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+bool UPR_PartitionWorldSubsystem::StepRegions()
+{
+	// Finished regions become ready before further ones are probed
+	if (!ProbedRegions.IsEmpty())
+	{
+		if (ResolveModel())
+		{
+			const FPR_GenerationRegion Region = MoveTemp(ProbedRegions[0]);
+			ProbedRegions.RemoveAt(0);
+			if (ReverbNet.IsValid())
+			{
+				PartitionTree.RunModel(*ReverbNet, Region.LeafIndices, InferenceCache.Get());
+			}
+
+			OnRegionReady.Broadcast(Region.Bounds);
+			return true;
+		}
+
+		if (bBlockingGeneration)
+		{
+			ModelLoadHandle->WaitUntilComplete();
+			return true;
+		}
+
+		// Probing goes on while the model loads, once every leaf is probed there is nothing left to do
+		if (PendingLeaves.IsEmpty() && ProbingRegion.LeafIndices.IsEmpty())
+		{
+			return false;
+		}
+	}
+
+	if (ProbingRegion.LeafIndices.IsEmpty())
+	{
+		if (PendingLeaves.IsEmpty())
+		{
+			OnAcousticDataCollected.Broadcast();
+			GenerationStage = EPR_GenerationStage::Visibility;
+			auto* Settings = GetDefault<UProceduralReverbSettings>();
+			if (Settings->bBuildLeafVisibility)
+			{
+				PartitionTree.BeginLeafVisibility(GetWorld(), Settings->LeafVisibilityRadius);
+			}
+			return true;
+		}
+
+		SelectNextRegion();
+	}
+
+	// Small slices keep a step well below the frame budget, tracing still runs on all workers
+	constexpr int32 LeavesPerStep = 128;
+	const int32 NumLeaves = FMath::Min(LeavesPerStep, ProbingRegion.LeafIndices.Num() - ProbingRegion.NumProbedLeaves);
+	const TConstArrayView<int32> Slice(ProbingRegion.LeafIndices.GetData() + ProbingRegion.NumProbedLeaves, NumLeaves);
+	PartitionTree.CollectAcousticData(GetWorld(), Slice);
+	for (const int32 LeafIndex : Slice)
+	{
+		ProbingRegion.Bounds += PartitionTree.GetLeafBounds(LeafIndex);
+	}
+
+	ProbingRegion.NumProbedLeaves += NumLeaves;
+	if (ProbingRegion.NumProbedLeaves == ProbingRegion.LeafIndices.Num())
+	{
+		ProbedRegions.Add(MoveTemp(ProbingRegion));
+		ProbingRegion = FPR_GenerationRegion();
+	}
+
+	return true;
+}
+
+void UPR_PartitionWorldSubsystem::SelectNextRegion()
+{
+	ProbingRegion = FPR_GenerationRegion();
+	UpdatePriorityPositions(PendingLeaves);
+	PendingLeaves.Pop(FMath::Max(GetDefault<UProceduralReverbSettings>()->GenerationRegionLeaves, 1), ProbingRegion.LeafIndices);
+}
+
+void UPR_PartitionWorldSubsystem::GetPriorityPositions(TArray<FVector, TInlineAllocator<8>>& OutPositions) const
+{
+	OutPositions.Reset();
+	for (const FPR_Listener& Listener : Listeners)
+	{
+		if (const AActor* Owner = Listener.Owner.Get())
+		{
+			OutPositions.Add(Owner->GetActorLocation());
+		}
+	}
+
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It && OutPositions.IsEmpty(); ++It)
+	{
+		if (const APawn* Pawn = It->IsValid() ? (*It)->GetPawn() : nullptr)
+		{
+			OutPositions.Add(Pawn->GetActorLocation());
+		}
+	}
+}
+
+void UPR_PartitionWorldSubsystem::UpdatePriorityPositions(FPR_LeafPriorityQueue& Leaves) const
+{
+	// Reordering is linear in the queued leaves, moves this short barely change which leaves are closest
+	constexpr float RefreshDistance = 100.0f;
+	FPR_LeafPriorityQueue::FPositions Positions;
+	GetPriorityPositions(Positions);
+	Leaves.UpdatePositions(PartitionTree, Positions, RefreshDistance);
+}
+
+void UPR_PartitionWorldSubsystem::RequestModel()
+{
+	if (bModelResolved || ModelLoadHandle.IsValid())
+	{
+		return;
+	}
+
+	const FSoftObjectPath ModelPath = GetDefault<UProceduralReverbSettings>()->PreLoadedModelData.ToSoftObjectPath();
+	ModelLoadHandle = ModelPath.IsNull() ? nullptr : StreamableManager.RequestAsyncLoad(ModelPath);
+}
+
+bool UPR_PartitionWorldSubsystem::ResolveModel()
+{
+	if (bModelResolved)
+	{
+		return true;
+	}
+
+	if (ModelLoadHandle.IsValid() && !ModelLoadHandle->HasLoadCompleted())
+	{
+		return false;
+	}
 
-	// TODO: Move to Actor Component?
-	TObjectPtr<UNNEModelData> ModelData = GetDefault<UProceduralReverbSettings>()->PreLoadedModelData.LoadSynchronous();
+	bModelResolved = true;
+
+	auto* ModelData = ModelLoadHandle.IsValid() ? Cast<UNNEModelData>(ModelLoadHandle->GetLoadedAsset()) : nullptr;
 	if (!IsValid(ModelData))
 	{
+		return true;
+	}
+
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+	TSharedPtr<FPR_ReverbNet> LoadedNet = MakeShared<FPR_ReverbNet>();
+	if (LoadedNet->Init(ModelData, Settings->InferenceBatchSize, Settings->InferenceBackend))
+	{
+		ReverbNet = MoveTemp(LoadedNet);
+		if (Settings->bInferenceCache)
+		{
+			InferenceCache = MakeShared<PRCore::FInferenceCache>(Settings->InferenceCacheResolution);
+		}
+	}
+
+	return true;
+}
+
+void UPR_PartitionWorldSubsystem::BeginEvaluation()
+{
+	if (PartitionTree.IsEmpty())
+	{
+		GenerationStage = EPR_GenerationStage::Compaction;
 		return;
 	}
 
-	TWeakInterfacePtr<INNERuntimeCPU> Runtime = UE::NNE::GetRuntime<INNERuntimeCPU>(FString("NNERuntimeORTCpu"));
-	if (!Runtime.IsValid())
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+	if (Settings->bLazyEvaluation)
 	{
+		PartitionTree.BeginEstimateLeaves(GetWorld(), Settings->LazyEstimateDepth);
+		GenerationStage = EPR_GenerationStage::Estimates;
 		return;
 	}
 
-	TSharedPtr<UE::NNE::IModelCPU> Model = Runtime->CreateModelCPU(ModelData);
-	if (!Model.IsValid())
+	GenerationStage = EPR_GenerationStage::Regions;
+	TArray<int32> PlayableLeaves;
+	PartitionTree.GetPlayableLeaves(PlayableLeaves);
+	UpdatePriorityPositions(PendingLeaves);
+	for (const int32 LeafIndex : PlayableLeaves)
+	{
+		PendingLeaves.Add(PartitionTree, LeafIndex);
+	}
+}
+
+void UPR_PartitionWorldSubsystem::FinishGeneration()
+{
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+	if (InferenceCache.IsValid())
+	{
+		UE_LOG(LogPrPartition, Log, TEXT("Inference cache holds %d results, %.1f%% of %llu lookups hit"),
+			static_cast<int32>(InferenceCache->Num()),
+			InferenceCache->GetHitRate() * 100.0,
+			InferenceCache->GetNumLookups());
+	}
+
+#if WITH_EDITOR
+	if (ReverbNet.IsValid() && Settings->bSaveBakedData)
+	{
+		SaveBakedData();
+	}
+#endif // WITH_EDITOR
+
+	// Dirty and lazily evaluated leaves need the model later on
+	if (!Settings->bDynamicUpdates && !Settings->bLazyEvaluation)
+	{
+		ReverbNet.Reset();
+		InferenceCache.Reset();
+	}
+
+	// The model instance doesn't need its asset after initialization
+	if (ModelLoadHandle.IsValid())
+	{
+		ModelLoadHandle->ReleaseHandle();
+		ModelLoadHandle.Reset();
+	}
+
+	UE_LOG(LogPrPartition, Log, TEXT("Generated %d leaves in %.2f ms over %d frames"),
+		PartitionTree.GetNumLeaves(),
+		(FPlatformTime::Seconds() - GenerationStartTime) * 1000.0,
+		GenerationFrames);
+
+	GenerationStage = EPR_GenerationStage::Ready;
+	OnWorldReady.Broadcast();
+}
+
+void UPR_PartitionWorldSubsystem::MarkDirty(const FBox& Bounds)
+{
+	if (!Bounds.IsValid || !GetDefault<UProceduralReverbSettings>()->bDynamicUpdates)
 	{
 		return;
 	}
 
-	TSharedPtr<UE::NNE::IModelInstanceCPU> ModelInstance = Model->CreateModelInstanceCPU();
+	// Overlapping requests become one box, e.g. a door marked every frame while it swings
+	FBox MergedBounds = Bounds;
+	for (int32 Index = DirtyBoxes.Num() - 1; Index >= 0; --Index)
+	{
+		if (DirtyBoxes[Index].Intersect(MergedBounds))
+		{
+			MergedBounds += DirtyBoxes[Index];
+			DirtyBoxes.RemoveAtSwap(Index, 1, EAllowShrinking::No);
+		}
+	}
 
-	TConstArrayView<UE::NNE::FTensorDesc> InputTensorDescs = ModelInstance->GetInputTensorDescs();
-	checkf(InputTensorDescs.Num() == 1, TEXT("The current example supports only models with a single input tensor"));
-	UE::NNE::FSymbolicTensorShape SymbolicInputTensorShape = InputTensorDescs[0].GetShape();
-	checkf(SymbolicInputTensorShape.IsConcrete(),
-			TEXT("The current example supports only models without variable input tensor dimensions"));
-	TArray<UE::NNE::FTensorShape> InputTensorShapes = {
-		UE::NNE::FTensorShape::MakeFromSymbolic(SymbolicInputTensorShape)
-	};
+	DirtyBoxes.Add(MergedBounds);
+}
 
-	ModelInstance->SetInputTensorShapes(InputTensorShapes);
+void UPR_PartitionWorldSubsystem::MarkDirty(const UPrimitiveComponent* Component)
+{
+	if (IsValid(Component))
+	{
+		MarkDirty(Component->Bounds.GetBox());
+	}
+}
 
-	TConstArrayView<UE::NNE::FTensorDesc> OutputTensorDescs = ModelInstance->GetOutputTensorDescs();
-	checkf(OutputTensorDescs.Num() == 1, TEXT("The current example supports only models with a single output tensor"));
-	UE::NNE::FSymbolicTensorShape SymbolicOutputTensorShape = OutputTensorDescs[0].GetShape();
-	checkf(SymbolicOutputTensorShape.IsConcrete(),
-			TEXT("The current example supports only models without variable output tensor dimensions"));
-	TArray<UE::NNE::FTensorShape> OutputTensorShapes = {
-		UE::NNE::FTensorShape::MakeFromSymbolic(SymbolicOutputTensorShape)
-	};
+void UPR_PartitionWorldSubsystem::UpdateQueuedLeaves()
+{
+	if (LeafUpdate.IsValid())
+	{
+		if (!LeafUpdateTask.IsCompleted())
+		{
+			return;
+		}
 
-	if (RootNode)
+		ApplyLeafUpdate();
+	}
+
+	if (PartitionTree.IsEmpty())
+	{
+		DirtyBoxes.Reset();
+		return;
+	}
+
+	// Leaf indices are stable from here on, boxes are resolved right away so requests for the same leaves coalesce
+	TArray<int32> BoxLeaves;
+	for (const FBox& Bounds : DirtyBoxes)
+	{
+		BoxLeaves.Reset();
+		PartitionTree.FindLeavesInBox(Bounds, BoxLeaves);
+		for (const int32 LeafIndex : BoxLeaves)
+		{
+			QueueLeaf(LeafIndex, true);
+		}
+	}
+	DirtyBoxes.Reset();
+
+	const bool bDirtyDue = !DirtyLeaves.IsEmpty()
+		&& FPlatformTime::Seconds() - LastDirtyUpdateTime >= GetDefault<UProceduralReverbSettings>()->DynamicUpdateInterval;
+	if (!bDirtyDue && LazyLeaves.IsEmpty())
 	{
-		RootNode->RunModel(ModelInstance, InputTensorShapes, OutputTensorShapes);
+		return;
+	}
+
+	// Baked worlds load the model on the first update
+	RequestModel();
+	if (ResolveModel())
+	{
+		LaunchLeafUpdate(bDirtyDue);
 	}
 }
 
-void UPR_PartitionWorldSubsystem::Tick(float DeltaTime)
+void UPR_PartitionWorldSubsystem::QueueLeaf(int32 LeafIndex, bool bDirty)
 {
-	Super::Tick(DeltaTime);
+	if (QueuedLeavesRevision != PartitionTree.GetRevision() || QueuedLeafMask.Num() != PartitionTree.GetNumLeaves())
+	{
+		DirtyLeaves.Reset();
+		LazyLeaves.Reset();
+		QueuedLeafMask.Init(false, PartitionTree.GetNumLeaves());
+		QueuedLeavesRevision = PartitionTree.GetRevision();
+	}
 
-	if (RootNode)
+	if (!QueuedLeafMask[LeafIndex])
 	{
-		RootNode->DrawDebug(GetWorld());
+		QueuedLeafMask[LeafIndex] = true;
+		if (bDirty)
+		{
+			DirtyLeaves.Add(LeafIndex);
+		}
+		else
+		{
+			LazyLeaves.Add(PartitionTree, LeafIndex);
+		}
 	}
 }
 
-TStatId UPR_PartitionWorldSubsystem::GetStatId() const
+void UPR_PartitionWorldSubsystem::LaunchLeafUpdate(bool bIncludeDirty)
 {
-	RETURN_QUICK_DECLARE_CYCLE_STAT(UPCGSubsystem, STATGROUP_Tickables);
+	TRACE_CPUPROFILER_EVENT_SCOPE(UPR_PartitionWorldSubsystem::LaunchLeafUpdate);
+
+	const int32 MaxLeaves = FMath::Max(GetDefault<UProceduralReverbSettings>()->DynamicUpdateMaxLeaves, 1);
+
+	TSharedPtr<FPR_LeafUpdate> Update = MakeShared<FPR_LeafUpdate>();
+	Update->TreeRevision = PartitionTree.GetRevision();
+	Update->StartTime = FPlatformTime::Seconds();
+	if (bIncludeDirty)
+	{
+		const int32 NumDirty = FMath::Min(MaxLeaves, DirtyLeaves.Num());
+		Update->LeafIndices.Append(DirtyLeaves.GetData(), NumDirty);
+		DirtyLeaves.RemoveAt(0, NumDirty, EAllowShrinking::No);
+		LastDirtyUpdateTime = Update->StartTime;
+	}
+
+	// Listeners move, so lazy leaves are reordered by their current distance once they moved
+	const int32 NumLazy = MaxLeaves - Update->LeafIndices.Num();
+	if (NumLazy > 0 && !LazyLeaves.IsEmpty())
+	{
+		UpdatePriorityPositions(LazyLeaves);
+		LazyLeaves.Pop(NumLazy, Update->LeafIndices);
+	}
+
+	const int32 NumLeaves = Update->LeafIndices.Num();
+	Update->Centers.Reserve(NumLeaves);
+	Update->Features.SetNum(NumLeaves);
+	for (const int32 LeafIndex : Update->LeafIndices)
+	{
+		const FBox LeafBounds = PartitionTree.GetLeafBounds(LeafIndex);
+		Update->Bounds += LeafBounds;
+		Update->Centers.Add(ToCore(LeafBounds.GetCenter()));
+		QueuedLeafMask[LeafIndex] = false;
+	}
+
+	LeafUpdate = Update;
+
+	// The probes overlap the rest of the world tick and are waited for at its end, before anything can be garbage collected
+	LeafProbeTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, [Update, World = GetWorld()]()
+	{
+		FPR_PartitionTree::ProbeLeaves(World, Update->Centers, Update->Features);
+	});
+
+	// Inference touches no world state and may take several frames,
+	// generation only starts again after the task finished, nothing else uses the model meanwhile
+	LeafUpdateTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, [Update, Net = ReverbNet, Cache = InferenceCache]()
+	{
+		if (Net.IsValid() && !FPR_PartitionTree::EvaluateFeatures(*Net, Update->Features, Update->ReverbParams, Cache.Get()))
+		{
+			Update->ReverbParams.Reset();
+		}
+	}, LeafProbeTask);
 }
 
-void UPR_PartitionWorldSubsystem::Generate()
+void UPR_PartitionWorldSubsystem::ApplyLeafUpdate()
 {
-	GenerateBSPTree(GetInitialBoundingBox());
+	TRACE_CPUPROFILER_EVENT_SCOPE(UPR_PartitionWorldSubsystem::ApplyLeafUpdate);
 
-	if (RootNode.IsValid())
+	const TSharedPtr<FPR_LeafUpdate> Update = MoveTemp(LeafUpdate);
+	if (Update->TreeRevision != PartitionTree.GetRevision())
 	{
-		RootNode->CollectAcousticData(GetWorld());
+		return;
+	}
+
+	// Listeners and the grid read the results on the game thread only, so they see all of them change at once
+	const bool bHadUnevaluatedLeaves = PartitionTree.HasUnevaluatedLeaves();
+	PartitionTree.UpdateLeaves(Update->LeafIndices, Update->Features, Update->ReverbParams);
+	if (ReverbGrid.IsValid() && !ReverbGrid.Update(PartitionTree, Update->Bounds))
+	{
+		BuildReverbGrid();
+	}
+
+	UpdatePartitionStats();
+
+	UE_LOG(LogPrPartition, Verbose, TEXT("Re-evaluated %d leaves in %.2f ms"),
+		Update->LeafIndices.Num(),
+		(FPlatformTime::Seconds() - Update->StartTime) * 1000.0);
+
+	OnRegionUpdated.Broadcast(Update->Bounds);
+	if (bHadUnevaluatedLeaves && !PartitionTree.HasUnevaluatedLeaves())
+	{
+		OnAcousticDataCollected.Broadcast();
+	}
+}
+
+void UPR_PartitionWorldSubsystem::WaitForLeafUpdate()
+{
+	if (LeafUpdate.IsValid())
+	{
+		LeafUpdateTask.Wait();
+		LeafUpdate.Reset();
 	}
 }
 
+void UPR_PartitionWorldSubsystem::HandleWorldTickEnd(UWorld* World, ELevelTick TickType, float DeltaSeconds)
+{
+	if (World == GetWorld() && LeafProbeTask.IsValid())
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE(UPR_PartitionWorldSubsystem::WaitForLeafProbes);
+		LeafProbeTask.Wait();
+		LeafProbeTask = {};
+	}
+}
+
+void UPR_PartitionWorldSubsystem::UpdatePartitionStats() const
+{
+	SET_DWORD_STAT(STAT_PR_NumLeaves, PartitionTree.GetNumLeaves());
+	SET_MEMORY_STAT(STAT_PR_PartitionMemory, PartitionTree.GetAllocatedSize() - PartitionTree.GetAcousticDataAllocatedSize());
+	SET_MEMORY_STAT(STAT_PR_AcousticDataMemory, PartitionTree.GetAcousticDataAllocatedSize());
+}
+
+void UPR_PartitionWorldSubsystem::BuildReverbGrid()
+{
+	BeginReverbGrid();
+	ReverbGrid.StepBuild(PartitionTree, TNumericLimits<int32>::Max());
+}
+
+void UPR_PartitionWorldSubsystem::BeginReverbGrid()
+{
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+	if (!Settings->bBuildReverbGrid)
+	{
+		ReverbGrid.Reset();
+		return;
+	}
+
+	ReverbGrid.BeginBuild(PartitionTree, Settings->ReverbGridCellSize, Settings->ReverbGridPrecision, Settings->ReverbGridMaxSamples);
+}
+
+bool UPR_PartitionWorldSubsystem::LoadBakedData()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UPR_PartitionWorldSubsystem::LoadBakedData);
+
+	const UWorld* World = GetWorld();
+	return FPR_PartitionBake::Load(FPR_PartitionBake::GetFilePath(World), FPR_PartitionBakeKey::Compute(World), PartitionTree);
+}
+
+bool UPR_PartitionWorldSubsystem::SaveBakedData()
+{
+	// Coarse estimates are not worth baking
+	if (PartitionTree.IsEmpty() || PartitionTree.HasUnevaluatedLeaves())
+	{
+		return false;
+	}
+
+	const UWorld* World = GetWorld();
+	return FPR_PartitionBake::Save(FPR_PartitionBake::GetFilePath(World), FPR_PartitionBakeKey::Compute(World), PartitionTree);
+}
+
 FBox UPR_PartitionWorldSubsystem::GetInitialBoundingBox() const
 {
-	FBox ResultBox;
+	TRACE_CPUPROFILER_EVENT_SCOPE(UPR_PartitionWorldSubsystem::GetInitialBoundingBox);
+
+	auto* Settings = GetDefault<UProceduralReverbSettings>();
+
+	TArray<const UStaticMeshComponent*> BoundsComponents;
 	for (TActorIterator<AActor> It(GetWorld()); It; ++It)
 	{
+		if (Settings->BoundsExcludedActorTags.ContainsByPredicate([&It](const FName& Tag) { return It->ActorHasTag(Tag); }))
+		{
+			continue;
+		}
+
 		TArray<UStaticMeshComponent*> Components;
 		It->GetComponents<UStaticMeshComponent>(Components);
 
@@ -104,30 +834,57 @@ FBox UPR_PartitionWorldSubsystem::GetInitialBoundingBox() const
 				continue;
 			}
 
-			auto StaticMesh = Component->GetStaticMesh();
-			if (!IsValid(StaticMesh))
+			if (!IsValid(Component->GetStaticMesh()))
 			{
 				continue;
 			}
 
-			FTransform ComponentToWorld = Component->GetComponentTransform();
-
-			if (StaticMesh->GetRenderData())
+			if (Settings->BoundsExcludedCollisionProfiles.Contains(Component->GetCollisionProfileName()))
 			{
-				FStaticMeshLODResources& LODResource = StaticMesh->GetRenderData()->LODResources[0];
-				const FPositionVertexBuffer& VertexBuffer = LODResource.VertexBuffers.PositionVertexBuffer;
-
-				int32 VertexCount = VertexBuffer.GetNumVertices();
-				TArray<FVector> Vertices;
-				Vertices.Reserve(VertexCount);
-				for (int32 i = 0; i < VertexCount; i++)
-				{
-					FVector VertexPosition = ComponentToWorld.
-						TransformPosition(FVector(VertexBuffer.VertexPosition(i)));
-					ResultBox += VertexPosition;
-				}
+				continue;
 			}
+
+			BoundsComponents.Add(Component);
+		}
+	}
+
+	FBox ResultBox(ForceInit);
+	if (Settings->BoundsMode == EPR_BoundsMode::ComponentBounds)
+	{
+		// Local bounds transformed to world space, kept up to date by the components themselves
+		for (const UStaticMeshComponent* Component : BoundsComponents)
+		{
+			ResultBox += Component->Bounds.GetBox();
 		}
+
+		return ResultBox;
+	}
+
+	TArray<FBox> ComponentBoxes;
+	ComponentBoxes.Init(FBox(ForceInit), BoundsComponents.Num());
+	ParallelFor(BoundsComponents.Num(), [&BoundsComponents, &ComponentBoxes](int32 Index)
+	{
+		const UStaticMeshComponent* Component = BoundsComponents[Index];
+		const FStaticMeshRenderData* RenderData = Component->GetStaticMesh()->GetRenderData();
+		if (!RenderData || RenderData->LODResources.IsEmpty())
+		{
+			return;
+		}
+
+		const FPositionVertexBuffer& VertexBuffer = RenderData->LODResources[0].VertexBuffers.PositionVertexBuffer;
+		const FMatrix ComponentToWorld = Component->GetComponentTransform().ToMatrixWithScale();
+
+		FBox& ComponentBox = ComponentBoxes[Index];
+		const int32 VertexCount = VertexBuffer.GetNumVertices();
+		for (int32 i = 0; i < VertexCount; i++)
+		{
+			ComponentBox += ComponentToWorld.TransformPosition(FVector(VertexBuffer.VertexPosition(i)));
+		}
+	});
+
+	for (const FBox& ComponentBox : ComponentBoxes)
+	{
+		ResultBox += ComponentBox;
 	}
 
 	return ResultBox;
@@ -140,15 +897,17 @@ void UPR_PartitionWorldSubsystem::GenerateBSPTree(const FBox& InitialBox)
 		return;
 	}
 
-	RootNode = MakeShared<FPR_BSPNode>(InitialBox);
-	RootNode->PartitionSpace(0);
+	PartitionTree.Build(InitialBox, FPR_PartitionBuildParams::FromSettings(GetWorld()), GetWorld());
 }
 
-void UPR_PartitionWorldSubsystem::FindNearbyNodes(const FVector& Position, float SearchRadius,
-												TArray<TSharedPtr<FPR_BSPNode>>& OutNearbyNodes) const
+void UPR_PartitionWorldSubsystem::FindNearbyLeaves(const FVector& Position, float SearchRadius,
+												TArray<FPR_LeafQueryResult>& OutNearbyLeaves) const
 {
-	if (RootNode)
-	{
-		RootNode->FindNearbyNodes(Position, SearchRadius, OutNearbyNodes);
-	}
+	PartitionTree.FindNearbyLeaves(Position, SearchRadius, OutNearbyLeaves);
+}
+
+void UPR_PartitionWorldSubsystem::FindNearestLeaves(const FVector& Position, int32 Count,
+												TArray<FPR_LeafQueryResult>& OutNearestLeaves) const
+{
+	PartitionTree.FindNearestLeaves(Position, Count, OutNearestLeaves);
 }
@@ -3,11 +3,63 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Engine/StreamableManager.h"
+#include "PR_LeafPriorityQueue.h"
+#include "PR_PartitionTree.h"
+#include "PR_ReverbGrid.h"
+#include "ProceduralReverb/Runtime/PR_ListenerNeighbourhood.h"
+#include "SubmixEffects/AudioMixerSubmixEffectReverb.h"
 #include "Subsystems/WorldSubsystem.h"
+#include "Tasks/Task.h"
 #include "PR_PartitionWorldSubsystem.generated.h"
 
+class FPR_ReverbNet;
+
+namespace PRCore
+{
+class FInferenceCache;
+}
+class UPrimitiveComponent;
 struct FPR_Polygon;
-struct FPR_BSPNode;
+
+DECLARE_MULTICAST_DELEGATE(FOnPRAcousticDataCollected);
+DECLARE_MULTICAST_DELEGATE_OneParam(FOnPRRegionReady, const FBox& /*Bounds*/);
+DECLARE_MULTICAST_DELEGATE(FOnPRWorldReady);
+DECLARE_DELEGATE_OneParam(FOnPRListenerReverbUpdated, const FSubmixEffectReverbSettings&);
+/** Called every frame whether or not the listener received new settings, lets it ease toward earlier ones */
+DECLARE_DELEGATE_OneParam(FOnPRListenerAdvance, float /*DeltaTime*/);
+
+
+struct FPR_ListenerParams
+{
+	float SearchRadius = 1000.0f;
+	/** Extra radius gathered around the listener, the partition is queried again only after moving this far */
+	float RequeryDistance = 250.0f;
+	/** Samples the reverb grid instead of blending nearby leaves, when the grid is built */
+	bool bUseReverbGrid = false;
+};
+
+enum class EPR_GenerationStage : uint8
+{
+	Idle,
+	Bounds,
+	/** The partition is built a slice of each level at a time */
+	Partition,
+	/** Solid and exterior leaves are found a range of leaves at a time, then collapsed */
+	Classification,
+	/** Leaves are probed and evaluated region by region, closest to the listeners first */
+	Regions,
+	/** Lazy evaluation only, every leaf takes the estimate of its coarse region, a range of regions at a time */
+	Estimates,
+	/** Leaf visibility is traced a range of leaves at a time */
+	Visibility,
+	Compaction,
+	/** The reverb grid is sampled a range of Z slices at a time */
+	Grid,
+	/** Writes the baked data in the editor, then the world is ready */
+	Save,
+	Ready
+};
 
 /**
  * 
@@ -20,18 +72,165 @@ class PROCEDURALREVERB_API UPR_PartitionWorldSubsystem : public UTickableWorldSu
 protected:
 	// UWorldSubsystem interface
 	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
 	virtual void Tick(float DeltaTime) override;
 	virtual TStatId GetStatId() const override;
 	//~ UWorldSubsystem interface
 
 public:
+	/** Generates the partition on the game thread and returns once the world is ready */
 	void Generate();
+	/** Starts a generation that Tick advances within GenerationFrameBudget per frame */
+	void StartGeneration();
+	EPR_GenerationStage GetGenerationStage() const { return GenerationStage; }
+	bool IsReady() const { return GenerationStage == EPR_GenerationStage::Ready; }
+
+	/**
+	 * Queues the leaves intersecting Bounds for re-evaluation after geometry changed, e.g. a door opened or a wall was destroyed.
+	 * Overlapping requests are coalesced, leaves are probed and evaluated on worker threads and swapped in on the game thread.
+	 * Baked leaf visibility is not updated.
+	 */
+	void MarkDirty(const FBox& Bounds);
+	/** Marks the current bounds of the component, call it before and after moving it */
+	void MarkDirty(const UPrimitiveComponent* Component);
 
 	FBox GetInitialBoundingBox() const;
 	void GenerateBSPTree(const FBox& InitialBox);
 
-	void FindNearbyNodes(const FVector& Position, float SearchRadius, TArray<TSharedPtr<FPR_BSPNode>>& OutNearbyNodes) const;
+	/** Replaces the partition with the baked one if it was generated from the current level and settings */
+	bool LoadBakedData();
+	bool SaveBakedData();
+
+	void FindNearbyLeaves(const FVector& Position, float SearchRadius, TArray<FPR_LeafQueryResult>& OutNearbyLeaves) const;
+	void FindNearestLeaves(const FVector& Position, int32 Count, TArray<FPR_LeafQueryResult>& OutNearestLeaves) const;
+
+	const FPR_PartitionTree& GetPartitionTree() const { return PartitionTree; }
+	/** Empty unless bBuildReverbGrid is set */
+	const FPR_ReverbGrid& GetReverbGrid() const { return ReverbGrid; }
+
+	/**
+	 * Listeners are evaluated together once per frame, nearby leaves of every listener that moved
+	 * are gathered with one traversal of the partition. OnUpdated is called with the blended settings.
+	 */
+	int32 RegisterListener(
+		const AActor* Owner,
+		const FPR_ListenerParams& Params,
+		FOnPRListenerReverbUpdated OnUpdated,
+		FOnPRListenerAdvance OnAdvance = FOnPRListenerAdvance());
+	void UnregisterListener(int32 ListenerHandle);
+	/** Replaces the parameters of a registered listener, its neighbourhood is gathered again on the next update */
+	void SetListenerParams(int32 ListenerHandle, const FPR_ListenerParams& Params);
+
+	/** Broadcast on the game thread once every leaf has its acoustic data */
+	FOnPRAcousticDataCollected OnAcousticDataCollected;
+	/** Broadcast when the leaves within Bounds have their reverb, before the whole world is ready */
+	FOnPRRegionReady OnRegionReady;
+	/** Broadcast once generation finished or baked data was loaded */
+	FOnPRWorldReady OnWorldReady;
+	/** Broadcast when leaves within Bounds were re-evaluated after MarkDirty or evaluated lazily */
+	FOnPRRegionReady OnRegionUpdated;
 
 private:
-	TSharedPtr<FPR_BSPNode> RootNode;
+	struct FPR_Listener
+	{
+		TWeakObjectPtr<const AActor> Owner;
+		FPR_ListenerParams Params;
+		FOnPRListenerReverbUpdated OnUpdated;
+		FOnPRListenerAdvance OnAdvance;
+		FPR_ListenerNeighbourhood Neighbourhood;
+	};
+
+	struct FPR_GenerationRegion
+	{
+		TArray<int32> LeafIndices;
+		int32 NumProbedLeaves = 0;
+		FBox Bounds = FBox(ForceInit);
+	};
+
+	/** Leaves re-evaluated by one worker task, inputs are copied so the task never reads the tree */
+	struct FPR_LeafUpdate
+	{
+		uint32 TreeRevision = 0;
+		double StartTime = 0.0;
+		FBox Bounds = FBox(ForceInit);
+		TArray<int32> LeafIndices;
+		TArray<PRCore::FVec3> Centers;
+		TArray<PRCore::FLeafFeatures> Features;
+		/** Empty when there is no model, only the features are replaced then */
+		TArray<PRCore::FReverbParams> ReverbParams;
+	};
+
+	/** Runs generation steps until the budget is spent, returns early while waiting for the model */
+	void AdvanceGeneration(double BudgetSeconds);
+	/** Runs one unit of work, returns false when nothing can be done before the model has loaded */
+	bool StepGeneration();
+	bool StepRegions();
+	void SelectNextRegion();
+	/** Listener positions, or the player pawns until listeners have registered */
+	void GetPriorityPositions(TArray<FVector, TInlineAllocator<8>>& OutPositions) const;
+	/** Reorders the leaves once the priority positions moved */
+	void UpdatePriorityPositions(FPR_LeafPriorityQueue& Leaves) const;
+	/** False while the model is loading, ReverbNet stays null when there is no usable model */
+	bool ResolveModel();
+	/** Queues the playable leaves for the regions, or starts the estimates under lazy evaluation */
+	void BeginEvaluation();
+	void FinishGeneration();
+	/** Starts loading the model unless it is loaded or loading */
+	void RequestModel();
+
+	/** Applies a finished update and launches the next one, dirty leaves once the interval has passed */
+	void UpdateQueuedLeaves();
+	/** Dirty leaves are kept in the order they were marked, leaves awaiting lazy evaluation go closest first */
+	void QueueLeaf(int32 LeafIndex, bool bDirty);
+	void LaunchLeafUpdate(bool bIncludeDirty);
+	void ApplyLeafUpdate();
+	void WaitForLeafUpdate();
+	/** Probes trace the world and read physical materials, they must not outlive the world tick that launched them */
+	void HandleWorldTickEnd(UWorld* World, ELevelTick TickType, float DeltaSeconds);
+
+	void BuildReverbGrid();
+	/** Starts sampling the grid, or drops it when bBuildReverbGrid isn't set */
+	void BeginReverbGrid();
+	void UpdateListeners();
+	/** Runs even while the partition is empty or being generated */
+	void AdvanceListeners(float DeltaTime);
+	void UpdatePartitionStats() const;
+
+	FPR_PartitionTree PartitionTree;
+	FPR_ReverbGrid ReverbGrid;
+
+	EPR_GenerationStage GenerationStage = EPR_GenerationStage::Idle;
+	/** Set by Generate, waiting for the model blocks instead of yielding to the next frame */
+	bool bBlockingGeneration = false;
+	double GenerationStartTime = 0.0;
+	int32 GenerationFrames = 0;
+	/** Leaves not yet assigned to a region */
+	FPR_LeafPriorityQueue PendingLeaves;
+	FPR_GenerationRegion ProbingRegion;
+	/** Probed regions waiting for the model, evaluated in the order they were probed */
+	TArray<FPR_GenerationRegion> ProbedRegions;
+
+	FStreamableManager StreamableManager;
+	TSharedPtr<FStreamableHandle> ModelLoadHandle;
+	TSharedPtr<FPR_ReverbNet> ReverbNet;
+	/** Lives as long as the model, results carry over from generation to dirty and lazy updates */
+	TSharedPtr<PRCore::FInferenceCache> InferenceCache;
+	bool bModelResolved = false;
+
+	/** Marked regions not yet resolved to leaves, leaf indices are only stable once the world is ready */
+	TArray<FBox> DirtyBoxes;
+	/** The mask keeps every leaf queued once, in either of the queues */
+	TArray<int32> DirtyLeaves;
+	FPR_LeafPriorityQueue LazyLeaves;
+	TBitArray<> QueuedLeafMask;
+	uint32 QueuedLeavesRevision = 0;
+	TSharedPtr<FPR_LeafUpdate> LeafUpdate;
+	/** Inference depends on the probes and may finish in a later frame, the probes finish at the end of the world tick */
+	UE::Tasks::FTask LeafProbeTask;
+	UE::Tasks::FTask LeafUpdateTask;
+	double LastDirtyUpdateTime = 0.0;
+
+	TSparseArray<FPR_Listener> Listeners;
+	/** Reused every frame, only listeners that moved out of their cached neighbourhood are queried */
+	TArray<FPR_NearbyLeavesQuery> PendingQueries;
 };
@@ -0,0 +1,246 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PR_ReverbGrid.h"
+
+#include "Async/ParallelFor.h"
+#include "PR_PartitionTree.h"
+#include "ProceduralReverb/LogPrPartition.h"
+#include "ProceduralReverb/PR_Stats.h"
+#include "Settings/ProceduralReverbSettings.h"
+#include "SubmixEffects/AudioMixerSubmixEffectReverb.h"
+
+
+namespace
+{
+// Same ranges the model outputs are clamped to, ordered as the grid channels
+constexpr float ChannelRanges[FPR_ReverbGrid::NumChannels] = {PRCore::MaxDecayTime, 1.0f, 1.0f, 1.0f};
+
+template <typename CodeType>
+void EncodeSample(const PRCore::FReverbParams& Settings, CodeType* OutCodes)
+{
+	const float Values[FPR_ReverbGrid::NumChannels] = {Settings.DecayTime, Settings.Gain, Settings.Density, Settings.WetLevel};
+	for (int32 Channel = 0; Channel < FPR_ReverbGrid::NumChannels; ++Channel)
+	{
+		const float Normalized = FMath::Clamp(Values[Channel] / ChannelRanges[Channel], 0.0f, 1.0f);
+		OutCodes[Channel] = static_cast<CodeType>(FMath::RoundToInt(Normalized * TNumericLimits<CodeType>::Max()));
+	}
+}
+}
+
+
+void FPR_ReverbGrid::Build(const FPR_PartitionTree& Tree, float InCellSize, EPR_ReverbGridPrecision Precision, int32 MaxSamples)
+{
+	BeginBuild(Tree, InCellSize, Precision, MaxSamples);
+	StepBuild(Tree, TNumericLimits<int32>::Max());
+}
+
+void FPR_ReverbGrid::BeginBuild(const FPR_PartitionTree& Tree, float InCellSize, EPR_ReverbGridPrecision Precision, int32 MaxSamples)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_ReverbGrid::BeginBuild);
+
+	Reset();
+
+	const FBox Bounds = Tree.GetRootBounds();
+	if (Tree.IsEmpty() || !Bounds.IsValid || InCellSize <= 0.0f || MaxSamples < 8)
+	{
+		return;
+	}
+
+	MaxSamples = FMath::Min(MaxSamples, MaxSamplesLimit);
+	const FVector Size = Bounds.GetSize();
+	auto ComputeDimensions = [&Size](float Cell)
+	{
+		return FIntVector(
+			FMath::Max(2, FMath::CeilToInt(Size.X / Cell) + 1),
+			FMath::Max(2, FMath::CeilToInt(Size.Y / Cell) + 1),
+			FMath::Max(2, FMath::CeilToInt(Size.Z / Cell) + 1));
+	};
+
+	CellSize = InCellSize;
+	Dimensions = ComputeDimensions(CellSize);
+	while (static_cast<int64>(Dimensions.X) * Dimensions.Y * Dimensions.Z > MaxSamples)
+	{
+		const double Ratio = static_cast<double>(Dimensions.X) * Dimensions.Y * Dimensions.Z / MaxSamples;
+		CellSize *= FMath::Max(1.01f, static_cast<float>(FMath::Pow(Ratio, 1.0 / 3.0)));
+		Dimensions = ComputeDimensions(CellSize);
+	}
+
+	if (CellSize != InCellSize)
+	{
+		UE_LOG(LogPrPartition, Log, TEXT("Reverb grid cell size raised from %.0f to %.0f cm to fit %d samples"), InCellSize, CellSize, MaxSamples);
+	}
+
+	Origin = Bounds.Min;
+	InvCellSize = 1.0f / CellSize;
+	BytesPerChannel = Precision == EPR_ReverbGridPrecision::Bits16 ? 2 : 1;
+	TreeRevision = Tree.GetRevision();
+
+	const int64 NumSamples = static_cast<int64>(Dimensions.X) * Dimensions.Y * Dimensions.Z;
+	const int64 NumBytes = NumSamples * NumChannels * BytesPerChannel;
+	check(NumBytes <= MAX_int32);
+	Data.SetNumZeroed(static_cast<int32>(NumBytes));
+	SET_MEMORY_STAT(STAT_PR_ReverbGridMemory, Data.GetAllocatedSize());
+}
+
+bool FPR_ReverbGrid::StepBuild(const FPR_PartitionTree& Tree, int32 MaxSlices)
+{
+	if (!IsBuilding())
+	{
+		return true;
+	}
+
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_ReverbGrid::StepBuild);
+
+	const double StartTime = FPlatformTime::Seconds();
+	const int32 EndSlice = NextSlice + FMath::Min(FMath::Max(MaxSlices, 1), Dimensions.Z - NextSlice);
+	SampleLeaves(Tree, FIntVector(0, 0, NextSlice), FIntVector(Dimensions.X - 1, Dimensions.Y - 1, EndSlice - 1));
+	NextSlice = EndSlice;
+	PendingSeconds += FPlatformTime::Seconds() - StartTime;
+	if (IsBuilding())
+	{
+		return false;
+	}
+
+	UE_LOG(LogPrPartition, Log, TEXT("Built %dx%dx%d reverb grid (%d-bit, %.1f KiB) in %.2f ms"),
+		Dimensions.X,
+		Dimensions.Y,
+		Dimensions.Z,
+		BytesPerChannel * 8,
+		Data.Num() / 1024.0f,
+		PendingSeconds * 1000.0);
+
+	PendingSeconds = 0.0;
+	return true;
+}
+
+bool FPR_ReverbGrid::Update(const FPR_PartitionTree& Tree, const FBox& Region)
+{
+	if (!IsValid() || TreeRevision != Tree.GetRevision())
+	{
+		return false;
+	}
+
+	// Grid points inside the region, the blend of any position reads at most one cell further
+	const FVector MinCell = (Region.Min - Origin) * InvCellSize;
+	const FVector MaxCell = (Region.Max - Origin) * InvCellSize;
+	const FIntVector Min(
+		FMath::Clamp(FMath::FloorToInt(MinCell.X), 0, Dimensions.X - 1),
+		FMath::Clamp(FMath::FloorToInt(MinCell.Y), 0, Dimensions.Y - 1),
+		FMath::Clamp(FMath::FloorToInt(MinCell.Z), 0, Dimensions.Z - 1));
+	const FIntVector Max(
+		FMath::Clamp(FMath::CeilToInt(MaxCell.X), 0, Dimensions.X - 1),
+		FMath::Clamp(FMath::CeilToInt(MaxCell.Y), 0, Dimensions.Y - 1),
+		FMath::Clamp(FMath::CeilToInt(MaxCell.Z), 0, Dimensions.Z - 1));
+
+	SampleLeaves(Tree, Min, Max);
+	return true;
+}
+
+void FPR_ReverbGrid::SampleLeaves(const FPR_PartitionTree& Tree, const FIntVector& Min, const FIntVector& Max)
+{
+	const FBox Bounds = Tree.GetRootBounds();
+
+	// One task per Z slice, every sample takes the settings of the leaf it falls into. Points in solid or exterior
+	// leaves take the closest playable leaf instead, a dry sample would pull the blend next to walls towards dry
+	ParallelFor(Max.Z - Min.Z + 1, [this, &Tree, &Bounds, &Min, &Max](int32 Slice)
+	{
+		TArray<FPR_LeafQueryResult> NearestLeaves;
+		const int32 Z = Min.Z + Slice;
+		for (int32 Y = Min.Y; Y <= Max.Y; ++Y)
+		{
+			for (int32 X = Min.X; X <= Max.X; ++X)
+			{
+				const FVector Position = ClampVector(Origin + FVector(X, Y, Z) * CellSize, Bounds.Min, Bounds.Max);
+				int32 LeafIndex = Tree.FindLeaf(Position);
+				if (!Tree.HasReverbParams(LeafIndex))
+				{
+					Tree.FindNearestLeaves(Position, 1, NearestLeaves);
+					LeafIndex = NearestLeaves.IsEmpty() ? INDEX_NONE : NearestLeaves[0].LeafIndex;
+					if (!Tree.HasReverbParams(LeafIndex))
+					{
+						continue;
+					}
+				}
+
+				const PRCore::FReverbParams& Settings = Tree.GetReverbParams(LeafIndex);
+				const int64 SampleIndex = (static_cast<int64>(Z) * Dimensions.Y + Y) * Dimensions.X + X;
+				if (BytesPerChannel == 2)
+				{
+					EncodeSample(Settings, reinterpret_cast<uint16*>(Data.GetData()) + SampleIndex * NumChannels);
+				}
+				else
+				{
+					EncodeSample(Settings, Data.GetData() + SampleIndex * NumChannels);
+				}
+			}
+		}
+	});
+}
+
+void FPR_ReverbGrid::Reset()
+{
+	Data.Empty();
+	SET_MEMORY_STAT(STAT_PR_ReverbGridMemory, 0);
+	Dimensions = FIntVector::ZeroValue;
+	CellSize = 0.0f;
+	InvCellSize = 0.0f;
+	NextSlice = 0;
+	PendingSeconds = 0.0;
+}
+
+bool FPR_ReverbGrid::Sample(const FVector& Position, FSubmixEffectReverbSettings& OutSettings) const
+{
+	if (!IsValid())
+	{
+		return false;
+	}
+
+	if (BytesPerChannel == 2)
+	{
+		SampleTyped<uint16>(Position, OutSettings);
+	}
+	else
+	{
+		SampleTyped<uint8>(Position, OutSettings);
+	}
+
+	return true;
+}
+
+template <typename CodeType>
+void FPR_ReverbGrid::SampleTyped(const FVector& Position, FSubmixEffectReverbSettings& OutSettings) const
+{
+	const FVector3f MaxCoordinate(Dimensions.X - 1, Dimensions.Y - 1, Dimensions.Z - 1);
+	const FVector3f Coordinate = ClampVector(FVector3f((Position - Origin) * InvCellSize), FVector3f::ZeroVector, MaxCoordinate);
+
+	// Lower corner of the cell, the last grid point belongs to the cell before it
+	const int32 X = FMath::Min(static_cast<int32>(Coordinate.X), Dimensions.X - 2);
+	const int32 Y = FMath::Min(static_cast<int32>(Coordinate.Y), Dimensions.Y - 2);
+	const int32 Z = FMath::Min(static_cast<int32>(Coordinate.Z), Dimensions.Z - 2);
+	const float FX = Coordinate.X - X;
+	const float FY = Coordinate.Y - Y;
+	const float FZ = Coordinate.Z - Z;
+
+	const SIZE_T StrideX = NumChannels;
+	const SIZE_T StrideY = StrideX * Dimensions.X;
+	const SIZE_T StrideZ = StrideY * Dimensions.Y;
+	const CodeType* Corner = reinterpret_cast<const CodeType*>(Data.GetData()) + Z * StrideZ + Y * StrideY + X * StrideX;
+
+	float Values[NumChannels];
+	for (int32 Channel = 0; Channel < NumChannels; ++Channel)
+	{
+		const CodeType* C = Corner + Channel;
+		const float X00 = FMath::Lerp<float>(C[0], C[StrideX], FX);
+		const float X10 = FMath::Lerp<float>(C[StrideY], C[StrideY + StrideX], FX);
+		const float X01 = FMath::Lerp<float>(C[StrideZ], C[StrideZ + StrideX], FX);
+		const float X11 = FMath::Lerp<float>(C[StrideZ + StrideY], C[StrideZ + StrideY + StrideX], FX);
+		const float Value = FMath::Lerp(FMath::Lerp(X00, X10, FY), FMath::Lerp(X01, X11, FY), FZ);
+		Values[Channel] = Value * (ChannelRanges[Channel] / TNumericLimits<CodeType>::Max());
+	}
+
+	OutSettings.DecayTime = Values[0];
+	OutSettings.Gain = Values[1];
+	OutSettings.Density = Values[2];
+	OutSettings.WetLevel = Values[3];
+}
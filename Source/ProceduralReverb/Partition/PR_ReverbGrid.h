@@ -0,0 +1,71 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FPR_PartitionTree;
+struct FSubmixEffectReverbSettings;
+enum class EPR_ReverbGridPrecision : uint8;
+
+
+/**
+ * Reverb settings of the partition resampled on a regular grid covering its root bounds.
+ * Every sample stores DecayTime, Gain, Density and WetLevel quantized to 8 or 16 bits,
+ * so a lookup is a clamp, eight corner loads and a trilinear blend, cheap enough for every emitter.
+ */
+struct FPR_ReverbGrid
+{
+	static constexpr int32 NumChannels = 4;
+	/** Keeps the 16-bit data of the largest grid (1 GiB) addressable by the int32 sized sample array */
+	static constexpr int32 MaxSamplesLimit = 128 * 1024 * 1024;
+
+	/**
+	 * Samples the leaf containing every grid point, or the closest playable leaf for points outside of the playable space.
+	 * CellSize grows until the grid fits in MaxSamples, which is capped at MaxSamplesLimit.
+	 */
+	void Build(const FPR_PartitionTree& Tree, float CellSize, EPR_ReverbGridPrecision Precision, int32 MaxSamples);
+	/**
+	 * Same build spread over several frames, every StepBuild samples up to MaxSlices further Z slices.
+	 * The grid stays invalid until StepBuild returned true, the tree must not change in between.
+	 */
+	void BeginBuild(const FPR_PartitionTree& Tree, float CellSize, EPR_ReverbGridPrecision Precision, int32 MaxSamples);
+	bool StepBuild(const FPR_PartitionTree& Tree, int32 MaxSlices);
+	bool IsBuilding() const { return NextSlice < Dimensions.Z; }
+	void Reset();
+	/** Resamples the grid points within Region, returns false when the grid was sampled from another revision of the tree */
+	bool Update(const FPR_PartitionTree& Tree, const FBox& Region);
+
+	bool IsValid() const { return !Data.IsEmpty() && !IsBuilding(); }
+	/** Revision of the tree the grid was sampled from */
+	uint32 GetTreeRevision() const { return TreeRevision; }
+	const FIntVector& GetDimensions() const { return Dimensions; }
+	float GetCellSize() const { return CellSize; }
+
+	/** Positions outside of the grid are clamped to its boundary, returns false only when the grid is empty */
+	bool Sample(const FVector& Position, FSubmixEffectReverbSettings& OutSettings) const;
+
+	SIZE_T GetAllocatedSize() const { return Data.GetAllocatedSize(); }
+
+private:
+	/** Samples the grid points from Min to Max inclusive */
+	void SampleLeaves(const FPR_PartitionTree& Tree, const FIntVector& Min, const FIntVector& Max);
+
+	template <typename CodeType>
+	void SampleTyped(const FVector& Position, FSubmixEffectReverbSettings& OutSettings) const;
+
+	FVector Origin = FVector::ZeroVector;
+	float CellSize = 0.0f;
+	float InvCellSize = 0.0f;
+	/** Grid points per axis, at least 2 so every position has a full cell around it */
+	FIntVector Dimensions = FIntVector::ZeroValue;
+	/** 1 or 2 */
+	int32 BytesPerChannel = 1;
+	uint32 TreeRevision = 0;
+	/** First Z slice a build in progress hasn't sampled yet, with the time its steps took so far */
+	int32 NextSlice = 0;
+	double PendingSeconds = 0.0;
+
+	/** X major samples, NumChannels codes each */
+	TArray<uint8> Data;
+};
@@ -0,0 +1,47 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PR_WorldQueries.h"
+
+#include "PhysicalMaterials/PhysicalMaterial.h"
+#include "ProceduralReverb/LogPrPartition.h"
+#include "ProceduralReverb/PR_Stats.h"
+
+
+FPR_WorldQueries::FPR_WorldQueries(const UWorld* InWorld)
+	: World(InWorld)
+	, QueryParams(SCENE_QUERY_STAT(PR_AcousticProbe), false)
+{
+}
+
+PRCore::FTraceHit FPR_WorldQueries::Trace(const PRCore::FVec3& Start, const PRCore::FVec3& End) const
+{
+	INC_DWORD_STAT(STAT_PR_TracesIssued);
+
+	const FVector TraceStart = ToUE(Start);
+	FHitResult Hit;
+	World->LineTraceSingleByChannel(Hit, TraceStart, ToUE(End), ECC_Visibility, QueryParams);
+
+	PRCore::FTraceHit Result;
+	if (Hit.bBlockingHit)
+	{
+		UPhysicalMaterial* Material = Hit.PhysMaterial.Get();
+		Result.bHit = true;
+		Result.Distance = (Hit.ImpactPoint - TraceStart).Size();
+		Result.Normal = ToCore(Hit.ImpactNormal);
+		Result.Material = Material ? static_cast<uint8>(Material->SurfaceType.GetValue()) : static_cast<uint8>(SurfaceType_Default);
+		Result.Surface = Hit.GetComponent();
+		Result.SurfaceMaterial = Material;
+		UE_LOG(LogPrPartition, VeryVerbose, TEXT("Found wall: %s - %f"), *GetNameSafe(Material), Result.Distance);
+	}
+
+	return Result;
+}
+
+bool FPR_WorldQueries::Overlaps(const PRCore::FBox3& Box) const
+{
+	INC_DWORD_STAT(STAT_PR_TracesIssued);
+
+	const FBox UEBox = ToUE(Box);
+	return World->OverlapBlockingTestByChannel(UEBox.GetCenter(), FQuat::Identity, ECC_Visibility, FCollisionShape::MakeBox(UEBox.GetExtent()), QueryParams);
+}
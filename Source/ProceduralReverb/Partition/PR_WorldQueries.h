@@ -0,0 +1,44 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ProceduralReverb/Core/PRCore_Acoustics.h"
+
+
+inline PRCore::FVec3 ToCore(const FVector& Vector)
+{
+	return PRCore::FVec3(Vector.X, Vector.Y, Vector.Z);
+}
+
+inline FVector ToUE(const PRCore::FVec3& Vector)
+{
+	return FVector(Vector.X, Vector.Y, Vector.Z);
+}
+
+inline PRCore::FBox3 ToCore(const FBox& Box)
+{
+	return Box.IsValid ? PRCore::FBox3(ToCore(Box.Min), ToCore(Box.Max)) : PRCore::FBox3();
+}
+
+inline FBox ToUE(const PRCore::FBox3& Box)
+{
+	return Box.bValid ? FBox(ToUE(Box.Min), ToUE(Box.Max)) : FBox(ForceInit);
+}
+
+
+/**
+ * Scene queries of the core featurization answered by the world's visibility channel.
+ */
+class FPR_WorldQueries : public PRCore::IWorldQueries
+{
+public:
+	explicit FPR_WorldQueries(const UWorld* InWorld);
+
+	virtual PRCore::FTraceHit Trace(const PRCore::FVec3& Start, const PRCore::FVec3& End) const override;
+	virtual bool Overlaps(const PRCore::FBox3& Box) const override;
+
+private:
+	const UWorld* World;
+	FCollisionQueryParams QueryParams;
+};
@@ -7,6 +7,46 @@
 #include "ProceduralReverbSettings.generated.h"
 
 class UNNEModelData;
+
+UENUM()
+enum class EPR_BoundsMode : uint8
+{
+	/** World space bounds of every static mesh component */
+	ComponentBounds,
+	/** Every LOD0 vertex transformed to world space, components are processed in parallel */
+	ExactVertices
+};
+
+UENUM()
+enum class EPR_InferenceBackend : uint8
+{
+	/** NNE ONNX Runtime on the CPU, runs any model */
+	ORT,
+	/** Built-in vector kernel for chains of dense layers, falls back to ORT for anything else */
+	Native
+};
+
+/** Mirrors PRCore::EProbeRaySet */
+UENUM()
+enum class EPR_ProbeRaySet : uint8
+{
+	/** One ray per feature direction */
+	Axes6,
+	/** Axes and the 8 cube corners */
+	Axes14,
+	/** Axes, the 12 cube edges and the 8 corners */
+	Axes26,
+	/** ProbeRayCount rays evenly spread on a sphere */
+	Fibonacci
+};
+
+UENUM()
+enum class EPR_ReverbGridPrecision : uint8
+{
+	Bits8,
+	Bits16
+};
+
 /**
  * 
  */
@@ -19,9 +59,150 @@ public:
 	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition", meta = (ClampMin = 1, UIMin = 1, ClampMax = 100, UIMax = 100))
 	int32 MaxPartitionDepth = 10;
 
+	/** How the root box of the partition is computed from static meshes */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition|Bounds")
+	EPR_BoundsMode BoundsMode = EPR_BoundsMode::ComponentBounds;
+
+	/** Actors with any of these tags don't contribute to the root box, e.g. sky domes and far background */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition|Bounds")
+	TArray<FName> BoundsExcludedActorTags;
+
+	/** Components using any of these collision profiles don't contribute to the root box */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition|Bounds")
+	TArray<FName> BoundsExcludedCollisionProfiles;
+
 	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition", meta = (Units = "cm", ClampMin = 0.0f, UIMin = 0.0f, ClampMax = 100000.0f, UIMax = 100000.0f))
 	float RayDistance = 5000.0f;
 
+	/** Rays traced from every leaf, reduced to the six directional features the model takes */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition|Probes")
+	EPR_ProbeRaySet ProbeRaySet = EPR_ProbeRaySet::Axes6;
+
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition|Probes", meta = (ClampMin = 6, UIMin = 6, ClampMax = 256, UIMax = 256, EditCondition = "ProbeRaySet == EPR_ProbeRaySet::Fibonacci"))
+	int32 ProbeRayCount = 32;
+
+	/**
+	 * Marks leaves inside solid geometry and leaves far from any playable space with overlap and distance tests.
+	 * Neighbouring marked leaves are collapsed, none of them is probed, evaluated or returned by queries.
+	 */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition|Classification")
+	bool bClassifyLeaves = true;
+
+	/** Navigation mesh bounds volumes enclose the playable space */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition|Classification", meta = (EditCondition = "bClassifyLeaves"))
+	bool bNavigationBoundsArePlayable = true;
+
+	/** Bounds of actors with any of these tags enclose the playable space as well, e.g. volumes around flying areas */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition|Classification", meta = (EditCondition = "bClassifyLeaves"))
+	TArray<FName> PlayableActorTags;
+
+	/** Leaves further than this from every playable bounds are exterior. No leaf is exterior while the level has no playable bounds */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition|Classification", meta = (Units = "cm", ClampMin = 0.0f, UIMin = 0.0f, EditCondition = "bClassifyLeaves"))
+	float PlayableMargin = 1000.0f;
+
+	/** Bakes which leaves see each other, listeners ignore leaves behind walls without tracing at runtime */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition|Visibility")
+	bool bBuildLeafVisibility = true;
+
+	/** Should cover the search radius of the listeners, leaves further apart are treated as not visible */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition|Visibility", meta = (Units = "cm", ClampMin = 0.0f, UIMin = 0.0f, EditCondition = "bBuildLeafVisibility"))
+	float LeafVisibilityRadius = 2000.0f;
+
+	/** Stops splitting regions where probe traces see the same surroundings from both halves */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition")
+	bool bAdaptivePartition = false;
+
+	/** Leaves are never split below this volume, in cubic meters. 0 disables the limit */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition", meta = (ClampMin = 0.0f, UIMin = 0.0f))
+	float MinLeafVolume = 0.0f;
+
+	/** Upper bound of leaves in the partition. 0 disables the limit */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Partition", meta = (ClampMin = 0, UIMin = 0))
+	int32 MaxLeafCount = 0;
+
 	UPROPERTY(Config, EditAnywhere)
 	TSoftObjectPtr<UNNEModelData> PreLoadedModelData;
+
+	/** Leaves evaluated per model run, used when the model input has a variable batch dimension */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Inference", meta = (ClampMin = 1, UIMin = 1, ClampMax = 65536, UIMax = 4096))
+	int32 InferenceBatchSize = 256;
+
+	/** Runtime used to evaluate the reverb model */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Inference")
+	EPR_InferenceBackend InferenceBackend = EPR_InferenceBackend::ORT;
+
+	/**
+	 * Reuses model results for leaves whose features match after snapping distances to InferenceCacheResolution,
+	 * e.g. open air leaves and repeated rooms. The model runs on the snapped distances.
+	 */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Inference")
+	bool bInferenceCache = true;
+
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Inference", meta = (Units = "cm", ClampMin = 0.01f, UIMin = 0.01f, ClampMax = 100.0f, UIMax = 100.0f, EditCondition = "bInferenceCache"))
+	float InferenceCacheResolution = 1.0f;
+
+	/** Step reverb parameters are quantized to for the shared palette, as a fraction of each parameter's range */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Inference|Compaction", meta = (ClampMin = 0.001f, UIMin = 0.001f, ClampMax = 0.25f, UIMax = 0.25f))
+	float ReverbPaletteTolerance = 0.01f;
+
+	/** Collapses sibling leaves that end up with the same palette entry into one leaf */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Inference|Compaction")
+	bool bMergeLeaves = true;
+
+	/** Resamples the leaves on a regular grid once they have reverb settings, for constant time lookups */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Grid")
+	bool bBuildReverbGrid = false;
+
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Grid", meta = (Units = "cm", ClampMin = 10.0f, UIMin = 10.0f, EditCondition = "bBuildReverbGrid"))
+	float ReverbGridCellSize = 200.0f;
+
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Grid", meta = (EditCondition = "bBuildReverbGrid"))
+	EPR_ReverbGridPrecision ReverbGridPrecision = EPR_ReverbGridPrecision::Bits8;
+
+	/** The cell size is raised when the grid would need more samples than this */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Grid", meta = (ClampMin = 8, UIMin = 8, ClampMax = 134217728, UIMax = 134217728, EditCondition = "bBuildReverbGrid"))
+	int32 ReverbGridMaxSamples = 4 * 1024 * 1024;
+
+	/** Generates the partition over several frames instead of blocking the first one, regions near listeners come first */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Generation")
+	bool bTimeSlicedGeneration = true;
+
+	/** Game thread time generation may take per frame, a frame always runs at least one step */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Generation", meta = (Units = "ms", ClampMin = 0.1f, UIMin = 0.1f, EditCondition = "bTimeSlicedGeneration"))
+	float GenerationFrameBudget = 4.0f;
+
+	/** Leaves probed and evaluated together, OnRegionReady fires once per region */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Generation", meta = (ClampMin = 1, UIMin = 1))
+	int32 GenerationRegionLeaves = 1024;
+
+	/**
+	 * Only coarse regions are evaluated up front, leaves are probed and evaluated once a listener query reaches them,
+	 * closest to the listeners first. Until then they use the estimate of their region. Skips leaf visibility and merging.
+	 */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Generation")
+	bool bLazyEvaluation = false;
+
+	/** Depth of the coarse regions evaluated up front, 2^Depth regions at most */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Generation", meta = (ClampMin = 0, UIMin = 0, ClampMax = 16, UIMax = 16, EditCondition = "bLazyEvaluation"))
+	int32 LazyEstimateDepth = 6;
+
+	/** Keeps the reverb model loaded after generation, so leaves marked dirty by geometry changes are re-evaluated */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Dynamic Updates")
+	bool bDynamicUpdates = true;
+
+	/** Leaves evaluated by one worker update, dirty leaves before lazily evaluated ones. The rest wait for the next update */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Dynamic Updates", meta = (ClampMin = 1, UIMin = 1, EditCondition = "bDynamicUpdates || bLazyEvaluation"))
+	int32 DynamicUpdateMaxLeaves = 512;
+
+	/** Minimum time between two updates of dirty leaves, requests arriving in between are coalesced */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Dynamic Updates", meta = (Units = "s", ClampMin = 0.0f, UIMin = 0.0f, EditCondition = "bDynamicUpdates"))
+	float DynamicUpdateInterval = 0.1f;
+
+	/** Loads the baked partition of the level at BeginPlay and skips generation when it is up to date */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Bake")
+	bool bUseBakedData = true;
+
+	/** Writes the baked partition after generating it in editor builds */
+	UPROPERTY(Config, EditDefaultsOnly, Category = "Bake")
+	bool bSaveBakedData = false;
 };
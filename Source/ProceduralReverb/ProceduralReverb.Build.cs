@@ -6,7 +6,7 @@ public class ProceduralReverb : ModuleRules
 {
 	public ProceduralReverb(ReadOnlyTargetRules Target) : base(Target)
 	{
-		PrivateDependencyModuleNames.AddRange(new string[] { "NNE" });
+		PrivateDependencyModuleNames.AddRange(new string[] { "NNE", "Json", "NavigationSystem" });
 		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
 
 		PublicDependencyModuleNames.AddRange(new string[]
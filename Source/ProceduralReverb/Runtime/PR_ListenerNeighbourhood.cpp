@@ -0,0 +1,92 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PR_ListenerNeighbourhood.h"
+
+#include "ProceduralReverb/Core/PRCore_Reverb.h"
+#include "SubmixEffects/AudioMixerSubmixEffectReverb.h"
+
+
+bool FPR_ListenerNeighbourhood::NeedsRequery(const FPR_PartitionTree& Tree, const FVector& Position, float SearchRadius) const
+{
+	if (QueryRadius < 0.0f || TreeRevision != Tree.GetRevision())
+	{
+		return true;
+	}
+
+	// Every leaf within SearchRadius of Position is within QueryRadius of QueryPosition
+	// as long as the listener has not moved further than the margin
+	const float Margin = QueryRadius - SearchRadius;
+	return Margin < 0.0f || FVector::DistSquared(Position, QueryPosition) > FMath::Square(Margin);
+}
+
+void FPR_ListenerNeighbourhood::Requery(
+	const FPR_PartitionTree& Tree,
+	const FVector& Position,
+	float SearchRadius,
+	float RequeryDistance)
+{
+	Tree.FindNearbyLeaves(Position, BeginRequery(Tree, Position, SearchRadius, RequeryDistance), CachedLeaves);
+}
+
+float FPR_ListenerNeighbourhood::BeginRequery(
+	const FPR_PartitionTree& Tree,
+	const FVector& Position,
+	float SearchRadius,
+	float RequeryDistance)
+{
+	QueryPosition = Position;
+	QueryRadius = SearchRadius + FMath::Max(RequeryDistance, 0.0f);
+	TreeRevision = Tree.GetRevision();
+
+	// Keeps the allocation, in steady state the query doesn't touch the heap
+	CachedLeaves.Reset();
+	return QueryRadius;
+}
+
+void FPR_ListenerNeighbourhood::Reset()
+{
+	CachedLeaves.Reset();
+	QueryRadius = -1.0f;
+	TreeRevision = 0;
+}
+
+bool FPR_ListenerNeighbourhood::Evaluate(
+	const FPR_PartitionTree& Tree,
+	const FVector& Position,
+	float SearchRadius,
+	FSubmixEffectReverbSettings& OutSettings,
+	const UWorld* DebugWorld) const
+{
+	PRCore::FNeighbourBlend Blend(SearchRadius);
+
+	// Leaves behind walls are dropped with the baked visibility of the listener's leaf, no traces at runtime
+	const int32 ListenerLeaf = Tree.FindLeaf(Position);
+	for (const FPR_LeafQueryResult& Leaf : CachedLeaves)
+	{
+		if (!Tree.HasReverbParams(Leaf.LeafIndex) || !Tree.IsLeafVisible(ListenerLeaf, Leaf.LeafIndex))
+		{
+			continue;
+		}
+
+		const float Distance = Tree.DistanceToLeaf(Leaf.LeafIndex, Position);
+		if (Blend.Add(Leaf.LeafIndex, Distance, Tree.GetReverbParams(Leaf.LeafIndex).DecayTime) && DebugWorld)
+		{
+			Tree.DrawLeafDebug(DebugWorld, Leaf.LeafIndex);
+		}
+	}
+
+	float DecayTime = 0.0f;
+	int32 DominantLeaf = INDEX_NONE;
+	if (!Blend.Resolve(DecayTime, DominantLeaf))
+	{
+		return false;
+	}
+
+	const PRCore::FReverbParams& ClosestSettings = Tree.GetReverbParams(DominantLeaf);
+	OutSettings.DecayTime = DecayTime;
+	OutSettings.Gain = ClosestSettings.Gain;
+	OutSettings.Density = ClosestSettings.Density;
+	OutSettings.WetLevel = ClosestSettings.WetLevel;
+	return true;
+}
@@ -0,0 +1,35 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ProceduralReverb/Partition/PR_PartitionTree.h"
+
+struct FSubmixEffectReverbSettings;
+
+
+/**
+ * Leaves around a listener, gathered with a margin so the tree is only queried again
+ * once the listener has moved further than that margin. Buffers are reused between queries.
+ */
+struct FPR_ListenerNeighbourhood
+{
+	bool NeedsRequery(const FPR_PartitionTree& Tree, const FVector& Position, float SearchRadius) const;
+	void Requery(const FPR_PartitionTree& Tree, const FVector& Position, float SearchRadius, float RequeryDistance);
+	/** Requery without the tree search, CachedLeaves is left empty for a batched query of the returned radius */
+	float BeginRequery(const FPR_PartitionTree& Tree, const FVector& Position, float SearchRadius, float RequeryDistance);
+	void Reset();
+
+	/** Blends the cached leaves within SearchRadius of Position that its leaf sees, returns false when none of them is in range */
+	bool Evaluate(
+		const FPR_PartitionTree& Tree,
+		const FVector& Position,
+		float SearchRadius,
+		FSubmixEffectReverbSettings& OutSettings,
+		const UWorld* DebugWorld = nullptr) const;
+
+	TArray<FPR_LeafQueryResult> CachedLeaves;
+	FVector QueryPosition = FVector::ZeroVector;
+	float QueryRadius = -1.0f;
+	uint32 TreeRevision = 0;
+};
@@ -0,0 +1,129 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PR_ReverbParameterChannel.h"
+
+#include "AudioEffect.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+
+namespace
+{
+// Only the parameters driven by the partition are compared and interpolated
+float MaxDifference(const FSubmixEffectReverbSettings& A, const FSubmixEffectReverbSettings& B)
+{
+	return FMath::Max(
+		FMath::Max(FMath::Abs(A.DecayTime - B.DecayTime), FMath::Abs(A.Gain - B.Gain)),
+		FMath::Max(FMath::Abs(A.Density - B.Density), FMath::Abs(A.WetLevel - B.WetLevel)));
+}
+
+void Interpolate(FSubmixEffectReverbSettings& Current, const FSubmixEffectReverbSettings& Target, float Alpha)
+{
+	Current.DecayTime = FMath::Lerp(Current.DecayTime, Target.DecayTime, Alpha);
+	Current.Gain = FMath::Lerp(Current.Gain, Target.Gain, Alpha);
+	Current.Density = FMath::Lerp(Current.Density, Target.Density, Alpha);
+	Current.WetLevel = FMath::Lerp(Current.WetLevel, Target.WetLevel, Alpha);
+}
+
+// Below this the remaining ramp is inaudible, the effects stop receiving updates until the next target
+constexpr float ConvergenceThreshold = 1.e-4f;
+}
+
+
+FPR_ReverbParameterChannel::FPR_ReverbParameterChannel(
+	TConstArrayView<USubmixEffectReverbPreset*> InPresets,
+	float InPublishThreshold,
+	float InSmoothingTime)
+	: PublishThreshold(FMath::Max(InPublishThreshold, 0.0f))
+	, SmoothingTime(FMath::Max(InSmoothingTime, 0.0f))
+{
+	for (USubmixEffectReverbPreset* Preset : InPresets)
+	{
+		Presets.Add(Preset);
+	}
+
+	if (!InPresets.IsEmpty())
+	{
+		BaseSettings = InPresets[0]->Settings;
+	}
+}
+
+void FPR_ReverbParameterChannel::Publish(const FSubmixEffectReverbSettings& Settings)
+{
+	check(IsInGameThread());
+
+	if (bHasTarget && MaxDifference(Settings, Target) <= PublishThreshold)
+	{
+		return;
+	}
+
+	Target = BaseSettings;
+	Target.DecayTime = Settings.DecayTime;
+	Target.Gain = Settings.Gain;
+	Target.Density = Settings.Density;
+	Target.WetLevel = Settings.WetLevel;
+	bHasTarget = true;
+	bConverged = false;
+}
+
+void FPR_ReverbParameterChannel::Advance(float DeltaTime)
+{
+	check(IsInGameThread());
+
+	if (bConverged)
+	{
+		return;
+	}
+
+	// The first target is applied as is, there is nothing to ramp from yet
+	if (!bHasCurrent)
+	{
+		Current = Target;
+		bHasCurrent = true;
+	}
+	else
+	{
+		// One pole smoothing, frame rate independent
+		const float Alpha = SmoothingTime > 0.0f ? 1.0f - FMath::Exp(-FMath::Max(DeltaTime, 0.0f) / SmoothingTime) : 1.0f;
+		Interpolate(Current, Target, Alpha);
+	}
+
+	if (MaxDifference(Current, Target) < ConvergenceThreshold)
+	{
+		Current = Target;
+		bConverged = true;
+	}
+
+	ApplyToEffects(Current);
+}
+
+void FPR_ReverbParameterChannel::ApplyToEffects(const FSubmixEffectReverbSettings& Settings) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FPR_ReverbParameterChannel::ApplyToEffects);
+
+	FAudioReverbEffect Parameters;
+	Parameters.Volume = Settings.WetLevel;
+	Parameters.Density = Settings.Density;
+	Parameters.Diffusion = Settings.Diffusion;
+	Parameters.Gain = Settings.Gain;
+	Parameters.GainHF = Settings.GainHF;
+	Parameters.DecayTime = Settings.DecayTime;
+	Parameters.DecayHFRatio = Settings.DecayHFRatio;
+	Parameters.ReflectionsGain = Settings.ReflectionsGain;
+	Parameters.ReflectionsDelay = Settings.ReflectionsDelay;
+	Parameters.LateGain = Settings.LateGain;
+	Parameters.LateDelay = Settings.LateDelay;
+	Parameters.AirAbsorptionGainHF = Settings.AirAbsorptionGainHF;
+
+	// The instance list is only modified on the game thread, the effects pick the parameters up with their next buffer
+	for (const TWeakObjectPtr<USubmixEffectReverbPreset>& Preset : Presets)
+	{
+		if (USubmixEffectReverbPreset* ReverbPreset = Preset.Get())
+		{
+			ReverbPreset->IterateEffects<FSubmixEffectReverb>([&Parameters](FSubmixEffectReverb& Effect)
+			{
+				Effect.SetEffectParameters(Parameters);
+			});
+		}
+	}
+}
@@ -0,0 +1,41 @@
+﻿// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SubmixEffects/AudioMixerSubmixEffectReverb.h"
+
+
+/**
+ * Hands reverb settings from the game thread to the reverb effects of a submix.
+ * Settings are only published once they differ from the last published ones by more than a threshold,
+ * the effects are then eased toward them each frame until they converge and receive nothing after that.
+ * Effect instances are only reached through their presets on the game thread, where the mixer adds and removes them,
+ * and parameters cross to the audio render thread through the effects' own synchronized parameter setter.
+ */
+class FPR_ReverbParameterChannel
+{
+public:
+	/** Settings the partition doesn't drive are taken from the first preset */
+	FPR_ReverbParameterChannel(TConstArrayView<USubmixEffectReverbPreset*> InPresets, float InPublishThreshold, float InSmoothingTime);
+
+	/** Only DecayTime, Gain, Density and WetLevel are used */
+	void Publish(const FSubmixEffectReverbSettings& Settings);
+
+	/** Eases the effects toward the published settings, frame rate independent */
+	void Advance(float DeltaTime);
+
+private:
+	void ApplyToEffects(const FSubmixEffectReverbSettings& Settings) const;
+
+	TArray<TWeakObjectPtr<USubmixEffectReverbPreset>> Presets;
+	float PublishThreshold = 0.01f;
+	float SmoothingTime = 0.1f;
+	FSubmixEffectReverbSettings BaseSettings;
+
+	FSubmixEffectReverbSettings Target;
+	FSubmixEffectReverbSettings Current;
+	bool bHasTarget = false;
+	bool bHasCurrent = false;
+	bool bConverged = true;
+};
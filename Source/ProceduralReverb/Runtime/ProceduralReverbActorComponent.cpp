@@ -3,9 +3,10 @@
 
 #include "ProceduralReverbActorComponent.h"
 
+#include "AudioDevice.h"
 #include "Components/AudioComponent.h"
+#include "PR_ReverbParameterChannel.h"
 #include "ProceduralReverb/LogPrPartition.h"
-#include "ProceduralReverb/Partition/PR_BSPNode.h"
 #include "ProceduralReverb/Partition/PR_PartitionWorldSubsystem.h"
 #include "Sound/SoundSubmix.h"
 #include "SubmixEffects/AudioMixerSubmixEffectReverb.h"
@@ -23,112 +24,144 @@ static TAutoConsoleVariable<float> CVarDebugReverbParametersPrintInterval(
 // Sets default values for this component's properties
 UProceduralReverbActorComponent::UProceduralReverbActorComponent()
 {
-	PrimaryComponentTick.bCanEverTick = true;
+	// Listeners are evaluated in batches by the partition subsystem
+	PrimaryComponentTick.bCanEverTick = false;
 }
 
 
 // Called when the game starts
 void UProceduralReverbActorComponent::BeginPlay()
 {
+	Super::BeginPlay();
+
 	if (!ReverbSubmix)
 	{
 		ReverbSubmix = NewObject<USoundSubmix>(this);
 	}
-}
 
+	ReverbPresets.Reset();
+	for (TObjectPtr<USoundEffectSubmixPreset> Effect : ReverbSubmix->SubmixEffectChain)
+	{
+		if (auto* Reverb = Cast<USubmixEffectReverbPreset>(Effect))
+		{
+			ReverbPresets.Add(Reverb);
+		}
+	}
 
-// Called every frame
-void UProceduralReverbActorComponent::TickComponent(float DeltaTime, ELevelTick TickType,
-													FActorComponentTickFunction* ThisTickFunction)
-{
-	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
-
-	check(GetOwner());
+	if (!ReverbPresets.IsEmpty() && GetWorld()->GetAudioDevice().IsValid())
+	{
+		ParameterChannel = MakeShared<FPR_ReverbParameterChannel>(TArray<USubmixEffectReverbPreset*>(ReverbPresets), PublishThreshold, SmoothingTime);
+	}
 
-	const FVector& Position = GetOwner()->GetActorLocation();
 	auto* ReverbSubsystem = GetWorld()->GetSubsystem<UPR_PartitionWorldSubsystem>();
 	if (!ReverbSubsystem)
 	{
 		return;
 	}
 
-	TArray<TSharedPtr<FPR_BSPNode>> NearbyNodes;
-	ReverbSubsystem->FindNearbyNodes(Position, NodesSearchRadius, NearbyNodes);
+	ListenerHandle = ReverbSubsystem->RegisterListener(
+		GetOwner(),
+		MakeListenerParams(),
+		FOnPRListenerReverbUpdated::CreateUObject(this, &UProceduralReverbActorComponent::ApplyReverbSettings),
+		FOnPRListenerAdvance::CreateUObject(this, &UProceduralReverbActorComponent::AdvanceReverbSettings));
+}
 
-	if (NodesSearchRadius <= 0.0)
-	{
-		// TODO: Handle
-		return;
-	}
 
-	if (NearbyNodes.IsEmpty())
+void UProceduralReverbActorComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (auto* ReverbSubsystem = GetWorld()->GetSubsystem<UPR_PartitionWorldSubsystem>())
 	{
-		return;
+		ReverbSubsystem->UnregisterListener(ListenerHandle);
 	}
+	ListenerHandle = INDEX_NONE;
+	ParameterChannel.Reset();
 
-	float Sum = 0.0f;
-	TMap<TSharedPtr<FPR_BSPNode>, float> NodesWeights;
-	// TODO: Check visibility to ignore nodes that are not visible
-	for (TSharedPtr<FPR_BSPNode>& Node : NearbyNodes)
-	{
-		if (!Node->AcousticData)
-		{
-			continue;
-		}
+	Super::EndPlay(EndPlayReason);
+}
 
-		const float Distance = Node->DistanceTo(Position);
-		const float Weight = (1.0f - Distance / NodesSearchRadius);
 
-		Sum += Weight;
-		NodesWeights.Add(Node, Weight);
-	}
+void UProceduralReverbActorComponent::SetNodesSearchRadius(float InNodesSearchRadius)
+{
+	NodesSearchRadius = InNodesSearchRadius;
+	UpdateListenerParams();
+}
+
+
+void UProceduralReverbActorComponent::SetRequeryDistance(float InRequeryDistance)
+{
+	RequeryDistance = FMath::Max(InRequeryDistance, 0.0f);
+	UpdateListenerParams();
+}
+
 
-	if (Sum <= 0.0f)
+void UProceduralReverbActorComponent::SetUseReverbGrid(bool bInUseReverbGrid)
+{
+	bUseReverbGrid = bInUseReverbGrid;
+	UpdateListenerParams();
+}
+
+
+#if WITH_EDITOR
+void UProceduralReverbActorComponent::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	// Properties edited on a playing instance take effect right away
+	UpdateListenerParams();
+}
+#endif // WITH_EDITOR
+
+
+FPR_ListenerParams UProceduralReverbActorComponent::MakeListenerParams() const
+{
+	FPR_ListenerParams Params;
+	Params.SearchRadius = NodesSearchRadius;
+	Params.RequeryDistance = RequeryDistance;
+	Params.bUseReverbGrid = bUseReverbGrid;
+	return Params;
+}
+
+
+void UProceduralReverbActorComponent::UpdateListenerParams()
+{
+	if (ListenerHandle == INDEX_NONE)
 	{
 		return;
 	}
 
-	FSubmixEffectReverbSettings CalculatedSettings;
-	CalculatedSettings.DecayTime = 0;
-	CalculatedSettings.Gain = 0;
-	CalculatedSettings.Density = 0;
-	CalculatedSettings.WetLevel = 0;
-
-	float MaxWeight = 0.0f;
-	for (auto& [Node, Weight] : NodesWeights)
+	if (auto* ReverbSubsystem = GetWorld() ? GetWorld()->GetSubsystem<UPR_PartitionWorldSubsystem>() : nullptr)
 	{
-		Node->DrawDebug(GetWorld());
-		const float NormalizedWeight = Weight / Sum;
-		CalculatedSettings.DecayTime += (Node->AcousticData->ReverbSettings.DecayTime) * NormalizedWeight;
+		ReverbSubsystem->SetListenerParams(ListenerHandle, MakeListenerParams());
+	}
+}
 
-		if (Weight > MaxWeight)
-		{
-			MaxWeight = Weight;
-			CalculatedSettings.Gain = Node->AcousticData->ReverbSettings.Gain;
-			CalculatedSettings.Density = Node->AcousticData->ReverbSettings.Density;
-			CalculatedSettings.WetLevel = Node->AcousticData->ReverbSettings.WetLevel;
-		}
+
+void UProceduralReverbActorComponent::AdvanceReverbSettings(float DeltaTime)
+{
+	// Ramps finish even when the listener leaves the partition or no nearby leaf is evaluated
+	if (ParameterChannel.IsValid())
+	{
+		ParameterChannel->Advance(DeltaTime);
 	}
+}
 
-	// Assign the reverb preset to the submix's effect chain
-	for (TObjectPtr<USoundEffectSubmixPreset> Effect : ReverbSubmix->SubmixEffectChain)
+
+void UProceduralReverbActorComponent::ApplyReverbSettings(const FSubmixEffectReverbSettings& CalculatedSettings)
+{
+	// The submix reverbs are eased toward the new settings by AdvanceReverbSettings, later in the same frame
+	if (ParameterChannel.IsValid())
 	{
-		auto* Reverb = Cast<USubmixEffectReverbPreset>(Effect);
-		if (Reverb)
-		{
-			Reverb->SetSettings(CalculatedSettings);
-		}
+		ParameterChannel->Publish(CalculatedSettings);
 	}
 
 #if UE_ENABLE_DEBUG_DRAWING
-	static float TimePassedSincePrint = 0.0f;
-	if (TimePassedSincePrint < CVarDebugReverbParametersPrintInterval.GetValueOnGameThread())
+	const double Time = GetWorld()->GetTimeSeconds();
+	if (Time - LastPrintTime < CVarDebugReverbParametersPrintInterval.GetValueOnGameThread())
 	{
-		TimePassedSincePrint += DeltaTime;
 		return;
 	}
 
-	TimePassedSincePrint = 0.0f;
+	LastPrintTime = Time;
 
 	UE_LOG(LogPrPartition, Verbose, TEXT("Decay: [%.2f] Gain [%.2f] Density [%.2f] Wet Level [%.2f]"),
 		CalculatedSettings.DecayTime,
@@ -137,4 +170,3 @@ void UProceduralReverbActorComponent::TickComponent(float DeltaTime, ELevelTick
 		CalculatedSettings.WetLevel);
 #endif // UE_ENABLE_DEBUG_DRAWING
 }
-
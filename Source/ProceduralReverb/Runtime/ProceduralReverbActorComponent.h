@@ -7,7 +7,10 @@
 #include "ProceduralReverbActorComponent.generated.h"
 
 
+class FPR_ReverbParameterChannel;
+struct FPR_ListenerParams;
 class USubmixEffectReverbPreset;
+struct FSubmixEffectReverbSettings;
 
 UCLASS(ClassGroup=(Custom), meta=(BlueprintSpawnableComponent))
 class PROCEDURALREVERB_API UProceduralReverbActorComponent : public UActorComponent
@@ -18,18 +21,66 @@ public:
 	// Sets default values for this component's properties
 	UProceduralReverbActorComponent();
 
+	UFUNCTION(BlueprintCallable, Category = "Procedural Reverb")
+	void SetNodesSearchRadius(float InNodesSearchRadius);
+
+	UFUNCTION(BlueprintCallable, Category = "Procedural Reverb")
+	void SetRequeryDistance(float InRequeryDistance);
+
+	UFUNCTION(BlueprintCallable, Category = "Procedural Reverb")
+	void SetUseReverbGrid(bool bInUseReverbGrid);
+
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif // WITH_EDITOR
+
 protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
-
-public:
-	// Called every frame
-	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 private:
+	/** Called by the partition subsystem once per frame, after every listener has been evaluated */
+	void ApplyReverbSettings(const FSubmixEffectReverbSettings& Settings);
+	/** Called by the partition subsystem every frame, also when the listener got no new settings */
+	void AdvanceReverbSettings(float DeltaTime);
+
+	FPR_ListenerParams MakeListenerParams() const;
+	/** Hands the current properties to the subsystem, listeners registered at BeginPlay would keep stale ones otherwise */
+	void UpdateListenerParams();
+
 	UPROPERTY(EditAnywhere)
 	USoundSubmix* ReverbSubmix = nullptr;
 
 	UPROPERTY(EditAnywhere)
 	float NodesSearchRadius = 1000.0f;
+
+	/** Extra radius gathered around the listener, the partition is queried again only after moving this far */
+	UPROPERTY(EditAnywhere, meta = (ClampMin = 0.0f, UIMin = 0.0f))
+	float RequeryDistance = 250.0f;
+
+	/** Samples the subsystem's reverb grid instead of blending nearby leaves, when the grid is built */
+	UPROPERTY(EditAnywhere)
+	bool bUseReverbGrid = false;
+
+	/** Changes of the blended settings smaller than this are not sent to the effects */
+	UPROPERTY(EditAnywhere, Category = "Smoothing", meta = (ClampMin = 0.0f, UIMin = 0.0f))
+	float PublishThreshold = 0.01f;
+
+	/** Time constant of the ramp the effects are eased along toward newly published settings */
+	UPROPERTY(EditAnywhere, Category = "Smoothing", meta = (Units = "s", ClampMin = 0.0f, UIMin = 0.0f))
+	float SmoothingTime = 0.1f;
+
+	/** Reverb presets of the submix effect chain, resolved once at BeginPlay. Keeps them alive for the parameter channel */
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<USubmixEffectReverbPreset>> ReverbPresets;
+
+	// Shared pointer, so the generated code doesn't need the complete type
+	TSharedPtr<FPR_ReverbParameterChannel> ParameterChannel;
+
+	int32 ListenerHandle = INDEX_NONE;
+
+#if UE_ENABLE_DEBUG_DRAWING
+	double LastPrintTime = 0.0;
+#endif // UE_ENABLE_DEBUG_DRAWING
 };
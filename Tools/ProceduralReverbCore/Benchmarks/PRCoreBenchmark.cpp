@@ -0,0 +1,481 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+// Microbenchmarks of the reverb core against a synthetic scene of axis aligned walls.
+// Usage: PRCoreBenchmark [Depth] [Queries]
+
+#include "PRCore_Acoustics.h"
+#include "PRCore_InferenceCache.h"
+#include "PRCore_Partition.h"
+#include "PRCore_Reverb.h"
+#include "PRCore_Visibility.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+
+namespace
+{
+/** Grid of rooms, every room is closed by walls of one material per room row */
+class FSyntheticScene : public PRCore::IWorldQueries
+{
+public:
+	FSyntheticScene(int32_t RoomsPerSide, double RoomSize, double WallThickness)
+	{
+		const double Half = 0.5 * WallThickness;
+		const double Extent = RoomsPerSide * RoomSize;
+		for (int32_t Index = 0; Index <= RoomsPerSide; ++Index)
+		{
+			const double Offset = Index * RoomSize;
+			Walls.push_back(PRCore::FBox3(PRCore::FVec3(Offset - Half, 0, 0), PRCore::FVec3(Offset + Half, Extent, RoomSize)));
+			Walls.push_back(PRCore::FBox3(PRCore::FVec3(0, Offset - Half, 0), PRCore::FVec3(Extent, Offset + Half, RoomSize)));
+			Materials.push_back(static_cast<uint8_t>(1 + Index % 4));
+			Materials.push_back(static_cast<uint8_t>(1 + Index % 4));
+		}
+
+		Walls.push_back(PRCore::FBox3(PRCore::FVec3(0, 0, -Half), PRCore::FVec3(Extent, Extent, Half)));
+		Walls.push_back(PRCore::FBox3(PRCore::FVec3(0, 0, RoomSize - Half), PRCore::FVec3(Extent, Extent, RoomSize + Half)));
+		Materials.push_back(5);
+		Materials.push_back(6);
+
+		Bounds = PRCore::FBox3(PRCore::FVec3(0, 0, 0), PRCore::FVec3(Extent, Extent, RoomSize));
+	}
+
+	virtual PRCore::FTraceHit Trace(const PRCore::FVec3& Start, const PRCore::FVec3& End) const override
+	{
+		const PRCore::FVec3 Delta = End - Start;
+		PRCore::FTraceHit Result;
+		double BestTime = 1.0;
+		for (size_t WallIndex = 0; WallIndex < Walls.size(); ++WallIndex)
+		{
+			double Time = 0.0;
+			PRCore::FVec3 Normal;
+			if (IntersectSegment(Walls[WallIndex], Start, Delta, Time, Normal) && Time <= BestTime)
+			{
+				BestTime = Time;
+				Result.bHit = true;
+				Result.Normal = Normal;
+				Result.Material = Materials[WallIndex];
+				Result.Surface = &Walls[WallIndex];
+			}
+		}
+
+		if (Result.bHit)
+		{
+			Result.Distance = static_cast<float>(BestTime * std::sqrt(Delta.X * Delta.X + Delta.Y * Delta.Y + Delta.Z * Delta.Z));
+		}
+		return Result;
+	}
+
+	virtual bool Overlaps(const PRCore::FBox3& Box) const override
+	{
+		for (const PRCore::FBox3& Wall : Walls)
+		{
+			if (Wall.Min.X < Box.Max.X && Wall.Max.X > Box.Min.X
+				&& Wall.Min.Y < Box.Max.Y && Wall.Max.Y > Box.Min.Y
+				&& Wall.Min.Z < Box.Max.Z && Wall.Max.Z > Box.Min.Z)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	PRCore::FBox3 Bounds;
+
+private:
+	static bool IntersectSegment(const PRCore::FBox3& Box, const PRCore::FVec3& Start, const PRCore::FVec3& Delta, double& OutTime, PRCore::FVec3& OutNormal)
+	{
+		double Enter = 0.0;
+		int32_t EnterAxis = -1;
+		double Exit = 1.0;
+		for (int32_t Axis = 0; Axis < 3; ++Axis)
+		{
+			if (std::abs(Delta[Axis]) < 1e-9)
+			{
+				if (Start[Axis] < Box.Min[Axis] || Start[Axis] > Box.Max[Axis])
+				{
+					return false;
+				}
+				continue;
+			}
+
+			double Near = (Box.Min[Axis] - Start[Axis]) / Delta[Axis];
+			double Far = (Box.Max[Axis] - Start[Axis]) / Delta[Axis];
+			if (Near > Far)
+			{
+				std::swap(Near, Far);
+			}
+			if (Near > Enter)
+			{
+				Enter = Near;
+				EnterAxis = Axis;
+			}
+			Exit = std::min(Exit, Far);
+			if (Enter > Exit)
+			{
+				return false;
+			}
+		}
+
+		// Starting inside a wall reports it as facing the ray
+		OutNormal = PRCore::FVec3();
+		if (EnterAxis >= 0)
+		{
+			OutNormal[EnterAxis] = Delta[EnterAxis] > 0.0 ? -1.0 : 1.0;
+		}
+		else
+		{
+			OutNormal = Delta * (-1.0 / std::sqrt(Delta.X * Delta.X + Delta.Y * Delta.Y + Delta.Z * Delta.Z));
+		}
+
+		OutTime = Enter;
+		return true;
+	}
+
+	std::vector<PRCore::FBox3> Walls;
+	std::vector<uint8_t> Materials;
+};
+
+
+template <typename FunctionType>
+double MeasureMs(FunctionType&& Function)
+{
+	const auto Start = std::chrono::steady_clock::now();
+	Function();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+}
+
+void Report(const char* Name, double Milliseconds, int32_t Iterations, int64_t Work = -1)
+{
+	std::printf("%-28s %10.3f ms %10.1f ns/op", Name, Milliseconds, Milliseconds * 1.0e6 / std::max(Iterations, 1));
+	if (Work >= 0)
+	{
+		std::printf("  (%lld nodes visited)", static_cast<long long>(Work));
+	}
+	std::printf("\n");
+}
+}
+
+
+int main(int Argc, char** Argv)
+{
+	const int32_t Depth = Argc > 1 ? std::atoi(Argv[1]) : 14;
+	const int32_t NumQueries = Argc > 2 ? std::atoi(Argv[2]) : 100000;
+	const float SearchRadius = 500.0f;
+
+	const FSyntheticScene Scene(8, 1000.0, 20.0);
+	std::mt19937 Random(1234);
+	std::uniform_real_distribution<double> UnitDistribution(0.0, 1.0);
+
+	std::vector<PRCore::FVec3> Positions(NumQueries);
+	for (PRCore::FVec3& Position : Positions)
+	{
+		for (int32_t Axis = 0; Axis < 3; ++Axis)
+		{
+			Position[Axis] = Scene.Bounds.Min[Axis] + UnitDistribution(Random) * (Scene.Bounds.Max[Axis] - Scene.Bounds.Min[Axis]);
+		}
+	}
+
+	PRCore::FPartition Partition;
+	PRCore::FBuildParams Params;
+	Params.MaxDepth = Depth;
+	Report("Build", MeasureMs([&] { Partition.Build(Scene.Bounds, Params); }), 1);
+	std::printf("  %d nodes, %d leaves, %.1f KiB\n", Partition.GetNumNodes(), Partition.GetNumLeaves(), Partition.GetAllocatedSize() / 1024.0);
+
+	PRCore::FPartition AdaptivePartition;
+	PRCore::FBuildParams AdaptiveParams = Params;
+	AdaptiveParams.CanSplit = [&Scene](const PRCore::FBox3& Region) { return !PRCore::IsRegionUniform(Scene, Region, 5000.0f); };
+	Report("Build adaptive", MeasureMs([&] { AdaptivePartition.Build(Scene.Bounds, AdaptiveParams); }), 1);
+	std::printf("  %d nodes, %d leaves\n", AdaptivePartition.GetNumNodes(), AdaptivePartition.GetNumLeaves());
+
+	int64_t Checksum = 0;
+	Report("FindLeaf", MeasureMs([&]
+	{
+		for (const PRCore::FVec3& Position : Positions)
+		{
+			Checksum += Partition.FindLeaf(Position);
+		}
+	}), NumQueries);
+
+	// Shared by the single and batched cases, so each query flavour is compiled once
+	const auto SumLeaf = [&Checksum](int32_t LeafIndex, float) { Checksum += LeafIndex; };
+	const auto SumQueryLeaf = [&Checksum](int32_t, int32_t LeafIndex, float) { Checksum += LeafIndex; };
+
+	// Work counters are read after the measurement, argument evaluation order is unspecified
+	int64_t NodesVisited = 0;
+	double Milliseconds = MeasureMs([&]
+	{
+		for (const PRCore::FVec3& Position : Positions)
+		{
+			NodesVisited += Partition.FindNearbyLeaves(Position, SearchRadius, SumLeaf);
+		}
+	});
+	Report("FindNearbyLeaves", Milliseconds, NumQueries, NodesVisited);
+
+	std::vector<PRCore::FSphereQuery> Spheres;
+	Spheres.reserve(Positions.size());
+	for (const PRCore::FVec3& Position : Positions)
+	{
+		Spheres.push_back({Position, SearchRadius});
+	}
+
+	NodesVisited = 0;
+	Milliseconds = MeasureMs([&]
+	{
+		NodesVisited += Partition.FindNearbyLeaves(Spheres.data(), static_cast<int32_t>(Spheres.size()), SumQueryLeaf);
+	});
+	Report("FindNearbyLeaves batched", Milliseconds, NumQueries, NodesVisited);
+
+	// Four listeners close to each other, e.g. a party moving through the same rooms, queried every frame
+	constexpr int32_t NumListeners = 4;
+	std::vector<PRCore::FSphereQuery> ListenerSpheres;
+	ListenerSpheres.reserve(Positions.size());
+	for (int32_t Frame = 0; Frame + NumListeners <= NumQueries; Frame += NumListeners)
+	{
+		for (int32_t Listener = 0; Listener < NumListeners; ++Listener)
+		{
+			PRCore::FVec3 Position = Positions[Frame];
+			Position.X += (UnitDistribution(Random) - 0.5) * 800.0;
+			Position.Y += (UnitDistribution(Random) - 0.5) * 800.0;
+			ListenerSpheres.push_back({Position, SearchRadius});
+		}
+	}
+
+	NodesVisited = 0;
+	Milliseconds = MeasureMs([&]
+	{
+		for (const PRCore::FSphereQuery& Sphere : ListenerSpheres)
+		{
+			NodesVisited += Partition.FindNearbyLeaves(Sphere.Center, Sphere.Radius, SumLeaf);
+		}
+	});
+	Report("FindNearbyLeaves 4 single", Milliseconds, static_cast<int32_t>(ListenerSpheres.size()), NodesVisited);
+
+	NodesVisited = 0;
+	Milliseconds = MeasureMs([&]
+	{
+		for (size_t Frame = 0; Frame < ListenerSpheres.size(); Frame += NumListeners)
+		{
+			NodesVisited += Partition.FindNearbyLeaves(ListenerSpheres.data() + Frame, NumListeners, SumQueryLeaf);
+		}
+	});
+	Report("FindNearbyLeaves 4 batched", Milliseconds, static_cast<int32_t>(ListenerSpheres.size()), NodesVisited);
+
+	NodesVisited = 0;
+	PRCore::FLeafHit Hits[8];
+	Milliseconds = MeasureMs([&]
+	{
+		for (const PRCore::FVec3& Position : Positions)
+		{
+			int32_t NumHits = 0;
+			NodesVisited += Partition.FindNearestLeaves(Position, 8, Hits, NumHits);
+			Checksum += NumHits;
+		}
+	});
+	Report("FindNearestLeaves (8)", Milliseconds, NumQueries, NodesVisited);
+
+	// Dirty boxes of the size a door or a destroyed wall touches
+	NodesVisited = 0;
+	const PRCore::FVec3 DirtyExtent(SearchRadius, SearchRadius, SearchRadius);
+	Milliseconds = MeasureMs([&]
+	{
+		for (const PRCore::FVec3& Position : Positions)
+		{
+			NodesVisited += Partition.FindLeavesInBox(PRCore::FBox3(Position - DirtyExtent, Position + DirtyExtent), [&Checksum](int32_t LeafIndex) { Checksum += LeafIndex; });
+		}
+	});
+	Report("FindLeavesInBox", Milliseconds, NumQueries, NodesVisited);
+
+	const int32_t NumLeaves = Partition.GetNumLeaves();
+
+	// Playable space covers the lower half of the scene, leaves beyond the margin above it are exterior
+	PRCore::FLeafSpaceParams SpaceParams;
+	PRCore::FBox3 PlayableBox = Scene.Bounds;
+	PlayableBox.Max.Z = Scene.Bounds.GetCenter().Z;
+	SpaceParams.PlayableBounds.push_back(PlayableBox);
+	SpaceParams.PlayableMargin = 100.0;
+	std::vector<uint8_t> LeafSpaces(NumLeaves);
+	Report("ClassifyLeaf", MeasureMs([&]
+	{
+		for (int32_t LeafIndex = 0; LeafIndex < NumLeaves; ++LeafIndex)
+		{
+			LeafSpaces[LeafIndex] = static_cast<uint8_t>(PRCore::ClassifyLeaf(Scene, Partition.GetLeafBounds().GetBox(LeafIndex), SpaceParams));
+		}
+	}), NumLeaves);
+
+	int32_t NumSpaceLeaves[PRCore::NumLeafSpaces] = {};
+	for (const uint8_t Space : LeafSpaces)
+	{
+		++NumSpaceLeaves[Space];
+	}
+	std::printf("  %d playable, %d solid, %d exterior leaves\n", NumSpaceLeaves[0], NumSpaceLeaves[1], NumSpaceLeaves[2]);
+
+	NodesVisited = 0;
+	Milliseconds = MeasureMs([&]
+	{
+		for (const PRCore::FVec3& Position : Positions)
+		{
+			int32_t NumHits = 0;
+			NodesVisited += Partition.FindNearestLeaves(Position, 8, Hits, NumHits, LeafSpaces.data());
+			Checksum += NumHits;
+		}
+	});
+	Report("FindNearestLeaves playable", Milliseconds, NumQueries, NodesVisited);
+	std::vector<PRCore::FLeafFeatures> Features(NumLeaves);
+	const struct
+	{
+		const char* Name;
+		PRCore::FProbeRaySet RaySet;
+	} RaySets[] = {
+		{"ProbeLeaf Axes6", PRCore::FProbeRaySet(PRCore::EProbeRaySet::Axes6)},
+		{"ProbeLeaf Axes26", PRCore::FProbeRaySet(PRCore::EProbeRaySet::Axes26)},
+		{"ProbeLeaf Fibonacci64", PRCore::FProbeRaySet(PRCore::EProbeRaySet::Fibonacci, 64)},
+	};
+
+	// Last one wins, so the features below come from the densest set
+	for (const auto& Entry : RaySets)
+	{
+		Report(Entry.Name, MeasureMs([&]
+		{
+			for (int32_t LeafIndex = 0; LeafIndex < NumLeaves; ++LeafIndex)
+			{
+				PRCore::ProbeLeaf(Scene, Entry.RaySet, Partition.GetLeafBounds().GetCenter(LeafIndex), 5000.0f, Features[LeafIndex]);
+			}
+		}), NumLeaves);
+	}
+
+	// Reduction alone, over precomputed hits
+	const PRCore::FProbeRaySet& DenseSet = RaySets[2].RaySet;
+	PRCore::FProbeHits ProbeHits;
+	ProbeHits.Resize(static_cast<size_t>(NumLeaves) * DenseSet.Num());
+	for (size_t Index = 0; Index < ProbeHits.Distances.size(); ++Index)
+	{
+		PRCore::FTraceHit Hit;
+		Hit.bHit = true;
+		Hit.Distance = static_cast<float>(UnitDistribution(Random) * 5000.0);
+		Hit.Normal = DenseSet.GetDirections()[Index % DenseSet.Num()] * -1.0;
+		Hit.Material = static_cast<uint8_t>(Index % 7);
+		ProbeHits.Set(Index, Hit, DenseSet.GetDirections()[Index % DenseSet.Num()], 5000.0f);
+	}
+	std::vector<PRCore::FLeafFeatures> ReducedFeatures(NumLeaves);
+	Report("Reduce Fibonacci64", MeasureMs([&] { DenseSet.Reduce(ProbeHits, 0, NumLeaves, 5000.0f, ReducedFeatures.data()); }), NumLeaves);
+
+	std::vector<float> Inputs(static_cast<size_t>(NumLeaves) * PRCore::NumModelInputs);
+	Report("PackFeatures", MeasureMs([&]
+	{
+		for (int32_t LeafIndex = 0; LeafIndex < NumLeaves; ++LeafIndex)
+		{
+			PRCore::PackFeatures(Features[LeafIndex], Inputs.data() + static_cast<size_t>(LeafIndex) * PRCore::NumModelInputs);
+		}
+	}), NumLeaves);
+
+	Report("NeighbourBlend", MeasureMs([&]
+	{
+		for (const PRCore::FVec3& Position : Positions)
+		{
+			PRCore::FNeighbourBlend Blend(SearchRadius);
+			Partition.FindNearbyLeaves(Position, SearchRadius, [&](int32_t LeafIndex, float Distance)
+			{
+				Blend.Add(LeafIndex, Distance, Inputs[static_cast<size_t>(LeafIndex) * PRCore::NumModelInputs]);
+			});
+
+			float DecayTime = 0.0f;
+			int32_t DominantLeaf = -1;
+			Checksum += Blend.Resolve(DecayTime, DominantLeaf) ? DominantLeaf : 0;
+		}
+	}), NumQueries);
+
+	// Stand-in for the model, decay drops close to walls and the wet level follows the closest material
+	std::vector<PRCore::FReverbParams> LeafParams(NumLeaves);
+	for (int32_t LeafIndex = 0; LeafIndex < NumLeaves; ++LeafIndex)
+	{
+		const PRCore::FLeafFeatures& LeafFeatures = Features[LeafIndex];
+		const int32_t Closest = static_cast<int32_t>(std::min_element(std::begin(LeafFeatures.Distances), std::end(LeafFeatures.Distances)) - std::begin(LeafFeatures.Distances));
+		const float Outputs[PRCore::NumModelOutputs] = {LeafFeatures.Distances[Closest] * 0.005f, 0.5f, 0.5f, LeafFeatures.Materials[Closest] * 0.1f};
+		LeafParams[LeafIndex] = PRCore::MapModelOutput(Outputs);
+	}
+
+	PRCore::FReverbPalette Palette;
+	std::vector<uint32_t> LeafKeys(NumLeaves);
+	Report("ReverbPalette", MeasureMs([&]
+	{
+		Palette.Reset(0.01f);
+		for (int32_t LeafIndex = 0; LeafIndex < NumLeaves; ++LeafIndex)
+		{
+			LeafKeys[LeafIndex] = static_cast<uint32_t>(Palette.Add(LeafParams[LeafIndex]));
+		}
+	}), NumLeaves);
+
+	PRCore::FPartition MergedPartition = Partition;
+	std::vector<int32_t> LeafRemap;
+	Report("MergeLeaves", MeasureMs([&] { MergedPartition.MergeLeaves(LeafKeys, LeafRemap); }), NumLeaves);
+	std::printf("  %d palette entries, %d -> %d leaves, %.1f -> %.1f KiB\n",
+		Palette.Num(),
+		NumLeaves,
+		MergedPartition.GetNumLeaves(),
+		(Partition.GetAllocatedSize() + LeafParams.size() * sizeof(PRCore::FReverbParams)) / 1024.0,
+		(MergedPartition.GetAllocatedSize() + Palette.GetAllocatedSize() + MergedPartition.GetNumLeaves() * sizeof(uint16_t)) / 1024.0);
+
+	// Leaves of repeated rooms share features, only distinct keys would reach the model
+	std::vector<int32_t> MissRows;
+	std::vector<int32_t> RowMisses;
+	for (const float Resolution : {1.0f, 10.0f})
+	{
+		PRCore::FInferenceCache Cache(Resolution);
+		char Name[64];
+		std::snprintf(Name, sizeof(Name), "InferenceCache (%.0f cm)", Resolution);
+		Report(Name, MeasureMs([&]
+		{
+			Cache.Reset(Resolution);
+			Cache.Lookup(Features.data(), NumLeaves, LeafParams.data(), MissRows, RowMisses);
+			for (const int32_t Row : MissRows)
+			{
+				Cache.Add(Features[Row], LeafParams[Row]);
+			}
+		}), NumLeaves);
+		std::printf("  %zu distinct keys, %.1f%% hits, %.1f KiB\n", Cache.Num(), Cache.GetHitRate() * 100.0, Cache.GetAllocatedSize() / 1024.0);
+	}
+
+	// Coarse regions the lazy mode evaluates up front, every leaf center has to lie in its region
+	std::vector<PRCore::FBox3> RegionBounds;
+	std::vector<int32_t> LeafRegions;
+	Report("CutAtDepth (6)", MeasureMs([&] { Partition.CutAtDepth(6, RegionBounds, LeafRegions); }), NumLeaves);
+	int32_t NumOutsideRegion = 0;
+	for (int32_t LeafIndex = 0; LeafIndex < NumLeaves; ++LeafIndex)
+	{
+		NumOutsideRegion += !RegionBounds[LeafRegions[LeafIndex]].IsInsideOrOn(Partition.GetLeafBounds().GetCenter(LeafIndex));
+	}
+	std::printf("  %d regions, %d leaves outside of their region\n", static_cast<int32_t>(RegionBounds.size()), NumOutsideRegion);
+
+	PRCore::FLeafVisibility Visibility;
+	PRCore::FVisibilityParams VisibilityParams;
+	VisibilityParams.Radius = SearchRadius;
+	Report("LeafVisibility build", MeasureMs([&] { Visibility.Build(Partition, Scene, VisibilityParams); }), NumLeaves);
+	std::printf("  %zu visible pairs, %.1f KiB\n", Visibility.GetVisibleLeaves().size() / 2, Visibility.GetAllocatedSize() / 1024.0);
+
+	Report("NeighbourBlend visible", MeasureMs([&]
+	{
+		for (const PRCore::FVec3& Position : Positions)
+		{
+			const int32_t ListenerLeaf = Partition.FindLeaf(Position);
+			PRCore::FNeighbourBlend Blend(SearchRadius);
+			Partition.FindNearbyLeaves(Position, SearchRadius, [&](int32_t LeafIndex, float Distance)
+			{
+				if (Visibility.IsVisible(ListenerLeaf, LeafIndex))
+				{
+					Blend.Add(LeafIndex, Distance, Inputs[static_cast<size_t>(LeafIndex) * PRCore::NumModelInputs]);
+				}
+			});
+
+			float DecayTime = 0.0f;
+			int32_t DominantLeaf = -1;
+			Checksum += Blend.Resolve(DecayTime, DominantLeaf) ? DominantLeaf : 0;
+		}
+	}), NumQueries);
+
+	std::printf("Checksum %lld\n", static_cast<long long>(Checksum));
+	return 0;
+}
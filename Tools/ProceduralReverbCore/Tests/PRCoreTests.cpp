@@ -0,0 +1,657 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+// Unit tests of the reverb core, run by ctest. Queries are checked against brute force over the leaf bounds.
+// Usage: PRCoreTests [TestName]
+
+#include "PRCore_Acoustics.h"
+#include "PRCore_Inference.h"
+#include "PRCore_InferenceCache.h"
+#include "PRCore_Partition.h"
+#include "PRCore_Reverb.h"
+#include "PRCore_Visibility.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <set>
+#include <vector>
+
+
+namespace
+{
+int32_t NumFailures = 0;
+
+#define PR_CHECK(Condition) \
+	do \
+	{ \
+		if (!(Condition)) \
+		{ \
+			std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #Condition); \
+			++NumFailures; \
+		} \
+	} while (false)
+
+#define PR_CHECK_NEAR(Value, Expected, Tolerance) PR_CHECK(std::abs((Value) - (Expected)) <= (Tolerance))
+
+// Leaf bounds are stored as floats, distances near a boundary may differ by rounding
+constexpr float DistanceTolerance = 1e-3f;
+
+
+/** Solid boxes, traces report the first box they enter */
+class FBoxScene : public PRCore::IWorldQueries
+{
+public:
+	void AddBox(const PRCore::FBox3& Box) { Boxes.push_back(Box); }
+
+	virtual PRCore::FTraceHit Trace(const PRCore::FVec3& Start, const PRCore::FVec3& End) const override
+	{
+		const PRCore::FVec3 Delta = End - Start;
+		PRCore::FTraceHit Result;
+		double BestTime = 1.0;
+		for (const PRCore::FBox3& Box : Boxes)
+		{
+			double Enter = 0.0;
+			double Exit = 1.0;
+			for (int32_t Axis = 0; Axis < 3 && Enter <= Exit; ++Axis)
+			{
+				if (std::abs(Delta[Axis]) < 1e-9)
+				{
+					Exit = (Start[Axis] < Box.Min[Axis] || Start[Axis] > Box.Max[Axis]) ? -1.0 : Exit;
+					continue;
+				}
+
+				const double Near = (Box.Min[Axis] - Start[Axis]) / Delta[Axis];
+				const double Far = (Box.Max[Axis] - Start[Axis]) / Delta[Axis];
+				Enter = std::max(Enter, std::min(Near, Far));
+				Exit = std::min(Exit, std::max(Near, Far));
+			}
+
+			if (Enter <= Exit && Enter <= BestTime)
+			{
+				BestTime = Enter;
+				Result.bHit = true;
+				Result.Surface = &Box;
+			}
+		}
+
+		if (Result.bHit)
+		{
+			Result.Distance = static_cast<float>(BestTime * std::sqrt(Delta.X * Delta.X + Delta.Y * Delta.Y + Delta.Z * Delta.Z));
+		}
+		return Result;
+	}
+
+	virtual bool Overlaps(const PRCore::FBox3& Box) const override
+	{
+		for (const PRCore::FBox3& Other : Boxes)
+		{
+			if (Other.Intersects(Box))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	std::vector<PRCore::FBox3> Boxes;
+};
+
+
+/** Stand-in model: decay from the room length, the other outputs out of range on purpose. Counts the rows it ran on */
+class FCountingModel : public PRCore::IReverbModel
+{
+public:
+	virtual int32_t GetNumInputs() const override { return PRCore::NumModelInputs; }
+	virtual int32_t GetNumOutputs() const override { return PRCore::NumModelOutputs; }
+
+	virtual bool Run(const float* Inputs, float* Outputs, int32_t NumRows) override
+	{
+		for (int32_t Row = 0; Row < NumRows; ++Row)
+		{
+			const float* RowInputs = Inputs + Row * PRCore::NumModelInputs;
+			float* RowOutputs = Outputs + Row * PRCore::NumModelOutputs;
+			RowOutputs[0] = RowInputs[0] / 1000.0f;
+			RowOutputs[1] = -1.0f;
+			RowOutputs[2] = 2.0f;
+			RowOutputs[3] = 0.5f;
+		}
+
+		NumRowsRun += NumRows;
+		return true;
+	}
+
+	int32_t NumRowsRun = 0;
+};
+
+
+const PRCore::FBox3 RootBox(PRCore::FVec3(0, 0, 0), PRCore::FVec3(1024, 1024, 1024));
+
+/** Irregular partition, the region around one corner is kept coarse */
+PRCore::FPartition BuildTestPartition()
+{
+	PRCore::FBuildParams Params;
+	Params.MaxDepth = 9;
+	Params.CanSplit = [](const PRCore::FBox3& Region)
+	{
+		return Region.Min.X < 600.0 || Region.Min.Y < 600.0;
+	};
+
+	PRCore::FPartition Partition;
+	Partition.Build(RootBox, Params);
+	return Partition;
+}
+
+/** Irregular partition with a leaf budget, so the budget check sees the nodes of a level in several steps */
+PRCore::FBuildParams MakeSteppedBuildParams()
+{
+	PRCore::FBuildParams Params;
+	Params.MaxDepth = 9;
+	Params.MaxLeafCount = 300;
+	Params.CanSplit = [](const PRCore::FBox3& Region)
+	{
+		return Region.Min.X < 600.0 || Region.Min.Y < 600.0;
+	};
+	return Params;
+}
+
+PRCore::FVec3 RandomPoint(std::mt19937& Random, const PRCore::FBox3& Box)
+{
+	PRCore::FVec3 Point;
+	for (int32_t Axis = 0; Axis < 3; ++Axis)
+	{
+		Point[Axis] = std::uniform_real_distribution<double>(Box.Min[Axis], Box.Max[Axis])(Random);
+	}
+	return Point;
+}
+
+
+void TestFindLeaf()
+{
+	const PRCore::FPartition Partition = BuildTestPartition();
+	const PRCore::FLeafBounds& LeafBounds = Partition.GetLeafBounds();
+	PR_CHECK(Partition.GetNumLeaves() > 64);
+
+	std::mt19937 Random(1);
+	for (int32_t Query = 0; Query < 2000; ++Query)
+	{
+		const PRCore::FVec3 Position = RandomPoint(Random, RootBox);
+		const int32_t LeafIndex = Partition.FindLeaf(Position);
+		PR_CHECK(LeafIndex >= 0 && LeafBounds.GetBox(LeafIndex).IsInsideOrOn(Position));
+
+		int32_t NumContaining = 0;
+		for (int32_t Leaf = 0; Leaf < LeafBounds.Num(); ++Leaf)
+		{
+			NumContaining += LeafBounds.GetBox(Leaf).IsInsideOrOn(Position) ? 1 : 0;
+		}
+		PR_CHECK(NumContaining >= 1);
+	}
+
+	PR_CHECK(Partition.FindLeaf(PRCore::FVec3(-1, 512, 512)) == -1);
+	PR_CHECK(Partition.FindLeaf(PRCore::FVec3(512, 512, 2000)) == -1);
+}
+
+/** Leaves clearly inside the radius must be found, found leaves must be within it and report their distance */
+void CheckNearbyResult(const PRCore::FPartition& Partition, const PRCore::FVec3& Center, float Radius, const std::vector<PRCore::FLeafHit>& Hits)
+{
+	std::set<int32_t> Found;
+	for (const PRCore::FLeafHit& Hit : Hits)
+	{
+		PR_CHECK(Found.insert(Hit.LeafIndex).second);
+		const float Distance = Partition.DistanceToLeaf(Hit.LeafIndex, Center);
+		PR_CHECK(Distance <= Radius + DistanceTolerance);
+		PR_CHECK_NEAR(Hit.Distance, Distance, DistanceTolerance);
+	}
+
+	for (int32_t Leaf = 0; Leaf < Partition.GetNumLeaves(); ++Leaf)
+	{
+		if (Partition.DistanceToLeaf(Leaf, Center) < Radius - DistanceTolerance)
+		{
+			PR_CHECK(Found.count(Leaf) == 1);
+		}
+	}
+}
+
+void TestSteppedBuild()
+{
+	PRCore::FPartition Built;
+	Built.Build(RootBox, MakeSteppedBuildParams());
+	PR_CHECK(!Built.IsBuilding() && Built.GetNumLeaves() == 300);
+
+	for (const int32_t MaxNodes : {1, 7, 64})
+	{
+		PRCore::FPartition Stepped;
+		Stepped.BeginBuild(RootBox, MakeSteppedBuildParams());
+		int32_t NumSteps = 1;
+		while (!Stepped.StepBuild(MaxNodes))
+		{
+			// Queries find nothing until the tree is complete
+			PR_CHECK(Stepped.IsBuilding() && Stepped.IsEmpty() && Stepped.FindLeaf(PRCore::FVec3(1, 1, 1)) == -1);
+			++NumSteps;
+		}
+		PR_CHECK(NumSteps > 1 && !Stepped.IsBuilding());
+		PR_CHECK(Stepped.GetNumNodes() == Built.GetNumNodes());
+		PR_CHECK(Stepped.GetLeafBounds().MinX == Built.GetLeafBounds().MinX && Stepped.GetLeafBounds().MaxZ == Built.GetLeafBounds().MaxZ);
+		PR_CHECK(Stepped.StepBuild(MaxNodes));
+	}
+
+	PRCore::FPartition Invalid;
+	Invalid.BeginBuild(PRCore::FBox3(), MakeSteppedBuildParams());
+	PR_CHECK(Invalid.StepBuild(1) && Invalid.IsEmpty());
+}
+
+/** Batched results have to match the single query of every sphere */
+void CheckBatchedNearbyLeaves(const PRCore::FPartition& Partition, const std::vector<PRCore::FSphereQuery>& Queries)
+{
+	std::vector<std::vector<PRCore::FLeafHit>> BatchedHits(Queries.size());
+	Partition.FindNearbyLeaves(Queries.data(), static_cast<int32_t>(Queries.size()), [&](int32_t QueryIndex, int32_t LeafIndex, float Distance)
+	{
+		BatchedHits[QueryIndex].push_back({LeafIndex, Distance});
+	});
+
+	for (size_t QueryIndex = 0; QueryIndex < Queries.size(); ++QueryIndex)
+	{
+		const PRCore::FSphereQuery& Query = Queries[QueryIndex];
+		std::vector<PRCore::FLeafHit> Hits;
+		Partition.FindNearbyLeaves(Query.Center, Query.Radius, [&](int32_t LeafIndex, float Distance)
+		{
+			Hits.push_back({LeafIndex, Distance});
+		});
+
+		CheckNearbyResult(Partition, Query.Center, Query.Radius, Hits);
+		CheckNearbyResult(Partition, Query.Center, Query.Radius, BatchedHits[QueryIndex]);
+		PR_CHECK(Hits.size() == BatchedHits[QueryIndex].size());
+	}
+}
+
+void TestFindNearbyLeaves()
+{
+	const PRCore::FPartition Partition = BuildTestPartition();
+	const PRCore::FBox3 QueryBox(PRCore::FVec3(-200, -200, -200), PRCore::FVec3(1224, 1224, 1224));
+
+	std::mt19937 Random(2);
+	std::vector<PRCore::FSphereQuery> Queries(70);
+	for (PRCore::FSphereQuery& Query : Queries)
+	{
+		Query.Center = RandomPoint(Random, QueryBox);
+		Query.Radius = std::uniform_real_distribution<float>(0.0f, 400.0f)(Random);
+	}
+	CheckBatchedNearbyLeaves(Partition, Queries);
+
+	// Clustered listeners share the descent until their spheres part
+	for (int32_t Cluster = 0; Cluster < 20; ++Cluster)
+	{
+		const PRCore::FVec3 Center = RandomPoint(Random, QueryBox);
+		const PRCore::FBox3 ClusterBox(Center - PRCore::FVec3(40, 40, 40), Center + PRCore::FVec3(40, 40, 40));
+		std::vector<PRCore::FSphereQuery> Listeners(4);
+		for (PRCore::FSphereQuery& Listener : Listeners)
+		{
+			Listener.Center = RandomPoint(Random, ClusterBox);
+			Listener.Radius = std::uniform_real_distribution<float>(200.0f, 400.0f)(Random);
+		}
+		CheckBatchedNearbyLeaves(Partition, Listeners);
+	}
+}
+
+void TestFindNearestLeaves()
+{
+	const PRCore::FPartition Partition = BuildTestPartition();
+	const int32_t NumLeaves = Partition.GetNumLeaves();
+
+	std::vector<uint8_t> SkipLeaves(NumLeaves, 0);
+	for (int32_t Leaf = 0; Leaf < NumLeaves; Leaf += 3)
+	{
+		SkipLeaves[Leaf] = 1;
+	}
+
+	std::mt19937 Random(3);
+	constexpr int32_t Count = 8;
+	for (int32_t Query = 0; Query < 300; ++Query)
+	{
+		const PRCore::FVec3 Position = RandomPoint(Random, RootBox);
+		const uint8_t* Skip = (Query % 2) ? SkipLeaves.data() : nullptr;
+
+		PRCore::FLeafHit Hits[Count];
+		int32_t NumHits = 0;
+		Partition.FindNearestLeaves(Position, Count, Hits, NumHits, Skip);
+		PR_CHECK(NumHits == Count);
+
+		std::vector<float> Expected;
+		for (int32_t Leaf = 0; Leaf < NumLeaves; ++Leaf)
+		{
+			if (!Skip || !Skip[Leaf])
+			{
+				Expected.push_back(Partition.DistanceToLeaf(Leaf, Position));
+			}
+		}
+		std::sort(Expected.begin(), Expected.end());
+
+		// Ties may come back in any order, so only the distances are compared
+		for (int32_t Hit = 0; Hit < NumHits; ++Hit)
+		{
+			PR_CHECK(!Skip || !Skip[Hits[Hit].LeafIndex]);
+			PR_CHECK(Hit == 0 || Hits[Hit - 1].Distance <= Hits[Hit].Distance);
+			PR_CHECK_NEAR(Hits[Hit].Distance, Expected[Hit], DistanceTolerance);
+		}
+	}
+}
+
+void TestAssign()
+{
+	const PRCore::FPartition Source = BuildTestPartition();
+
+	const auto TryAssign = [&](auto&& Corrupt)
+	{
+		std::vector<PRCore::FNode> Nodes = Source.GetNodes();
+		PRCore::FLeafBounds LeafBounds = Source.GetLeafBounds();
+		Corrupt(Nodes, LeafBounds);
+
+		PRCore::FPartition Partition;
+		const bool bAssigned = Partition.Assign(Source.GetRootBounds(), std::move(Nodes), std::move(LeafBounds));
+		PR_CHECK(bAssigned != Partition.IsEmpty());
+		return bAssigned;
+	};
+
+	PR_CHECK(TryAssign([](std::vector<PRCore::FNode>&, PRCore::FLeafBounds&) {}));
+
+	// Cycle back to the root
+	PR_CHECK(!TryAssign([](std::vector<PRCore::FNode>& Nodes, PRCore::FLeafBounds&) { Nodes[0].FirstChild = 0; }));
+	// Children past the end of the array
+	PR_CHECK(!TryAssign([](std::vector<PRCore::FNode>& Nodes, PRCore::FLeafBounds&) { Nodes[0].FirstChild = static_cast<uint32_t>(Nodes.size()) - 1; }));
+	// Invalid split axis
+	PR_CHECK(!TryAssign([](std::vector<PRCore::FNode>& Nodes, PRCore::FLeafBounds&) { Nodes[0].SplitAxis = 7; }));
+	// Leaf index out of range
+	PR_CHECK(!TryAssign([](std::vector<PRCore::FNode>& Nodes, PRCore::FLeafBounds& LeafBounds)
+	{
+		for (PRCore::FNode& Node : Nodes)
+		{
+			if (Node.IsLeaf())
+			{
+				Node.LeafIndex = static_cast<uint32_t>(LeafBounds.Num());
+				break;
+			}
+		}
+	}));
+	// Columns of different length
+	PR_CHECK(!TryAssign([](std::vector<PRCore::FNode>&, PRCore::FLeafBounds& LeafBounds) { LeafBounds.MaxZ.pop_back(); }));
+	// Nodes without leaves
+	PR_CHECK(!TryAssign([](std::vector<PRCore::FNode>&, PRCore::FLeafBounds& LeafBounds) { LeafBounds.Reset(); }));
+	// Nodes no parent reaches
+	PR_CHECK(!TryAssign([](std::vector<PRCore::FNode>& Nodes, PRCore::FLeafBounds&)
+	{
+		const PRCore::FNode Leaf = Nodes.back();
+		Nodes.push_back(Leaf);
+		Nodes.push_back(Leaf);
+	}));
+
+	// Chains of interior nodes, each splitting into a leaf and the next interior node, may not exceed MaxDepthLimit
+	const auto AssignChain = [](int32_t NumInteriorNodes, int32_t OrphanDepth = -1)
+	{
+		std::vector<PRCore::FNode> Nodes;
+		PRCore::FLeafBounds LeafBounds;
+		for (int32_t Depth = 0; Depth < NumInteriorNodes; ++Depth)
+		{
+			PRCore::FNode Node;
+			Node.SplitAxis = 0;
+			Node.SplitPosition = 512.0f;
+			Node.FirstChild = static_cast<uint32_t>(Nodes.size() + (Depth == OrphanDepth ? 2 : 1));
+			Nodes.push_back(Node);
+
+			// Unreachable copy of the node between it and its children, which would restart their depth at 1
+			if (Depth == OrphanDepth)
+			{
+				Nodes.push_back(Node);
+			}
+
+			PRCore::FNode Leaf;
+			Leaf.LeafIndex = static_cast<uint32_t>(LeafBounds.Add(RootBox));
+			Nodes.push_back(Leaf);
+		}
+
+		PRCore::FNode Last;
+		Last.LeafIndex = static_cast<uint32_t>(LeafBounds.Add(RootBox));
+		Nodes.push_back(Last);
+
+		PRCore::FPartition Partition;
+		return Partition.Assign(RootBox, std::move(Nodes), std::move(LeafBounds));
+	};
+
+	PR_CHECK(AssignChain(PRCore::FPartition::MaxDepthLimit));
+	PR_CHECK(!AssignChain(PRCore::FPartition::MaxDepthLimit + 1));
+	PR_CHECK(!AssignChain(PRCore::FPartition::MaxDepthLimit + 1, PRCore::FPartition::MaxDepthLimit / 2));
+}
+
+void TestMapModelOutput()
+{
+	const float InRange[PRCore::NumModelOutputs] = {1.5f, 0.25f, 0.5f, 0.75f};
+	const PRCore::FReverbParams Params = PRCore::MapModelOutput(InRange);
+	PR_CHECK(Params.DecayTime == 1.5f && Params.Gain == 0.25f && Params.Density == 0.5f && Params.WetLevel == 0.75f);
+
+	const float Below[PRCore::NumModelOutputs] = {-3.0f, -0.1f, -1.0f, -100.0f};
+	const PRCore::FReverbParams Low = PRCore::MapModelOutput(Below);
+	PR_CHECK(Low.DecayTime == 0.0f && Low.Gain == 0.0f && Low.Density == 0.0f && Low.WetLevel == 0.0f);
+
+	const float Above[PRCore::NumModelOutputs] = {PRCore::MaxDecayTime + 1.0f, 1.1f, 2.0f, 100.0f};
+	const PRCore::FReverbParams High = PRCore::MapModelOutput(Above);
+	PR_CHECK(High.DecayTime == PRCore::MaxDecayTime && High.Gain == 1.0f && High.Density == 1.0f && High.WetLevel == 1.0f);
+}
+
+void TestNeighbourBlend()
+{
+	float DecayTime = 0.0f;
+	int32_t DominantLeaf = -1;
+
+	PRCore::FNeighbourBlend Empty(100.0f);
+	PR_CHECK(!Empty.Resolve(DecayTime, DominantLeaf));
+
+	// Weights 1 and 0.5, the leaf beyond the radius is ignored
+	PRCore::FNeighbourBlend Blend(100.0f);
+	PR_CHECK(Blend.Add(7, 0.0f, 2.0f));
+	PR_CHECK(Blend.Add(8, 50.0f, 4.0f));
+	PR_CHECK(!Blend.Add(9, 150.0f, 10.0f));
+	PR_CHECK(Blend.Resolve(DecayTime, DominantLeaf));
+	PR_CHECK_NEAR(DecayTime, (2.0f * 1.0f + 4.0f * 0.5f) / 1.5f, 1e-5f);
+	PR_CHECK(DominantLeaf == 7);
+
+	// Only leaves at exactly the radius carry no weight
+	PRCore::FNeighbourBlend Edge(100.0f);
+	PR_CHECK(Edge.Add(3, 100.0f, 1.0f));
+	PR_CHECK(!Edge.Resolve(DecayTime, DominantLeaf));
+
+	PRCore::FNeighbourBlend NoRadius(0.0f);
+	PR_CHECK(!NoRadius.Add(1, 0.0f, 1.0f));
+}
+
+void TestReverbPalette()
+{
+	PRCore::FReverbPalette Palette(0.01f);
+	std::mt19937 Random(4);
+	std::uniform_real_distribution<float> Unit(0.0f, 1.0f);
+
+	std::vector<PRCore::FReverbParams> Params(500);
+	std::vector<int32_t> Indices;
+	for (PRCore::FReverbParams& Entry : Params)
+	{
+		Entry = {Unit(Random) * PRCore::MaxDecayTime, Unit(Random), Unit(Random), Unit(Random)};
+		Indices.push_back(Palette.Add(Entry));
+		PR_CHECK(Palette.IsValidIndex(Indices.back()));
+		PR_CHECK_NEAR(Palette.Get(Indices.back()).Gain, Entry.Gain, 0.005f + 1e-6f);
+	}
+
+	// Same entries at the same indices after a round trip
+	std::vector<PRCore::FReverbParams> Entries = Palette.GetEntries();
+	PRCore::FReverbPalette Loaded;
+	PR_CHECK(Loaded.Assign(Palette.GetTolerance(), std::move(Entries)));
+	PR_CHECK(Loaded.Num() == Palette.Num());
+	for (size_t Index = 0; Index < Params.size(); ++Index)
+	{
+		PR_CHECK(Loaded.Add(Params[Index]) == Indices[Index]);
+	}
+
+	// Entries off the quantization steps are rejected
+	std::vector<PRCore::FReverbParams> OffStep = {{0.0f, 0.123456f, 0.0f, 0.0f}};
+	PR_CHECK(!Loaded.Assign(0.01f, std::move(OffStep)));
+	PR_CHECK(Loaded.Num() == 0);
+
+	// Coarsening keeps every entry within the doubled tolerance
+	const int32_t NumEntries = Palette.Num();
+	std::vector<int32_t> Remap;
+	Palette.Coarsen(Remap);
+	PR_CHECK(Remap.size() == static_cast<size_t>(NumEntries) && Palette.Num() <= NumEntries);
+	for (size_t Index = 0; Index < Params.size(); ++Index)
+	{
+		const int32_t Coarse = Remap[Indices[Index]];
+		PR_CHECK(Palette.IsValidIndex(Coarse));
+		PR_CHECK_NEAR(Palette.Get(Coarse).Density, Params[Index].Density, 0.015f + 1e-6f);
+	}
+}
+
+void TestLeafVisibility()
+{
+	// Closed wall across the middle
+	FBoxScene Scene;
+	Scene.AddBox(PRCore::FBox3(PRCore::FVec3(500, 0, 0), PRCore::FVec3(524, 1024, 1024)));
+
+	PRCore::FBuildParams BuildParams;
+	BuildParams.MaxDepth = 6;
+	PRCore::FPartition Partition;
+	Partition.Build(RootBox, BuildParams);
+
+	PRCore::FVisibilityParams Params;
+	Params.Radius = 4000.0f;
+	PRCore::FLeafVisibility Visibility;
+	Visibility.Build(Partition, Scene, Params);
+	PR_CHECK(Visibility.GetNumLeaves() == Partition.GetNumLeaves());
+
+	const int32_t Near = Partition.FindLeaf(PRCore::FVec3(100, 100, 100));
+	const int32_t Neighbour = Partition.FindLeaf(PRCore::FVec3(300, 100, 100));
+	const int32_t Behind = Partition.FindLeaf(PRCore::FVec3(900, 100, 100));
+	PR_CHECK(Visibility.IsVisible(Near, Near));
+	PR_CHECK(Visibility.IsVisible(Near, Neighbour));
+	PR_CHECK(!Visibility.IsVisible(Near, Behind));
+
+	// Traced a few leaves at a time, the rows only appear at the end and match the single call
+	PRCore::FLeafVisibility Stepped;
+	Stepped.BeginBuild(Partition, Params);
+	while (!Stepped.StepBuild(Partition, Scene, 5))
+	{
+		PR_CHECK(Stepped.IsBuilding() && Stepped.IsEmpty());
+	}
+	PR_CHECK(!Stepped.IsBuilding());
+	PR_CHECK(Stepped.GetOffsets() == Visibility.GetOffsets() && Stepped.GetVisibleLeaves() == Visibility.GetVisibleLeaves());
+
+	const int32_t NumLeaves = Partition.GetNumLeaves();
+	for (int32_t From = 0; From < NumLeaves; ++From)
+	{
+		for (int32_t To = 0; To < NumLeaves; ++To)
+		{
+			PR_CHECK(Visibility.IsVisible(From, To) == Visibility.IsVisible(To, From));
+		}
+	}
+
+	// Round trip keeps every row
+	std::vector<uint32_t> Offsets = Visibility.GetOffsets();
+	std::vector<int32_t> VisibleLeaves = Visibility.GetVisibleLeaves();
+	PRCore::FLeafVisibility Loaded;
+	PR_CHECK(Loaded.Assign(NumLeaves, std::move(Offsets), std::move(VisibleLeaves)));
+	PR_CHECK(Loaded.GetOffsets() == Visibility.GetOffsets() && Loaded.GetVisibleLeaves() == Visibility.GetVisibleLeaves());
+
+	// Unsorted rows and leaves out of range are rejected
+	std::vector<uint32_t> BadOffsets = {0, 2, 2};
+	std::vector<int32_t> Unsorted = {1, 0};
+	PR_CHECK(!Loaded.Assign(2, std::move(BadOffsets), std::move(Unsorted)));
+	PR_CHECK(Loaded.IsEmpty());
+
+	BadOffsets = {0, 1, 1};
+	std::vector<int32_t> OutOfRange = {5};
+	PR_CHECK(!Loaded.Assign(2, std::move(BadOffsets), std::move(OutOfRange)));
+}
+
+void TestEvaluateFeatures()
+{
+	std::vector<PRCore::FLeafFeatures> Features(6);
+	for (size_t Index = 0; Index < Features.size(); ++Index)
+	{
+		for (int32_t Direction = 0; Direction < PRCore::NumDirections; ++Direction)
+		{
+			// Three distinct rooms, each twice
+			Features[Index].Distances[Direction] = 100.0f * static_cast<float>(1 + Index % 3);
+			Features[Index].Materials[Direction] = 1;
+		}
+	}
+
+	FCountingModel Model;
+	std::vector<PRCore::FReverbParams> Params(Features.size());
+	int32_t NumEvaluated = 0;
+	PR_CHECK(PRCore::EvaluateFeatures(Model, Features.data(), static_cast<int32_t>(Features.size()), Params.data(), nullptr, &NumEvaluated));
+	PR_CHECK(NumEvaluated == 6 && Model.NumRowsRun == 6);
+
+	float Inputs[PRCore::NumModelInputs];
+	for (size_t Index = 0; Index < Features.size(); ++Index)
+	{
+		PRCore::PackFeatures(Features[Index], Inputs);
+		PR_CHECK_NEAR(Params[Index].DecayTime, std::min(Inputs[0] / 1000.0f, PRCore::MaxDecayTime), 1e-6f);
+		PR_CHECK(Params[Index].Gain == 0.0f && Params[Index].Density == 1.0f && Params[Index].WetLevel == 0.5f);
+	}
+
+	// Duplicates run once, a second pass runs nothing
+	PRCore::FInferenceCache Cache(1.0f);
+	std::vector<PRCore::FReverbParams> CachedParams(Features.size());
+	Model.NumRowsRun = 0;
+	PR_CHECK(PRCore::EvaluateFeatures(Model, Features.data(), static_cast<int32_t>(Features.size()), CachedParams.data(), &Cache, &NumEvaluated));
+	PR_CHECK(NumEvaluated == 3 && Model.NumRowsRun == 3);
+	PR_CHECK(PRCore::EvaluateFeatures(Model, Features.data(), static_cast<int32_t>(Features.size()), CachedParams.data(), &Cache, &NumEvaluated));
+	PR_CHECK(NumEvaluated == 0 && Model.NumRowsRun == 3);
+	for (size_t Index = 0; Index < Features.size(); ++Index)
+	{
+		PR_CHECK(CachedParams[Index].DecayTime == Params[Index].DecayTime);
+	}
+}
+
+
+struct FTest
+{
+	const char* Name;
+	void (*Function)();
+};
+
+const FTest Tests[] = {
+	{"FindLeaf", TestFindLeaf},
+	{"SteppedBuild", TestSteppedBuild},
+	{"FindNearbyLeaves", TestFindNearbyLeaves},
+	{"FindNearestLeaves", TestFindNearestLeaves},
+	{"Assign", TestAssign},
+	{"MapModelOutput", TestMapModelOutput},
+	{"NeighbourBlend", TestNeighbourBlend},
+	{"ReverbPalette", TestReverbPalette},
+	{"LeafVisibility", TestLeafVisibility},
+	{"EvaluateFeatures", TestEvaluateFeatures},
+};
+}
+
+
+int main(int Argc, char** Argv)
+{
+	const char* Filter = Argc > 1 ? Argv[1] : nullptr;
+	int32_t NumRun = 0;
+	for (const FTest& Test : Tests)
+	{
+		if (Filter && std::strcmp(Filter, Test.Name) != 0)
+		{
+			continue;
+		}
+
+		const int32_t PreviousFailures = NumFailures;
+		Test.Function();
+		++NumRun;
+		std::printf("%-20s %s\n", Test.Name, NumFailures == PreviousFailures ? "passed" : "FAILED");
+	}
+
+	if (NumRun == 0)
+	{
+		std::printf("No test named %s\n", Filter);
+		return 1;
+	}
+
+	return NumFailures == 0 ? 0 : 1;
+}